@@ -0,0 +1,94 @@
+/*
+ * Filename: arena.cpp
+ *
+ * Bump allocator for load-time temporaries (see arena.hpp).
+ */
+
+#include "arena.hpp"
+
+#include <iostream>
+#include <cstdlib>
+#include <new>
+
+// Everything handed out is aligned to this
+static const size_t ARENA_ALIGN = 16;
+
+Arena::Arena()
+{
+        m_Bytes = m_PeakBytes = 0;
+        m_Allocations = m_BlockCount = 0;
+}
+
+Arena::~Arena()
+{
+        Reset();
+}
+
+void *Arena::Allocate( size_t bytes )
+{
+        bytes = (bytes + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+        QMutexLocker locker( &m_Lock );
+        m_Allocations++;
+
+        if (m_Blocks.empty() || m_Blocks.back().size - m_Blocks.back().used < bytes) {
+                // A request too big for a normal block gets one to itself,
+                // put in front of the block being filled so that one can
+                // still be used up
+                Block block;
+                block.size = (bytes > ARENA_BLOCK_SIZE) ? bytes : ARENA_BLOCK_SIZE;
+                block.used = 0;
+                block.data = (char *) malloc( block.size + ARENA_ALIGN );
+                if (block.data == NULL) {
+                        std::cerr << "ERROR: out of memory allocating "
+                                  << block.size / 1024 << " KiB of load data" << std::endl;
+                        throw std::bad_alloc();
+                }
+                m_BlockCount++;
+
+                if (bytes > ARENA_BLOCK_SIZE && !m_Blocks.empty())
+                        m_Blocks.insert( m_Blocks.end() - 1, block );
+                else
+                        m_Blocks.push_back( block );
+        }
+
+        Block &block = (bytes > ARENA_BLOCK_SIZE && m_Blocks.size() > 1)
+                       ? m_Blocks[m_Blocks.size() - 2] : m_Blocks.back();
+
+        // malloc() only promises 8 byte alignment on some systems
+        char *start = block.data + ((ARENA_ALIGN - (size_t) block.data % ARENA_ALIGN) % ARENA_ALIGN);
+        void *memory = start + block.used;
+        block.used += bytes;
+
+        m_Bytes += bytes;
+        if (m_Bytes > m_PeakBytes)
+                m_PeakBytes = m_Bytes;
+        return memory;
+}
+
+void Arena::Reset()
+{
+        QMutexLocker locker( &m_Lock );
+        for (unsigned int b = 0; b < m_Blocks.size(); b++)
+                free( m_Blocks[b].data );
+        m_Blocks.clear();
+        m_Bytes = 0;
+}
+
+unsigned int Arena::Allocations() const
+{
+        QMutexLocker locker( &m_Lock );
+        return m_Allocations;
+}
+
+unsigned int Arena::Blocks() const
+{
+        QMutexLocker locker( &m_Lock );
+        return m_BlockCount;
+}
+
+size_t Arena::PeakBytes() const
+{
+        QMutexLocker locker( &m_Lock );
+        return m_PeakBytes;
+}
@@ -0,0 +1,69 @@
+/*
+ * Filename: arena.hpp
+ *
+ * Bump allocator for the temporary geometry of one model load (face
+ * normals, the face-expanded corners, the concatenated vertex and index
+ * arrays, the packed upload copies). Allocating is just moving a pointer
+ * along a big block, and nothing is freed on its own: Reset() at the end
+ * of the load drops everything at once.
+ *
+ * Only for plain data (no constructors or destructors are run). Safe to
+ * allocate from several threads at once, the meshes are built in
+ * parallel.
+ */
+
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <QMutex>
+
+#include <vector>
+#include <cstddef>
+
+// Size of each block the arena gets from malloc(); anything bigger gets
+// a block of its own
+const size_t ARENA_BLOCK_SIZE = 4 << 20;
+
+class Arena
+{
+public:
+        Arena();
+        ~Arena();
+
+        // bytes of uninitialized memory, 16 byte aligned (for SSE loads)
+        void *Allocate( size_t bytes );
+
+        template <class T>
+        T *Array( size_t count )
+        {
+                return (T *) Allocate( sizeof(T) * count );
+        }
+
+        // Free everything allocated so far (the counters below stay)
+        void Reset();
+
+        // Allocate() calls and malloc()'d blocks since the arena was made,
+        // and the most it has held at once
+        unsigned int Allocations() const;
+        unsigned int Blocks() const;
+        size_t PeakBytes() const;
+
+private:
+        struct Block
+        {
+                char *data;
+                size_t size, used;
+        };
+
+        // Not copyable (it owns the blocks)
+        Arena( const Arena & );
+        Arena &operator=( const Arena & );
+
+        std::vector<Block> m_Blocks;   // the last one is being filled
+        mutable QMutex m_Lock;
+
+        size_t m_Bytes, m_PeakBytes;
+        unsigned int m_Allocations, m_BlockCount;
+};
+
+#endif    // _ARENA_H
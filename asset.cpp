@@ -9,12 +9,127 @@
  */
 
 #include "asset.hpp"
+#include "meshopt.hpp"
+#include "meshlet.hpp"
+#include "meshcache.hpp"
+#include "meshclean.hpp"
+#include "meshtangents.hpp"
+#include "memusage.hpp"
+
+#include <QtConcurrentMap>
 #include <iostream>
+#include <cstddef>
+#include <cstdio>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// These come from GL 3.x (ARB_half_float_vertex and
+// ARB_vertex_type_2_10_10_10_rev); older headers may not know them.
+#ifndef GL_HALF_FLOAT
+#define GL_HALF_FLOAT 0x140B
+#endif
+#ifndef GL_INT_2_10_10_10_REV
+#define GL_INT_2_10_10_10_REV 0x8D9F
+#endif
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+#ifndef GL_PARAMETER_BUFFER_ARB
+#define GL_PARAMETER_BUFFER_ARB 0x80EE
+#endif
 
-Asset3ds::Asset3ds(std::string filename)
+
+// Largest value a quantized position component can take
+static const float QUANT_MAX = 32767.0f;
+
+/*
+ * IEEE single -> half precision conversion (round to nearest, no NaN
+ * payloads, denormals flushed to zero which is plenty for texture
+ * coordinates).
+ */
+static GLushort floatToHalf( float value )
+{
+        union { float f; unsigned int u; } bits;
+        bits.f = value;
+
+        unsigned int sign = (bits.u >> 16) & 0x8000;
+        int exponent = (int) ((bits.u >> 23) & 0xff) - 127 + 15;
+        unsigned int mantissa = bits.u & 0x007fffff;
+
+        if (exponent <= 0)
+                return (GLushort) sign;
+        if (exponent >= 31)
+                return (GLushort) (sign | 0x7c00);
+
+        // Round the mantissa, carrying into the exponent if needed
+        unsigned int half = sign | (exponent << 10) | (mantissa >> 13);
+        if (mantissa & 0x00001000)
+                half++;
+        return (GLushort) half;
+}
+
+// Map [-1, 1] onto a signed 10 bit field
+static GLuint packSnorm10( float value )
+{
+        if (value > 1.0f)  value = 1.0f;
+        if (value < -1.0f) value = -1.0f;
+        int q = (int) floorf( value * 511.0f + 0.5f );
+        return (GLuint) q & 0x3ff;
+}
+
+static GLuint packNormal( const Lib3dsVector n )
+{
+        return packSnorm10( n[0] )
+             | (packSnorm10( n[1] ) << 10)
+             | (packSnorm10( n[2] ) << 20);
+}
+
+Asset3ds::Asset3ds(std::string filename, bool useCache, bool outOfCore,
+                   bool mergeCoplanar, float smoothAngle)
 {
         // Constructor will immediately try to open the model file
+        m_Filename = filename;
+        m_UseCache = useCache;
+        m_MergeCoplanar = mergeCoplanar;
+        m_SmoothAngle = smoothAngle;
         m_TotalFaces = 0;
+        m_Format = FloatVertices;
+        m_VertexBytes = 0;
+        m_Submit = IndirectSubmit;
+        m_IndirectSupport = -1;
+        m_TangentAttrib = false;
+        m_ObjectCount = 0;
+        m_SphereRadius = -1.0f;
+        m_model = NULL;
+        m_MeshesBuilt = false;
+        m_OutOfCore = outOfCore;
+        m_Stream = NULL;
+        m_StreamRam = CHUNK_RAM_BUDGET;
+        m_StreamVram = CHUNK_VRAM_BUDGET;
+        m_StartKiB = ResidentKiB();
+        GpuMemory::Register( this );
+
+        // Out-of-core, a good chunk file is all that's needed
+        if (m_OutOfCore) {
+                OpenStream();
+                if (m_Stream != NULL) {
+                        m_MeshesBuilt = true;
+                        return;
+                }
+        }
+
+        // A good cache means lib3ds never has to touch the file
+        if (m_UseCache && LoadMeshCache( m_Filename, m_Meshes, m_MergeCoplanar,
+                                         m_SmoothAngle )) {
+                std::cout << "Loaded meshes from " << MeshCachePath( m_Filename )
+                          << std::endl;
+                m_MeshesBuilt = true;
+                return;
+        }
+
         m_model = lib3ds_file_load(filename.c_str());
 
         if (!m_model) {
@@ -25,68 +140,309 @@ Asset3ds::Asset3ds(std::string filename)
 
 Asset3ds::~Asset3ds()
 {
-        // Clean up ALL the OpenGL buffers
-        glDeleteBuffers(1, &m_VertexVBO);
-        glDeleteBuffers(1, &m_NormalVBO);
-        glDeleteBuffers(1, &m_TexCoordVBO);
+        // The buffers clean up after themselves (if they were ever made)
+        GpuMemory::Unregister( this );
+        delete m_Stream;
 
         if (m_model != NULL) {
                 lib3ds_file_free(m_model);
         }
 }
 
-void Asset3ds::CreateVBO()
+/*
+ * One lib3ds mesh to be turned into one of our Meshes. These get handed
+ * out to the QtConcurrent thread pool, one mesh per job.
+ */
+struct MeshJob
 {
-        assert(m_model != NULL);
+        Lib3dsMesh *source;
+        Mesh *mesh;
+        Arena *arena;                   // for the temporaries
+        bool mergeCoplanar;
+        float smoothAngle;
+        CleanStats clean;               // what the cleanup dropped
+        qint64 tangentNs;               // time spent on the tangents
+};
+
+static void buildMesh( MeshJob &job )
+{
+        Lib3dsMesh *source = job.source;
+        Mesh &mesh = *job.mesh;
+
+        mesh.name = source->name;
+        mesh.hasTexels = (source->texels != 0);
 
         /*
-         * Use helper function to determine the number of faces will be needed
-         * What this will do is allow us to make ample space for:
-         *   + object vertices
-         *   + normal vectors
-         *   + texturing coordinates
+         * Leave out the faces that would draw nothing (see meshclean.hpp).
+         * Merging points only looks at texture coordinates if every point
+         * has them.
          */
-        GetFaces();
-        Lib3dsVector *vertices  = new Lib3dsVector  [m_TotalFaces * 3];
-        Lib3dsVector *normals   = new Lib3dsVector  [m_TotalFaces * 3];
-        Lib3dsTexel  *texCoords = new Lib3dsTexel   [m_TotalFaces * 3];
+        unsigned int *faces = job.arena->Array<unsigned int>( source->faces * 3 );
+        for (unsigned int f = 0; f < source->faces; f++) {
+                for (unsigned int i = 0; i < 3; i++)
+                        faces[f * 3 + i] = source->faceL[f].points[i];
+        }
+        const float *points = source->points > 0 ? source->pointL[0].pos : NULL;
+        const float *texels = (mesh.hasTexels && source->texels >= source->points)
+                              ? source->texelL[0] : NULL;
+        unsigned int *kept = job.arena->Array<unsigned int>( source->faces );
+        unsigned int keptCount = CleanFaces( points, source->points, texels, faces,
+                                             source->faces, job.mergeCoplanar, kept,
+                                             *job.arena, job.clean );
+        unsigned int cornerCount = keptCount * 3;
+
+        // Normals for what's left, from the smoothing groups (see
+        // meshnormals.hpp)
+        unsigned int *keptFaces = job.arena->Array<unsigned int>( cornerCount );
+        unsigned int *smoothing = job.arena->Array<unsigned int>( keptCount );
+        for (unsigned int k = 0; k < keptCount; k++) {
+                memcpy( &keptFaces[k * 3], &faces[kept[k] * 3], sizeof(unsigned int) * 3 );
+                smoothing[k] = source->faceL[kept[k]].smoothing;
+        }
+        float *normals = job.arena->Array<float>( cornerCount * 3 );
+        SmoothNormals( points, source->points, keptFaces, smoothing, keptCount,
+                       job.smoothAngle, normals, *job.arena );
+
+        /*
+         * Deal with each face and check if there are actual texture
+         * coordinates. The mesh object has a texels member function to
+         * do this check for us so we don't muck up the file parsing.
+         */
+        MeshVertex *corners = job.arena->Array<MeshVertex>( cornerCount );
+        for (unsigned int k = 0; k < keptCount; k++) {
+                const unsigned int *face = &keptFaces[k * 3];
+
+                for (unsigned int i = 0; i < 3; i++) {
+                        MeshVertex &corner = corners[k * 3 + i];
+
+                        memcpy( corner.pos, source->pointL[face[i]].pos,
+                                sizeof(Lib3dsVector) );
+                        memcpy( corner.normal, &normals[(k * 3 + i) * 3],
+                                sizeof(Lib3dsVector) );
+
+                        // Parse optional texture coordinates (some files
+                        // have fewer of them than points)
+                        if (mesh.hasTexels && face[i] < source->texels) {
+                                memcpy( corner.texCoord, source->texelL[face[i]],
+                                        sizeof(Lib3dsTexel) );
+                        } else {
+                                corner.texCoord[0] = corner.texCoord[1] = 0.0f;
+                        }
+                }
+        }
+
+        // Tangents go in before welding so mirrored seams get split
+        QElapsedTimer tangentTimer;
+        tangentTimer.start();
+        ComputeTangents( corners, cornerCount, *job.arena );
+        job.tangentNs = tangentTimer.nsecsElapsed();
+
+        WeldVertices( corners, cornerCount, mesh );
+        OptimizeMesh( mesh );
+        BuildMeshlets( mesh );
+}
+
+void Asset3ds::BuildMeshes()
+{
+        if (m_MeshesBuilt)
+                return;
+        assert(m_model != NULL);
+
+        QElapsedTimer timer;
+        timer.start();
 
         /*
-         * We will now iteratively build the entire model's mesh
+         * We will now build every mesh in the model. They don't share any
+         * data so each one can go to its own thread.
          */
+        unsigned int meshCount = 0;
         Lib3dsMesh * mesh;
-        unsigned int FinishedFaces = 0;
+        for (mesh = m_model->meshes; mesh != NULL; mesh = mesh->next)
+                meshCount++;
 
-        for (mesh = m_model->meshes; mesh != NULL; mesh = mesh->next) {
-                lib3ds_mesh_calculate_normals(mesh, &normals[FinishedFaces * 3]);
+        m_Meshes.resize( meshCount );
+        std::vector<MeshJob> jobs( meshCount );
+        unsigned int m = 0;
+        for (mesh = m_model->meshes; mesh != NULL; mesh = mesh->next, m++) {
+                jobs[m].source = mesh;
+                jobs[m].mesh = &m_Meshes[m];
+                jobs[m].arena = &m_Arena;
+                jobs[m].mergeCoplanar = m_MergeCoplanar;
+                jobs[m].smoothAngle = m_SmoothAngle;
+                jobs[m].tangentNs = 0;
+        }
 
-                /*
-                 * Deal with each face and check if there are actual texture
-                 * coordinates. The mesh object has a texels member function to
-                 * do this check for us so we don't muck up the file parsing.
-                 */
-                for (unsigned int cur_face = 0;
-                     cur_face < mesh->faces;
-                     cur_face++) {
-
-                        Lib3dsFace * face = &mesh->faceL[cur_face];
-                        for (unsigned int i = 0; i < 3; i++) {
-
-                                // Parse optional texture coordinates
-                                if (mesh->texels) {
-                                        memcpy( &texCoords[FinishedFaces * 3 + i],
-                                                mesh->texelL[face->points[i]],
-                                                sizeof(Lib3dsTexel) );
-                                }
-
-                                // Parse and copy the object coordinates
-                                memcpy( &vertices[FinishedFaces * 3 + i],
-                                                mesh->pointL[face->points[i]].pos,
-                                                sizeof(Lib3dsVector) );
+        QtConcurrent::blockingMap( jobs, buildMesh );
+
+        std::cout << "Processed " << meshCount << " meshes in "
+                  << timer.elapsed() << " ms" << std::endl;
+
+        // What the cleanup saved: the dropped faces' indices, and a
+        // vertex for each point nothing else used
+        unsigned int faces = 0, degenerate = 0, duplicate = 0, merged = 0, points = 0;
+        for (m = 0; m < meshCount; m++) {
+                faces += jobs[m].source->faces;
+                degenerate += jobs[m].clean.degenerate;
+                duplicate += jobs[m].clean.duplicate;
+                merged += jobs[m].clean.merged;
+                points += jobs[m].clean.pointsDropped;
+        }
+
+        // Tangents: the time they took (summed over the threads) and the
+        // room they take in every vertex
+        qint64 tangentNs = 0;
+        unsigned int vertices = 0;
+        for (m = 0; m < meshCount; m++) {
+                tangentNs += jobs[m].tangentNs;
+                vertices += m_Meshes[m].vertices.size();
+        }
+        std::cout << "Tangents: " << vertices << " vertices in "
+                  << tangentNs / 1000000.0 << " ms (thread time), "
+                  << sizeof(MeshVertex().tangent) << " bytes/vertex" << std::endl;
+
+        unsigned int removed = degenerate + duplicate + merged;
+        if (removed > 0) {
+                long bytes = removed * 3 * (long) sizeof(unsigned int)
+                             + points * (long) sizeof(MeshVertex);
+                std::cout << "Cleanup: removed " << removed << " of " << faces
+                          << " triangles (" << degenerate << " degenerate, " << duplicate
+                          << " duplicate, " << merged << " merged), about "
+                          << bytes / 1024 << " KiB" << std::endl;
+        }
+
+        if (m_UseCache && !SaveMeshCache( m_Filename, m_Meshes, m_MergeCoplanar,
+                                          m_SmoothAngle )) {
+                std::cerr << "WARNING: could not write "
+                          << MeshCachePath( m_Filename ) << "\n";
+        }
+
+        // We no longer need lib3ds
+        lib3ds_file_free( m_model );
+        m_model = NULL;
+        m_MeshesBuilt = true;
+}
+
+void Asset3ds::CreateVBO()
+{
+        BuildMeshes();
+
+        // Same GL types as the compact format (see meshtangents.hpp)
+        m_TangentAttrib = CompactFormatSupported();
+
+        /*
+         * Out-of-core, the meshes only go as far as the chunk file (the
+         * first time) and the stream uploads what it needs as it goes.
+         * lib3ds can only load a whole file, so this first load still
+         * has to fit in memory.
+         */
+        if (m_OutOfCore && m_Stream == NULL && !m_Meshes.empty()) {
+                if (WriteChunkFile( m_Filename, m_Meshes, m_MergeCoplanar, m_SmoothAngle ))
+                        OpenStream();
+                if (m_Stream == NULL) {
+                        std::cerr << "WARNING: could not write " << ChunkFilePath( m_Filename )
+                                  << ", drawing the whole model instead\n";
+                } else {
+                        std::vector<Mesh>().swap( m_Meshes );
+                }
+        }
+
+        if (m_Stream != NULL) {
+                m_Stream->GetBounds( m_BoundsMin, m_BoundsMax );
+                ComputeBoundingSphere();
+                m_TotalFaces = m_Stream->Triangles();
+                m_Ranges.clear();
+                m_Meshlets.Clear();
+                m_Arena.Reset();
+                return;
+        }
+
+        /*
+         * Use helper function to determine the number of faces will be needed
+         * What this will do is allow us to make ample space for all of the
+         * vertices and indices once the meshes are stuck end to end.
+         */
+        GetFaces();
+
+        unsigned int vertexCount = 0, indexTotal = 0;
+        for (unsigned int m = 0; m < m_Meshes.size(); m++)
+                vertexCount += m_Meshes[m].vertices.size();
+
+        // Where each mesh will sit once they're stuck end to end
+        m_Ranges.resize( m_Meshes.size() );
+        m_Meshlets.Clear();
+
+        // Track the bounding box while we're walking the vertices anyway
+        for (unsigned int i = 0; i < 3; i++) {
+                m_BoundsMin[i] =  HUGE_VALF;
+                m_BoundsMax[i] = -HUGE_VALF;
+        }
+
+        // Cache numbers for the whole model (weighted by triangle count)
+        MeshCacheStats total = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+        for (unsigned int m = 0; m < m_Meshes.size(); m++) {
+                const Mesh &mesh = m_Meshes[m];
+
+                m_Ranges[m].firstIndex = indexTotal;
+                m_Ranges[m].indexCount = mesh.indices.size();
+                m_Meshlets.Add( mesh, m_Ranges[m].firstIndex, m );
+                indexTotal += mesh.indices.size();
+
+                float *lo = m_Ranges[m].boundsMin;
+                float *hi = m_Ranges[m].boundsMax;
+                for (unsigned int k = 0; k < 3; k++) {
+                        lo[k] =  HUGE_VALF;
+                        hi[k] = -HUGE_VALF;
+                }
+
+#ifdef __SSE2__
+                // Four lanes at a time; the fourth lane of each load is
+                // normal[0] and is thrown away at the end
+                __m128 vlo = _mm_set1_ps(  HUGE_VALF );
+                __m128 vhi = _mm_set1_ps( -HUGE_VALF );
+                for (unsigned int v = 0; v < mesh.vertices.size(); v++) {
+                        __m128 p = _mm_loadu_ps( mesh.vertices[v].pos );
+                        vlo = _mm_min_ps( vlo, p );
+                        vhi = _mm_max_ps( vhi, p );
+                }
+                float lanes[4];
+                _mm_storeu_ps( lanes, vlo );
+                memcpy( lo, lanes, sizeof(float) * 3 );
+                _mm_storeu_ps( lanes, vhi );
+                memcpy( hi, lanes, sizeof(float) * 3 );
+#else
+                for (unsigned int v = 0; v < mesh.vertices.size(); v++) {
+                        const float *p = mesh.vertices[v].pos;
+                        for (unsigned int k = 0; k < 3; k++) {
+                                if (p[k] < lo[k]) lo[k] = p[k];
+                                if (p[k] > hi[k]) hi[k] = p[k];
                         }
-                        // Increment the array offset for proper data copying
-                        FinishedFaces++;
                 }
+#endif
+
+                for (unsigned int k = 0; k < 3; k++) {
+                        if (lo[k] < m_BoundsMin[k]) m_BoundsMin[k] = lo[k];
+                        if (hi[k] > m_BoundsMax[k]) m_BoundsMax[k] = hi[k];
+                }
+
+                float tris = mesh.indices.size() / 3;
+                total.acmrBefore += mesh.cacheStats.acmrBefore * tris;
+                total.acmrAfter  += mesh.cacheStats.acmrAfter * tris;
+                total.atvrBefore += mesh.cacheStats.atvrBefore * mesh.vertices.size();
+                total.atvrAfter  += mesh.cacheStats.atvrAfter * mesh.vertices.size();
+        }
+
+        ComputeBoundingSphere();
+
+        if (m_TotalFaces > 0 && vertexCount > 0) {
+                std::cout << "Vertex cache (FIFO " << MESHOPT_CACHE_SIZE << "): ACMR "
+                          << total.acmrBefore / m_TotalFaces << " -> "
+                          << total.acmrAfter / m_TotalFaces << ", ATVR "
+                          << total.atvrBefore / vertexCount << " -> "
+                          << total.atvrAfter / vertexCount << std::endl;
+                std::cout << "Meshlets: " << m_Meshlets.Size() << " (at most "
+                          << MESHLET_MAX_VERTICES << " vertices / "
+                          << MESHLET_MAX_TRIANGLES << " triangles each)" << std::endl;
         }
 
         /*
@@ -94,90 +450,694 @@ void Asset3ds::CreateVBO()
          * have to actually generate a Vertex Buffer Object and store it so
          * the GPU has access to it.
          */
+        if (m_Format == CompactVertices && !CompactFormatSupported()) {
+                std::cerr << "WARNING: GL driver lacks half float / 10_10_10_2 "
+                          << "vertex support, using the float vertex format.\n";
+                m_Format = FloatVertices;
+        }
+
+        std::cout << "Draw submission: " << SubmitName( m_Submit );
+        if (!SubmitSupported( m_Submit ))
+                std::cout << " (not supported, using " << SubmitName( MultiDrawSubmit ) << ")";
+        std::cout << std::endl;
+
+        UploadGpu();
+
+        std::cout << "Vertex data: " << vertexCount << " vertices, "
+                  << (m_Format == CompactVertices ? "compact" : "float")
+                  << " format (" << (m_Format == CompactVertices ? sizeof(CompactVertex)
+                                                                 : sizeof(MeshVertex))
+                  << " bytes/vertex), " << m_VertexBytes / 1024 << " KiB";
+        if (m_Format == CompactVertices) {
+                std::cout << " (saved " << (GetFloatVertexBytes() - m_VertexBytes) / 1024
+                          << " KiB over float)";
+        }
+        std::cout << std::endl;
+
+        long peakKiB = PeakResidentKiB();
+        std::cout << "Load memory: " << m_Arena.Allocations() << " temporary allocations in "
+                  << m_Arena.Blocks() << " blocks (" << m_Arena.PeakBytes() / 1024
+                  << " KiB at most), peak RSS " << peakKiB / 1024 << " MiB";
+        if (m_StartKiB >= 0 && peakKiB >= 0)
+                std::cout << " (" << (peakKiB - m_StartKiB) / 1024 << " MiB over the start of the load)";
+        std::cout << std::endl;
+}
+
+/*
+ * Stick the meshes end to end as CreateVBO() laid them out and hand them
+ * to GL. This is all that runs again when the buffers come back after
+ * being evicted, so it doesn't report anything.
+ */
+void Asset3ds::UploadGpu()
+{
+        unsigned int vertexCount = 0;
+        for (unsigned int m = 0; m < m_Meshes.size(); m++)
+                vertexCount += m_Meshes[m].vertices.size();
+
+        // Everything stuck end to end, in the load's arena
+        MeshVertex *vertices = m_Arena.Array<MeshVertex>( vertexCount );
+        GLuint *indices = m_Arena.Array<GLuint>( m_TotalFaces * 3 );
+        unsigned int vertexTotal = 0, indexTotal = 0;
+        for (unsigned int m = 0; m < m_Meshes.size(); m++) {
+                const Mesh &mesh = m_Meshes[m];
+                unsigned int base = vertexTotal;
+
+                for (unsigned int i = 0; i < mesh.indices.size(); i++)
+                        indices[indexTotal++] = base + mesh.indices[i];
+                if (!mesh.vertices.empty())
+                        memcpy( &vertices[vertexTotal], &mesh.vertices[0],
+                                sizeof(MeshVertex) * mesh.vertices.size() );
+                vertexTotal += mesh.vertices.size();
+        }
+
+        // Every meshlet again, in the layout the GPU culling stage reads
+        m_ObjectCount = 0;
+        for (unsigned int m = 0; m < m_Meshes.size(); m++)
+                m_ObjectCount += m_Meshes[m].meshlets.size();
+        GpuCullObject *objects = m_Arena.Array<GpuCullObject>( m_ObjectCount );
+        unsigned int objectTotal = 0;
+        for (unsigned int m = 0; m < m_Meshes.size(); m++) {
+                const std::vector<Meshlet> &meshlets = m_Meshes[m].meshlets;
+                for (unsigned int i = 0; i < meshlets.size(); i++) {
+                        GpuCullObject &object = objects[objectTotal++];
+                        memcpy( object.center, meshlets[i].center, sizeof(object.center) );
+                        object.radius = meshlets[i].radius;
+                        memcpy( object.coneAxis, meshlets[i].coneAxis, sizeof(object.coneAxis) );
+                        object.coneCutoff = meshlets[i].coneCutoff;
+                        object.firstIndex = m_Ranges[m].firstIndex + meshlets[i].firstIndex;
+                        object.indexCount = meshlets[i].indexCount;
+                        object.pad[0] = object.pad[1] = 0;
+                }
+        }
+
+        if (m_Format == CompactVertices)
+                UploadCompact( vertices, vertexCount );
+        else
+                UploadFloat( vertices, vertexCount );
+
+        m_IndexVBO.Create( GL_ELEMENT_ARRAY_BUFFER, GpuIndex, sizeof(GLuint) * indexTotal,
+                           indexTotal == 0 ? NULL : indices, GL_STATIC_DRAW );
+        glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
 
+        m_ObjectBuffer.Create( GL_ARRAY_BUFFER, GpuOther, sizeof(GpuCullObject) * m_ObjectCount,
+                               m_ObjectCount == 0 ? NULL : objects, GL_STATIC_DRAW );
+        glBindBuffer( GL_ARRAY_BUFFER, 0 );
+
+        // GL has its copy now, so the temporaries can all go
+        m_Arena.Reset();
+}
+
+void Asset3ds::UploadFloat( const MeshVertex *vertices, unsigned int count )
+{
         //
         // WHY DOES THIS SEGFAULT!? (-- it doesn't anymore)
         // Weird application states, don't use GLEW, Qt is doing a GREAT
         // amount of work for us as it turns out! (Thanks, Qt, you're amazing)
         //
-        glGenBuffers( 1, &m_VertexVBO );
-        glBindBuffer( GL_ARRAY_BUFFER, m_VertexVBO );
-        glBufferData( GL_ARRAY_BUFFER, sizeof(Lib3dsVector) * 3 * m_TotalFaces,
-                        vertices, GL_STATIC_DRAW );
-
-        // Generate another Vertex Buffer Object and store the normals in it
-        glGenBuffers( 1, &m_NormalVBO );
-        glBindBuffer( GL_ARRAY_BUFFER, m_NormalVBO );
-        glBufferData( GL_ARRAY_BUFFER, sizeof(Lib3dsVector) * 3 * m_TotalFaces,
-                        normals, GL_STATIC_DRAW );
-
-        // Make a 3rd VBO with the texture coordinates in it
-        glGenBuffers( 1, &m_TexCoordVBO );
-        glBindBuffer( GL_ARRAY_BUFFER, m_TexCoordVBO );
-        glBufferData( GL_ARRAY_BUFFER, sizeof(Lib3dsTexel) * 3 * m_TotalFaces, texCoords, GL_STATIC_DRAW );
-
-        // Clean up our allocated memory
-        delete vertices;
-        delete normals;
-        delete texCoords;
+        // MeshVertex already has the float layout, so it goes up as-is.
+        //
+        m_VertexBytes = sizeof(MeshVertex) * count;
+        m_VertexVBO.Create( GL_ARRAY_BUFFER, GpuVertex, m_VertexBytes,
+                            count == 0 ? NULL : vertices, GL_STATIC_DRAW );
 
-        // We no longer need lib3ds
-        lib3ds_file_free( m_model );
-        m_model = NULL;
+        // Positions on their own as well, for the depth-only passes
+        GLfloat *positions = m_Arena.Array<GLfloat>( count * 3 );
+        for (unsigned int v = 0; v < count; v++)
+                memcpy( &positions[v * 3], vertices[v].pos, sizeof(GLfloat) * 3 );
+
+        m_PositionVBO.Create( GL_ARRAY_BUFFER, GpuVertex, sizeof(GLfloat) * count * 3,
+                              count == 0 ? NULL : positions, GL_STATIC_DRAW );
+}
+
+/*
+ * Positions get quantized against the bounding box. We use the SAME scale
+ * on all three axes so the dequantizing transform in Draw() is a uniform
+ * scale; a non-uniform one would bend the normals under fixed function.
+ */
+void Asset3ds::UploadCompact( const MeshVertex *vertices, unsigned int count )
+{
+        CompactVertex *packed = m_Arena.Array<CompactVertex>( count );
+
+        Lib3dsVector center;
+        float extent = 0.0f;
+        for (unsigned int k = 0; k < 3; k++) {
+                center[k] = 0.5f * (m_BoundsMin[k] + m_BoundsMax[k]);
+                extent = qMax( extent, 0.5f * (m_BoundsMax[k] - m_BoundsMin[k]) );
+        }
+        float toQuant = (extent > 0.0f) ? QUANT_MAX / extent : 0.0f;
+
+        for (unsigned int v = 0; v < count; v++) {
+                for (unsigned int k = 0; k < 3; k++) {
+                        float q = (vertices[v].pos[k] - center[k]) * toQuant;
+                        packed[v].pos[k] = (GLshort) floorf( q + 0.5f );
+                }
+                packed[v].pos[3] = 0;
+                packed[v].normal = packNormal( vertices[v].normal );
+                packed[v].texCoord[0] = floatToHalf( vertices[v].texCoord[0] );
+                packed[v].texCoord[1] = floatToHalf( vertices[v].texCoord[1] );
+                packed[v].tangent = vertices[v].tangent;
+        }
+
+        m_VertexBytes = sizeof(CompactVertex) * count;
+        m_VertexVBO.Create( GL_ARRAY_BUFFER, GpuVertex, m_VertexBytes, packed, GL_STATIC_DRAW );
+
+        // The quantized positions on their own as well (8 bytes a vertex)
+        // for the depth-only passes
+        GLshort *positions = m_Arena.Array<GLshort>( count * 4 );
+        for (unsigned int v = 0; v < count; v++)
+                memcpy( &positions[v * 4], packed[v].pos, sizeof(GLshort) * 4 );
+
+        m_PositionVBO.Create( GL_ARRAY_BUFFER, GpuVertex, sizeof(GLshort) * count * 4,
+                              count == 0 ? NULL : positions, GL_STATIC_DRAW );
+}
+
+/*
+ * Half float and 2_10_10_10 vertex attributes are core in GL 3.3 and
+ * were extensions before that. We need BOTH for the compact layout.
+ */
+bool Asset3ds::CompactFormatSupported() const
+{
+        int major = 0, minor = 0;
+        const char *version = (const char *) glGetString( GL_VERSION );
+        if (version != NULL && sscanf( version, "%d.%d", &major, &minor ) == 2) {
+                if (major > 3 || (major == 3 && minor >= 3))
+                        return true;
+        }
+
+        const char *ext = (const char *) glGetString( GL_EXTENSIONS );
+        return ext != NULL
+            && strstr( ext, "GL_ARB_half_float_vertex" ) != NULL
+            && strstr( ext, "GL_ARB_vertex_type_2_10_10_10_rev" ) != NULL;
+}
+
+/*
+ * Indirect drawing is core in GL 4.3; before that it's the extension.
+ * The other two modes are GL 1.4 and always there.
+ */
+bool Asset3ds::SubmitSupported( SubmitMode mode ) const
+{
+        if (mode != IndirectSubmit)
+                return true;
+        if (m_IndirectSupport >= 0)
+                return m_IndirectSupport != 0;
+
+        int major = 0, minor = 0;
+        bool supported = false;
+        const char *version = (const char *) glGetString( GL_VERSION );
+        if (version != NULL && sscanf( version, "%d.%d", &major, &minor ) == 2)
+                supported = (major > 4 || (major == 4 && minor >= 3));
+
+        const char *ext = (const char *) glGetString( GL_EXTENSIONS );
+        if (!supported && ext != NULL)
+                supported = (strstr( ext, "GL_ARB_multi_draw_indirect" ) != NULL);
+
+        // Only remember the answer once there was a context to ask
+        if (version != NULL)
+                m_IndirectSupport = supported ? 1 : 0;
+        return supported;
+}
+
+void Asset3ds::SetSubmitMode( SubmitMode mode )
+{
+        m_Submit = mode;
+}
+
+Asset3ds::SubmitMode Asset3ds::GetSubmitMode() const
+{
+        return m_Submit;
+}
+
+const char *Asset3ds::SubmitName( SubmitMode mode )
+{
+        static const char *names[3] = { "per-range", "multi-draw", "indirect" };
+        return names[mode];
+}
+
+unsigned int Asset3ds::GetTriangleCount() const
+{
+        return m_TotalFaces;
+}
+
+void Asset3ds::SetVertexFormat( VertexFormat format )
+{
+        m_Format = format;
+}
+
+Asset3ds::VertexFormat Asset3ds::GetVertexFormat() const
+{
+        return m_Format;
+}
+
+unsigned int Asset3ds::GetVertexBytes() const
+{
+        return m_VertexBytes;
+}
+
+unsigned int Asset3ds::GetFloatVertexBytes() const
+{
+        unsigned int count = 0;
+        for (unsigned int m = 0; m < m_Meshes.size(); m++)
+                count += m_Meshes[m].vertices.size();
+        return sizeof(MeshVertex) * count;
 }
 
 void Asset3ds::GetFaces()
 {
-        assert( m_model != NULL );
+        assert( m_MeshesBuilt );
 
         m_TotalFaces = 0;
-        Lib3dsMesh * mesh;
         // Loop through every mesh
-        for ( mesh = m_model->meshes; mesh != NULL; mesh = mesh->next ) {
+        for ( unsigned int m = 0; m < m_Meshes.size(); m++ ) {
 
                 // Add the number of faces this mesh has to the total faces
-                m_TotalFaces += mesh->faces;
+                m_TotalFaces += m_Meshes[m].indices.size() / 3;
 
         }
 }
 
-GLuint * Asset3ds::GetTexCoordVBO( void )
+bool Asset3ds::Resident() const
 {
-        // This is a HIDEOUS DISGUSTING EVIL thing to do, we've all come to
-        // terms with it and acknowledge it. Sorry C++.
-        // Blah blah blah wrong function / class scope
-        return &( this->m_TexCoordVBO );
+        // Streamed chunks come and go on their own
+        return m_Stream != NULL || m_VertexVBO.Valid();
 }
 
-void Asset3ds::Draw() const
+void Asset3ds::OpenStream()
 {
-        assert(m_TotalFaces != 0);
+        ChunkStream *stream = new ChunkStream;
+        if (!stream->Open( m_Filename, m_MergeCoplanar, m_SmoothAngle )) {
+                delete stream;
+                return;
+        }
+
+        stream->SetBudgets( m_StreamRam, m_StreamVram );
+        m_Stream = stream;
+        std::cout << "Streaming " << m_Stream->Count() << " chunks ("
+                  << m_Stream->Triangles() << " triangles) from "
+                  << ChunkFilePath( m_Filename ) << std::endl;
+}
+
+bool Asset3ds::OutOfCore() const
+{
+        return m_Stream != NULL;
+}
+
+void Asset3ds::SetStreamBudgets( long ramBytes, long vramBytes )
+{
+        m_StreamRam = ramBytes;
+        m_StreamVram = vramBytes;
+        if (m_Stream != NULL)
+                m_Stream->SetBudgets( ramBytes, vramBytes );
+}
+
+void Asset3ds::Stream( const CullView &view )
+{
+        if (m_Stream != NULL)
+                m_Stream->Update( view );
+}
+
+const ChunkStream *Asset3ds::GetStream() const
+{
+        return m_Stream;
+}
+
+void Asset3ds::SetTexture( GLTexture &texture )
+{
+        m_Texture.Reset();
+        m_Texture.Swap( texture );
+}
 
+GLuint Asset3ds::GetTexture() const
+{
+        return m_Texture.Name();
+}
+
+long Asset3ds::GpuBytes() const
+{
+        return m_VertexVBO.Bytes() + m_IndexVBO.Bytes() + m_PositionVBO.Bytes()
+             + m_IndirectBuffer.Bytes() + m_ObjectBuffer.Bytes();
+}
+
+void Asset3ds::RestoreGpu()
+{
+        if (!Resident())
+                UploadGpu();
+}
+
+/*
+ * The texture stays: it came from the widget and we couldn't load it
+ * again ourselves
+ */
+void Asset3ds::EvictGpu()
+{
+        m_VertexVBO.Reset();
+        m_IndexVBO.Reset();
+        m_PositionVBO.Reset();
+        m_IndirectBuffer.Reset();
+        m_ObjectBuffer.Reset();
+}
+
+/*
+ * Dequantizing transform for compact positions: the integer positions are
+ * scaled and moved back onto the bounding box
+ */
+void Asset3ds::PushDequantize() const
+{
+        float extent = 0.0f;
+        for (unsigned int k = 0; k < 3; k++)
+                extent = qMax( extent, 0.5f * (m_BoundsMax[k] - m_BoundsMin[k]) );
+        float fromQuant = extent / QUANT_MAX;
+
+        glPushMatrix();
+        glTranslatef( 0.5f * (m_BoundsMin[0] + m_BoundsMax[0]),
+                      0.5f * (m_BoundsMin[1] + m_BoundsMax[1]),
+                      0.5f * (m_BoundsMin[2] + m_BoundsMax[2]) );
+        glScalef( fromQuant, fromQuant, fromQuant );
+}
+
+void Asset3ds::BeginArrays() const
+{
         // Enable vertex and normal arrays
         glEnableClientState(GL_VERTEX_ARRAY);
         glEnableClientState(GL_NORMAL_ARRAY);
         glEnableClientState(GL_TEXTURE_COORD_ARRAY);
 
-        // Bind the vbo with the normals
-        glBindBuffer(GL_ARRAY_BUFFER, m_NormalVBO);
+        // Everything lives in the one interleaved vbo, so the pointers are
+        // just byte offsets into it with the vertex size as the stride
+        glBindBuffer(GL_ARRAY_BUFFER, m_VertexVBO.Name());
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_IndexVBO.Name());
 
-        // The pointer for the normals is NULL which means that OpenGL will use the currently bound vbo
-        glNormalPointer(GL_FLOAT, 0, NULL);
+        if (m_Format == CompactVertices) {
+                /*
+                 * Dequantize in the vertex transform. The scale shrinks
+                 * the normals too, so have GL renormalize them.
+                 */
+                PushDequantize();
+                glEnable( GL_NORMALIZE );
 
-        glBindBuffer(GL_ARRAY_BUFFER, m_TexCoordVBO);
+                GLsizei stride = sizeof(CompactVertex);
+                glNormalPointer(GL_INT_2_10_10_10_REV, stride,
+                                (const GLvoid *) offsetof(CompactVertex, normal));
+                glTexCoordPointer(2, GL_HALF_FLOAT, stride,
+                                (const GLvoid *) offsetof(CompactVertex, texCoord));
+                glVertexPointer(3, GL_SHORT, stride,
+                                (const GLvoid *) offsetof(CompactVertex, pos));
+        } else {
+                GLsizei stride = sizeof(MeshVertex);
+                glNormalPointer(GL_FLOAT, stride,
+                                (const GLvoid *) offsetof(MeshVertex, normal));
+                glTexCoordPointer(2, GL_FLOAT, stride,
+                                (const GLvoid *) offsetof(MeshVertex, texCoord));
+                glVertexPointer(3, GL_FLOAT, stride,
+                                (const GLvoid *) offsetof(MeshVertex, pos));
+        }
 
-        //////////
-        //// THIS MIGHT NEED TO BE A 2
-        //////////
-        glTexCoordPointer(3, GL_FLOAT, 0, NULL);
+        // The packed tangents can only be sourced if GL knows the type
+        if (m_TangentAttrib) {
+                glEnableVertexAttribArray(TANGENT_ATTRIB);
+                if (m_Format == CompactVertices)
+                        glVertexAttribPointer(TANGENT_ATTRIB, 4, GL_INT_2_10_10_10_REV, GL_TRUE,
+                                sizeof(CompactVertex),
+                                (const GLvoid *) offsetof(CompactVertex, tangent));
+                else
+                        glVertexAttribPointer(TANGENT_ATTRIB, 4, GL_INT_2_10_10_10_REV, GL_TRUE,
+                                sizeof(MeshVertex),
+                                (const GLvoid *) offsetof(MeshVertex, tangent));
+        }
+}
 
-        glBindBuffer(GL_ARRAY_BUFFER, m_VertexVBO);
-        glVertexPointer(3, GL_FLOAT, 0, NULL);
+void Asset3ds::EndArrays() const
+{
+        if (m_Format == CompactVertices) {
+                glDisable( GL_NORMALIZE );
+                glPopMatrix();
+        }
 
-        // Render the triangles
-        glDrawArrays(GL_TRIANGLES, 0, m_TotalFaces * 3);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
         glDisableClientState(GL_VERTEX_ARRAY);
         glDisableClientState(GL_NORMAL_ARRAY);
         glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+        if (m_TangentAttrib)
+                glDisableVertexAttribArray(TANGENT_ATTRIB);
+}
+
+/*
+ * Depth-only drawing (shadow maps): just the position stream, so the
+ * passes read a third (or half, compact) of the vertex data
+ */
+void Asset3ds::DrawPositions() const
+{
+        if (m_Stream != NULL) {
+                m_Stream->DrawPositions();
+                return;
+        }
+        if (m_TotalFaces == 0)
+                return;
+        GpuMemory::Touch( this );
+
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glBindBuffer(GL_ARRAY_BUFFER, m_PositionVBO.Name());
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_IndexVBO.Name());
+
+        if (m_Format == CompactVertices) {
+                PushDequantize();
+                glVertexPointer(3, GL_SHORT, sizeof(GLshort) * 4, NULL);
+        } else {
+                glVertexPointer(3, GL_FLOAT, 0, NULL);
+        }
+
+        glDrawElements(GL_TRIANGLES, m_TotalFaces * 3, GL_UNSIGNED_INT, NULL);
+
+        if (m_Format == CompactVertices)
+                glPopMatrix();
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+void Asset3ds::Draw() const
+{
+        // Out-of-core: the chunks Stream() picked
+        if (m_Stream != NULL) {
+                m_Stream->Draw( m_TangentAttrib );
+                return;
+        }
+        assert(m_TotalFaces != 0);
+        GpuMemory::Touch( this );
+
+        BeginArrays();
+
+        // Render the triangles (every mesh is back to back in the
+        // index buffer so it's still just the one call)
+        glDrawElements(GL_TRIANGLES, m_TotalFaces * 3, GL_UNSIGNED_INT, NULL);
+
+        EndArrays();
+}
+
+void Asset3ds::Cull( const CullView &view, DrawRanges &ranges,
+                     const std::vector<char> *meshVisible ) const
+{
+        m_Meshlets.Cull( view, ranges, meshVisible );
+}
+
+void Asset3ds::MeshRanges( const std::vector<char> &meshVisible,
+                           DrawRanges &ranges ) const
+{
+        ranges.firstIndex.clear();
+        ranges.indexCount.clear();
+        ranges.clustersTested = ranges.clustersVisible = 0;
+
+        for (unsigned int m = 0; m < m_Ranges.size(); m++) {
+                if (!meshVisible[m] || m_Ranges[m].indexCount == 0)
+                        continue;
+
+                // Meshes are back to back, so neighbors can share a draw
+                if (!ranges.firstIndex.empty()
+                    && ranges.firstIndex.back() + ranges.indexCount.back()
+                       == m_Ranges[m].firstIndex) {
+                        ranges.indexCount.back() += m_Ranges[m].indexCount;
+                } else {
+                        ranges.firstIndex.push_back( m_Ranges[m].firstIndex );
+                        ranges.indexCount.push_back( m_Ranges[m].indexCount );
+                }
+        }
+}
+
+/*
+ * The sphere is centered on the bounding box. Rather than go over every
+ * vertex again for the radius, the meshlet spheres (built at load time)
+ * are enclosed instead, which is nearly as tight. It can never be bigger
+ * than the box's own sphere, so take whichever is smaller.
+ */
+void Asset3ds::ComputeBoundingSphere()
+{
+        m_SphereRadius = -1.0f;
+        if (m_BoundsMin[0] > m_BoundsMax[0])
+                return;
+
+        float halfDiagonal = 0.0f;
+        for (unsigned int k = 0; k < 3; k++) {
+                m_SphereCenter[k] = 0.5f * (m_BoundsMin[k] + m_BoundsMax[k]);
+                float half = 0.5f * (m_BoundsMax[k] - m_BoundsMin[k]);
+                halfDiagonal += half * half;
+        }
+        halfDiagonal = sqrtf( halfDiagonal );
+
+        float radius = 0.0f;
+        bool anyMeshlets = false;
+        for (unsigned int m = 0; m < m_Meshes.size(); m++) {
+                const std::vector<Meshlet> &meshlets = m_Meshes[m].meshlets;
+                for (unsigned int i = 0; i < meshlets.size(); i++) {
+                        float d = 0.0f;
+                        for (unsigned int k = 0; k < 3; k++) {
+                                float e = meshlets[i].center[k] - m_SphereCenter[k];
+                                d += e * e;
+                        }
+                        radius = qMax( radius, sqrtf( d ) + meshlets[i].radius );
+                        anyMeshlets = true;
+                }
+        }
+
+        m_SphereRadius = anyMeshlets ? qMin( radius, halfDiagonal ) : halfDiagonal;
+}
+
+bool Asset3ds::GetBounds( float min[3], float max[3] ) const
+{
+        if (m_SphereRadius < 0.0f)
+                return false;
+
+        for (unsigned int k = 0; k < 3; k++) {
+                min[k] = m_BoundsMin[k];
+                max[k] = m_BoundsMax[k];
+        }
+        return true;
+}
+
+bool Asset3ds::GetBoundingSphere( float center[3], float &radius ) const
+{
+        if (m_SphereRadius < 0.0f)
+                return false;
+
+        memcpy( center, m_SphereCenter, sizeof(float) * 3 );
+        radius = m_SphereRadius;
+        return true;
+}
+
+const std::vector<Mesh> &Asset3ds::GetMeshes() const
+{
+        return m_Meshes;
+}
+
+unsigned int Asset3ds::GetMeshCount() const
+{
+        return m_Ranges.size();
+}
+
+void Asset3ds::GetMeshBounds( unsigned int mesh, float min[3], float max[3] ) const
+{
+        assert( mesh < m_Ranges.size() );
+        memcpy( min, m_Ranges[mesh].boundsMin, sizeof(float) * 3 );
+        memcpy( max, m_Ranges[mesh].boundsMax, sizeof(float) * 3 );
+}
+
+void Asset3ds::Draw( const DrawRanges &ranges ) const
+{
+        if (ranges.firstIndex.empty())
+                return;
+        GpuMemory::Touch( this );
+
+        if (m_Submit == IndirectSubmit && SubmitSupported( IndirectSubmit )) {
+                BeginArrays();
+                SubmitIndirect( ranges );
+                EndArrays();
+                return;
+        }
+
+        // glMultiDrawElements wants byte offsets into the index buffer
+        m_DrawCounts.resize( ranges.firstIndex.size() );
+        m_DrawOffsets.resize( ranges.firstIndex.size() );
+        for (unsigned int i = 0; i < ranges.firstIndex.size(); i++) {
+                m_DrawCounts[i] = ranges.indexCount[i];
+                m_DrawOffsets[i] = (const GLvoid *) (sizeof(GLuint) * (size_t) ranges.firstIndex[i]);
+        }
+
+        BeginArrays();
+        if (m_Submit == PerRangeSubmit) {
+                for (unsigned int i = 0; i < m_DrawCounts.size(); i++)
+                        glDrawElements(GL_TRIANGLES, m_DrawCounts[i], GL_UNSIGNED_INT, m_DrawOffsets[i]);
+        } else {
+                glMultiDrawElements(GL_TRIANGLES, &m_DrawCounts[0], GL_UNSIGNED_INT,
+                                    &m_DrawOffsets[0], m_DrawCounts.size());
+        }
+        EndArrays();
+}
+
+/*
+ * One command per range, sent up in a single glBufferSubData() and drawn
+ * with a single call, so the GL side costs the same however many ranges
+ * there are. The buffer only grows (doubling), it's never reallocated for
+ * a frame with fewer ranges.
+ */
+void Asset3ds::SubmitIndirect( const DrawRanges &ranges ) const
+{
+        unsigned int count = ranges.firstIndex.size();
+        m_DrawCommands.resize( count );
+        for (unsigned int i = 0; i < count; i++) {
+                DrawCommand &command = m_DrawCommands[i];
+                command.count = ranges.indexCount[i];
+                command.instanceCount = 1;
+                command.firstIndex = ranges.firstIndex[i];
+                command.baseVertex = 0;
+                command.baseInstance = 0;
+        }
+
+        GLsizeiptr bytes = sizeof(DrawCommand) * count;
+        if (m_IndirectBuffer.Bytes() < bytes) {
+                GLsizeiptr capacity = qMax( m_IndirectBuffer.Bytes(), (GLsizeiptr) (sizeof(DrawCommand) * 64) );
+                while (capacity < bytes)
+                        capacity *= 2;
+                m_IndirectBuffer.Create( GL_DRAW_INDIRECT_BUFFER, GpuOther, capacity,
+                                         NULL, GL_STREAM_DRAW );
+        } else {
+                glBindBuffer( GL_DRAW_INDIRECT_BUFFER, m_IndirectBuffer.Name() );
+        }
+        glBufferSubData( GL_DRAW_INDIRECT_BUFFER, 0, bytes, &m_DrawCommands[0] );
+
+        glMultiDrawElementsIndirect( GL_TRIANGLES, GL_UNSIGNED_INT, NULL, count, 0 );
+        glBindBuffer( GL_DRAW_INDIRECT_BUFFER, 0 );
+}
+
+GLuint Asset3ds::GetObjectBuffer() const
+{
+        return m_ObjectBuffer.Name();
+}
+
+unsigned int Asset3ds::GetObjectCount() const
+{
+        return m_ObjectCount;
+}
+
+/*
+ * The commands (and their count) were written on the GPU, so nothing
+ * about them goes through the CPU here
+ */
+void Asset3ds::DrawCommands( GLuint commandBuffer, GLuint countBuffer,
+                             unsigned int maxCount ) const
+{
+        if (maxCount == 0)
+                return;
+        GpuMemory::Touch( this );
+
+        BeginArrays();
+        glBindBuffer( GL_DRAW_INDIRECT_BUFFER, commandBuffer );
+        if (countBuffer != 0) {
+                glBindBuffer( GL_PARAMETER_BUFFER_ARB, countBuffer );
+                glMultiDrawElementsIndirectCountARB( GL_TRIANGLES, GL_UNSIGNED_INT, NULL, 0,
+                                                     maxCount, 0 );
+                glBindBuffer( GL_PARAMETER_BUFFER_ARB, 0 );
+        } else {
+                glMultiDrawElementsIndirect( GL_TRIANGLES, GL_UNSIGNED_INT, NULL, maxCount, 0 );
+        }
+        glBindBuffer( GL_DRAW_INDIRECT_BUFFER, 0 );
+        EndArrays();
 }
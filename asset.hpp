@@ -11,51 +11,250 @@
 #ifndef _ASSET_H
 #define _ASSET_H
 
-// Needed to properly get OpenGL initialized for VBO details
-// Thanks to:
-// http://www.opengl.org/discussion_boards/showthread.php/172481-glGenBuffer-was-not-declared
-
-#define GL_GLEXT_PROTOTYPES
-#include <QtOpenGL>
+#include "gl.hpp"
 
 #include <lib3ds/file.h>
 #include <lib3ds/mesh.h>
 
+#include "mesh.hpp"
+#include "culling.hpp"
+#include "arena.hpp"
+#include "gpuresource.hpp"
+#include "chunkstream.hpp"
+#include "meshnormals.hpp"
+
 #include <string>
+#include <vector>
 #include <cstring>
 #include <cassert>
 
-class Asset3ds
+class Asset3ds : public GpuCacheEntry
 {
 public:
+        /*
+         * Layout of the vertices that end up in the VBO.
+         *   FloatVertices   - 32-bit floats for everything but the packed
+         *                     tangent (36 bytes/vertex)
+         *   CompactVertices - positions as 16-bit integers relative to the
+         *                     model's bounding box, normals packed into
+         *                     10_10_10_2 and texture coordinates as half
+         *                     floats (20 bytes/vertex)
+         * Both carry the tangent packed into 10_10_10_2 (see
+         * meshtangents.hpp).
+         */
+        enum VertexFormat { FloatVertices, CompactVertices };
+
+        /*
+         * How Draw(ranges) hands the ranges to GL.
+         *   PerRangeSubmit  - a glDrawElements() per range
+         *   MultiDrawSubmit - one glMultiDrawElements() (the arrays are
+         *                     still read by the driver on the CPU)
+         *   IndirectSubmit  - the ranges are written to a draw command
+         *                     buffer and drawn with one
+         *                     glMultiDrawElementsIndirect() (GL 4.3 or
+         *                     ARB_multi_draw_indirect; MultiDrawSubmit is
+         *                     used without it)
+         */
+        enum SubmitMode { PerRangeSubmit, MultiDrawSubmit, IndirectSubmit };
+
         // Constructor takes the name of the file that will be opened.
         // This MUST be in .3ds format, hence the lib3ds dependency.
-        Asset3ds(std::string filename);
+        // If useCache is set and a valid mesh cache exists for the file
+        // (see meshcache.hpp), that is loaded instead.
+        // With outOfCore the model is drawn from its chunk file (see
+        // chunkstream.hpp), which is written on the first load if there
+        // isn't a good one; nothing else is kept in memory.
+        // mergeCoplanar also collapses tiny flat edges when the faces are
+        // cleaned up (see meshclean.hpp), and smoothAngle is the most
+        // (degrees) a normal is smoothed across (see meshnormals.hpp).
+        Asset3ds(std::string filename, bool useCache = true, bool outOfCore = false,
+                 bool mergeCoplanar = false, float smoothAngle = SMOOTH_ANGLE);
+
+        // Pick the vertex layout. Must be called BEFORE CreateVBO().
+        void SetVertexFormat(VertexFormat format);
+        VertexFormat GetVertexFormat() const;
+
+        // Size of the uploaded vertex data, and what it would have been
+        // with plain floats (handy for seeing what the compact format saves)
+        unsigned int GetVertexBytes() const;
+        unsigned int GetFloatVertexBytes() const;
+
+        // Pick how ranges are submitted (IndirectSubmit by default). Can
+        // be changed at any time; SubmitSupported() needs a GL context.
+        void SetSubmitMode(SubmitMode mode);
+        SubmitMode GetSubmitMode() const;
+        bool SubmitSupported(SubmitMode mode) const;
+        static const char *SubmitName(SubmitMode mode);
+
+        // Triangles in the whole model (after CreateVBO())
+        unsigned int GetTriangleCount() const;
 
         // Draw the scene into the OpenGL framebuffer.
         // This is used in GLWidget::paintGL();
         virtual void Draw() const;
 
+        // Find the meshlets that can be seen from view (in model space)
+        // and draw only those with a single glMultiDrawElements().
+        // Meshes with a 0 in meshVisible (if given) are left out.
+        void Cull(const CullView &view, DrawRanges &ranges,
+                  const std::vector<char> *meshVisible = NULL) const;
+        virtual void Draw(const DrawRanges &ranges) const;
+
+        // Every meshlet's bounds and index range (GpuCullObject each, see
+        // culling.hpp) in a GL buffer for culling on the GPU, and drawing
+        // the indirect commands that culling writes. With countBuffer 0
+        // all maxCount commands are drawn (the unused ones are empty).
+        GLuint GetObjectBuffer() const;
+        unsigned int GetObjectCount() const;
+        void DrawCommands(GLuint commandBuffer, GLuint countBuffer,
+                          unsigned int maxCount) const;
+
+        // Every triangle, positions only (for depth-only passes like
+        // shadow maps; no normals or texture coordinates are set up)
+        void DrawPositions() const;
+
+        // Whole-mesh ranges for the meshes with a non-zero meshVisible
+        // entry (for when there's no meshlet culling going on)
+        void MeshRanges(const std::vector<char> &meshVisible,
+                        DrawRanges &ranges) const;
+
+        // The processed meshes (after BuildMeshes()), for anything that
+        // wants the geometry on the CPU side
+        const std::vector<Mesh> &GetMeshes() const;
+
+        // Bounding box and sphere of the whole model (available after
+        // CreateVBO()). Both return false if the model has no vertices.
+        bool GetBounds(float min[3], float max[3]) const;
+        bool GetBoundingSphere(float center[3], float &radius) const;
+
+        // Per-mesh information (available after CreateVBO())
+        unsigned int GetMeshCount() const;
+        void GetMeshBounds(unsigned int mesh, float min[3], float max[3]) const;
+
+        // Pull the meshes out of lib3ds, weld them and reorder the indices
+        // (one mesh per thread). Needs NO GL context. CreateVBO() calls this
+        // if it hasn't been done yet.
+        void BuildMeshes();
+
+        // Out-of-core mode: is the model drawn from its chunk file? Its
+        // budgets, the chunks to draw for this view (call once a frame
+        // before Draw()), and the stream itself for its numbers.
+        bool OutOfCore() const;
+        void SetStreamBudgets(long ramBytes, long vramBytes);
+        void Stream(const CullView &view);
+        const ChunkStream *GetStream() const;
+
         // Copy the vertices and normals (vectors) into the GPU.
         // This must be done at the frame buffer init.
         virtual void CreateVBO();
 
-        // Returns texture coordinate vertex buffer object
-        // This is normally bad practice (to return a pointer to data
-        // in another class' scope, but OpenGL being what it is we couldn't
-        // come up with another way because IT loves globals so much.
-        virtual GLuint *GetTexCoordVBO( void );
+        // Put the buffers back after they've been evicted (see
+        // Resident()), quietly: the layout and load reports are from
+        // CreateVBO() and don't change.
+        void RestoreGpu();
 
-        // Destructor. Qt may be nice about its own cleanup, but glDeleteBuffer
-        // needs to be called on the private VBO members of this class.
+        // Are the buffers on the GPU? (false before CreateVBO() and after
+        // being evicted to stay under the GPU memory budget)
+        bool Resident() const;
+
+        // The model's texture. SetTexture() takes the one given over (it's
+        // left empty); it stays with the asset until the asset goes.
+        void SetTexture( GLTexture &texture );
+        GLuint GetTexture() const;
+
+        // GPU memory cache entry: evicting drops the buffers, the CPU copy
+        // of the meshes stays so RestoreGpu() can put them back
+        long GpuBytes() const;
+        void EvictGpu();
+
+        // Destructor. The buffers and texture delete themselves, but that
+        // still needs the GL context current.
         virtual ~Asset3ds();
 
 protected:
         void GetFaces();                   // internal use
+        void OpenStream();
+        bool CompactFormatSupported() const;
+        void SubmitIndirect(const DrawRanges &ranges) const;
+        void UploadGpu();
+        void UploadFloat(const MeshVertex *vertices, unsigned int count);
+        void UploadCompact(const MeshVertex *vertices, unsigned int count);
+        void ComputeBoundingSphere();
+
+        // Bind the VBOs and set up the array pointers, and undo it again
+        void BeginArrays() const;
+        void EndArrays() const;
+        void PushDequantize() const;
+
+        // Where each mesh's triangles sit in the shared index buffer,
+        // and the mesh's bounding box
+        struct MeshRange
+        {
+                unsigned int firstIndex, indexCount;
+                float boundsMin[3], boundsMax[3];
+        };
+
+        std::string m_Filename;
+        bool m_UseCache;
+        bool m_MergeCoplanar;
+        float m_SmoothAngle;
+
         unsigned int m_TotalFaces;
         Lib3dsFile * m_model;              // a 3ds file pointer (to our model)
 
-        GLuint m_VertexVBO, m_NormalVBO, m_TexCoordVBO;   // vertex and normal buffer objects
+        bool m_MeshesBuilt;
+        std::vector<Mesh> m_Meshes;        // processed copy of the meshes
+        std::vector<MeshRange> m_Ranges;
+        MeshletBounds m_Meshlets;          // every meshlet, for culling
+
+        // Out-of-core mode: the chunk file being drawn from (NULL if the
+        // whole model is loaded)
+        bool m_OutOfCore;
+        ChunkStream *m_Stream;
+        long m_StreamRam, m_StreamVram;
+
+        // Scratch space for the glMultiDrawElements() arguments
+        mutable std::vector<GLsizei> m_DrawCounts;
+        mutable std::vector<const GLvoid *> m_DrawOffsets;
+
+        // Layout GL wants for each indirect draw, the commands for the
+        // current frame, and the buffer they go up in (grown as needed)
+        struct DrawCommand
+        {
+                GLuint count, instanceCount;
+                GLuint firstIndex, baseVertex, baseInstance;
+        };
+        SubmitMode m_Submit;
+        mutable int m_IndirectSupport;     // -1 until asked
+        bool m_TangentAttrib;              // can GL source the packed tangents?
+        mutable std::vector<DrawCommand> m_DrawCommands;
+        mutable GLBuffer m_IndirectBuffer;
+
+        VertexFormat m_Format;
+        unsigned int m_VertexBytes;
+
+        // Model bounding box (also used to dequantize compact positions)
+        // and bounding sphere; a negative radius means no vertices
+        Lib3dsVector m_BoundsMin, m_BoundsMax;
+        float m_SphereCenter[3], m_SphereRadius;
+
+        // Interleaved vertex buffer object, index buffer, and the texture
+        // loadGLTextures() hands us
+        GLBuffer m_VertexVBO, m_IndexVBO;
+        GLTexture m_Texture;
+
+        // The positions alone, split out of the interleaved buffer
+        GLBuffer m_PositionVBO;
+
+        // Meshlet bounds for the GPU culling stage
+        GLBuffer m_ObjectBuffer;
+        unsigned int m_ObjectCount;
+
+        // Temporaries of the load (BuildMeshes() through CreateVBO()),
+        // all dropped at once when the upload is done, and how much
+        // memory the process had before the load started
+        Arena m_Arena;
+        long m_StartKiB;
 };
 
 #endif    // _ASSET_H
@@ -0,0 +1,299 @@
+/*
+ * Filename: batch.cpp
+ *
+ * Offscreen turntable rendering of a list of models (see batch.hpp).
+ */
+
+#include "batch.hpp"
+#include "asset.hpp"
+#include "memusage.hpp"
+
+#include <QtGui>
+#include <QGLPixelBuffer>
+#include <QtConcurrentRun>
+#include <iostream>
+#include <math.h>
+
+// Defaults for the options
+static const int DEFAULT_ANGLES = 8;
+static const int DEFAULT_SIZE = 256;
+
+// Views are looked at from a little above, like a product shot
+static const float ELEVATION = 20.0;
+
+// Same field of view as the viewer (tan of this is top / near)
+static const float FIELD_OF_VIEW = 40.0;
+
+// Images that may be waiting for an encoder, per encoder thread. Keeps
+// memory in check if encoding falls behind the GPU.
+static const int QUEUED_PER_ENCODER = 4;
+
+// Same lights as the viewer starts up with
+static const GLfloat roomLightPos[4]  = { 0.0, 0.0, 1000.0, 1.0 };
+static const GLfloat rightLightPos[4] = { 1000.0, 0.0, 0.1, 0.0 };
+static const GLfloat leftLightPos[4]  = { -1000.0, 0.0, 0.1, 0.0 };
+static const GLfloat rightLightColor[4] = { 0.1, 0.1, 0.1, 1.0 };
+static const GLfloat leftLightColor[4]  = { 0.9, 0.9, 0.9, 1.0 };
+
+// Images that could not be written, across all encoder threads
+static QAtomicInt encodeFailures;
+
+/*
+ * Compresses one image on an encoder thread and frees up its queue slot
+ */
+class EncodeJob : public QRunnable
+{
+public:
+        EncodeJob( const QImage &image, const QString &filename, QSemaphore *queued ) :
+                image( image ), filename( filename ), queued( queued ) {}
+
+        void run()
+        {
+                if (!image.save( filename, "PNG" )) {
+                        std::cerr << "ERROR: could not write "
+                                  << filename.toLocal8Bit().constData() << std::endl;
+                        encodeFailures.ref();
+                }
+                queued->release();
+        }
+
+private:
+        QImage image;
+        QString filename;
+        QSemaphore *queued;
+};
+
+/*
+ * Read and process one model. Runs on the loader thread, so nothing in
+ * here may touch GL. Returns NULL if the model couldn't be loaded.
+ */
+static Asset3ds *loadModel( QString path, bool useCache, bool mergeCoplanar,
+                            float smoothAngle )
+{
+        try {
+                Asset3ds *asset = new Asset3ds( path.toLocal8Bit().constData(), useCache,
+                                                false, mergeCoplanar, smoothAngle );
+                asset->BuildMeshes();
+                return asset;
+        } catch (int) {
+                return NULL;
+        }
+}
+
+/*
+ * The value of a "--name=value" option, or an empty string
+ */
+static QString optionValue( const QStringList &args, const QString &name )
+{
+        for (int i = 1; i < args.size(); i++) {
+                if (args.at(i).startsWith( name ))
+                        return args.at(i).mid( name.length() );
+        }
+        return QString();
+}
+
+TurntableBatch::TurntableBatch( const QStringList &args )
+{
+        listFile = optionValue( args, "--batch=" );
+        outDir = optionValue( args, "--out=" );
+        if (outDir.isEmpty())
+                outDir = ".";
+
+        angles = optionValue( args, "--angles=" ).toInt();
+        if (angles <= 0)
+                angles = DEFAULT_ANGLES;
+
+        size = optionValue( args, "--size=" ).toInt();
+        if (size <= 0)
+                size = DEFAULT_SIZE;
+
+        useCache = !args.contains( "--no-cache" );
+        compact = args.contains( "--compact" );
+        mergeCoplanar = args.contains( "--merge-coplanar" );
+        smoothAngle = SmoothAngleArg( args );
+        framesRendered = 0;
+}
+
+bool TurntableBatch::Requested( const QStringList &args )
+{
+        return !optionValue( args, "--batch=" ).isEmpty();
+}
+
+/*
+ * One model path per line; blank lines and lines starting with # are
+ * skipped
+ */
+bool TurntableBatch::readList()
+{
+        QFile file( listFile );
+        if (!file.open( QIODevice::ReadOnly | QIODevice::Text )) {
+                std::cerr << "ERROR: could not open model list "
+                          << listFile.toLocal8Bit().constData() << std::endl;
+                return false;
+        }
+
+        QTextStream in( &file );
+        while (!in.atEnd()) {
+                QString line = in.readLine().trimmed();
+                if (!line.isEmpty() && !line.startsWith( "#" ))
+                        models.append( line );
+        }
+        return true;
+}
+
+/*
+ * Fixed GL state, the same as GLWidget::initializeGL() sets up
+ */
+void TurntableBatch::setupGL()
+{
+        QColor clear = QColor::fromCmykF( 0.0, 0.0, 0.0, 0.85 ).light();
+        glClearColor( clear.redF(), clear.greenF(), clear.blueF(), 1.0 );
+
+        glEnable( GL_DEPTH_TEST );
+        glEnable( GL_CULL_FACE );
+        glShadeModel( GL_SMOOTH );
+
+        glEnable( GL_LIGHTING );
+        glEnable( GL_LIGHT0 );
+        glEnable( GL_LIGHT1 );
+        glEnable( GL_LIGHT2 );
+        glEnable( GL_MULTISAMPLE );
+
+        glMatrixMode( GL_MODELVIEW );
+        glLoadIdentity();
+        glLightfv( GL_LIGHT0, GL_POSITION, roomLightPos );
+        glLightfv( GL_LIGHT1, GL_POSITION, rightLightPos );
+        glLightfv( GL_LIGHT2, GL_POSITION, leftLightPos );
+        glLightfv( GL_LIGHT1, GL_DIFFUSE, rightLightColor );
+        glLightfv( GL_LIGHT2, GL_DIFFUSE, leftLightColor );
+
+        glViewport( 0, 0, size, size );
+}
+
+/*
+ * Draw all the views of one model (its VBOs must already be created) and
+ * hand the images to the encoders
+ */
+void TurntableBatch::renderModel( Asset3ds *asset, const QString &path,
+                                  QGLPixelBuffer &pbuffer, QThreadPool &encoders,
+                                  QSemaphore &queued )
+{
+        float center[3], radius;
+        if (!asset->GetBoundingSphere( center, radius )) {
+                std::cerr << "WARNING: nothing to draw in "
+                          << path.toLocal8Bit().constData() << std::endl;
+                return;
+        }
+
+        // Back the camera off until the bounding sphere fits the view
+        radius = qMax( radius, 1e-6f );
+        float halfAngle = FIELD_OF_VIEW * M_PI / 180.0;
+        float distance = radius / sinf( halfAngle );
+        float near = qMax( distance - radius * 1.1f, distance * 0.001f );
+        float far = distance + radius * 1.1f;
+        float top = tanf( halfAngle ) * near;
+
+        glMatrixMode( GL_PROJECTION );
+        glLoadIdentity();
+        glFrustum( -top, top, -top, top, near, far );
+        glMatrixMode( GL_MODELVIEW );
+
+        QString name = QFileInfo( path ).completeBaseName();
+
+        for (int a = 0; a < angles; a++) {
+                glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+                glLoadIdentity();
+                glTranslatef( 0.0, 0.0, -distance );
+                glRotatef( ELEVATION, 1.0, 0.0, 0.0 );
+                glRotatef( 360.0 * a / angles, 0.0, 1.0, 0.0 );
+                glTranslatef( -center[0], -center[1], -center[2] );
+
+                asset->Draw();
+
+                // Wait here (not on the encoders) if they've fallen behind
+                QImage image = pbuffer.toImage();
+                QString filename = QString( "%1/%2_%3.png" ).arg( outDir ).arg( name )
+                                   .arg( a, 3, 10, QChar( '0' ) );
+                queued.acquire();
+                encoders.start( new EncodeJob( image, filename, &queued ) );
+                framesRendered++;
+        }
+}
+
+int TurntableBatch::Run()
+{
+        if (!readList())
+                return 1;
+        if (models.isEmpty()) {
+                std::cerr << "ERROR: no models listed in "
+                          << listFile.toLocal8Bit().constData() << std::endl;
+                return 1;
+        }
+        if (!QDir().mkpath( outDir )) {
+                std::cerr << "ERROR: could not create "
+                          << outDir.toLocal8Bit().constData() << std::endl;
+                return 1;
+        }
+
+        if (!QGLPixelBuffer::hasOpenGLPbuffers()) {
+                std::cerr << "ERROR: offscreen rendering (pbuffers) isn't supported here" << std::endl;
+                return 1;
+        }
+        QGLPixelBuffer pbuffer( QSize( size, size ), QGLFormat( QGL::SampleBuffers ) );
+        if (!pbuffer.isValid() || !pbuffer.makeCurrent()) {
+                std::cerr << "ERROR: could not create a " << size << "x" << size
+                          << " pbuffer" << std::endl;
+                return 1;
+        }
+        setupGL();
+
+        QThreadPool encoders;
+        encoders.setMaxThreadCount( qMax( 1, QThread::idealThreadCount() ) );
+        QSemaphore queued( encoders.maxThreadCount() * QUEUED_PER_ENCODER );
+
+        QElapsedTimer total, waiting;
+        total.start();
+        qint64 waitedMs = 0;
+        int failed = 0;
+
+        // The loader always works on the model after the one being drawn
+        QFuture<Asset3ds *> next = QtConcurrent::run( loadModel, models.at(0), useCache,
+                                                       mergeCoplanar, smoothAngle );
+
+        for (int i = 0; i < models.size(); i++) {
+                waiting.start();
+                Asset3ds *asset = next.result();
+                waitedMs += waiting.elapsed();
+
+                if (i + 1 < models.size())
+                        next = QtConcurrent::run( loadModel, models.at(i + 1), useCache,
+                                                  mergeCoplanar, smoothAngle );
+
+                if (!asset) {
+                        failed++;
+                        continue;
+                }
+
+                if (compact)
+                        asset->SetVertexFormat( Asset3ds::CompactVertices );
+                asset->CreateVBO();
+                renderModel( asset, models.at(i), pbuffer, encoders, queued );
+
+                // The VBOs go with it, so this has to happen on our thread
+                delete asset;
+        }
+
+        encoders.waitForDone();
+        double seconds = total.elapsed() / 1000.0;
+        int done = models.size() - failed;
+
+        std::cout << "Batch: " << done << " models (" << failed << " failed), "
+                  << framesRendered << " images (" << (int) encodeFailures
+                  << " not written) in " << seconds << " s" << std::endl;
+        std::cout << "  " << done / qMax( seconds, 0.001 ) << " models/sec, "
+                  << framesRendered / qMax( seconds, 0.001 ) << " images/sec, "
+                  << waitedMs / 1000.0 << " s spent waiting on the loader" << std::endl;
+        std::cout << "  peak memory " << PeakResidentKiB() / 1024 << " MiB" << std::endl;
+
+        return (failed > 0 || encodeFailures > 0) ? 1 : 0;
+}
@@ -0,0 +1,63 @@
+/*
+ * Filename: batch.hpp
+ *
+ * Batch turntable rendering for making preview images of lots of models
+ * without opening a window for each one:
+ *
+ *   ./finalproject --batch=models.txt [--angles=8] [--size=256] [--out=dir]
+ *
+ * models.txt lists one model path per line. Every model is drawn from
+ * --angles directions around its vertical axis into an offscreen pbuffer
+ * and each view is written out as <out>/<model name>_<angle>.png.
+ *
+ * Three things go on at once:
+ *   - the main thread owns the GL context and draws the current model
+ *   - a loader thread reads and processes (BuildMeshes()) the next model
+ *   - a pool of encoder threads compresses the finished images to PNG
+ */
+
+#ifndef _BATCH_H
+#define _BATCH_H
+
+#include <QString>
+#include <QStringList>
+
+class Asset3ds;
+class QGLPixelBuffer;
+class QThreadPool;
+class QSemaphore;
+
+class TurntableBatch
+{
+public:
+        // Picks up --batch=, --angles=, --size=, --out=, --compact and
+        // --no-cache from the command line
+        TurntableBatch( const QStringList &args );
+
+        // Was --batch= given at all?
+        static bool Requested( const QStringList &args );
+
+        // Render everything. Returns the exit code for main().
+        int Run();
+
+private:
+        bool readList();
+        void setupGL();
+        void renderModel( Asset3ds *asset, const QString &path,
+                          QGLPixelBuffer &pbuffer, QThreadPool &encoders,
+                          QSemaphore &queued );
+
+        QString listFile;
+        QString outDir;
+        int angles;                 // views per model
+        int size;                   // width and height of each image
+        bool useCache;
+        bool compact;
+        bool mergeCoplanar;         // how the meshes are processed (see
+        float smoothAngle;          // meshclean.hpp and meshnormals.hpp)
+
+        QStringList models;
+        int framesRendered;
+};
+
+#endif    // _BATCH_H
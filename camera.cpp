@@ -0,0 +1,396 @@
+/*
+ * Filename: camera.cpp
+ *
+ * Lazily rebuilt modelview / projection matrices (see camera.hpp).
+ */
+
+#include "camera.hpp"
+
+#include <math.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Defaults that match what the viewer has always started with
+static const float DEFAULT_FIELD_OF_VIEW = 40.0;
+static const float DEFAULT_ORTHO_SIZE = 3.0;
+
+// Planes used while the model's size isn't known
+static const float FALLBACK_NEAR = 0.1;
+static const float FALLBACK_FAR = 10000.0;
+
+static const float identity[16] = { 1, 0, 0, 0,
+                                    0, 1, 0, 0,
+                                    0, 0, 1, 0,
+                                    0, 0, 0, 1 };
+
+static float toRadians( float degrees )
+{
+        return degrees * (M_PI / 180.0);
+}
+
+// A full turn in slider units (1/16ths of a degree)
+static const int FULL_TURN = 360 * 16;
+
+/*
+ * out = a * b for quaternions stored x, y, z, w (out may be a or b)
+ */
+static void quatMultiply( const float a[4], const float b[4], float out[4] )
+{
+        float result[4];
+        result[0] = a[3] * b[0] + a[0] * b[3] + a[1] * b[2] - a[2] * b[1];
+        result[1] = a[3] * b[1] - a[0] * b[2] + a[1] * b[3] + a[2] * b[0];
+        result[2] = a[3] * b[2] + a[0] * b[1] - a[1] * b[0] + a[2] * b[3];
+        result[3] = a[3] * b[3] - a[0] * b[0] - a[1] * b[1] - a[2] * b[2];
+        memcpy( out, result, sizeof(result) );
+}
+
+static void quatNormalize( float q[4] )
+{
+        float length = sqrt( q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3] );
+        if (length == 0.0) {
+                q[0] = q[1] = q[2] = 0.0;
+                q[3] = 1.0;
+                return;
+        }
+        for (int k = 0; k < 4; k++)
+                q[k] /= length;
+}
+
+/*
+ * The 3x3 rotation of a unit quaternion, into the upper left of a
+ * column major 4x4
+ */
+static void quatToMatrix( const float q[4], float m[16] )
+{
+        float x = q[0], y = q[1], z = q[2], w = q[3];
+
+        m[0] = 1 - 2 * (y * y + z * z);
+        m[1] = 2 * (x * y + z * w);
+        m[2] = 2 * (x * z - y * w);
+        m[4] = 2 * (x * y - z * w);
+        m[5] = 1 - 2 * (x * x + z * z);
+        m[6] = 2 * (y * z + x * w);
+        m[8] = 2 * (x * z + y * w);
+        m[9] = 2 * (y * z - x * w);
+        m[10] = 1 - 2 * (x * x + y * y);
+}
+
+/*
+ * Degrees to slider units, wrapped into [0, FULL_TURN)
+ */
+static int toSliderAngle( float degrees )
+{
+        int angle = (int) floor( degrees * 16.0 + 0.5 );
+        angle %= FULL_TURN;
+        if (angle < 0)
+                angle += FULL_TURN;
+        return angle;
+}
+
+/*
+ * out = a * b (column major, out may be a or b)
+ */
+static void multiply( const float a[16], const float b[16], float out[16] )
+{
+        float result[16];
+#ifdef __SSE2__
+        __m128 c0 = _mm_loadu_ps( a );
+        __m128 c1 = _mm_loadu_ps( a + 4 );
+        __m128 c2 = _mm_loadu_ps( a + 8 );
+        __m128 c3 = _mm_loadu_ps( a + 12 );
+
+        // Column j of the result is a's columns weighted by column j of b
+        for (int j = 0; j < 4; j++) {
+                __m128 col = _mm_mul_ps( c0, _mm_set1_ps( b[j * 4 + 0] ) );
+                col = _mm_add_ps( col, _mm_mul_ps( c1, _mm_set1_ps( b[j * 4 + 1] ) ) );
+                col = _mm_add_ps( col, _mm_mul_ps( c2, _mm_set1_ps( b[j * 4 + 2] ) ) );
+                col = _mm_add_ps( col, _mm_mul_ps( c3, _mm_set1_ps( b[j * 4 + 3] ) ) );
+                _mm_storeu_ps( result + j * 4, col );
+        }
+#else
+        for (int j = 0; j < 4; j++) {
+                for (int i = 0; i < 4; i++) {
+                        result[j * 4 + i] = a[i] * b[j * 4]
+                                          + a[4 + i] * b[j * 4 + 1]
+                                          + a[8 + i] * b[j * 4 + 2]
+                                          + a[12 + i] * b[j * 4 + 3];
+                }
+        }
+#endif
+        memcpy( out, result, sizeof(result) );
+}
+
+Camera::Camera()
+{
+        m_Position[0] = m_Position[1] = m_Position[2] = 0.0;
+        m_Orientation[0] = m_Orientation[1] = m_Orientation[2] = 0.0;
+        m_Orientation[3] = 1.0;
+        for (int k = 0; k < 3; k++) {
+                m_Angle[k] = 0;
+                m_Sin[k] = 0.0;
+                m_Cos[k] = 1.0;
+                m_Center[k] = 0.0;
+        }
+        m_Scale = 1.0;
+        m_Radius = 0.0;
+
+        m_Perspective = true;
+        m_InvTanFov = 1.0 / tan( toRadians( DEFAULT_FIELD_OF_VIEW ) );
+        m_OrthoSize = DEFAULT_ORTHO_SIZE;
+
+        m_ViewDirty = m_ProjectionDirty = true;
+        m_Version = m_ProjectionVersion = 1;
+}
+
+void Camera::SetPosition( float x, float y, float z )
+{
+        m_Position[0] = x;
+        m_Position[1] = y;
+        m_Position[2] = z;
+
+        // Near/far follow the distance to the model too
+        m_ViewDirty = m_ProjectionDirty = true;
+        m_ProjectionVersion++;
+        m_Version++;
+}
+
+void Camera::Move( float dx, float dy, float dz )
+{
+        SetPosition( m_Position[0] + dx, m_Position[1] + dy, m_Position[2] + dz );
+}
+
+const float *Camera::Position() const
+{
+        return m_Position;
+}
+
+/*
+ * The sine and cosine are worked out here, once per change, rather than
+ * every time the orientation is rebuilt
+ */
+void Camera::SetRotation( int axis, int angle )
+{
+        if (m_Angle[axis] == angle)
+                return;
+
+        m_Angle[axis] = angle;
+        float radians = toRadians( angle / 16.0 );
+        m_Sin[axis] = sin( 0.5 * radians );
+        m_Cos[axis] = cos( 0.5 * radians );
+        anglesToOrientation();
+
+        m_ViewDirty = true;
+        m_Version++;
+}
+
+int Camera::Rotation( int axis ) const
+{
+        return m_Angle[axis];
+}
+
+void Camera::Rotate( const float q[4] )
+{
+        quatMultiply( q, m_Orientation, m_Orientation );
+        quatNormalize( m_Orientation );
+        orientationToAngles();
+
+        m_ViewDirty = true;
+        m_Version++;
+}
+
+const float *Camera::Orientation() const
+{
+        return m_Orientation;
+}
+
+/*
+ * orientation = rotX * rotY * rotZ, from the cached half angle trig
+ */
+void Camera::anglesToOrientation()
+{
+        float qx[4] = { m_Sin[0], 0.0, 0.0, m_Cos[0] };
+        float qy[4] = { 0.0, m_Sin[1], 0.0, m_Cos[1] };
+        float qz[4] = { 0.0, 0.0, m_Sin[2], m_Cos[2] };
+
+        quatMultiply( qx, qy, m_Orientation );
+        quatMultiply( m_Orientation, qz, m_Orientation );
+}
+
+/*
+ * Pull x, y, z angles back out of the orientation so the sliders can
+ * follow the arcball. For R = rotX(a) * rotY(b) * rotZ(c):
+ *     R02 = sin b,  R12 = -sin a cos b,  R22 = cos a cos b,
+ *     R01 = -cos b sin c,  R00 = cos b cos c
+ * (rows, columns). When cos b is 0 only a + c is known, so c is left 0.
+ */
+void Camera::orientationToAngles()
+{
+        float m[16];
+        quatToMatrix( m_Orientation, m );
+
+        // m is column major: R[row][col] = m[col * 4 + row]
+        float sinB = m[8];
+        if (sinB > 1.0) sinB = 1.0;
+        if (sinB < -1.0) sinB = -1.0;
+        float a, b = asin( sinB ), c;
+        if (fabs( sinB ) < 0.99999) {
+                a = atan2( -m[9], m[10] );
+                c = atan2( -m[4], m[0] );
+        } else {
+                a = atan2( m[6], m[5] );
+                c = 0.0;
+        }
+
+        float radians[3] = { a, b, c };
+        for (int k = 0; k < 3; k++) {
+                m_Angle[k] = toSliderAngle( radians[k] * (180.0 / M_PI) );
+                m_Sin[k] = sin( 0.5 * radians[k] );
+                m_Cos[k] = cos( 0.5 * radians[k] );
+        }
+}
+
+void Camera::SetScale( float scale )
+{
+        m_Scale = scale;
+        m_ViewDirty = m_ProjectionDirty = true;
+        m_ProjectionVersion++;
+        m_Version++;
+}
+
+float Camera::Scale() const
+{
+        return m_Scale;
+}
+
+void Camera::SetTarget( const float center[3], float radius )
+{
+        memcpy( m_Center, center, sizeof(m_Center) );
+        m_Radius = radius;
+        m_ViewDirty = m_ProjectionDirty = true;
+        m_ProjectionVersion++;
+        m_Version++;
+}
+
+void Camera::SetPerspective( bool on )
+{
+        m_Perspective = on;
+        m_ProjectionDirty = true;
+        m_ProjectionVersion++;
+        m_Version++;
+}
+
+bool Camera::Perspective() const
+{
+        return m_Perspective;
+}
+
+void Camera::SetFieldOfView( float degrees )
+{
+        m_InvTanFov = 1.0 / tan( toRadians( degrees ) );
+        m_ProjectionDirty = true;
+        m_ProjectionVersion++;
+        m_Version++;
+}
+
+void Camera::SetOrthoSize( float halfWidth )
+{
+        m_OrthoSize = halfWidth;
+        m_ProjectionDirty = true;
+        m_ProjectionVersion++;
+        m_Version++;
+}
+
+float Camera::OrthoSize() const
+{
+        return m_OrthoSize;
+}
+
+const float *Camera::ViewMatrix() const
+{
+        if (m_ViewDirty)
+                updateView();
+        return m_View;
+}
+
+const float *Camera::ProjectionMatrix() const
+{
+        if (m_ProjectionDirty)
+                updateProjection();
+        return m_Projection;
+}
+
+unsigned int Camera::Version() const
+{
+        return m_Version;
+}
+
+unsigned int Camera::ProjectionVersion() const
+{
+        return m_ProjectionVersion;
+}
+
+void Camera::updateView() const
+{
+        // scale * translate(-center) in one go
+        float model[16];
+        memcpy( model, identity, sizeof(identity) );
+        model[0] = model[5] = model[10] = m_Scale;
+        for (int k = 0; k < 3; k++)
+                model[12 + k] = -m_Scale * m_Center[k];
+
+        // translate(position) * rotation is just the rotation with the
+        // position in the last column
+        memcpy( m_View, identity, sizeof(identity) );
+        quatToMatrix( m_Orientation, m_View );
+        for (int k = 0; k < 3; k++)
+                m_View[12 + k] = m_Position[k];
+
+        multiply( m_View, model, m_View );
+
+        m_ViewDirty = false;
+}
+
+/*
+ * Same matrices glFrustum() (symmetric, square) and glOrtho() make, with
+ * near and far placed just in front of and just behind the model so the
+ * depth buffer's precision is spent on the model and not on empty space
+ */
+void Camera::updateProjection() const
+{
+        float near = FALLBACK_NEAR, far = FALLBACK_FAR;
+
+        if (m_Radius > 0.0) {
+                float radius = m_Radius * m_Scale;
+                float distance = sqrt( m_Position[0] * m_Position[0]
+                                     + m_Position[1] * m_Position[1]
+                                     + m_Position[2] * m_Position[2] );
+
+                // Inside the sphere the near plane can't go behind the
+                // eye, so just keep the ratio sane for the depth buffer
+                far = (distance + radius) * 1.01;
+                near = (distance - radius) * 0.99;
+                if (near < far / 10000.0)
+                        near = far / 10000.0;
+        }
+
+        memset( m_Projection, 0, sizeof(float) * 16 );
+
+        if (m_Perspective) {
+                m_Projection[0] = m_InvTanFov;
+                m_Projection[5] = m_InvTanFov;
+                m_Projection[10] = -(far + near) / (far - near);
+                m_Projection[11] = -1.0;
+                m_Projection[14] = -2.0 * far * near / (far - near);
+        } else {
+                m_Projection[0] = 1.0 / m_OrthoSize;
+                m_Projection[5] = 1.0 / m_OrthoSize;
+                m_Projection[10] = -2.0 / (far - near);
+                m_Projection[14] = -(far + near) / (far - near);
+                m_Projection[15] = 1.0;
+        }
+
+        m_ProjectionDirty = false;
+}
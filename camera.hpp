@@ -0,0 +1,95 @@
+/*
+ * Filename: camera.hpp
+ *
+ * The viewer's camera: where the model sits in front of the eye, how it's
+ * turned and scaled, and the projection. It keeps the modelview and
+ * projection matrices itself and only rebuilds them when something they
+ * depend on changes, so paintGL() just loads them with glLoadMatrixf()
+ * instead of redoing glFrustum()/glRotatef() every frame.
+ *
+ * Every change bumps Version(); anything derived from the matrices (like
+ * the culling frustum) can remember the version it was built from and
+ * skip the work when it hasn't moved.
+ *
+ * The modelview is
+ *     translate(position) * rotation * scale * translate(-center)
+ * where center is the middle of the model, so it turns about itself. The
+ * rotation is kept as a unit quaternion so it can be turned any which way
+ * (an arcball) without gimbal lock. It can also be set, and read back, as
+ * the x, y, z angles the sliders show (rotation = rotX * rotY * rotZ).
+ * Near and far are fitted around the model's bounding sphere (see
+ * SetTarget()) wherever the camera has been moved to.
+ *
+ * Matrices are column major, like GL.
+ */
+
+#ifndef _CAMERA_H
+#define _CAMERA_H
+
+class Camera
+{
+public:
+        Camera();
+
+        // Model offset from the eye (eye space)
+        void SetPosition( float x, float y, float z );
+        void Move( float dx, float dy, float dz );
+        const float *Position() const;
+
+        // Rotation about axis 0, 1 or 2 (x, y, z) in 1/16ths of a degree,
+        // the same units the sliders use
+        void SetRotation( int axis, int angle );
+        int Rotation( int axis ) const;
+
+        // Turn the model by quaternion q (x, y, z, w) about eye space
+        // axes, on top of whatever rotation it already has
+        void Rotate( const float q[4] );
+        const float *Orientation() const;
+
+        void SetScale( float scale );
+        float Scale() const;
+
+        // The model's bounding sphere (model space). A radius of 0 means
+        // unknown: no centering, and wide fixed near/far planes.
+        void SetTarget( const float center[3], float radius );
+
+        // Perspective (field of view is the half angle, in degrees) or
+        // orthographic (half the width of the view)
+        void SetPerspective( bool on );
+        bool Perspective() const;
+        void SetFieldOfView( float degrees );
+        void SetOrthoSize( float halfWidth );
+        float OrthoSize() const;
+
+        const float *ViewMatrix() const;
+        const float *ProjectionMatrix() const;
+
+        // Changes whenever either matrix does
+        unsigned int Version() const;
+
+        // Changes only when the projection does
+        unsigned int ProjectionVersion() const;
+
+private:
+        void updateView() const;
+        void updateProjection() const;
+        void anglesToOrientation();
+        void orientationToAngles();
+
+        float m_Position[3];
+        float m_Orientation[4];            // unit quaternion, x y z w
+        int m_Angle[3];                     // the same as slider angles
+        float m_Sin[3], m_Cos[3];           // of HALF of each m_Angle
+        float m_Scale;
+        float m_Center[3], m_Radius;
+
+        bool m_Perspective;
+        float m_InvTanFov;                  // near / top of the frustum
+        float m_OrthoSize;
+
+        mutable float m_View[16], m_Projection[16];
+        mutable bool m_ViewDirty, m_ProjectionDirty;
+        unsigned int m_Version, m_ProjectionVersion;
+};
+
+#endif    // _CAMERA_H
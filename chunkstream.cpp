@@ -0,0 +1,937 @@
+/*
+ * Filename: chunkstream.cpp
+ *
+ * Writing the chunk files and streaming them back in (see chunkstream.hpp).
+ * Like the mesh cache, the file is the structs dumped in the machine's own
+ * byte order.
+ */
+
+#include "chunkstream.hpp"
+#include "meshtangents.hpp"
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <map>
+#include <cstring>
+#include <cstddef>
+#include <cmath>
+#include <sys/stat.h>
+
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Bump this whenever the layout or the chunking changes
+static const unsigned int CHUNKFILE_VERSION = 4;
+static const char CHUNKFILE_MAGIC[8] = { 'U', 'M', 'L', 'C', 'H', 'U', 'N', 'K' };
+
+// Clustering grid for each coarser level, in cells along the chunk's
+// longest side
+static const unsigned int LOD_CELLS[CHUNK_LODS] = { 0, 48, 12 };
+
+// Screen size (radius over distance) a chunk has to reach for each finer
+// level
+static const float LOD_SIZE[CHUNK_LODS - 1] = { 0.25f, 0.06f };
+
+// Most bytes uploaded in one frame, so arriving chunks can't stall it
+static const long CHUNK_UPLOAD_BYTES = 32L << 20;
+
+struct ChunkFileHeader
+{
+        char magic[8];
+        unsigned int version;
+        unsigned int chunkCount;
+        long long sourceSize;
+        long long sourceTime;
+        float boundsMin[3], boundsMax[3];
+        unsigned int triangles;
+        unsigned int mergeCoplanar;     // how the meshes were cleaned up
+        float smoothAngle;              // and how their normals were made
+        unsigned int pad;
+};
+
+std::string ChunkFilePath( const std::string &modelPath )
+{
+        return modelPath + ".chunks";
+}
+
+// Size and mtime of the model, so a changed model invalidates the file
+static bool sourceStamp( const std::string &modelPath, ChunkFileHeader &header )
+{
+        struct stat info;
+        if (stat( modelPath.c_str(), &info ) != 0)
+                return false;
+
+        header.sourceSize = (long long) info.st_size;
+        header.sourceTime = (long long) info.st_mtime;
+        return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  Writing
+//////////////////////////////////////////////////////////////////////////////
+
+/*
+ * The unit that gets sorted into chunks: one meshlet (or, for a mesh
+ * without meshlets, a run of its triangles)
+ */
+struct ChunkAtom
+{
+        unsigned int mesh, firstIndex, indexCount;
+        float center[3];
+};
+
+struct AtomLess
+{
+        int axis;
+        AtomLess( int a ) : axis( a ) {}
+        bool operator()( const ChunkAtom &a, const ChunkAtom &b ) const
+        {
+                return a.center[axis] < b.center[axis];
+        }
+};
+
+static void atomCenter( const Mesh &mesh, ChunkAtom &atom )
+{
+        float lo[3] = {  HUGE_VALF,  HUGE_VALF,  HUGE_VALF };
+        float hi[3] = { -HUGE_VALF, -HUGE_VALF, -HUGE_VALF };
+        for (unsigned int i = atom.firstIndex; i < atom.firstIndex + atom.indexCount; i++) {
+                const float *p = mesh.vertices[mesh.indices[i]].pos;
+                for (unsigned int k = 0; k < 3; k++) {
+                        lo[k] = qMin( lo[k], p[k] );
+                        hi[k] = qMax( hi[k], p[k] );
+                }
+        }
+        for (unsigned int k = 0; k < 3; k++)
+                atom.center[k] = 0.5f * (lo[k] + hi[k]);
+}
+
+/*
+ * Median split on the longest side of the atoms' centers until each group
+ * is small enough. Groups come out as [begin, end) runs of atoms.
+ */
+static void splitAtoms( std::vector<ChunkAtom> &atoms, unsigned int begin, unsigned int end,
+                        std::vector<unsigned int> &groups )
+{
+        unsigned int triangles = 0;
+        float lo[3] = {  HUGE_VALF,  HUGE_VALF,  HUGE_VALF };
+        float hi[3] = { -HUGE_VALF, -HUGE_VALF, -HUGE_VALF };
+        for (unsigned int a = begin; a < end; a++) {
+                triangles += atoms[a].indexCount / 3;
+                for (unsigned int k = 0; k < 3; k++) {
+                        lo[k] = qMin( lo[k], atoms[a].center[k] );
+                        hi[k] = qMax( hi[k], atoms[a].center[k] );
+                }
+        }
+
+        if (triangles <= CHUNK_TRIANGLES || end - begin == 1) {
+                groups.push_back( begin );
+                groups.push_back( end );
+                return;
+        }
+
+        int axis = 0;
+        for (int k = 1; k < 3; k++) {
+                if (hi[k] - lo[k] > hi[axis] - lo[axis])
+                        axis = k;
+        }
+
+        unsigned int middle = begin + (end - begin) / 2;
+        std::nth_element( atoms.begin() + begin, atoms.begin() + middle,
+                          atoms.begin() + end, AtomLess( axis ) );
+        splitAtoms( atoms, begin, middle, groups );
+        splitAtoms( atoms, middle, end, groups );
+}
+
+struct Cluster
+{
+        float pos[3], normal[3], texCoord[2];
+        unsigned int count;
+        unsigned int index;             // in the level's vertices, once used
+};
+
+/*
+ * Vertex clustering: snap every vertex to a grid of cells on the chunk's
+ * longest side, merge each cell's vertices into their average, and keep
+ * the triangles whose corners still land in three different cells.
+ */
+static void clusterLevel( const std::vector<MeshVertex> &vertices,
+                          const std::vector<unsigned int> &indices,
+                          const float lo[3], const float hi[3], unsigned int cells,
+                          std::vector<MeshVertex> &outVertices,
+                          std::vector<unsigned int> &outIndices )
+{
+        outVertices.clear();
+        outIndices.clear();
+
+        float extent = qMax( hi[0] - lo[0], qMax( hi[1] - lo[1], hi[2] - lo[2] ) );
+        float toCell = (extent > 0.0f) ? cells / extent : 0.0f;
+
+        std::map<unsigned long long, unsigned int> cellOf;
+        std::vector<Cluster> clusters;
+        std::vector<unsigned int> vertexCluster( vertices.size() );
+
+        for (unsigned int v = 0; v < vertices.size(); v++) {
+                const MeshVertex &vertex = vertices[v];
+                unsigned long long key = 0;
+                for (unsigned int k = 0; k < 3; k++) {
+                        unsigned int c = (unsigned int) ((vertex.pos[k] - lo[k]) * toCell);
+                        key = (key << 21) | qMin( c, cells );
+                }
+
+                std::map<unsigned long long, unsigned int>::iterator found = cellOf.find( key );
+                unsigned int id;
+                if (found == cellOf.end()) {
+                        id = clusters.size();
+                        cellOf[key] = id;
+                        Cluster fresh;
+                        memset( &fresh, 0, sizeof(fresh) );
+                        fresh.index = ~0u;
+                        clusters.push_back( fresh );
+                } else {
+                        id = found->second;
+                }
+
+                Cluster &cluster = clusters[id];
+                for (unsigned int k = 0; k < 3; k++) {
+                        cluster.pos[k] += vertex.pos[k];
+                        cluster.normal[k] += vertex.normal[k];
+                }
+                cluster.texCoord[0] += vertex.texCoord[0];
+                cluster.texCoord[1] += vertex.texCoord[1];
+                cluster.count++;
+                vertexCluster[v] = id;
+        }
+
+        for (unsigned int i = 0; i + 2 < indices.size(); i += 3) {
+                unsigned int c[3];
+                for (unsigned int j = 0; j < 3; j++)
+                        c[j] = vertexCluster[indices[i + j]];
+                if (c[0] == c[1] || c[1] == c[2] || c[0] == c[2])
+                        continue;
+
+                for (unsigned int j = 0; j < 3; j++) {
+                        Cluster &cluster = clusters[c[j]];
+                        if (cluster.index == ~0u) {
+                                MeshVertex merged;
+                                float scale = 1.0f / cluster.count;
+                                float length = 0.0f;
+                                for (unsigned int k = 0; k < 3; k++) {
+                                        merged.pos[k] = cluster.pos[k] * scale;
+                                        length += cluster.normal[k] * cluster.normal[k];
+                                }
+                                // Opposite normals can cancel out: keep one
+                                // of the originals then
+                                length = sqrtf( length );
+                                for (unsigned int k = 0; k < 3; k++) {
+                                        merged.normal[k] = (length > 1e-6f)
+                                                ? cluster.normal[k] / length
+                                                : vertices[indices[i + j]].normal[k];
+                                }
+                                merged.texCoord[0] = cluster.texCoord[0] * scale;
+                                merged.texCoord[1] = cluster.texCoord[1] * scale;
+                                merged.tangent = vertices[indices[i + j]].tangent;
+
+                                cluster.index = outVertices.size();
+                                outVertices.push_back( merged );
+                        }
+                        outIndices.push_back( cluster.index );
+                }
+        }
+}
+
+static void writePadding( std::ofstream &out )
+{
+        static const char zeros[4096] = { 0 };
+        long long at = (long long) out.tellp();
+        long long pad = (CHUNK_ALIGN - at % CHUNK_ALIGN) % CHUNK_ALIGN;
+        while (pad > 0) {
+                long long n = qMin( pad, (long long) sizeof(zeros) );
+                out.write( zeros, n );
+                pad -= n;
+        }
+}
+
+bool WriteChunkFile( const std::string &modelPath, const std::vector<Mesh> &meshes,
+                     bool mergeCoplanar, float smoothAngle )
+{
+        ChunkFileHeader header;
+        memset( &header, 0, sizeof(header) );
+        if (!sourceStamp( modelPath, header ))
+                return false;
+
+        // Everything to be sorted into chunks
+        std::vector<ChunkAtom> atoms;
+        for (unsigned int m = 0; m < meshes.size(); m++) {
+                const Mesh &mesh = meshes[m];
+                if (!mesh.meshlets.empty()) {
+                        for (unsigned int i = 0; i < mesh.meshlets.size(); i++) {
+                                const Meshlet &meshlet = mesh.meshlets[i];
+                                ChunkAtom atom = { m, meshlet.firstIndex, meshlet.indexCount,
+                                                   { meshlet.center[0], meshlet.center[1],
+                                                     meshlet.center[2] } };
+                                atoms.push_back( atom );
+                        }
+                } else {
+                        for (unsigned int i = 0; i < mesh.indices.size(); i += 3 * 128) {
+                                ChunkAtom atom = { m, i, qMin( 3u * 128, (unsigned int) mesh.indices.size() - i ),
+                                                   { 0.0f, 0.0f, 0.0f } };
+                                atomCenter( mesh, atom );
+                                atoms.push_back( atom );
+                        }
+                }
+        }
+
+        std::vector<unsigned int> groups;
+        if (!atoms.empty())
+                splitAtoms( atoms, 0, atoms.size(), groups );
+        unsigned int chunkCount = groups.size() / 2;
+
+        std::string path = ChunkFilePath( modelPath );
+        std::ofstream out( path.c_str(), std::ios::binary | std::ios::trunc );
+        if (!out)
+                return false;
+
+        // The header (with no magic yet, so a half written file is never
+        // taken for a good one) and table go in again at the end
+        std::vector<ChunkInfo> table( chunkCount );
+        out.write( (const char *) &header, sizeof(header) );
+        if (chunkCount > 0)
+                out.write( (const char *) &table[0], sizeof(ChunkInfo) * chunkCount );
+
+        for (unsigned int k = 0; k < 3; k++) {
+                header.boundsMin[k] =  HUGE_VALF;
+                header.boundsMax[k] = -HUGE_VALF;
+        }
+
+        // Where each mesh vertex went in the current chunk (valid when
+        // its stamp is the chunk's)
+        std::vector< std::vector<unsigned int> > remap( meshes.size() ), stamp( meshes.size() );
+        for (unsigned int m = 0; m < meshes.size(); m++) {
+                remap[m].resize( meshes[m].vertices.size() );
+                stamp[m].assign( meshes[m].vertices.size(), ~0u );
+        }
+
+        std::vector<MeshVertex> vertices, levelVertices;
+        std::vector<unsigned int> indices, levelIndices;
+
+        for (unsigned int c = 0; c < chunkCount; c++) {
+                ChunkInfo &info = table[c];
+                vertices.clear();
+                indices.clear();
+
+                // Full detail: the chunk's triangles with chunk-local indices
+                for (unsigned int a = groups[c * 2]; a < groups[c * 2 + 1]; a++) {
+                        const ChunkAtom &atom = atoms[a];
+                        const Mesh &mesh = meshes[atom.mesh];
+                        for (unsigned int i = atom.firstIndex; i < atom.firstIndex + atom.indexCount; i++) {
+                                unsigned int v = mesh.indices[i];
+                                if (stamp[atom.mesh][v] != c) {
+                                        stamp[atom.mesh][v] = c;
+                                        remap[atom.mesh][v] = vertices.size();
+                                        vertices.push_back( mesh.vertices[v] );
+                                }
+                                indices.push_back( remap[atom.mesh][v] );
+                        }
+                }
+
+                for (unsigned int k = 0; k < 3; k++) {
+                        info.boundsMin[k] =  HUGE_VALF;
+                        info.boundsMax[k] = -HUGE_VALF;
+                }
+                for (unsigned int v = 0; v < vertices.size(); v++) {
+                        for (unsigned int k = 0; k < 3; k++) {
+                                info.boundsMin[k] = qMin( info.boundsMin[k], vertices[v].pos[k] );
+                                info.boundsMax[k] = qMax( info.boundsMax[k], vertices[v].pos[k] );
+                        }
+                }
+                info.radius = 0.0f;
+                for (unsigned int k = 0; k < 3; k++) {
+                        info.center[k] = 0.5f * (info.boundsMin[k] + info.boundsMax[k]);
+                        header.boundsMin[k] = qMin( header.boundsMin[k], info.boundsMin[k] );
+                        header.boundsMax[k] = qMax( header.boundsMax[k], info.boundsMax[k] );
+                }
+                for (unsigned int v = 0; v < vertices.size(); v++) {
+                        float d = 0.0f;
+                        for (unsigned int k = 0; k < 3; k++) {
+                                float e = vertices[v].pos[k] - info.center[k];
+                                d += e * e;
+                        }
+                        info.radius = qMax( info.radius, d );
+                }
+                info.radius = sqrtf( info.radius );
+                header.triangles += indices.size() / 3;
+
+                for (unsigned int lod = 0; lod < CHUNK_LODS; lod++) {
+                        const std::vector<MeshVertex> *v = &vertices;
+                        const std::vector<unsigned int> *i = &indices;
+                        if (lod > 0) {
+                                clusterLevel( vertices, indices, info.boundsMin, info.boundsMax,
+                                              LOD_CELLS[lod], levelVertices, levelIndices );
+                                v = &levelVertices;
+                                i = &levelIndices;
+                        }
+
+                        writePadding( out );
+                        ChunkLevel &level = info.levels[lod];
+                        level.offset = (long long) out.tellp();
+                        level.vertexCount = v->size();
+                        level.indexCount = i->size();
+                        if (!v->empty())
+                                out.write( (const char *) &(*v)[0], sizeof(MeshVertex) * v->size() );
+                        if (!i->empty())
+                                out.write( (const char *) &(*i)[0], sizeof(unsigned int) * i->size() );
+                }
+        }
+
+        memcpy( header.magic, CHUNKFILE_MAGIC, sizeof(CHUNKFILE_MAGIC) );
+        header.version = CHUNKFILE_VERSION;
+        header.chunkCount = chunkCount;
+        header.mergeCoplanar = mergeCoplanar ? 1 : 0;
+        header.smoothAngle = smoothAngle;
+        out.seekp( 0 );
+        out.write( (const char *) &header, sizeof(header) );
+        if (chunkCount > 0)
+                out.write( (const char *) &table[0], sizeof(ChunkInfo) * chunkCount );
+
+        return (bool) out;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  ChunkPrefetcher
+//////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Pages levels of the mapping in, off the GL thread. A level's state goes
+ * Queued -> Loading -> Loaded here; the stream only uploads Loaded ones,
+ * so the GL thread never waits on the disk. Paging in reads the indices
+ * anyway, so they're checked against the level's vertices then: a
+ * damaged level goes to Bad and is never uploaded.
+ */
+enum { LevelCold, LevelQueued, LevelLoading, LevelLoaded, LevelBad };
+
+struct PrefetchJob
+{
+        const uchar *data;
+        long bytes;
+        unsigned int vertexCount, indexCount;
+        QAtomicInt *state;
+};
+
+class ChunkPrefetcher : public QThread
+{
+public:
+        ChunkPrefetcher() : m_Quit( false ) {}
+
+        // Replace the queue (nearest first). Whatever was still waiting
+        // and isn't wanted any more goes back to cold.
+        void Replace( const std::vector<PrefetchJob> &jobs )
+        {
+                QMutexLocker locker( &m_Lock );
+                for (unsigned int j = 0; j < m_Queue.size(); j++)
+                        m_Queue[j].state->testAndSetOrdered( LevelQueued, LevelCold );
+
+                m_Queue.assign( jobs.rbegin(), jobs.rend() );      // popped off the back
+                for (unsigned int j = 0; j < m_Queue.size(); j++)
+                        m_Queue[j].state->testAndSetOrdered( LevelCold, LevelQueued );
+                m_Wake.wakeOne();
+        }
+
+        void Stop()
+        {
+                {
+                        QMutexLocker locker( &m_Lock );
+                        m_Quit = true;
+                        m_Wake.wakeOne();
+                }
+                wait();
+        }
+
+protected:
+        void run()
+        {
+                for (;;) {
+                        PrefetchJob job;
+                        {
+                                QMutexLocker locker( &m_Lock );
+                                while (m_Queue.empty() && !m_Quit)
+                                        m_Wake.wait( &m_Lock );
+                                if (m_Quit)
+                                        return;
+                                job = m_Queue.back();
+                                m_Queue.pop_back();
+                                if (!job.state->testAndSetOrdered( LevelQueued, LevelLoading ))
+                                        continue;
+                        }
+
+#ifdef Q_OS_UNIX
+                        madvise( (void *) job.data, job.bytes, MADV_WILLNEED );
+#endif
+                        // Touching a byte of every page is what actually
+                        // gets it read in
+                        volatile uchar sum = 0;
+                        for (long b = 0; b < job.bytes; b += 4096)
+                                sum += job.data[b];
+
+                        const unsigned int *indices = (const unsigned int *)
+                                (job.data + sizeof(MeshVertex) * (long) job.vertexCount);
+                        bool good = true;
+                        for (unsigned int i = 0; i < job.indexCount && good; i++)
+                                good = indices[i] < job.vertexCount;
+                        if (!good)
+                                std::cerr << "WARNING: chunk level with bad indices skipped" << std::endl;
+                        job.state->fetchAndStoreOrdered( good ? LevelLoaded : LevelBad );
+                }
+        }
+
+private:
+        QMutex m_Lock;
+        QWaitCondition m_Wake;
+        std::vector<PrefetchJob> m_Queue;
+        bool m_Quit;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+//  ChunkStream
+//////////////////////////////////////////////////////////////////////////////
+
+ChunkStream::ChunkStream()
+{
+        m_Map = NULL;
+        m_Chunks = NULL;
+        m_Count = m_Triangles = 0;
+        m_Entries = NULL;
+        m_Prefetcher = NULL;
+        m_Frame = 1;
+        m_GpuVersion = 0;
+        m_Visible = m_Waiting = 0;
+        memset( m_Drawn, 0, sizeof(m_Drawn) );
+        m_RamBytes = m_VramBytes = 0;
+        m_RamBudget = CHUNK_RAM_BUDGET;
+        m_VramBudget = CHUNK_VRAM_BUDGET;
+        for (unsigned int k = 0; k < 3; k++)
+                m_BoundsMin[k] = m_BoundsMax[k] = 0.0f;
+}
+
+ChunkStream::~ChunkStream()
+{
+        if (m_Prefetcher != NULL) {
+                m_Prefetcher->Stop();
+                delete m_Prefetcher;
+        }
+
+        // The buffers delete themselves
+        delete [] m_Entries;
+        if (m_Map != NULL)
+                m_File.unmap( m_Map );
+}
+
+bool ChunkStream::Open( const std::string &modelPath, bool mergeCoplanar,
+                        float smoothAngle )
+{
+        ChunkFileHeader expected;
+        if (!sourceStamp( modelPath, expected ))
+                return false;
+
+        m_File.setFileName( QString::fromLocal8Bit( ChunkFilePath( modelPath ).c_str() ) );
+        if (!m_File.open( QIODevice::ReadOnly ) || m_File.size() < (qint64) sizeof(ChunkFileHeader))
+                return false;
+
+        qint64 size = m_File.size();
+        uchar *map = m_File.map( 0, size );
+        if (map == NULL)
+                return false;
+
+        const ChunkFileHeader *header = (const ChunkFileHeader *) map;
+        bool good = memcmp( header->magic, CHUNKFILE_MAGIC, sizeof(CHUNKFILE_MAGIC) ) == 0
+                 && header->version == CHUNKFILE_VERSION
+                 && header->mergeCoplanar == (mergeCoplanar ? 1u : 0u)
+                 && header->smoothAngle == smoothAngle
+                 && header->sourceSize == expected.sourceSize
+                 && header->sourceTime == expected.sourceTime
+                 && (qint64) (sizeof(ChunkFileHeader) + sizeof(ChunkInfo) * (qint64) header->chunkCount) <= size;
+
+        // Every level has to be inside the file and be whole triangles
+        // (the indices themselves are checked as each level pages in)
+        const ChunkInfo *chunks = (const ChunkInfo *) (map + sizeof(ChunkFileHeader));
+        for (unsigned int c = 0; good && c < header->chunkCount; c++) {
+                for (unsigned int lod = 0; lod < CHUNK_LODS; lod++) {
+                        const ChunkLevel &level = chunks[c].levels[lod];
+                        qint64 bytes = sizeof(MeshVertex) * (qint64) level.vertexCount
+                                     + sizeof(unsigned int) * (qint64) level.indexCount;
+                        if (level.offset < 0 || level.offset % CHUNK_ALIGN != 0
+                            || level.offset + bytes > size || level.indexCount % 3 != 0) {
+                                good = false;
+                        }
+                }
+        }
+
+        if (!good) {
+                m_File.unmap( map );
+                m_File.close();
+                return false;
+        }
+
+        m_Map = map;
+        m_Chunks = chunks;
+        m_Count = header->chunkCount;
+        m_Triangles = header->triangles;
+        memcpy( m_BoundsMin, header->boundsMin, sizeof(m_BoundsMin) );
+        memcpy( m_BoundsMax, header->boundsMax, sizeof(m_BoundsMax) );
+
+        m_Entries = new Entry[m_Count * CHUNK_LODS];
+        for (unsigned int e = 0; e < m_Count * CHUNK_LODS; e++)
+                m_Entries[e].ramUsed = m_Entries[e].gpuUsed = 0;
+
+        m_Prefetcher = new ChunkPrefetcher;
+        m_Prefetcher->start( QThread::LowPriority );
+        return true;
+}
+
+void ChunkStream::SetBudgets( long ramBytes, long vramBytes )
+{
+        m_RamBudget = ramBytes;
+        m_VramBudget = vramBytes;
+}
+
+void ChunkStream::GetBounds( float min[3], float max[3] ) const
+{
+        memcpy( min, m_BoundsMin, sizeof(m_BoundsMin) );
+        memcpy( max, m_BoundsMax, sizeof(m_BoundsMax) );
+}
+
+unsigned int ChunkStream::Triangles() const
+{
+        return m_Triangles;
+}
+
+unsigned int ChunkStream::Count() const
+{
+        return m_Count;
+}
+
+const uchar *ChunkStream::levelData( unsigned int entry ) const
+{
+        return m_Map + m_Chunks[entry / CHUNK_LODS].levels[entry % CHUNK_LODS].offset;
+}
+
+long ChunkStream::levelBytes( unsigned int entry ) const
+{
+        const ChunkLevel &level = m_Chunks[entry / CHUNK_LODS].levels[entry % CHUNK_LODS];
+        return sizeof(MeshVertex) * (long) level.vertexCount
+             + sizeof(unsigned int) * (long) level.indexCount;
+}
+
+// Straight from the mapping (it's already paged in)
+void ChunkStream::upload( unsigned int entry )
+{
+        const ChunkLevel &level = m_Chunks[entry / CHUNK_LODS].levels[entry % CHUNK_LODS];
+        const uchar *data = levelData( entry );
+        long vertexBytes = sizeof(MeshVertex) * (long) level.vertexCount;
+
+        Entry &e = m_Entries[entry];
+        e.vertices.Create( GL_ARRAY_BUFFER, GpuVertex, vertexBytes, data, GL_STATIC_DRAW );
+        e.indices.Create( GL_ELEMENT_ARRAY_BUFFER, GpuIndex,
+                          sizeof(unsigned int) * level.indexCount, data + vertexBytes,
+                          GL_STATIC_DRAW );
+        glBindBuffer( GL_ARRAY_BUFFER, 0 );
+        glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
+        m_VramBytes += e.vertices.Bytes() + e.indices.Bytes();
+        m_GpuVersion++;
+}
+
+// Give a level's pages back (it reads in again from the file if needed)
+void ChunkStream::drop( unsigned int entry )
+{
+        if (!m_Entries[entry].state.testAndSetOrdered( LevelLoaded, LevelCold ))
+                return;
+
+#ifdef Q_OS_UNIX
+        long page = sysconf( _SC_PAGESIZE );
+        long bytes = (levelBytes( entry ) + page - 1) / page * page;
+        madvise( (void *) levelData( entry ), bytes, MADV_DONTNEED );
+#endif
+        m_RamBytes -= levelBytes( entry );
+}
+
+struct LruLess
+{
+        const std::vector<unsigned int> *used;
+        bool operator()( unsigned int a, unsigned int b ) const
+        {
+                return (*used)[a] < (*used)[b];
+        }
+};
+
+/*
+ * Least recently used first, and never anything the current frame needs.
+ * If that isn't enough the budget is simply overrun until the view moves.
+ */
+void ChunkStream::evict()
+{
+        unsigned int total = m_Count * CHUNK_LODS;
+
+        if (m_VramBytes > m_VramBudget) {
+                std::vector<unsigned int> victims, used( total );
+                for (unsigned int e = 0; e < total; e++) {
+                        used[e] = m_Entries[e].gpuUsed;
+                        if (m_Entries[e].vertices.Valid() && m_Entries[e].gpuUsed != m_Frame)
+                                victims.push_back( e );
+                }
+                LruLess less = { &used };
+                std::sort( victims.begin(), victims.end(), less );
+
+                for (unsigned int v = 0; v < victims.size() && m_VramBytes > m_VramBudget; v++) {
+                        Entry &e = m_Entries[victims[v]];
+                        m_VramBytes -= e.vertices.Bytes() + e.indices.Bytes();
+                        e.vertices.Reset();
+                        e.indices.Reset();
+                        m_GpuVersion++;
+                }
+        }
+
+        if (m_RamBytes > m_RamBudget) {
+                std::vector<unsigned int> victims, used( total );
+                for (unsigned int e = 0; e < total; e++) {
+                        used[e] = m_Entries[e].ramUsed;
+                        if (m_Entries[e].state == LevelLoaded && m_Entries[e].ramUsed != m_Frame)
+                                victims.push_back( e );
+                }
+                LruLess less = { &used };
+                std::sort( victims.begin(), victims.end(), less );
+
+                for (unsigned int v = 0; v < victims.size() && m_RamBytes > m_RamBudget; v++)
+                        drop( victims[v] );
+        }
+}
+
+struct ChunkDistance
+{
+        float distance;
+        unsigned int entry;
+        bool visible;
+
+        bool operator<( const ChunkDistance &other ) const
+        {
+                // Visible ones first, then nearest first
+                if (visible != other.visible)
+                        return visible;
+                return distance < other.distance;
+        }
+};
+
+void ChunkStream::Update( const CullView &view )
+{
+        m_Frame++;
+        m_DrawList.clear();
+        m_Visible = 0;
+        memset( m_Drawn, 0, sizeof(m_Drawn) );
+        if (m_Count == 0 || !view.valid)
+                return;
+
+        // What finished paging in since last frame counts against the budget
+        m_RamBytes = 0;
+        for (unsigned int e = 0; e < m_Count * CHUNK_LODS; e++) {
+                if (m_Entries[e].state == LevelLoaded)
+                        m_RamBytes += levelBytes( e );
+        }
+
+        // Chunks in view, and chunks about one chunk outside it (to have
+        // them ready when the view turns), at the level their size wants
+        std::vector<ChunkDistance> wanted;
+        for (unsigned int c = 0; c < m_Count; c++) {
+                const ChunkInfo &chunk = m_Chunks[c];
+                bool inside = true, near = true;
+                for (unsigned int p = 0; p < 6; p++) {
+                        const float *pl = view.planes[p];
+                        float d = pl[0] * chunk.center[0] + pl[1] * chunk.center[1]
+                                + pl[2] * chunk.center[2] + pl[3];
+                        if (d < -chunk.radius)
+                                inside = false;
+                        if (d < -2.0f * chunk.radius)
+                                near = false;
+                }
+                if (!near)
+                        continue;
+
+                float distance = 0.0f;
+                unsigned int lod = 0;
+                if (!view.orthographic) {
+                        for (unsigned int k = 0; k < 3; k++) {
+                                float e = chunk.center[k] - view.eye[k];
+                                distance += e * e;
+                        }
+                        distance = sqrtf( distance );
+                        float gap = distance - chunk.radius;
+                        float size = (gap > 0.0f) ? chunk.radius / gap : HUGE_VALF;
+                        while (lod < CHUNK_LODS - 1 && size < LOD_SIZE[lod])
+                                lod++;
+                }
+
+                ChunkDistance want = { distance, c * CHUNK_LODS + lod, inside };
+                wanted.push_back( want );
+                if (inside)
+                        m_Visible++;
+        }
+        std::sort( wanted.begin(), wanted.end() );
+
+        std::vector<PrefetchJob> jobs;
+        long uploaded = 0;
+        for (unsigned int w = 0; w < wanted.size(); w++) {
+                unsigned int entry = wanted[w].entry;
+                Entry &e = m_Entries[entry];
+
+                if (!e.vertices.Valid()) {
+                        int state = e.state;
+                        e.ramUsed = m_Frame;
+                        if (state == LevelCold || state == LevelQueued) {
+                                const ChunkLevel &level = m_Chunks[entry / CHUNK_LODS].levels[entry % CHUNK_LODS];
+                                PrefetchJob job = { levelData( entry ), levelBytes( entry ),
+                                                    level.vertexCount, level.indexCount, &e.state };
+                                jobs.push_back( job );
+                        } else if (state == LevelLoaded && wanted[w].visible
+                                   && uploaded < CHUNK_UPLOAD_BYTES) {
+                                upload( entry );
+                                uploaded += levelBytes( entry );
+                        }
+                }
+                if (!wanted[w].visible)
+                        continue;
+
+                // Not there yet: draw whatever other level of it is
+                unsigned int chunk = entry / CHUNK_LODS;
+                if (!e.vertices.Valid()) {
+                        for (unsigned int lod = 0; lod < CHUNK_LODS; lod++) {
+                                if (m_Entries[chunk * CHUNK_LODS + lod].vertices.Valid()) {
+                                        entry = chunk * CHUNK_LODS + lod;
+                                        break;
+                                }
+                        }
+                }
+                if (m_Entries[entry].vertices.Valid()) {
+                        m_Entries[entry].gpuUsed = m_Frame;
+                        m_DrawList.push_back( entry );
+                        m_Drawn[entry % CHUNK_LODS]++;
+                }
+        }
+
+        m_Prefetcher->Replace( jobs );
+        m_Waiting = jobs.size();
+        evict();
+}
+
+void ChunkStream::Draw( bool tangents ) const
+{
+        if (m_DrawList.empty())
+                return;
+
+        glEnableClientState( GL_VERTEX_ARRAY );
+        glEnableClientState( GL_NORMAL_ARRAY );
+        glEnableClientState( GL_TEXTURE_COORD_ARRAY );
+        if (tangents)
+                glEnableVertexAttribArray( TANGENT_ATTRIB );
+
+        GLsizei stride = sizeof(MeshVertex);
+        for (unsigned int d = 0; d < m_DrawList.size(); d++) {
+                const Entry &e = m_Entries[m_DrawList[d]];
+                glBindBuffer( GL_ARRAY_BUFFER, e.vertices.Name() );
+                glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, e.indices.Name() );
+                glNormalPointer( GL_FLOAT, stride, (const GLvoid *) offsetof(MeshVertex, normal) );
+                glTexCoordPointer( 2, GL_FLOAT, stride, (const GLvoid *) offsetof(MeshVertex, texCoord) );
+                glVertexPointer( 3, GL_FLOAT, stride, (const GLvoid *) offsetof(MeshVertex, pos) );
+                if (tangents)
+                        glVertexAttribPointer( TANGENT_ATTRIB, 4, GL_INT_2_10_10_10_REV, GL_TRUE,
+                                               stride, (const GLvoid *) offsetof(MeshVertex, tangent) );
+                glDrawElements( GL_TRIANGLES, e.indices.Bytes() / sizeof(GLuint), GL_UNSIGNED_INT, NULL );
+        }
+
+        glBindBuffer( GL_ARRAY_BUFFER, 0 );
+        glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
+        glDisableClientState( GL_VERTEX_ARRAY );
+        glDisableClientState( GL_NORMAL_ARRAY );
+        glDisableClientState( GL_TEXTURE_COORD_ARRAY );
+        if (tangents)
+                glDisableVertexAttribArray( TANGENT_ATTRIB );
+}
+
+void ChunkStream::DrawPositions() const
+{
+        if (m_VramBytes == 0)
+                return;
+
+        glEnableClientState( GL_VERTEX_ARRAY );
+        for (unsigned int chunk = 0; chunk < m_Count; chunk++) {
+                unsigned int lod = 0;
+                while (lod < CHUNK_LODS && !m_Entries[chunk * CHUNK_LODS + lod].vertices.Valid())
+                        lod++;
+                if (lod == CHUNK_LODS)
+                        continue;
+
+                const Entry &e = m_Entries[chunk * CHUNK_LODS + lod];
+                glBindBuffer( GL_ARRAY_BUFFER, e.vertices.Name() );
+                glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, e.indices.Name() );
+                glVertexPointer( 3, GL_FLOAT, sizeof(MeshVertex), (const GLvoid *) offsetof(MeshVertex, pos) );
+                glDrawElements( GL_TRIANGLES, e.indices.Bytes() / sizeof(GLuint), GL_UNSIGNED_INT, NULL );
+        }
+
+        glBindBuffer( GL_ARRAY_BUFFER, 0 );
+        glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
+        glDisableClientState( GL_VERTEX_ARRAY );
+}
+
+void ChunkStream::Reset()
+{
+        for (unsigned int e = 0; e < m_Count * CHUNK_LODS; e++) {
+                m_Entries[e].vertices.Reset();
+                m_Entries[e].indices.Reset();
+        }
+        m_VramBytes = 0;
+        m_DrawList.clear();
+        m_GpuVersion++;
+}
+
+unsigned int ChunkStream::GpuVersion() const
+{
+        return m_GpuVersion;
+}
+
+unsigned int ChunkStream::Visible() const
+{
+        return m_Visible;
+}
+
+unsigned int ChunkStream::Drawn( unsigned int lod ) const
+{
+        return lod < CHUNK_LODS ? m_Drawn[lod] : 0;
+}
+
+unsigned int ChunkStream::Waiting() const
+{
+        return m_Waiting;
+}
+
+long ChunkStream::RamBytes() const
+{
+        return m_RamBytes;
+}
+
+long ChunkStream::VramBytes() const
+{
+        return m_VramBytes;
+}
+
+long ChunkStream::RamBudget() const
+{
+        return m_RamBudget;
+}
+
+long ChunkStream::VramBudget() const
+{
+        return m_VramBudget;
+}
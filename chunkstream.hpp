@@ -0,0 +1,165 @@
+/*
+ * Filename: chunkstream.hpp
+ *
+ * Out-of-core drawing (--out-of-core) for models too big to keep in RAM
+ * or on the GPU all at once.
+ *
+ * The processed meshes are cut up once into spatial chunks (meshlets
+ * grouped by a median split on the longest axis until each group is at
+ * most CHUNK_TRIANGLES) and written next to the model as
+ * "<model>.chunks", with CHUNK_LODS levels of detail per chunk (the full
+ * chunk, then coarser vertex-clustered copies). Each level sits on its
+ * own CHUNK_ALIGN boundary so it can be paged in and out by itself.
+ *
+ * Viewing maps that file instead of loading anything. Every frame the
+ * chunks are culled against the view and each visible one picks a level
+ * by how big it is on screen. Levels that aren't in RAM are queued for a
+ * background prefetcher that pages them in (as are chunks just outside
+ * the view, so turning doesn't stall), then a few are uploaded per frame
+ * straight from the mapping. Until a level is on the GPU, whatever
+ * other level of that chunk is there gets drawn.
+ *
+ * RAM (paged in levels) and VRAM (uploaded levels) each have a fixed
+ * budget. Anything over it that the current frame doesn't need goes,
+ * least recently used first: GPU copies are deleted, RAM copies are given
+ * back to the kernel (the file can always be read again).
+ */
+
+#ifndef _CHUNKSTREAM_H
+#define _CHUNKSTREAM_H
+
+#include "mesh.hpp"
+#include "meshnormals.hpp"
+#include "culling.hpp"
+#include "gl.hpp"
+#include "gpuresource.hpp"
+
+#include <QFile>
+#include <QAtomicInt>
+
+#include <string>
+#include <vector>
+
+// Most triangles in a chunk, levels per chunk, and where levels start
+const unsigned int CHUNK_TRIANGLES = 32768;
+const unsigned int CHUNK_LODS = 3;
+const unsigned int CHUNK_ALIGN = 65536;
+
+// Default budgets (--ooc-ram=<MiB>, --ooc-vram=<MiB>)
+const long CHUNK_RAM_BUDGET = 512L << 20;
+const long CHUNK_VRAM_BUDGET = 256L << 20;
+
+/*
+ * On disk: the header, the chunk table, then the levels. Each level is
+ * vertexCount MeshVertex followed by indexCount unsigned ints (local to
+ * the level's vertices).
+ */
+struct ChunkLevel
+{
+        long long offset;
+        unsigned int vertexCount, indexCount;
+};
+
+struct ChunkInfo
+{
+        float boundsMin[3], boundsMax[3];
+        float center[3], radius;
+        ChunkLevel levels[CHUNK_LODS];
+};
+
+// Where the chunk file for a given model lives
+std::string ChunkFilePath( const std::string &modelPath );
+
+// Cut meshes up into chunks and write them out, noting how they were
+// processed (as the mesh cache does, see meshcache.hpp). Returns false if
+// the file couldn't be written.
+bool WriteChunkFile( const std::string &modelPath, const std::vector<Mesh> &meshes,
+                     bool mergeCoplanar = false, float smoothAngle = SMOOTH_ANGLE );
+
+class ChunkPrefetcher;
+
+class ChunkStream
+{
+public:
+        ChunkStream();
+
+        // Needs the GL context current if anything was uploaded
+        ~ChunkStream();
+
+        // Map the model's chunk file. False if there isn't a usable one
+        // (including one whose meshes were processed differently).
+        bool Open( const std::string &modelPath, bool mergeCoplanar = false,
+                   float smoothAngle = SMOOTH_ANGLE );
+        void SetBudgets( long ramBytes, long vramBytes );
+
+        // Whole model
+        void GetBounds( float min[3], float max[3] ) const;
+        unsigned int Triangles() const;
+        unsigned int Count() const;
+
+        // Once a frame, on the GL thread: pick the chunks and levels for
+        // this view, queue prefetches, upload what's arrived and evict
+        // what's over budget
+        void Update( const CullView &view );
+
+        // Draw what Update() picked (float MeshVertex layout, with the
+        // packed tangents if GL can source them)
+        void Draw( bool tangents ) const;
+
+        // Positions only for depth-only passes (shadow maps): every chunk
+        // on the GPU, in the finest level there, not just the ones in
+        // the camera's view. GpuVersion() changes whenever that set does.
+        void DrawPositions() const;
+        unsigned int GpuVersion() const;
+
+        // Drop every GPU copy (e.g. before the context goes away)
+        void Reset();
+
+        // Last Update(): chunks in view, levels drawn at each LOD, and
+        // levels waiting on the prefetcher
+        unsigned int Visible() const;
+        unsigned int Drawn( unsigned int lod ) const;
+        unsigned int Waiting() const;
+
+        long RamBytes() const;
+        long VramBytes() const;
+        long RamBudget() const;
+        long VramBudget() const;
+
+private:
+        // One level of one chunk
+        struct Entry
+        {
+                QAtomicInt state;           // paged in yet? (chunkstream.cpp)
+                GLBuffer vertices, indices;
+                unsigned int ramUsed;       // frame it was last needed in
+                unsigned int gpuUsed;       // frame it was last drawn in
+        };
+
+        ChunkStream( const ChunkStream & );
+        ChunkStream &operator=( const ChunkStream & );
+
+        const uchar *levelData( unsigned int entry ) const;
+        long levelBytes( unsigned int entry ) const;
+        void upload( unsigned int entry );
+        void drop( unsigned int entry );
+        void evict();
+
+        QFile m_File;
+        uchar *m_Map;
+        const ChunkInfo *m_Chunks;
+        unsigned int m_Count, m_Triangles;
+        float m_BoundsMin[3], m_BoundsMax[3];
+
+        Entry *m_Entries;                   // m_Count * CHUNK_LODS
+        ChunkPrefetcher *m_Prefetcher;
+
+        std::vector<unsigned int> m_DrawList;
+        unsigned int m_Frame;
+        unsigned int m_GpuVersion;          // bumped on upload and eviction
+        unsigned int m_Visible, m_Drawn[CHUNK_LODS], m_Waiting;
+        long m_RamBytes, m_VramBytes;
+        long m_RamBudget, m_VramBudget;
+};
+
+#endif    // _CHUNKSTREAM_H
@@ -0,0 +1,281 @@
+/*
+ * Filename: culling.cpp
+ *
+ * Frustum plane extraction (Gribb & Hartmann, "Fast Extraction of Viewing
+ * Frustum Planes from the World-View-Projection Matrix") and the SSE
+ * meshlet tests.
+ */
+
+#include "culling.hpp"
+
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Column-major element access, like GL stores them
+#define M(m, row, col) (m)[(col) * 4 + (row)]
+
+CullView MakeCullView( const float modelview[16], const float projection[16],
+                       bool orthographic )
+{
+        CullView view;
+        view.orthographic = orthographic;
+
+        // An x or y flip in the projection turns the triangles' winding
+        // around on screen, and GL_CULL_FACE then keeps the "back" faces
+        view.coneTest = (M(projection, 0, 0) * M(projection, 1, 1) > 0.0f);
+
+        // mvp = projection * modelview
+        float mvp[16];
+        for (unsigned int r = 0; r < 4; r++) {
+                for (unsigned int c = 0; c < 4; c++) {
+                        float sum = 0.0f;
+                        for (unsigned int k = 0; k < 4; k++)
+                                sum += M(projection, r, k) * M(modelview, k, c);
+                        M(mvp, r, c) = sum;
+                }
+        }
+
+        // Planes are row 3 +/- rows 0, 1 and 2
+        for (unsigned int i = 0; i < 3; i++) {
+                for (unsigned int c = 0; c < 4; c++) {
+                        view.planes[i * 2][c]     = M(mvp, 3, c) + M(mvp, i, c);
+                        view.planes[i * 2 + 1][c] = M(mvp, 3, c) - M(mvp, i, c);
+                }
+        }
+
+        // Normalize so the plane distance is in model units (needed to
+        // compare against sphere radii)
+        for (unsigned int i = 0; i < 6; i++) {
+                float *p = view.planes[i];
+                float length = sqrtf( p[0] * p[0] + p[1] * p[1] + p[2] * p[2] );
+                if (length > 0.0f) {
+                        for (unsigned int c = 0; c < 4; c++)
+                                p[c] /= length;
+                }
+        }
+
+        /*
+         * Invert the upper 3x3 of the modelview (it has our rotation and
+         * scale in it) to take the eye and view direction to model space.
+         */
+        float a = M(modelview, 0, 0), b = M(modelview, 0, 1), c = M(modelview, 0, 2);
+        float d = M(modelview, 1, 0), e = M(modelview, 1, 1), f = M(modelview, 1, 2);
+        float g = M(modelview, 2, 0), h = M(modelview, 2, 1), i = M(modelview, 2, 2);
+
+        float det = a * (e * i - f * h) - b * (d * i - f * g) + c * (d * h - e * g);
+        view.valid = fabsf( det ) > 1e-12f;
+        if (!view.valid)
+                return view;
+
+        float inv[3][3] = {
+                { (e * i - f * h) / det, (c * h - b * i) / det, (b * f - c * e) / det },
+                { (f * g - d * i) / det, (a * i - c * g) / det, (c * d - a * f) / det },
+                { (d * h - e * g) / det, (b * g - a * h) / det, (a * e - b * d) / det }
+        };
+
+        float t[3] = { M(modelview, 0, 3), M(modelview, 1, 3), M(modelview, 2, 3) };
+        for (unsigned int r = 0; r < 3; r++) {
+                view.eye[r] = -(inv[r][0] * t[0] + inv[r][1] * t[1] + inv[r][2] * t[2]);
+                view.viewDir[r] = -inv[r][2];       // eye space -Z
+        }
+
+        float length = sqrtf( view.viewDir[0] * view.viewDir[0]
+                            + view.viewDir[1] * view.viewDir[1]
+                            + view.viewDir[2] * view.viewDir[2] );
+        for (unsigned int r = 0; r < 3; r++)
+                view.viewDir[r] /= length;
+
+        return view;
+}
+
+#undef M
+
+MeshletBounds::MeshletBounds()
+{
+        m_Size = 0;
+}
+
+void MeshletBounds::Clear()
+{
+        m_X.clear();     m_Y.clear();     m_Z.clear();     m_Radius.clear();
+        m_AxisX.clear(); m_AxisY.clear(); m_AxisZ.clear(); m_Cutoff.clear();
+        m_First.clear(); m_Count.clear(); m_Mesh.clear();
+        m_Size = 0;
+}
+
+unsigned int MeshletBounds::Size() const
+{
+        return m_Size;
+}
+
+void MeshletBounds::Add( const Mesh &mesh, unsigned int baseIndex,
+                         unsigned int meshId )
+{
+        // Drop the padding from the last Add(), we'll redo it at the end
+        m_X.resize( m_Size );     m_Y.resize( m_Size );
+        m_Z.resize( m_Size );     m_Radius.resize( m_Size );
+        m_AxisX.resize( m_Size ); m_AxisY.resize( m_Size );
+        m_AxisZ.resize( m_Size ); m_Cutoff.resize( m_Size );
+        m_First.resize( m_Size ); m_Count.resize( m_Size );
+        m_Mesh.resize( m_Size );
+
+        for (unsigned int i = 0; i < mesh.meshlets.size(); i++) {
+                const Meshlet &m = mesh.meshlets[i];
+                m_X.push_back( m.center[0] );
+                m_Y.push_back( m.center[1] );
+                m_Z.push_back( m.center[2] );
+                m_Radius.push_back( m.radius );
+                m_AxisX.push_back( m.coneAxis[0] );
+                m_AxisY.push_back( m.coneAxis[1] );
+                m_AxisZ.push_back( m.coneAxis[2] );
+                m_Cutoff.push_back( m.coneCutoff );
+                m_First.push_back( baseIndex + m.firstIndex );
+                m_Count.push_back( m.indexCount );
+                m_Mesh.push_back( meshId );
+        }
+        m_Size = m_X.size();
+
+        unsigned int padded = (m_Size + 3) & ~3u;
+        m_X.resize( padded, 0.0f );     m_Y.resize( padded, 0.0f );
+        m_Z.resize( padded, 0.0f );     m_Radius.resize( padded, 0.0f );
+        m_AxisX.resize( padded, 0.0f ); m_AxisY.resize( padded, 0.0f );
+        m_AxisZ.resize( padded, 0.0f ); m_Cutoff.resize( padded, 1.0f );
+        m_First.resize( padded, 0 );    m_Count.resize( padded, 0 );
+        m_Mesh.resize( padded, meshId );
+}
+
+void MeshletBounds::Append( unsigned int first, unsigned int count,
+                            DrawRanges &out ) const
+{
+        out.clustersVisible++;
+
+        // Glue onto the previous range if they touch
+        if (!out.firstIndex.empty()
+            && out.firstIndex.back() + out.indexCount.back() == first) {
+                out.indexCount.back() += count;
+                return;
+        }
+        out.firstIndex.push_back( first );
+        out.indexCount.push_back( count );
+}
+
+void MeshletBounds::Cull( const CullView &view, DrawRanges &out,
+                          const std::vector<char> *meshVisible ) const
+{
+        out.firstIndex.clear();
+        out.indexCount.clear();
+        out.clustersTested = m_Size;
+        out.clustersVisible = 0;
+
+        // A singular modelview (scale of 0) has nothing sensible to test
+        if (!view.valid) {
+                for (unsigned int i = 0; i < m_Size; i++) {
+                        if (!meshVisible || (*meshVisible)[m_Mesh[i]])
+                                Append( m_First[i], m_Count[i], out );
+                }
+                return;
+        }
+
+#ifdef __SSE2__
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 eyeX = _mm_set1_ps( view.eye[0] );
+        const __m128 eyeY = _mm_set1_ps( view.eye[1] );
+        const __m128 eyeZ = _mm_set1_ps( view.eye[2] );
+        const __m128 dirX = _mm_set1_ps( view.viewDir[0] );
+        const __m128 dirY = _mm_set1_ps( view.viewDir[1] );
+        const __m128 dirZ = _mm_set1_ps( view.viewDir[2] );
+
+        for (unsigned int i = 0; i < m_Size; i += 4) {
+                __m128 x = _mm_loadu_ps( &m_X[i] );
+                __m128 y = _mm_loadu_ps( &m_Y[i] );
+                __m128 z = _mm_loadu_ps( &m_Z[i] );
+                __m128 r = _mm_loadu_ps( &m_Radius[i] );
+                __m128 negR = _mm_sub_ps( zero, r );
+
+                // Inside (or touching) all six planes
+                __m128 visible = _mm_castsi128_ps( _mm_set1_epi32( -1 ) );
+                for (unsigned int p = 0; p < 6; p++) {
+                        __m128 d = _mm_add_ps(
+                                _mm_add_ps( _mm_mul_ps( x, _mm_set1_ps( view.planes[p][0] ) ),
+                                            _mm_mul_ps( y, _mm_set1_ps( view.planes[p][1] ) ) ),
+                                _mm_add_ps( _mm_mul_ps( z, _mm_set1_ps( view.planes[p][2] ) ),
+                                            _mm_set1_ps( view.planes[p][3] ) ) );
+                        visible = _mm_and_ps( visible, _mm_cmpge_ps( d, negR ) );
+                }
+
+                __m128 ax = _mm_loadu_ps( &m_AxisX[i] );
+                __m128 ay = _mm_loadu_ps( &m_AxisY[i] );
+                __m128 az = _mm_loadu_ps( &m_AxisZ[i] );
+                __m128 cutoff = _mm_loadu_ps( &m_Cutoff[i] );
+                __m128 backFacing;
+
+                if (!view.coneTest) {
+                        backFacing = zero;
+                } else if (view.orthographic) {
+                        // dot(viewDir, axis) >= cutoff
+                        __m128 dp = _mm_add_ps( _mm_add_ps( _mm_mul_ps( dirX, ax ),
+                                                            _mm_mul_ps( dirY, ay ) ),
+                                                _mm_mul_ps( dirZ, az ) );
+                        backFacing = _mm_cmpge_ps( dp, cutoff );
+                } else {
+                        // dot(center - eye, axis) >= cutoff * |center - eye| + radius
+                        __m128 dx = _mm_sub_ps( x, eyeX );
+                        __m128 dy = _mm_sub_ps( y, eyeY );
+                        __m128 dz = _mm_sub_ps( z, eyeZ );
+                        __m128 dp = _mm_add_ps( _mm_add_ps( _mm_mul_ps( dx, ax ),
+                                                            _mm_mul_ps( dy, ay ) ),
+                                                _mm_mul_ps( dz, az ) );
+                        __m128 length = _mm_sqrt_ps(
+                                _mm_add_ps( _mm_add_ps( _mm_mul_ps( dx, dx ),
+                                                        _mm_mul_ps( dy, dy ) ),
+                                            _mm_mul_ps( dz, dz ) ) );
+                        backFacing = _mm_cmpge_ps( dp, _mm_add_ps( _mm_mul_ps( cutoff, length ), r ) );
+                }
+                visible = _mm_andnot_ps( backFacing, visible );
+
+                int mask = _mm_movemask_ps( visible );
+                for (unsigned int k = 0; k < 4; k++) {
+                        if (!(mask & (1 << k)) || m_Count[i + k] == 0)
+                                continue;
+                        if (meshVisible && !(*meshVisible)[m_Mesh[i + k]])
+                                continue;
+                        Append( m_First[i + k], m_Count[i + k], out );
+                }
+        }
+#else
+        for (unsigned int i = 0; i < m_Size; i++) {
+                if (meshVisible && !(*meshVisible)[m_Mesh[i]])
+                        continue;
+
+                bool visible = true;
+                for (unsigned int p = 0; p < 6 && visible; p++) {
+                        const float *pl = view.planes[p];
+                        float d = pl[0] * m_X[i] + pl[1] * m_Y[i] + pl[2] * m_Z[i] + pl[3];
+                        visible = (d >= -m_Radius[i]);
+                }
+                if (!visible)
+                        continue;
+
+                if (!view.coneTest) {
+                        // keep it
+                } else if (view.orthographic) {
+                        float dp = view.viewDir[0] * m_AxisX[i] + view.viewDir[1] * m_AxisY[i]
+                                 + view.viewDir[2] * m_AxisZ[i];
+                        if (dp >= m_Cutoff[i])
+                                continue;
+                } else {
+                        float dx = m_X[i] - view.eye[0];
+                        float dy = m_Y[i] - view.eye[1];
+                        float dz = m_Z[i] - view.eye[2];
+                        float dp = dx * m_AxisX[i] + dy * m_AxisY[i] + dz * m_AxisZ[i];
+                        float length = sqrtf( dx * dx + dy * dy + dz * dz );
+                        if (dp >= m_Cutoff[i] * length + m_Radius[i])
+                                continue;
+                }
+                Append( m_First[i], m_Count[i], out );
+        }
+#endif
+}
@@ -0,0 +1,95 @@
+/*
+ * Filename: culling.hpp
+ *
+ * CPU visibility tests for meshlets (see meshlet.hpp). The bounds of every
+ * meshlet in the model are kept as a structure of arrays so four of them
+ * can be tested at once with SSE.
+ *
+ * All of the tests happen in MODEL space: the frustum planes are pulled
+ * out of projection * modelview, and the eye is the modelview's inverse
+ * applied to the origin. That way none of the bounds ever get transformed.
+ */
+
+#ifndef _CULLING_H
+#define _CULLING_H
+
+#include "mesh.hpp"
+
+#include <vector>
+
+/*
+ * What the camera looks like from model space. For orthographic views the
+ * eye is "at infinity", so back facing clusters are found with viewDir.
+ */
+struct CullView
+{
+        float planes[6][4];        // ax + by + cz + d >= 0 means inside
+        float eye[3];
+        float viewDir[3];
+        bool orthographic;
+        bool valid;                // false if the modelview can't be inverted
+        bool coneTest;             // false if the projection mirrors the image
+                                   // (winding flips, so "back" isn't back)
+};
+
+// Build a CullView from the column-major GL matrices
+CullView MakeCullView( const float modelview[16], const float projection[16],
+                       bool orthographic );
+
+/*
+ * One meshlet as the GPU culling stage reads it (see gpucull.hpp), laid
+ * out for a std430 array: the sphere, the normal cone and where its
+ * triangles sit in the model's index buffer.
+ */
+struct GpuCullObject
+{
+        float center[3], radius;
+        float coneAxis[3], coneCutoff;
+        unsigned int firstIndex, indexCount;
+        unsigned int pad[2];
+};
+
+/*
+ * Index ranges that survived culling. Neighbors that are back to back in
+ * the index buffer are merged so there are as few draws as possible.
+ */
+struct DrawRanges
+{
+        std::vector<unsigned int> firstIndex;
+        std::vector<unsigned int> indexCount;
+
+        unsigned int clustersTested;
+        unsigned int clustersVisible;
+};
+
+class MeshletBounds
+{
+public:
+        MeshletBounds();
+
+        // Append one mesh's meshlets; baseIndex is where the mesh's indices
+        // start in the shared index buffer, meshId is its position in
+        // the model (used by the meshVisible mask below)
+        void Add( const Mesh &mesh, unsigned int baseIndex, unsigned int meshId );
+        void Clear();
+
+        unsigned int Size() const;
+
+        // Frustum + normal cone test of every meshlet, results in out.
+        // If meshVisible is given, meshlets of meshes with a 0 entry in it
+        // are skipped (e.g. meshes found to be occluded).
+        void Cull( const CullView &view, DrawRanges &out,
+                   const std::vector<char> *meshVisible = 0 ) const;
+
+private:
+        void Append( unsigned int first, unsigned int count, DrawRanges &out ) const;
+
+        // One entry per meshlet, padded to a multiple of 4 (the padding
+        // has indexCount 0 and is skipped)
+        std::vector<float> m_X, m_Y, m_Z, m_Radius;
+        std::vector<float> m_AxisX, m_AxisY, m_AxisZ, m_Cutoff;
+        std::vector<unsigned int> m_First, m_Count, m_Mesh;
+        unsigned int m_Size;
+};
+
+#endif    // _CULLING_H
@@ -0,0 +1,315 @@
+/*
+ * Filename: debugviews.cpp
+ *
+ * The wireframe, normal and bounding box overlays (see debugviews.hpp).
+ */
+
+#include "debugviews.hpp"
+#include "gl.hpp"
+
+#include <iostream>
+
+// Width of every overlay line, in pixels
+static const float LINE_WIDTH = 2.0f;
+
+static const GLfloat wireColor[4] = { 0.2f, 1.0f, 0.4f, 0.9f };
+static const GLfloat normalColor[4] = { 0.3f, 0.6f, 1.0f, 1.0f };
+static const GLfloat boxColor[4] = { 1.0f, 0.85f, 0.2f, 1.0f };
+
+/*
+ * ftransform() so the overlay lands on exactly the depths the model was
+ * drawn at (fixed function or the lighting shader, which uses it too),
+ * and the clip-space end of the normal for the geometry shader
+ */
+static const char *vertexSource =
+        "uniform float normalLength;\n"
+        "out vec4 tip;\n"
+        "void main()\n"
+        "{\n"
+        "        vec4 eye = gl_ModelViewMatrix * gl_Vertex;\n"
+        "        vec3 normal = normalize( gl_NormalMatrix * gl_Normal );\n"
+        "        tip = gl_ProjectionMatrix * vec4( eye.xyz / eye.w + normal * normalLength, 1.0 );\n"
+        "        gl_Position = ftransform();\n"
+        "}\n";
+
+/*
+ * The triangle, each corner carrying its window-space height over the
+ * opposite edge (interpolated without perspective that's the distance
+ * to every edge), then a LINE_WIDTH wide quad along each corner's
+ * normal. Triangles reaching behind the eye get no edges.
+ */
+static const char *geometrySource =
+        "layout(triangles) in;\n"
+        "layout(triangle_strip, max_vertices = 15) out;\n"
+        "in vec4 tip[];\n"
+        "uniform vec2 viewportSize;\n"
+        "uniform bool wireframe;\n"
+        "uniform bool normals;\n"
+        "noperspective out vec3 edgeDistance;\n"
+        "flat out int isNormal;\n"
+        "vec2 window( vec4 clip )\n"
+        "{\n"
+        "        return clip.xy / clip.w * 0.5 * viewportSize;\n"
+        "}\n"
+        "void main()\n"
+        "{\n"
+        "        if (wireframe) {\n"
+        "                vec3 height = vec3( 1.0e6 );\n"
+        "                if (gl_in[0].gl_Position.w > 0.0 && gl_in[1].gl_Position.w > 0.0\n"
+        "                    && gl_in[2].gl_Position.w > 0.0) {\n"
+        "                        vec2 p0 = window( gl_in[0].gl_Position );\n"
+        "                        vec2 p1 = window( gl_in[1].gl_Position );\n"
+        "                        vec2 p2 = window( gl_in[2].gl_Position );\n"
+        "                        vec2 a = p1 - p0, b = p2 - p0;\n"
+        "                        float area = abs( a.x * b.y - a.y * b.x );\n"
+        "                        height = area / max( vec3( length( p2 - p1 ), length( b ), length( a ) ),\n"
+        "                                             vec3( 1.0e-6 ) );\n"
+        "                }\n"
+        "                for (int i = 0; i < 3; i++) {\n"
+        "                        gl_Position = gl_in[i].gl_Position;\n"
+        "                        edgeDistance = vec3( 0.0 );\n"
+        "                        edgeDistance[i] = height[i];\n"
+        "                        isNormal = 0;\n"
+        "                        EmitVertex();\n"
+        "                }\n"
+        "                EndPrimitive();\n"
+        "        }\n"
+        "        if (!normals)\n"
+        "                return;\n"
+        "        for (int i = 0; i < 3; i++) {\n"
+        "                vec4 from = gl_in[i].gl_Position, to = tip[i];\n"
+        "                if (from.w <= 0.0 || to.w <= 0.0)\n"
+        "                        continue;\n"
+        "                vec2 along = window( to ) - window( from );\n"
+        "                if (dot( along, along ) < 1.0e-6)\n"
+        "                        continue;                       // pointing at us\n"
+        "                vec2 side = normalize( vec2( -along.y, along.x ) ) * LINE_WIDTH / viewportSize;\n"
+        "                for (int corner = 0; corner < 4; corner++) {\n"
+        "                        vec4 end = (corner < 2) ? from : to;\n"
+        "                        float flip = (corner & 1) != 0 ? -1.0 : 1.0;\n"
+        "                        gl_Position = end + vec4( side * flip * end.w, 0.0, 0.0 );\n"
+        "                        edgeDistance = vec3( 0.0 );\n"
+        "                        isNormal = 1;\n"
+        "                        EmitVertex();\n"
+        "                }\n"
+        "                EndPrimitive();\n"
+        "        }\n"
+        "}\n";
+
+/*
+ * Front faces only (culling is off so the normal quads always show) and
+ * only near an edge, with a one pixel falloff for the antialiasing
+ */
+static const char *fragmentSource =
+        "noperspective in vec3 edgeDistance;\n"
+        "flat in int isNormal;\n"
+        "void main()\n"
+        "{\n"
+        "        if (isNormal != 0) {\n"
+        "                gl_FragColor = NORMAL_COLOR;\n"
+        "                return;\n"
+        "        }\n"
+        "        if (!gl_FrontFacing)\n"
+        "                discard;\n"
+        "        float d = min( edgeDistance.x, min( edgeDistance.y, edgeDistance.z ) );\n"
+        "        float coverage = clamp( LINE_WIDTH * 0.5 + 0.5 - d, 0.0, 1.0 );\n"
+        "        if (coverage <= 0.0)\n"
+        "                discard;\n"
+        "        gl_FragColor = vec4( WIRE_COLOR.rgb, WIRE_COLOR.a * coverage );\n"
+        "}\n";
+
+/*
+ * A color as GLSL source. QByteArray::number() always writes a '.', where
+ * printf's %f follows the locale (and gives "0,2" in much of Europe).
+ */
+static QByteArray glslColor( const GLfloat color[4] )
+{
+        QByteArray source = "vec4( ";
+        for (int k = 0; k < 4; k++)
+                source += QByteArray::number( color[k], 'f', 3 ) + (k < 3 ? ", " : " )");
+        return source;
+}
+
+/*
+ * Compile one stage, printing the log if it doesn't. Returns 0 on failure.
+ */
+static GLuint compileShader( GLenum type, const char *body )
+{
+        QByteArray header = "#version 150 compatibility\n"
+                            "#define LINE_WIDTH " + QByteArray::number( LINE_WIDTH, 'f', 1 ) + "\n"
+                            "#define WIRE_COLOR " + glslColor( wireColor ) + "\n"
+                            "#define NORMAL_COLOR " + glslColor( normalColor ) + "\n";
+        const char *sources[2] = { header.constData(), body };
+
+        GLuint shader = glCreateShader( type );
+        glShaderSource( shader, 2, sources, NULL );
+        glCompileShader( shader );
+
+        GLint ok = GL_FALSE;
+        glGetShaderiv( shader, GL_COMPILE_STATUS, &ok );
+        if (!ok) {
+                char log[1024];
+                glGetShaderInfoLog( shader, sizeof(log), NULL, log );
+                std::cerr << "WARNING: debug view shader didn't compile:\n" << log << std::endl;
+                glDeleteShader( shader );
+                return 0;
+        }
+        return shader;
+}
+
+DebugViews::DebugViews()
+{
+        m_Program = 0;
+        m_ViewportLocation = m_WireframeLocation = m_NormalsLocation = -1;
+        m_LengthLocation = -1;
+}
+
+DebugViews::~DebugViews()
+{
+        Reset();
+}
+
+void DebugViews::Reset()
+{
+        if (m_Program != 0)
+                glDeleteProgram( m_Program );
+        m_Program = 0;
+}
+
+bool DebugViews::Shaded() const
+{
+        return m_Program != 0;
+}
+
+void DebugViews::Init()
+{
+        Reset();
+
+        // Geometry shaders (and #version 150) are core in GL 3.2
+        if (!GLVersionAtLeast( 3, 2 )) {
+                std::cerr << "WARNING: no geometry shaders (GL 3.2), wireframe in line mode and no normals"
+                          << std::endl;
+                return;
+        }
+
+        GLuint stages[3] = {
+                compileShader( GL_VERTEX_SHADER, vertexSource ),
+                compileShader( GL_GEOMETRY_SHADER, geometrySource ),
+                compileShader( GL_FRAGMENT_SHADER, fragmentSource )
+        };
+        bool compiled = true;
+        for (int s = 0; s < 3; s++)
+                compiled = compiled && stages[s] != 0;
+
+        if (compiled) {
+                m_Program = glCreateProgram();
+                for (int s = 0; s < 3; s++)
+                        glAttachShader( m_Program, stages[s] );
+                glLinkProgram( m_Program );
+        }
+        for (int s = 0; s < 3; s++) {
+                if (stages[s] != 0)
+                        glDeleteShader( stages[s] );    // the program keeps them alive
+        }
+
+        GLint ok = GL_FALSE;
+        if (m_Program != 0)
+                glGetProgramiv( m_Program, GL_LINK_STATUS, &ok );
+        if (!ok) {
+                if (m_Program != 0) {
+                        char log[1024];
+                        glGetProgramInfoLog( m_Program, sizeof(log), NULL, log );
+                        std::cerr << "WARNING: debug view shader didn't link:\n" << log << std::endl;
+                }
+                std::cerr << "WARNING: wireframe in line mode and no normals" << std::endl;
+                Reset();
+                return;
+        }
+
+        m_ViewportLocation = glGetUniformLocation( m_Program, "viewportSize" );
+        m_WireframeLocation = glGetUniformLocation( m_Program, "wireframe" );
+        m_NormalsLocation = glGetUniformLocation( m_Program, "normals" );
+        m_LengthLocation = glGetUniformLocation( m_Program, "normalLength" );
+}
+
+bool DebugViews::Begin( int views, const int viewport[4], float normalLength )
+{
+        bool wireframe = (views & Wireframe) != 0;
+        bool normals = (views & Normals) != 0 && m_Program != 0;
+        if (!wireframe && !normals)
+                return false;
+
+        // Over what's there, never hiding it from anything drawn later
+        glPushAttrib( GL_ENABLE_BIT | GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT
+                      | GL_POLYGON_BIT | GL_CURRENT_BIT );
+        glDepthFunc( GL_LEQUAL );
+        glDepthMask( GL_FALSE );
+        glEnable( GL_BLEND );
+        glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
+
+        if (m_Program == 0) {
+                glDisable( GL_LIGHTING );
+                glDisable( GL_TEXTURE_2D );
+                glEnable( GL_POLYGON_OFFSET_LINE );
+                glPolygonOffset( -1.0f, -1.0f );
+                glPolygonMode( GL_FRONT_AND_BACK, GL_LINE );
+                glLineWidth( LINE_WIDTH );
+                glColor4fv( wireColor );
+                return true;
+        }
+
+        glDisable( GL_CULL_FACE );
+        glEnable( GL_POLYGON_OFFSET_FILL );
+        glPolygonOffset( -1.0f, -1.0f );
+        glUseProgram( m_Program );
+        glUniform2f( m_ViewportLocation, (GLfloat) viewport[2], (GLfloat) viewport[3] );
+        glUniform1i( m_WireframeLocation, wireframe );
+        glUniform1i( m_NormalsLocation, normals );
+        glUniform1f( m_LengthLocation, normalLength );
+        return true;
+}
+
+void DebugViews::End()
+{
+        if (m_Program != 0)
+                glUseProgram( 0 );
+        glPopAttrib();
+}
+
+/*
+ * Twelve edges per box, straight from the mesh bounds each frame (there
+ * are only as many boxes as meshes)
+ */
+void DebugViews::DrawBoxes( const Asset3ds &asset ) const
+{
+        unsigned int meshes = asset.GetMeshCount();
+        if (meshes == 0)
+                return;
+
+        glPushAttrib( GL_ENABLE_BIT | GL_CURRENT_BIT | GL_LINE_BIT );
+        glDisable( GL_LIGHTING );
+        glDisable( GL_TEXTURE_2D );
+        glLineWidth( LINE_WIDTH );
+        glColor4fv( boxColor );
+
+        glBegin( GL_LINES );
+        for (unsigned int m = 0; m < meshes; m++) {
+                float bounds[2][3];
+                asset.GetMeshBounds( m, bounds[0], bounds[1] );
+                for (int axis = 0; axis < 3; axis++) {
+                        int u = (axis + 1) % 3, v = (axis + 2) % 3;
+                        for (int corner = 0; corner < 4; corner++) {
+                                float p[3];
+                                p[u] = bounds[corner & 1][u];
+                                p[v] = bounds[corner >> 1][v];
+                                p[axis] = bounds[0][axis];
+                                glVertex3fv( p );
+                                p[axis] = bounds[1][axis];
+                                glVertex3fv( p );
+                        }
+                }
+        }
+        glEnd();
+
+        glPopAttrib();
+}
@@ -0,0 +1,59 @@
+/*
+ * Filename: debugviews.hpp
+ *
+ * Overlays for checking imported models: the wireframe, the vertex
+ * normals and each mesh's bounding box.
+ *
+ * The wireframe and the normals come out of one extra pass over the
+ * buffers the model is already drawn from (the same draw call, culled
+ * the same way). A geometry shader (GL 3.2) gives each triangle the
+ * window-space distance of its corners to the opposite edges, so the
+ * fragment shader can draw the edges antialiased without any line
+ * primitives, and it also turns each corner's normal into a thin quad in
+ * the same pass. Without geometry shaders the wireframe falls back to
+ * drawing that pass in line mode, and there are no normals.
+ *
+ * The boxes are just a few lines per mesh.
+ */
+
+#ifndef _DEBUGVIEWS_H
+#define _DEBUGVIEWS_H
+
+#include "gl.hpp"
+#include "asset.hpp"
+
+class DebugViews
+{
+public:
+        enum View { Wireframe = 1, Normals = 2, BoundingBoxes = 4 };
+
+        DebugViews();
+
+        // Needs the GL context current (it deletes the program)
+        ~DebugViews();
+
+        // Build the shader if GL can (a WARNING otherwise, see above)
+        void Init();
+        bool Shaded() const;
+        void Reset();
+
+        // Set up for drawing the model over itself as the views picked
+        // in views (Wireframe, Normals). normalLength is in eye space.
+        // False if there's nothing to draw, otherwise draw the model the
+        // way it was just drawn and call End().
+        bool Begin( int views, const int viewport[4], float normalLength );
+        void End();
+
+        // Every mesh's box, in model space (the modelview loaded)
+        void DrawBoxes( const Asset3ds &asset ) const;
+
+private:
+        DebugViews( const DebugViews & );
+        DebugViews &operator=( const DebugViews & );
+
+        GLuint m_Program;
+        GLint m_ViewportLocation, m_WireframeLocation, m_NormalsLocation;
+        GLint m_LengthLocation;
+};
+
+#endif    // _DEBUGVIEWS_H
@@ -1,8 +1,58 @@
 HEADERS      = asset.hpp\
+               mesh.hpp \
+               meshopt.hpp \
+               meshcache.hpp \
+               meshlet.hpp \
+               culling.hpp \
+               occlusion.hpp \
+               softrender.hpp \
+               memusage.hpp \
+               arena.hpp \
+               gpuresource.hpp \
+               gl.hpp \
+               chunkstream.hpp \
+               gpucull.hpp \
+               debugviews.hpp \
+               meshstats.hpp \
+               meshclean.hpp \
+               meshnormals.hpp \
+               meshtangents.hpp \
+               batch.hpp \
+               framecapture.hpp \
+               camera.hpp \
+               input.hpp \
+               lights.hpp \
+               shadows.hpp \
+               triplebuffer.hpp \
+               renderthread.hpp \
                glwidget.hpp \
                window.hpp \
                qtlogo.hpp
 SOURCES      = asset.cpp\
+               meshopt.cpp \
+               meshcache.cpp \
+               meshlet.cpp \
+               culling.cpp \
+               occlusion.cpp \
+               softrender.cpp \
+               memusage.cpp \
+               arena.cpp \
+               gpuresource.cpp \
+               gl.cpp \
+               chunkstream.cpp \
+               gpucull.cpp \
+               debugviews.cpp \
+               meshstats.cpp \
+               meshclean.cpp \
+               meshnormals.cpp \
+               meshtangents.cpp \
+               batch.cpp \
+               framecapture.cpp \
+               camera.cpp \
+               input.cpp \
+               lights.cpp \
+               shadows.cpp \
+               renderthread.cpp \
                glwidget.cpp \
                main.cpp \
                window.cpp \
@@ -0,0 +1,313 @@
+/*
+ * Filename: framecapture.cpp
+ *
+ * Pipelined frame readback through a ring of PBOs (see framecapture.hpp).
+ */
+
+#include "framecapture.hpp"
+#include "gl.hpp"
+
+#include <QThreadPool>
+#include <QSemaphore>
+#include <iostream>
+#include <cassert>
+
+// Frames that may be waiting for an encoder, per encoder thread
+static const int QUEUED_PER_ENCODER = 4;
+
+// Longest we'll wait for a late frame's fence (in nanoseconds)
+static const GLuint64 FENCE_TIMEOUT = 1000000000;
+
+/*
+ * Writes one frame out on an encoder thread and frees up its queue slot.
+ * The pixels are bottom row first, BGRA, straight from glReadPixels().
+ * The frame is counted in written or failed.
+ */
+class CaptureJob : public QRunnable
+{
+public:
+        CaptureJob( const QByteArray &pixels, int width, int height,
+                    const QString &filename, QFile *raw, QSemaphore *queued,
+                    QAtomicInt *written, QAtomicInt *failed ) :
+                pixels( pixels ), width( width ), height( height ),
+                filename( filename ), raw( raw ), queued( queued ),
+                written( written ), failed( failed ) {}
+
+        void run()
+        {
+                bool ok;
+                if (raw) {
+                        // Only one encoder thread in this mode, so the
+                        // frames land in the file in order
+                        ok = raw->write( pixels ) == pixels.size();
+                        if (!ok)
+                                std::cerr << "ERROR: could not write "
+                                          << raw->fileName().toLocal8Bit().constData()
+                                          << std::endl;
+                } else {
+                        QImage image( (const uchar *) pixels.constData(), width, height,
+                                      width * 4, QImage::Format_RGB32 );
+                        ok = image.mirrored().save( filename, "PNG" );
+                        if (!ok)
+                                std::cerr << "ERROR: could not write "
+                                          << filename.toLocal8Bit().constData() << std::endl;
+                }
+                if (ok)
+                        written->ref();
+                else
+                        failed->ref();
+                queued->release();
+        }
+
+private:
+        QByteArray pixels;
+        int width, height;
+        QString filename;
+        QFile *raw;
+        QSemaphore *queued;
+        QAtomicInt *written, *failed;
+};
+
+FrameCapture::FrameCapture()
+{
+        m_Recording = false;
+        m_HaveSync = false;
+        m_Format = PngSequence;
+        m_Next = 0;
+        m_RingSize = 0;
+        m_Width = m_Height = 0;
+        m_Encoders = NULL;
+        m_Queued = NULL;
+        m_Raw = NULL;
+        m_Frames = m_Late = m_Dropped = 0;
+        m_Written = m_Failed = 0;
+}
+
+FrameCapture::~FrameCapture()
+{
+        // Stop() needs the GL context, so the owner should have called it
+        assert( !m_Recording );
+}
+
+bool FrameCapture::Start( const QString &dir, Format format )
+{
+        if (m_Recording)
+                return true;
+
+        if (!HaveGL( 2, 1, "GL_ARB_pixel_buffer_object" )) {
+                std::cerr << "ERROR: frame capture needs pixel buffer objects" << std::endl;
+                return false;
+        }
+        if (!QDir().mkpath( dir )) {
+                std::cerr << "ERROR: could not create "
+                          << dir.toLocal8Bit().constData() << std::endl;
+                return false;
+        }
+
+        m_Dir = dir;
+        m_Format = format;
+        m_HaveSync = HaveGL( 3, 2, "GL_ARB_sync" );
+        if (!m_HaveSync)
+                std::cerr << "WARNING: no fences (ARB_sync), late frames won't be detected" << std::endl;
+
+        // PNGs can be compressed in any order, the raw file can't
+        m_Encoders = new QThreadPool;
+        m_Encoders->setMaxThreadCount( format == RawVideo
+                                       ? 1 : qMax( 1, QThread::idealThreadCount() ) );
+        m_Queued = new QSemaphore( m_Encoders->maxThreadCount() * QUEUED_PER_ENCODER );
+
+        if (format == RawVideo) {
+                m_Raw = new QFile( QDir( dir ).filePath( "capture.bgra" ) );
+                if (!m_Raw->open( QIODevice::WriteOnly )) {
+                        std::cerr << "ERROR: could not write "
+                                  << m_Raw->fileName().toLocal8Bit().constData() << std::endl;
+                        delete m_Raw;
+                        m_Raw = NULL;
+                        delete m_Queued;
+                        delete m_Encoders;
+                        m_Queued = NULL;
+                        m_Encoders = NULL;
+                        return false;
+                }
+        }
+
+        m_Frames = m_Late = m_Dropped = 0;
+        m_Written = m_Failed = 0;
+        m_Recording = true;
+        return true;
+}
+
+void FrameCapture::Stop()
+{
+        if (!m_Recording)
+                return;
+
+        flush();
+        destroyRing();
+
+        m_Encoders->waitForDone();
+        delete m_Encoders;
+        delete m_Queued;
+        m_Encoders = NULL;
+        m_Queued = NULL;
+
+        std::cout << "Capture: " << (int) m_Written << " frames written to "
+                  << m_Dir.toLocal8Bit().constData() << ", " << (int) m_Failed
+                  << " failed, " << m_Late << " late, " << m_Dropped << " dropped"
+                  << std::endl;
+
+        if (m_Raw) {
+                m_Raw->close();
+                std::cout << "  raw BGRA, bottom row first; to convert:" << std::endl
+                          << "  ffmpeg -f rawvideo -pixel_format bgra -video_size "
+                          << m_Width << "x" << m_Height << " -framerate 50 -i "
+                          << m_Raw->fileName().toLocal8Bit().constData()
+                          << " -vf vflip capture.mp4" << std::endl;
+                delete m_Raw;
+                m_Raw = NULL;
+        }
+
+        m_Recording = false;
+}
+
+bool FrameCapture::Recording() const
+{
+        return m_Recording;
+}
+
+bool FrameCapture::Capture( int width, int height )
+{
+        if (!m_Recording)
+                return true;
+
+        // The raw file is one fixed size, so a resize ends that recording.
+        // A new recording has no ring yet, whatever size the last one was.
+        if (m_RingSize == 0 || width != m_Width || height != m_Height) {
+                if (m_Raw && m_RingSize > 0) {
+                        std::cerr << "WARNING: window resized, raw capture stopped" << std::endl;
+                        Stop();
+                        return false;
+                }
+                flush();
+                destroyRing();
+                createRing( width, height );
+        }
+
+        // This slot's frame was read CAPTURE_RING_SIZE frames ago; get it
+        // out before reusing the buffer
+        Slot &slot = m_Ring[m_Next];
+        if (slot.pending)
+                collect( slot, false );
+
+        glBindBuffer( GL_PIXEL_PACK_BUFFER, slot.buffer.Name() );
+        glReadPixels( 0, 0, width, height, GL_BGRA, GL_UNSIGNED_BYTE, 0 );
+        glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+
+        if (m_HaveSync)
+                slot.fence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+        slot.pending = true;
+
+        m_Next = (m_Next + 1) % CAPTURE_RING_SIZE;
+        return true;
+}
+
+unsigned int FrameCapture::FramesWritten() const
+{
+        return (int) m_Written;
+}
+
+unsigned int FrameCapture::FramesFailed() const
+{
+        return (int) m_Failed;
+}
+
+unsigned int FrameCapture::FramesLate() const
+{
+        return m_Late;
+}
+
+unsigned int FrameCapture::FramesDropped() const
+{
+        return m_Dropped;
+}
+
+void FrameCapture::createRing( int width, int height )
+{
+        m_Width = width;
+        m_Height = height;
+        m_Next = 0;
+        m_RingSize = CAPTURE_RING_SIZE;
+
+        for (unsigned int i = 0; i < m_RingSize; i++) {
+                m_Ring[i].buffer.Create( GL_PIXEL_PACK_BUFFER, GpuOther, width * height * 4,
+                                         NULL, GL_STREAM_READ );
+                m_Ring[i].fence = 0;
+                m_Ring[i].pending = false;
+        }
+        glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+}
+
+void FrameCapture::destroyRing()
+{
+        for (unsigned int i = 0; i < m_RingSize; i++) {
+                if (m_Ring[i].fence)
+                        glDeleteSync( m_Ring[i].fence );
+                m_Ring[i].buffer.Reset();
+        }
+        m_RingSize = 0;
+}
+
+/*
+ * Map a slot's buffer and queue its frame for encoding. When stopping
+ * (stopping) we're expected to wait, so that isn't counted as late.
+ */
+void FrameCapture::collect( Slot &slot, bool stopping )
+{
+        if (slot.fence) {
+                if (glClientWaitSync( slot.fence, 0, 0 ) == GL_TIMEOUT_EXPIRED) {
+                        if (!stopping)
+                                m_Late++;
+                        glClientWaitSync( slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT );
+                }
+                glDeleteSync( slot.fence );
+                slot.fence = 0;
+        }
+        slot.pending = false;
+
+        if (!m_Queued->tryAcquire()) {
+                m_Dropped++;
+                return;
+        }
+
+        glBindBuffer( GL_PIXEL_PACK_BUFFER, slot.buffer.Name() );
+        const char *pixels = (const char *) glMapBuffer( GL_PIXEL_PACK_BUFFER, GL_READ_ONLY );
+        if (pixels == NULL) {
+                glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+                m_Queued->release();
+                m_Dropped++;
+                return;
+        }
+
+        QByteArray frame( pixels, m_Width * m_Height * 4 );
+        glUnmapBuffer( GL_PIXEL_PACK_BUFFER );
+        glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+
+        QString filename = QDir( m_Dir ).filePath(
+                QString( "frame_%1.png" ).arg( m_Frames, 6, 10, QChar( '0' ) ) );
+        m_Encoders->start( new CaptureJob( frame, m_Width, m_Height,
+                                           filename, m_Raw, m_Queued,
+                                           &m_Written, &m_Failed ) );
+        m_Frames++;
+}
+
+/*
+ * Collect whatever is still in the ring, oldest first
+ */
+void FrameCapture::flush()
+{
+        for (unsigned int i = 0; i < m_RingSize; i++) {
+                Slot &slot = m_Ring[(m_Next + i) % m_RingSize];
+                if (slot.pending)
+                        collect( slot, true );
+        }
+}
@@ -0,0 +1,101 @@
+/*
+ * Filename: framecapture.hpp
+ *
+ * Records what the GLWidget draws without stalling paintGL().
+ *
+ * glReadPixels() straight into client memory makes the CPU wait for the
+ * GPU to finish the frame (and then for the copy). Instead each frame is
+ * read into one of a ring of pixel buffer objects, which returns right
+ * away, and a fence is dropped after it. The buffer is only mapped
+ * CAPTURE_RING_SIZE - 1 frames later when its fence has (normally)
+ * signaled, so the readback trails rendering and never blocks it.
+ *
+ * The mapped pixels are copied out and handed to background threads that
+ * write either a numbered PNG sequence or one raw BGRA video file.
+ *
+ * Frames are counted as
+ *   written - an encoder wrote it out
+ *   failed  - an encoder couldn't (the PNG or the raw file write failed)
+ *   late    - the fence hadn't signaled when the buffer was needed again
+ *             and we had to wait for it (the GPU is more than a ring
+ *             behind)
+ *   dropped - the encoders were too far behind so the frame was skipped
+ *             rather than let memory grow without bound
+ */
+
+#ifndef _FRAMECAPTURE_H
+#define _FRAMECAPTURE_H
+
+#include "gl.hpp"
+#include "gpuresource.hpp"
+
+#include <QAtomicInt>
+
+class QFile;
+class QThreadPool;
+class QSemaphore;
+
+// Frames in flight between glReadPixels() and mapping the buffer
+const unsigned int CAPTURE_RING_SIZE = 3;
+
+class FrameCapture
+{
+public:
+        enum Format { PngSequence, RawVideo };
+
+        FrameCapture();
+        ~FrameCapture();
+
+        // Begin recording into directory dir (a GL context must be
+        // current). Returns false if it can't.
+        bool Start( const QString &dir, Format format );
+
+        // Finish the frames still in the ring and wait for the encoders
+        void Stop();
+
+        bool Recording() const;
+
+        // Call at the very end of paintGL(), before the buffers are swapped.
+        // Returns false if this frame ended the recording (a raw capture's
+        // window was resized).
+        bool Capture( int width, int height );
+
+        // Statistics for the current (or last) recording
+        unsigned int FramesWritten() const;
+        unsigned int FramesFailed() const;
+        unsigned int FramesLate() const;
+        unsigned int FramesDropped() const;
+
+private:
+        struct Slot
+        {
+                GLBuffer buffer;
+                GLsync fence;
+                bool pending;               // holds a frame not yet collected
+        };
+
+        void createRing( int width, int height );
+        void destroyRing();
+        void collect( Slot &slot, bool stopping );
+        void flush();
+
+        bool m_Recording;
+        bool m_HaveSync;                    // fences supported?
+        Format m_Format;
+        QString m_Dir;
+
+        Slot m_Ring[CAPTURE_RING_SIZE];
+        unsigned int m_RingSize;            // 0 until there's a ring
+        unsigned int m_Next;                // slot the next frame goes into
+        int m_Width, m_Height;
+
+        QThreadPool *m_Encoders;
+        QSemaphore *m_Queued;               // free spots in the encode queue
+        QFile *m_Raw;                       // the RawVideo output file
+
+        unsigned int m_Frames;              // frames handed to the encoders
+        QAtomicInt m_Written, m_Failed;     // counted by the encoders
+        unsigned int m_Late, m_Dropped;
+};
+
+#endif    // _FRAMECAPTURE_H
@@ -0,0 +1,30 @@
+/*
+ * Filename: gl.cpp
+ *
+ * GL version and extension checks (see gl.hpp).
+ */
+
+#include "gl.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+bool GLVersionAtLeast( int wantMajor, int wantMinor )
+{
+        int major = 0, minor = 0;
+        const char *version = (const char *) glGetString( GL_VERSION );
+        if (version == NULL || sscanf( version, "%d.%d", &major, &minor ) != 2)
+                return false;
+        return major > wantMajor || (major == wantMajor && minor >= wantMinor);
+}
+
+bool HaveGLExtension( const char *extension )
+{
+        const char *ext = (const char *) glGetString( GL_EXTENSIONS );
+        return ext != NULL && strstr( ext, extension ) != NULL;
+}
+
+bool HaveGL( int major, int minor, const char *extension )
+{
+        return GLVersionAtLeast( major, minor ) || HaveGLExtension( extension );
+}
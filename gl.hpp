@@ -0,0 +1,31 @@
+/*
+ * Filename: gl.hpp
+ *
+ * Include this for GL instead of <QtOpenGL>: it asks for the extension
+ * prototypes first (glGenBuffers() and the rest aren't declared without
+ * them), which only works if it's done before GL is first included. See
+ * http://www.opengl.org/discussion_boards/showthread.php/172481-glGenBuffer-was-not-declared
+ *
+ * Also what the GL driver we're running on can do. Every optional
+ * feature (pixel buffer objects, fences, framebuffer objects, uniform
+ * buffers, compute, geometry shaders) is checked with these once its
+ * context is current, before it's first used.
+ */
+
+#ifndef _GL_H
+#define _GL_H
+
+#define GL_GLEXT_PROTOTYPES
+#include <QtOpenGL>
+
+// GL_VERSION is at least major.minor?
+bool GLVersionAtLeast( int major, int minor );
+
+// extension is in GL_EXTENSIONS?
+bool HaveGLExtension( const char *extension );
+
+// Either of the above: a feature that's core since major.minor and was
+// an extension before
+bool HaveGL( int major, int minor, const char *extension );
+
+#endif    // _GL_H
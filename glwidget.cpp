@@ -19,6 +19,7 @@
 #define TEXTURE_MODE_ON 0
 
 #include <QtGui>      // Pull in the actual interface to the GUI elems
+#include <iostream>
 #include <math.h>     // As with any good OpenGL program, there's a 
                       // healthy amount of under-the-hood mathematics!
 
@@ -30,6 +31,7 @@ static float toRadians( float degrees )
 
 // Project local includes
 #include "glwidget.hpp" // grab our GLWidget class
+#include "renderthread.hpp"
 #include "qtlogo.hpp"   // get the Qt framework's logo (to be shown)
 
 
@@ -37,6 +39,40 @@ static float toRadians( float degrees )
 #define GL_MULTISAMPLE 0x809D
 #endif
 
+// Light positions (eye space, set up with an identity modelview)
+static const GLfloat roomLightPos[4]  = { 0.0, 0.0, 1000.0, 1.0 };
+static const GLfloat rightLightPos[4] = { 1000.0, 0.0, 0.1, 0.0 };
+static const GLfloat leftLightPos[4]  = { -1000.0, 0.0, 0.1, 0.0 };
+
+// Fixed function default diffuse color of GL_LIGHT0
+static const GLfloat whiteLight[4] = { 1.0, 1.0, 1.0, 1.0 };
+
+// The room, right and left lights come first in the light manager,
+// spawned light grids go after them
+static const unsigned int FIXED_LIGHTS = 3;
+
+// How far a grid light reaches (in grid spacings) and how bright it is
+static const float GRID_LIGHT_RANGE = 1.5;
+static const float GRID_LIGHT_LEVEL = 0.6;
+
+// Perspective projection: tan() of this is top / near
+static const GLfloat FIELD_OF_VIEW = 40.0;
+
+// How much room to leave around the model when fitting it in the view
+static const GLfloat FIT_MARGIN = 1.1;
+
+// WASD panning speed in units per second (for a model 10 units across,
+// see fitCamera()) and right button drag rotation per pixel
+static const float PAN_SPEED = 25.0;
+static const float DEGREES_PER_PIXEL = 0.5;
+
+// Longest time step applied at once, so a stall (or the first tick)
+// doesn't throw the camera across the scene
+static const float MAX_INPUT_STEP = 0.1;
+
+// Frames drawn by each renderer in runBenchmark()
+static const int BENCHMARK_FRAMES = 50;
+
 /*
  * Constructor to setup the scene
  */
@@ -52,10 +88,108 @@ GLWidget::GLWidget( QWidget *parent ) :
         ///////////////////////////////////////
         QStringList args = QCoreApplication::arguments();
 
-        // Pure AWESOME cascading member function calls! WHeeeeeeeeee
-        char *assetName = args.at(1).toLocal8Bit().data();
+        // The model is the first argument that isn't a "--option"
+        for (int i = 1; i < args.size(); i++) {
+                if (!args.at(i).startsWith( "--" )) {
+                        assetName = args.at(i);
+                        break;
+                }
+        }
+
+        // --smooth-angle=<degrees> is the sharpest edge normals are
+        // smoothed across (see meshnormals.hpp)
+        float smoothAngle = SmoothAngleArg( args );
+
+        asset = new Asset3ds( assetName.toLocal8Bit().constData(),
+                              !args.contains( "--no-cache" ),
+                              args.contains( "--out-of-core" ),
+                              args.contains( "--merge-coplanar" ),
+                              smoothAngle );
+
+        // Optionally squeeze the vertex data down (see asset.hpp)
+        if (args.contains( "--compact" ))
+                asset->SetVertexFormat( Asset3ds::CompactVertices );
+
+        // --submit=per-range|multi-draw|indirect picks how the culled
+        // ranges go to GL (indirect when GL has it, by default)
+        for (int i = 1; i < args.size(); i++) {
+                if (!args.at(i).startsWith( "--submit=" ))
+                        continue;
+                QString mode = args.at(i).mid( 9 );
+                if (mode == "per-range")
+                        asset->SetSubmitMode( Asset3ds::PerRangeSubmit );
+                else if (mode == "multi-draw")
+                        asset->SetSubmitMode( Asset3ds::MultiDrawSubmit );
+                else if (mode == "indirect")
+                        asset->SetSubmitMode( Asset3ds::IndirectSubmit );
+                else
+                        std::cerr << "WARNING: unknown --submit mode "
+                                  << mode.toLocal8Bit().constData() << "\n";
+        }
+
+        // --vram-budget=<MiB> caps what's kept on the GPU (see gpuresource.hpp)
+        for (int i = 1; i < args.size(); i++) {
+                if (args.at(i).startsWith( "--vram-budget=" )) {
+                        long budget = args.at(i).mid( 14 ).toLong();
+                        GpuMemory::SetBudget( budget * 1024 * 1024 );
+                }
+        }
+
+        // --ooc-ram=<MiB> and --ooc-vram=<MiB> are what --out-of-core may
+        // keep paged in and uploaded (see chunkstream.hpp)
+        long streamRam = CHUNK_RAM_BUDGET, streamVram = CHUNK_VRAM_BUDGET;
+        for (int i = 1; i < args.size(); i++) {
+                if (args.at(i).startsWith( "--ooc-ram=" ))
+                        streamRam = args.at(i).mid( 10 ).toLong() * 1024 * 1024;
+                else if (args.at(i).startsWith( "--ooc-vram=" ))
+                        streamVram = args.at(i).mid( 11 ).toLong() * 1024 * 1024;
+        }
+        asset->SetStreamBudgets( streamRam, streamVram );
+
+        // Meshlet culling is on (on the GPU if it can) unless the panel
+        // says otherwise, occlusion culling is off
+        clusterCulling = true;
+        gpuCulling = true;
+        gpuVisible = 0;
+        occlusionCulling = false;
+        debugViews = 0;
+        drawRanges.clustersTested = drawRanges.clustersVisible = 0;
+
+        // Draw on the CPU instead of through GL? (see softrender.hpp)
+        softwareMode = args.contains( "--software" );
+        softwareReady = false;
+
+        // --bench runs the benchmark as soon as we're up, then quits
+        benchmarkQuit = args.contains( "--bench" );
+        if (benchmarkQuit)
+                QTimer::singleShot( 0, this, SLOT(runBenchmark()) );
+
+        // Recording is started from the panel
+        captureFormat = FrameCapture::PngSequence;
+        recordingWanted = recordingStarted = false;
+        occlusionWasOn = false;
+
+        // --render-thread moves all of the GL work off the GUI thread
+        // (the thread itself is started once we're on screen)
+        threaded = args.contains( "--render-thread" );
+        renderThread = NULL;
+        renderWidth = renderHeight = -1;
+        if (threaded) {
+                renderThread = new RenderThread( this );
+                setAutoBufferSwap( false );
+        }
 
-        asset = new Asset3ds(assetName);
+        // No input has been waited on yet
+        pendingInput = -1;
+        latencyMs = latencyMaxMs = latencyTotalMs = 0.0;
+        latencyCount = 0;
+
+        // Frame timing overlay starts hidden (toggle with H)
+        hudOn = false;
+        frameMs = 0.0;
+        frameTotalMs = 0.0;
+        frameCount = 0;
+        framesDrawn = 0;
 
         // Look dead-on at the scene to start (no initial rotations)
         // WARNING: This is overruled by the slider settings in window.cpp!!
@@ -63,19 +197,28 @@ GLWidget::GLWidget( QWidget *parent ) :
         setYRotation( 0 );
         setZRotation( 0 );
 
-        // Position Offset Initializer
-        xPos = yPos = 0;
-
         // Push model BACK a bit to start. This is important because
         // some are ungodly huge and need to be visible at least in some
         // fashion right away, less the user thinks something failed.
-        zPos = -20.0;
-
-        // Initialize scaling factor to 1, no scale change
-        scaleFactor = 1.0;
+        // (Once the model's bounds are known fitCamera() does this
+        // properly, this is just for a model with nothing in it.)
+        camera.SetPosition( 0.0, 0.0, -20.0 );
+        camera.SetFieldOfView( FIELD_OF_VIEW );
+        moveStep = 1.0;
+        modelCenter[0] = modelCenter[1] = modelCenter[2] = 0.0f;
+        modelRadius = -1.0f;
+
+        // Straight through without the render thread, queued with it
+        connect( this, SIGNAL(modelBoundsReady(float, float, float, float)),
+                 this, SLOT(setModelBounds(float, float, float, float)) );
+
+        // Nothing has been handed to GL or the culling yet
+        loadedProjection = 0;
+        cullVersion = 0;
 
         // Initialize motion state bools
         moveUp_ = moveDn_ = moveRight_ = moveLeft_ = false;
+        motionClock.start();
 
         // These colors must be generated via CMYK values otherwise
         // it seems lighting will simply NOT WORK.
@@ -95,25 +238,93 @@ GLWidget::GLWidget( QWidget *parent ) :
         auxRed(10);
         auxGreen(10);
         auxBlue(10);
+
+        // The three lights, in GL_LIGHT0..2 order (see lights.hpp).
+        // --fixed-function keeps them off the lighting shader.
+        shadedLights = !args.contains( "--fixed-function" );
+        lightManager.Add( roomLightPos, whiteLight );
+        lightManager.Add( rightLightPos, auxColor );
+        lightManager.Add( leftLightPos, axxColor );
+
+        // No light grid until one is spawned from the panel; Forward+
+        // tiling kicks in for it when the shader path is available
+        lightGrid = renderLightGrid = 0;
+        tiledLighting = true;
+        tileHeatmap = false;
+        gridRange = 0.0;
+
+        // Medium shadows to start; nothing has been timed yet
+        shadowQuality = ShadowsMedium;
+        for (int q = 0; q < SHADOW_QUALITIES; q++) {
+                shadowMs[q] = 0.0;
+                shadowFrames[q] = 0;
+        }
+        viewportRect[0] = viewportRect[1] = viewportRect[2] = viewportRect[3] = 0;
         
         // Make the default on instantiation be perspective projection
         p_Perspective();
 
         // Default size of orthographic projection mode
         // (These are changed with the mouse wheel when in PROJECTION).
-        ortho_left = ortho_top = -3.0;
-        ortho_bottom = ortho_right = 3.0;
+        camera.SetOrthoSize( 3.0 );
+
+        // Nobody is waiting on the setup above, so it's not timed as input
+        InputFrame setup;
+        input.Take( setup );
 
         // Begin the updating of the GLwidget using the QTimerEvent here
         startTimer( 20 );
 }
 
 /*
- * Destructor (empty since the QWidgets
- * will take care of themselves)
+ * Destructor (the QWidgets will take care of themselves), but give a
+ * summary of how fast this model drew so runs can be compared.
  */
 GLWidget::~GLWidget()
 {
+        // The render thread has to be done with the context (and have
+        // given it back) before it can be used here
+        if (renderThread) {
+                renderThread->Stop();
+                delete renderThread;
+        }
+
+        // The query objects need our context to be deleted
+        makeCurrent();
+        occlusion.Reset();
+        gpuCuller.Reset();
+        debugOverlay.Reset();
+        lightManager.Reset();
+        shadows.Reset();
+        capture.Stop();
+
+        if (frameCount > 0) {
+                std::cout << assetName.toLocal8Bit().constData() << ": "
+                          << (asset->GetVertexFormat() == Asset3ds::CompactVertices
+                              ? "compact" : "float")
+                          << " vertices, " << asset->GetVertexBytes() / 1024 << " KiB, "
+                          << frameTotalMs / frameCount << " ms/frame average over "
+                          << frameCount << " timed frames" << std::endl;
+                std::cout << "Shadows: " << shadowCosts().toLocal8Bit().constData()
+                          << ", " << shadows.Renders() << " maps rendered" << std::endl;
+        }
+
+        std::cout << "Input: " << input.EventsReceived() << " events coalesced into "
+                  << input.UpdatesApplied() << " updates, " << framesDrawn
+                  << " frames drawn" << std::endl;
+
+        if (latencyCount > 0) {
+                std::cout << "Latency: " << latencyTotalMs / latencyCount << " ms average, "
+                          << latencyMaxMs << " ms worst, input to "
+                          << (threaded ? "buffer swap" : "frame drawn") << " over "
+                          << latencyCount << " frames" << std::endl;
+        }
+
+        std::cout << "GPU memory: " << GpuMemory::PeakBytes() / 1024 << " KiB at most, "
+                  << GpuMemory::Evictions() << " evictions" << std::endl;
+
+        // Its buffers and texture go with it, while we still have the context
+        delete asset;
 }
 
 /*
@@ -153,62 +364,29 @@ static void qNormalizeAngle( int &angle )
 void GLWidget::setXRotation( int angle )
 {
         qNormalizeAngle( angle );        // Helper will fix the angle
-        if (angle != xRot) {
-                xRot = angle;
-                emit xRotationChanged( angle );
-                updateGL();              // Given to us from QGLWidget!
-        }
+        input.SetRotation( 0, angle );  // applied at the next frame tick
 }
 
 void GLWidget::setYRotation( int angle )
 {
         qNormalizeAngle( angle );        // Helper will fix the angle
-        if (angle != yRot) {
-                yRot = angle;
-                emit yRotationChanged( angle );
-                updateGL();              // Given to us from QGLWidget!
-        }
-
+        input.SetRotation( 1, angle );  // applied at the next frame tick
 }
 
 void GLWidget::setZRotation( int angle )
 {
         qNormalizeAngle( angle );        // Helper will fix the angle
-        if (angle != zRot) {
-                zRot = angle;
-                emit zRotationChanged( angle );
-                updateGL();              // Given to us from QGLWidget!
-        }
+        input.SetRotation( 2, angle );  // applied at the next frame tick
 }
 
 void GLWidget::forward  ( float amount )
 {
-        if (!perspectiveMode) {
-                ortho_bottom -= amount;
-                ortho_top    += amount;
-                ortho_left   += amount;
-                ortho_right  -= amount;
-        } else {
-                zPos += amount;
-        }
-        // Evil way of forcing the redraw to happen
-        resizeGL( this->width(), this->height() );
-        updateGL();
+        input.Zoom( amount );
 }
 
 void GLWidget::backward ( float amount )
 {
-        if (!perspectiveMode) {
-                ortho_bottom += amount;
-                ortho_top    -= amount;
-                ortho_left   -= amount;
-                ortho_right  += amount;
-        } else {
-                zPos -= amount;
-        }
-        // Evil way of forcing the redraw to happen
-        resizeGL( this->width(), this->height() );
-        updateGL();
+        input.Zoom( -amount );
 }
 
 void GLWidget::strafeL  ( bool on )
@@ -236,30 +414,28 @@ void GLWidget::decrElev ( bool on )
  */
 void GLWidget::panHorizontal( int direction )
 {
-        if (direction < 0)       xPos -= 0.5;
-        else                     xPos += 0.5;
-        updateGL();
+        if (direction < 0)       camera.Move( -0.5 * moveStep, 0.0, 0.0 );
+        else                     camera.Move(  0.5 * moveStep, 0.0, 0.0 );
+        requestFrame();
 }
 
 void GLWidget::panVertical( int direction )
 {
-        if (direction < 0)       yPos -= 0.5;
-        else                     yPos += 0.5;
-        updateGL();
+        if (direction < 0)       camera.Move( 0.0, -0.5 * moveStep, 0.0 );
+        else                     camera.Move( 0.0,  0.5 * moveStep, 0.0 );
+        requestFrame();
 }
 
 void GLWidget::masterReset( void )
 {
-        xPos = yPos = 0.0;
-        zPos = -20.0;
+        fitCamera();
 
-        ortho_bottom = ortho_right = 5.0;
-        ortho_top = ortho_left = -5.0;
+        camera.SetRotation( 0, 0 );
+        camera.SetRotation( 1, 0 );
+        camera.SetRotation( 2, 0 );
+        emitRotations();
 
-        xRot = yRot = zRot = 0.0;
-
-        resizeGL( this->width(), this->height() );
-        updateGL();
+        requestFrame();
 }
 
 /*
@@ -269,22 +445,10 @@ void GLWidget::masterReset( void )
  */
 void GLWidget::lightAmbientToggle( void )
 {
-        if (ambientLight) {
-                // Light is presently on, so turn it off when called
-                glDisable( GL_LIGHT0 );
-
-                // Change the background to be darker w/o ambient light
-                qglClearColor( qtDark.dark() );
-                ambientLight = false;
-
-        } else {
-                // Light is off when called, so turn it back on
-                glEnable( GL_LIGHT0 );
-
-                qglClearColor( qtDark.light() );
-                ambientLight = true;
-        }
-        updateGL();                // Commit the change to the scene
+        // The next frame turns GL_LIGHT0 on or off to match, and changes
+        // the background to be darker w/o ambient light
+        ambientLight = !ambientLight;
+        requestFrame();            // Commit the change to the scene
 }
 
 /*
@@ -294,28 +458,14 @@ void GLWidget::lightAmbientToggle( void )
  */
 void GLWidget::auxLightToggle( void )
 {
-        if (flashlightOn) {
-                // Light is presently on, so turn it off
-                glDisable( GL_LIGHT1 );
-                flashlightOn = false;
-        } else {
-                // Light is presently off, so turn it on
-                glEnable( GL_LIGHT1 );
-                flashlightOn = true;
-        }
-        updateGL();                // Force the change to the scene
+        flashlightOn = !flashlightOn;   // GL_LIGHT1 follows at the next frame
+        requestFrame();            // Force the change to the scene
 }
 
 void GLWidget::oppositeLightToggle( void )
 {
-        if (oppositeOn) {
-                glDisable( GL_LIGHT2 );
-                oppositeOn = false;
-        } else {
-                glEnable( GL_LIGHT2 );
-                oppositeOn = true;
-        }
-        updateGL();
+        oppositeOn = !oppositeOn;       // and GL_LIGHT2
+        requestFrame();
 }
 
 
@@ -327,7 +477,7 @@ void GLWidget::auxRed( int userRed )
         auxR = userRed;
         auxColor[0] = (float) auxR / 100.0;
         axxColor[0] = (float) ((auxR - 100.0) * -1) / 100.0;
-        updateGL();
+        input.Touch();
 }
 
 void GLWidget::auxGreen( int userGreen )
@@ -335,7 +485,7 @@ void GLWidget::auxGreen( int userGreen )
         auxG = userGreen;
         auxColor[1] = (float) auxG / 100.0;
         axxColor[1] = (float) ((auxG - 100.0) * -1) / 100.0;
-        updateGL();
+        input.Touch();
 }
 
 void GLWidget::auxBlue( int userBlue )
@@ -343,7 +493,7 @@ void GLWidget::auxBlue( int userBlue )
         auxB = userBlue;
         auxColor[2] = (float) auxB / 100.0;
         axxColor[2] = (float) ((auxB - 100.0) * -1) / 100.0;
-        updateGL();
+        input.Touch();
 }
 
 void GLWidget::auxAlpha( int userAlpha )
@@ -351,7 +501,7 @@ void GLWidget::auxAlpha( int userAlpha )
         auxA = userAlpha;
         auxColor[3] = (float) auxA / 100.0;
         axxColor[3] = (float) (auxA - 500.0) * -1;
-        updateGL();
+        input.Touch();
 }
 
 /* 
@@ -360,11 +510,8 @@ void GLWidget::auxAlpha( int userAlpha )
  */
 void GLWidget::p_Perspective( void )
 {
-        perspectiveMode = true;
-        
-        // Evil way of forcing the redraw to happen
-        resizeGL( this->width(), this->height() );
-        updateGL();
+        camera.SetPerspective( true );
+        requestFrame();
 }
 
 /* 
@@ -372,11 +519,8 @@ void GLWidget::p_Perspective( void )
  */
 void GLWidget::p_Orthographic( void )
 {
-        perspectiveMode = false;
-
-        // Evil way of forcing the redraw to happen
-        resizeGL( this->width(), this->height() );
-        updateGL();
+        camera.SetPerspective( false );
+        requestFrame();
 }
 
 
@@ -391,9 +535,645 @@ void GLWidget::setScaling( double usrFactor )
 {
         // Qt provides a double spin box. But we want a float! Bah!
 
-        scaleFactor = (float) usrFactor;
+        camera.SetScale( (float) usrFactor );
+
+        input.Touch();
+}
+
+/*
+ * Turn the per-meshlet frustum / back face culling on or off
+ */
+void GLWidget::setClusterCulling( bool on )
+{
+        clusterCulling = on;
+        requestFrame();
+}
+
+/*
+ * Cull the meshlets in a compute shader instead of on the CPU (only
+ * matters when GL has compute shaders; see gpucull.hpp)
+ */
+void GLWidget::setGpuCulling( bool on )
+{
+        gpuCulling = on;
+        requestFrame();
+}
+
+/*
+ * The debug overlays (wireframe, normals, mesh boxes)
+ */
+void GLWidget::setWireframe( bool on )
+{
+        setDebugView( DebugViews::Wireframe, on );
+}
+
+void GLWidget::setNormals( bool on )
+{
+        setDebugView( DebugViews::Normals, on );
+}
+
+void GLWidget::setBoundingBoxes( bool on )
+{
+        setDebugView( DebugViews::BoundingBoxes, on );
+}
+
+void GLWidget::setDebugView( int view, bool on )
+{
+        if (on)
+                debugViews |= view;
+        else
+                debugViews &= ~view;
+        requestFrame();
+}
+
+/*
+ * Turn the occlusion queries on or off. Turning them off throws away any
+ * pending results so switching back on starts fresh (all visible); the
+ * renderer does that when it sees the change, since it owns the queries.
+ */
+void GLWidget::setOcclusionCulling( bool on )
+{
+        occlusionCulling = on;
+        requestFrame();
+}
+
+/*
+ * Switch between the GL and the CPU renderer
+ */
+void GLWidget::setSoftwareRendering( bool on )
+{
+        softwareMode = on;
+        requestFrame();
+}
+
+bool GLWidget::softwareRendering( void ) const
+{
+        return softwareMode;
+}
+
+/*
+ * Start or stop recording. Starting can fail (no PBOs, can't write the
+ * directory) so the panel is told what actually happened. With the render
+ * thread the capture belongs to it, so it starts or stops it at the next
+ * frame and does the telling (the signal gets queued over to us).
+ */
+void GLWidget::setRecording( bool on )
+{
+        recordingWanted = on;
+        if (threaded) {
+                requestFrame();
+                return;
+        }
+
+        makeCurrent();
+        recordingStarted = on;
+        if (on)
+                capture.Start( "capture", captureFormat );
+        else
+                capture.Stop();
+
+        emit recordingChanged( capture.Recording() );
+}
+
+void GLWidget::setCaptureFormat( int format )
+{
+        captureFormat = (FrameCapture::Format) format;
+}
+
+/*
+ * Draw the same view a bunch of times with GL and then with the CPU
+ * renderer and print how fast each one went. paintGL() is called directly
+ * (no buffer swaps, so vsync doesn't get in the way) and GL is made to
+ * finish every frame. The last CPU frame is saved as softrender.png so the
+ * two can be compared by eye too.
+ */
+void GLWidget::runBenchmark( void )
+{
+        // It draws straight from this thread, which owns no context then
+        if (threaded) {
+                std::cerr << "WARNING: the benchmark can't be run with --render-thread\n";
+                if (benchmarkQuit)
+                        QCoreApplication::quit();
+                return;
+        }
+
+        bool wasSoftware = softwareMode;
+        bool wasHud = hudOn;
+        hudOn = false;
+
+        makeCurrent();
+        double msPerFrame[2];
+        for (int pass = 0; pass < 2; pass++) {
+                softwareMode = (pass == 1);
+
+                QElapsedTimer timer;
+                timer.start();
+                for (int i = 0; i < BENCHMARK_FRAMES; i++) {
+                        paintGL();
+                        glFinish();
+                }
+                msPerFrame[pass] = timer.nsecsElapsed() / 1000000.0 / BENCHMARK_FRAMES;
+        }
+
+        unsigned int triangles = software.TriangleCount();
+        const char *names[2] = { "GL ", "CPU" };
+        std::cout << "Benchmark: " << assetName.toLocal8Bit().constData() << ", "
+                  << triangles << " triangles, " << width() << "x" << height()
+                  << ", " << BENCHMARK_FRAMES << " frames each" << std::endl;
+        for (int pass = 0; pass < 2; pass++) {
+                std::cout << "  " << names[pass] << ": " << msPerFrame[pass]
+                          << " ms/frame, " << triangles / (msPerFrame[pass] * 1000.0)
+                          << " Mtri/s" << std::endl;
+        }
+
+        FrameState state;
+        makeState( state );
+        if (!software.Render( softwareFrame( state ) ).save( "softrender.png" ))
+                std::cerr << "WARNING: could not write softrender.png\n";
+
+        benchmarkSubmission();
+        benchmarkCulling();
+
+        softwareMode = wasSoftware;
+        hudOn = wasHud;
+        requestFrame();
+
+        if (benchmarkQuit)
+                QCoreApplication::quit();
+}
+
+/*
+ * CPU cost of handing the model to GL as more and more ranges, for each
+ * way of submitting them. The model is cut into equal ranges (as if that
+ * many clusters survived culling) and drawn from the current view; only
+ * the submitting is timed on the CPU, the whole frame is timed with a
+ * glFinish() after it.
+ */
+void GLWidget::benchmarkSubmission( void )
+{
+        unsigned int triangles = asset->GetTriangleCount();
+        if (asset->OutOfCore() || triangles == 0)
+                return;
+
+        Asset3ds::SubmitMode wasSubmit = asset->GetSubmitMode();
+        static const unsigned int rangeCounts[] = { 1, 16, 256, 4096, 16384 };
+
+        std::cout << "Submission (CPU us to submit / ms per frame):" << std::endl;
+        for (unsigned int r = 0; r < sizeof(rangeCounts) / sizeof(rangeCounts[0]); r++) {
+                unsigned int count = rangeCounts[r];
+                if (count > triangles)
+                        break;
+
+                DrawRanges ranges;
+                ranges.clustersTested = ranges.clustersVisible = count;
+                unsigned int per = triangles / count;
+                for (unsigned int i = 0; i < count; i++) {
+                        unsigned int first = i * per;
+                        unsigned int last = (i + 1 == count) ? triangles : first + per;
+                        ranges.firstIndex.push_back( first * 3 );
+                        ranges.indexCount.push_back( (last - first) * 3 );
+                }
+
+                std::cout << "  " << count << (count == 1 ? " range: " : " ranges: ");
+                for (int mode = Asset3ds::PerRangeSubmit; mode <= Asset3ds::IndirectSubmit; mode++) {
+                        Asset3ds::SubmitMode submit = (Asset3ds::SubmitMode) mode;
+                        if (mode > Asset3ds::PerRangeSubmit)
+                                std::cout << ", ";
+                        std::cout << Asset3ds::SubmitName( submit );
+                        if (!asset->SubmitSupported( submit )) {
+                                std::cout << " n/a";
+                                continue;
+                        }
+
+                        asset->SetSubmitMode( submit );
+                        asset->Draw( ranges );          // first use sets things up
+                        glFinish();
+
+                        qint64 submitNs = 0;
+                        QElapsedTimer frame;
+                        frame.start();
+                        for (int i = 0; i < BENCHMARK_FRAMES; i++) {
+                                QElapsedTimer timer;
+                                timer.start();
+                                asset->Draw( ranges );
+                                submitNs += timer.nsecsElapsed();
+                                glFinish();
+                        }
+                        std::cout << " " << submitNs / 1000 / BENCHMARK_FRAMES << " us / "
+                                  << frame.nsecsElapsed() / 1000000.0 / BENCHMARK_FRAMES << " ms";
+                }
+                std::cout << std::endl;
+        }
 
-        updateGL();
+        asset->SetSubmitMode( wasSubmit );
+}
+
+/*
+ * Meshlet culling on the CPU against the compute shader, for more and more
+ * made-up meshlets (spheres scattered through the model's box, seen from
+ * the current view). CPU times are for MeshletBounds::Cull(), GPU times
+ * are for GpuCuller::Cull() up to a glFinish(). Both report how many got
+ * through, which should match (without occlusion).
+ */
+void GLWidget::benchmarkCulling( void )
+{
+        float min[3], max[3];
+        if (!asset->GetBounds( min, max ))
+                return;
+
+        FrameState state;
+        makeState( state );
+        CullView view = MakeCullView( state.view, state.projection, !state.perspective );
+
+        float size = 0.0f;
+        for (int a = 0; a < 3; a++)
+                size = qMax( size, max[a] - min[a] );
+
+        static const unsigned int objectCounts[] = { 1024, 16384, 131072, 1048576 };
+        unsigned int seed = 12345;
+
+        std::cout << "Culling (ms per cull, visible):" << std::endl;
+        for (unsigned int c = 0; c < sizeof(objectCounts) / sizeof(objectCounts[0]); c++) {
+                unsigned int count = objectCounts[c];
+
+                Mesh mesh;
+                mesh.meshlets.resize( count );
+                std::vector<GpuCullObject> objects( count );
+                for (unsigned int i = 0; i < count; i++) {
+                        Meshlet &m = mesh.meshlets[i];
+                        for (int a = 0; a < 3; a++) {
+                                seed = seed * 1664525u + 1013904223u;
+                                m.center[a] = min[a] + (max[a] - min[a]) * (seed >> 8) / 16777216.0f;
+                                m.coneAxis[a] = (a == 2) ? 1.0f : 0.0f;
+                        }
+                        m.radius = 0.01f * size;
+                        m.coneCutoff = 1.0f;
+                        m.firstIndex = i * 3;
+                        m.indexCount = 3;
+                        m.vertexCount = 3;
+
+                        GpuCullObject &o = objects[i];
+                        memcpy( o.center, m.center, sizeof(o.center) );
+                        o.radius = m.radius;
+                        memcpy( o.coneAxis, m.coneAxis, sizeof(o.coneAxis) );
+                        o.coneCutoff = m.coneCutoff;
+                        o.firstIndex = m.firstIndex;
+                        o.indexCount = m.indexCount;
+                        o.pad[0] = o.pad[1] = 0;
+                }
+
+                MeshletBounds bounds;
+                bounds.Add( mesh, 0, 0 );
+                DrawRanges ranges;
+                QElapsedTimer timer;
+                timer.start();
+                for (int i = 0; i < BENCHMARK_FRAMES; i++)
+                        bounds.Cull( view, ranges );
+                std::cout << "  " << count << " objects: CPU "
+                          << timer.nsecsElapsed() / 1000000.0 / BENCHMARK_FRAMES << " ms, "
+                          << ranges.clustersVisible;
+
+                if (!gpuCuller.Ready()) {
+                        std::cout << ", GPU n/a" << std::endl;
+                        continue;
+                }
+
+                GLBuffer buffer;
+                buffer.Create( GL_ARRAY_BUFFER, GpuOther, sizeof(GpuCullObject) * count,
+                               &objects[0], GL_STATIC_DRAW );
+                glBindBuffer( GL_ARRAY_BUFFER, 0 );
+                gpuCuller.DropPyramid();
+                gpuCuller.Cull( buffer.Name(), count, view, false );   // sets things up
+                glFinish();
+
+                timer.start();
+                for (int i = 0; i < BENCHMARK_FRAMES; i++) {
+                        gpuCuller.Cull( buffer.Name(), count, view, false );
+                        glFinish();
+                }
+                std::cout << ", GPU " << timer.nsecsElapsed() / 1000000.0 / BENCHMARK_FRAMES
+                          << " ms, " << gpuCuller.LastVisible() << std::endl;
+        }
+}
+
+/*
+ * Everything the CPU renderer needs to draw what GL would draw right now
+ */
+SoftFrame GLWidget::softwareFrame( const FrameState &state )
+{
+        SoftFrame frame;
+        frame.width = state.width;
+        frame.height = state.height;
+        glGetIntegerv( GL_VIEWPORT, frame.viewport );
+        memcpy( frame.modelview, state.view, sizeof(frame.modelview) );
+        memcpy( frame.projection, state.projection, sizeof(frame.projection) );
+
+        QColor clear = state.lights[0] ? qtDark.light() : qtDark.dark();
+        frame.clearColor[0] = clear.redF();
+        frame.clearColor[1] = clear.greenF();
+        frame.clearColor[2] = clear.blueF();
+
+        const GLfloat *positions[SOFT_MAX_LIGHTS] = { roomLightPos, rightLightPos, leftLightPos };
+        const GLfloat *colors[SOFT_MAX_LIGHTS] = { whiteLight, state.auxColor, state.axxColor };
+
+        for (unsigned int l = 0; l < SOFT_MAX_LIGHTS; l++) {
+                frame.lights[l].enabled = state.lights[l];
+                memcpy( frame.lights[l].position, positions[l], sizeof(GLfloat) * 4 );
+                memcpy( frame.lights[l].diffuse, colors[l], sizeof(GLfloat) * 4 );
+        }
+
+        if (!softwareReady) {
+                software.SetGeometry( asset->GetMeshes() );
+                softwareReady = true;
+        }
+        return frame;
+}
+
+/*
+ * Show or hide the frame timing overlay. While it's up, every frame
+ * waits for the GPU to finish so the number is the real frame cost.
+ */
+void GLWidget::toggleHud( void )
+{
+        hudOn = !hudOn;
+        requestFrame();
+}
+
+/*
+ * Light grids for checking materials: perSide^3 point lights spread over
+ * the model's box (as many as the light manager can take). The renderer
+ * builds them when it sees the new size.
+ */
+void GLWidget::setLightGrid( int perSide )
+{
+        lightGrid = qMax( perSide, 0 );
+        requestFrame();
+}
+
+void GLWidget::clearLights( void )
+{
+        setLightGrid( 0 );
+}
+
+// Forward+: each pixel only looks at the lights binned into its tile
+void GLWidget::setTiledLighting( bool on )
+{
+        tiledLighting = on;
+        requestFrame();
+}
+
+// Color the model by how many lights each tile has
+void GLWidget::setTileHeatmap( bool on )
+{
+        tileHeatmap = on;
+        requestFrame();
+}
+
+// Shadow map preset from the panel
+void GLWidget::setShadowQuality( int quality )
+{
+        if (quality < 0 || quality >= SHADOW_QUALITIES)
+                return;
+        shadowQuality = (ShadowQuality) quality;
+        requestFrame();
+}
+
+/*
+ * (Render side) Replace the spawned lights with a perSide^3 grid. The
+ * positions are kept in model space so the grid stays put on the model;
+ * placeGridLights() moves them into eye space every frame.
+ */
+void GLWidget::buildLightGrid( int perSide )
+{
+        renderLightGrid = perSide;
+        lightManager.Truncate( FIXED_LIGHTS );
+        gridLights.clear();
+
+        float min[3], max[3];
+        if (perSide <= 0 || !asset->GetBounds( min, max ))
+                return;
+
+        // A little past the box so the outside of the model gets lit too
+        float size = 0.0;
+        for (int k = 0; k < 3; k++)
+                size = qMax( size, max[k] - min[k] );
+        for (int k = 0; k < 3; k++) {
+                min[k] -= 0.1 * size;
+                max[k] += 0.1 * size;
+        }
+        size *= 1.2;
+
+        float spacing = (perSide > 1) ? size / (perSide - 1) : size;
+        gridRange = qMax( GRID_LIGHT_RANGE * spacing, 1e-6f );
+
+        for (int z = 0; z < perSide; z++) {
+                for (int y = 0; y < perSide; y++) {
+                        for (int x = 0; x < perSide; x++) {
+                                if (lightManager.Count() >= MAX_LIGHTS)
+                                        return;
+
+                                int at[3] = { x, y, z };
+                                float position[4] = { 0.0, 0.0, 0.0, 1.0 };
+                                for (int k = 0; k < 3; k++) {
+                                        position[k] = (perSide > 1)
+                                                ? min[k] + (max[k] - min[k]) * at[k] / (perSide - 1)
+                                                : 0.5 * (min[k] + max[k]);
+                                }
+
+                                // Spread the hues out (golden ratio steps)
+                                unsigned int n = gridLights.size() / 3;
+                                QColor hue = QColor::fromHsvF( fmod( 0.618034 * n, 1.0 ), 0.7, 1.0 );
+                                float diffuse[4] = { GRID_LIGHT_LEVEL * hue.redF(),
+                                                     GRID_LIGHT_LEVEL * hue.greenF(),
+                                                     GRID_LIGHT_LEVEL * hue.blueF(), 1.0 };
+
+                                gridLights.insert( gridLights.end(), position, position + 3 );
+                                lightManager.Add( position, diffuse, gridRange );
+                        }
+                }
+        }
+}
+
+/*
+ * (Render side) Grid lights from model space to eye space for this view.
+ * Only changes anything (and costs an upload) when the camera moved.
+ */
+void GLWidget::placeGridLights( const float view[16] )
+{
+        // The view scales the model, the lights' reach has to scale with it
+        float scale = sqrt( view[0] * view[0] + view[1] * view[1] + view[2] * view[2] );
+
+        unsigned int count = gridLights.size() / 3;
+        for (unsigned int i = 0; i < count; i++) {
+                const float *p = &gridLights[i * 3];
+                float eye[4];
+                for (int r = 0; r < 3; r++)
+                        eye[r] = view[r] * p[0] + view[4 + r] * p[1] + view[8 + r] * p[2] + view[12 + r];
+                eye[3] = 1.0;
+
+                lightManager.SetPosition( FIXED_LIGHTS + i, eye );
+                lightManager.SetRange( FIXED_LIGHTS + i, gridRange * scale );
+        }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+//  Frame snapshots and the render thread
+//////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Copy everything a frame needs out of the widget. This (and the rest of
+ * the GUI side) never touches GL.
+ */
+void GLWidget::makeState( FrameState &state )
+{
+        memcpy( state.view, camera.ViewMatrix(), sizeof(state.view) );
+        memcpy( state.projection, camera.ProjectionMatrix(), sizeof(state.projection) );
+        state.cameraVersion = camera.Version();
+        state.projectionVersion = camera.ProjectionVersion();
+        state.perspective = camera.Perspective();
+
+        state.lights[0] = ambientLight;
+        state.lights[1] = flashlightOn;
+        state.lights[2] = oppositeOn;
+        memcpy( state.auxColor, auxColor, sizeof(state.auxColor) );
+        memcpy( state.axxColor, axxColor, sizeof(state.axxColor) );
+
+        state.clusterCulling = clusterCulling;
+        state.gpuCulling = gpuCulling;
+        state.occlusionCulling = occlusionCulling;
+        state.softwareMode = softwareMode;
+        state.hudOn = hudOn;
+        state.debugViews = debugViews;
+        state.recording = recordingWanted;
+        state.captureFormat = captureFormat;
+        state.lightGrid = lightGrid;
+        state.tiledLighting = tiledLighting;
+        state.tileHeatmap = tileHeatmap;
+        state.shadowQuality = shadowQuality;
+
+        state.width = width();
+        state.height = height();
+        state.inputEvents = input.EventsReceived();
+        state.inputUpdates = input.UpdatesApplied();
+
+        // The input waiting for a frame is in this one now
+        state.inputTime = pendingInput;
+        pendingInput = -1;
+}
+
+/*
+ * Get a new frame on the screen. Without the render thread that's just
+ * updateGL(); with it, the newest snapshot is handed over and the thread
+ * is woken up (it skips any snapshots it didn't get to in time).
+ */
+void GLWidget::requestFrame( void )
+{
+        if (!threaded) {
+                updateGL();
+                return;
+        }
+
+        makeState( states.Back() );
+        states.Publish();
+        renderThread->RequestFrame();
+}
+
+void GLWidget::paintEvent( QPaintEvent *event )
+{
+        if (threaded)
+                requestFrame();
+        else
+                QGLWidget::paintEvent( event );
+}
+
+// The render thread calls resizeGL() itself when a snapshot's size changes
+void GLWidget::resizeEvent( QResizeEvent *event )
+{
+        if (threaded)
+                requestFrame();
+        else
+                QGLWidget::resizeEvent( event );
+}
+
+/*
+ * Once the window is up, give the context to the render thread and start
+ * it. From here on the GUI thread never makes the context current.
+ */
+void GLWidget::showEvent( QShowEvent *event )
+{
+        QGLWidget::showEvent( event );
+        if (!threaded || renderThread->isRunning())
+                return;
+
+        doneCurrent();
+#if QT_VERSION >= 0x040800
+        context()->moveToThread( renderThread );
+#endif
+        renderThread->start();
+        requestFrame();
+}
+
+// On the render thread: everything initializeGL() usually does
+void GLWidget::startRendering( void )
+{
+        makeCurrent();
+        initializeGL();
+}
+
+/*
+ * On the render thread: draw the newest snapshot and show it
+ */
+void GLWidget::renderNextFrame( void )
+{
+        if (!states.Update())
+                return;             // woken up with nothing new
+
+        const FrameState &state = states.Front();
+        if (state.width != renderWidth || state.height != renderHeight) {
+                renderWidth = state.width;
+                renderHeight = state.height;
+                resizeGL( renderWidth, renderHeight );
+        }
+
+        renderFrame( state );
+        swapBuffers();
+        measureLatency( state );
+}
+
+/*
+ * On the render thread, as it quits: let go of everything that needs the
+ * context and give the context back to the GUI thread
+ */
+void GLWidget::stopRendering( void )
+{
+        occlusion.Reset();
+        gpuCuller.Reset();
+        debugOverlay.Reset();
+        lightManager.Reset();
+        shadows.Reset();
+        capture.Stop();
+
+        doneCurrent();
+#if QT_VERSION >= 0x040800
+        context()->moveToThread( qApp->thread() );
+#endif
+}
+
+/*
+ * How long the oldest input in a frame took to get to the screen (to the
+ * buffer swap with the render thread, to the end of paintGL() without)
+ */
+void GLWidget::measureLatency( const FrameState &state )
+{
+        if (state.inputTime < 0)
+                return;
+
+        double ms = (input.Now() - state.inputTime) / 1000.0;
+        latencyMs = (latencyCount == 0) ? ms : 0.9 * latencyMs + 0.1 * ms;
+        latencyMaxMs = qMax( latencyMaxMs, ms );
+        latencyTotalMs += ms;
+        latencyCount++;
 }
 
 
@@ -422,60 +1202,106 @@ void GLWidget::initializeGL()
         glEnable( GL_CULL_FACE );
         glShadeModel( GL_SMOOTH );
 
+        // A new context has none of the camera's matrices yet
+        loadedProjection = 0;
+
         // Need these options to enable light sources
         // (can do GL_LIGHT0, 1, ..., n sources)
         glEnable( GL_LIGHTING );
-        glEnable( GL_LIGHT0 );            // The stationary "room" light
-        glEnable( GL_LIGHT1 );            // The recoloarable light
-        glEnable( GL_LIGHT2 );            // Another light (why not?)
         glEnable( GL_MULTISAMPLE );       // Use hardware to smooth edges!
                                           // (may not work on all platforms)
 
         // Old light setting (in case we want it back)
         //static GLfloat lightPosition[4] = { 0.5, 5.0, 7.0, 7.0 };
 
-        // Setup the room's light position. This will be a constant.
-        //static GLfloat lightPosition[4] = { 0.0, 0.9, 0.5, 1.0 };
-        static GLfloat lightPosition[4] = { 0.0, 0.0, 1000.0, 1.0 };
-        glLightfv( GL_LIGHT0, GL_POSITION, lightPosition );
-
-        // Initialize the side lights
-        static GLfloat flPos[4] = { 1000.0, 0.0, 0.1, 0.0 };
-        glLightfv( GL_LIGHT1, GL_POSITION, flPos );
+        // The lights themselves (the room light, the recolorable light
+        // and its opposite) are sent by the light manager at the first
+        // frame, through the uniform block shader if GL can do it
+        lightManager.Init( shadedLights );
 
-        static GLfloat llPos[4] = { -1000.0, 0.0, 0.1, 0.0 };
-        glLightfv( GL_LIGHT2, GL_POSITION, llPos );
+        // Meshlets are culled in a compute shader if GL has them
+        gpuCuller.Init();
+        debugOverlay.Init();
 
         // Create the vertex buffer array with the object!
         // NOTE: This fails unless you have the proper context first.
 
         asset->CreateVBO();
 
+        // The camera is the GUI thread's, so it's fitted over there
+        float center[3] = { 0.0f, 0.0f, 0.0f }, radius;
+        if (!asset->GetBoundingSphere( center, radius ))
+                radius = -1.0f;
+        emit modelBoundsReady( center[0], center[1], center[2], radius );
+
 #if TEXTURE_MODE_ON
         // The texture loading interface is very wonky still and
         // needs more debugging time. We've removed all calls and
         // interaction with the outside files that deal with them ... for now.
         loadGLTextures();
-        glBindTexture(GL_TEXTURE_2D, *(asset->GetTexCoordVBO()));
+        glBindTexture(GL_TEXTURE_2D, asset->GetTexture());
 #endif
 }
 
 // Basically the redraw call back from GLUT
 void GLWidget::paintGL()
 {
-        glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
-        glLoadIdentity();
+        FrameState state;
+        makeState( state );
+        renderFrame( state );
+        measureLatency( state );
+}
+
+/*
+ * Draw a frame. Everything the GUI side can change comes from the
+ * snapshot, the rest (the asset, culling results, the capture) belongs
+ * to whichever thread is doing the drawing.
+ */
+void GLWidget::renderFrame( const FrameState &state )
+{
+        frameClock.start();
+        framesDrawn++;
+
+        // Lights and background as the panel has them
+        // (only the lights that changed go to GL)
+        qglClearColor( state.lights[0] ? qtDark.light() : qtDark.dark() );
+        for (int l = 0; l < 3; l++)
+                lightManager.SetEnabled( l, state.lights[l] );
+        lightManager.SetDiffuse( 1, state.auxColor );
+        lightManager.SetDiffuse( 2, state.axxColor );
+        if (state.lightGrid != renderLightGrid)
+                buildLightGrid( state.lightGrid );
+        placeGridLights( state.view );
+        lightManager.SetTiled( state.tiledLighting );
+        lightManager.SetHeatmap( state.tileHeatmap );
+        lightManager.Apply();
+
+        // Start or stop recording if the panel has asked since last time
+        if (state.recording != recordingStarted) {
+                recordingStarted = state.recording;
+                if (state.recording)
+                        capture.Start( "capture", state.captureFormat );
+                else
+                        capture.Stop();
+                emit recordingChanged( capture.Recording() );
+        }
 
-        glTranslatef( xPos, yPos, zPos );
-        glRotatef( xRot / 16.0, 1.0, 0.0, 0.0 );
-        glRotatef( yRot / 16.0, 0.0, 1.0, 0.0 );
-        glRotatef( zRot / 16.0, 0.0, 0.0, 1.0 );
+        // Occlusion culling was just turned off: forget the old results
+        if (occlusionWasOn && !state.occlusionCulling)
+                occlusion.Reset();
+        occlusionWasOn = state.occlusionCulling;
 
-        // Now we can scale the scene we load, in case it's huge/tiny.
-        glScalef( scaleFactor, scaleFactor, scaleFactor );
+        glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
 
-        glLightfv( GL_LIGHT1, GL_DIFFUSE, auxColor );
-        glLightfv( GL_LIGHT2, GL_DIFFUSE, axxColor );
+        // The camera only rebuilds its matrices when it has been moved,
+        // and the projection only goes to GL when it has changed
+        if (loadedProjection != state.projectionVersion) {
+                glMatrixMode( GL_PROJECTION );
+                glLoadMatrixf( state.projection );
+                glMatrixMode( GL_MODELVIEW );
+                loadedProjection = state.projectionVersion;
+        }
+        glLoadMatrixf( state.view );
 
 /*
         // Have the logo redraw itself based on the new rotations!
@@ -486,12 +1312,370 @@ void GLWidget::paintGL()
         // This is where we'll put the textures on
         glEnable(GL_TEXTURE_2D);
 #endif
-        // Have the asset redraw!
-        asset->Draw();
+        // The CPU renderer draws the whole frame itself and we just
+        // copy the picture into our framebuffer
+        if (state.softwareMode) {
+                software.Render( softwareFrame( state ) );
+
+                glPushAttrib( GL_ENABLE_BIT | GL_DEPTH_BUFFER_BIT );
+                glDisable( GL_DEPTH_TEST );
+                glDisable( GL_LIGHTING );
+                glDisable( GL_TEXTURE_2D );
+                glDepthMask( GL_FALSE );
+                glPixelStorei( GL_UNPACK_ROW_LENGTH, software.Stride() );
+                glWindowPos2i( 0, 0 );
+                glDrawPixels( state.width, state.height, GL_BGRA, GL_UNSIGNED_BYTE,
+                              software.GLOrderPixels() );
+                glPixelStorei( GL_UNPACK_ROW_LENGTH, 0 );
+                glPopAttrib();
+
+                finishFrame( state );
+                return;
+        }
+
+        // Anything over the GPU memory budget that wasn't used last frame
+        // goes, and the model comes back if it was one of them
+        GpuMemory::Enforce();
+        asset->RestoreGpu();
+
+        // Where the camera is as seen from the model (for culling),
+        // only worked out again when the camera has moved
+        if (cullVersion != state.cameraVersion) {
+                cullView = MakeCullView( state.view, state.projection, !state.perspective );
+                cullVersion = state.cameraVersion;
+        }
+        const CullView &view = cullView;
+
+        // Meshlets culled on the GPU are tested against a depth pyramid
+        // of last frame instead of the occlusion queries
+        bool gpuCull = state.clusterCulling && state.gpuCulling && gpuCuller.Ready()
+                       && !asset->OutOfCore() && asset->GetObjectCount() > 0;
+
+        // Meshes whose boxes were hidden last frame get skipped (there
+        // are no meshes to test when the model is streamed in chunks)
+        const std::vector<char> *meshVisible = NULL;
+        bool occlusionOn = state.occlusionCulling && !asset->OutOfCore() && !gpuCull;
+        if (occlusionOn) {
+                occlusion.CollectResults( *asset );
+                meshVisible = &occlusion.Visible();
+        }
+
+        // A streamed model picks (and uploads) this view's chunks first,
+        // so the shadow maps see what's on the GPU this frame
+        if (asset->OutOfCore())
+                asset->Stream( view );
+
+        // Have the asset redraw! With culling on, only the meshlets that
+        // can be seen from here are drawn (tested in model space).
+        updateShadows( state );
+        lightManager.Bin( state.projection, viewportRect );
+        lightManager.Begin();
+        if (lightManager.Shaded()) {
+                int slots[SHADOW_LIGHTS];
+                for (unsigned int l = 0; l < SHADOW_LIGHTS; l++)
+                        slots[l] = lightManager.PackedIndex( l );
+                shadows.Bind( lightManager.Program(), slots );
+        }
+        if (asset->OutOfCore()) {
+                // Chunks were culled by the stream, a chunk at a time
+                asset->Draw();
+        } else if (gpuCull) {
+                // Culled and compacted into draw commands without
+                // coming back to the CPU
+                gpuCuller.Cull( asset->GetObjectBuffer(), asset->GetObjectCount(),
+                                view, state.occlusionCulling );
+                asset->DrawCommands( gpuCuller.CommandBuffer(), gpuCuller.CountBuffer(),
+                                     gpuCuller.MaxCommands() );
+        } else if (state.clusterCulling) {
+                asset->Cull( view, drawRanges, meshVisible );
+                asset->Draw( drawRanges );
+        } else if (meshVisible) {
+                asset->MeshRanges( *meshVisible, drawRanges );
+                asset->Draw( drawRanges );
+        } else {
+                asset->Draw();
+        }
+        lightManager.End();
+
+        // Test everything against this frame's depth for the next frame
+        if (occlusionOn)
+                occlusion.IssueQueries( *asset, view );
+        if (gpuCull && state.occlusionCulling)
+                gpuCuller.BuildPyramid( viewportRect, state.view, state.projection );
+        else
+                gpuCuller.DropPyramid();
+        if (gpuCull && state.hudOn)
+                gpuVisible = gpuCuller.LastVisible();
+
+        // Wireframe and normals come from one more pass over what was
+        // just drawn, normals a few percent of the model's size long
+        float center[3], radius;
+        if (!asset->GetBoundingSphere( center, radius ))
+                radius = 0.0f;
+        float scale = sqrt( state.view[0] * state.view[0] + state.view[1] * state.view[1]
+                            + state.view[2] * state.view[2] );
+        if (debugOverlay.Begin( state.debugViews, viewportRect, 0.02f * radius * scale )) {
+                redrawModel( state, gpuCull, meshVisible );
+                debugOverlay.End();
+        }
+        if (state.debugViews & DebugViews::BoundingBoxes)
+                debugOverlay.DrawBoxes( *asset );
 #if TEXTURE_MODE_ON
         // Reset the texture state
         glDisable(GL_TEXTURE_2D);
 #endif
+
+        finishFrame( state );
+}
+
+/*
+ * End of frame bookkeeping: timing and the overlay
+ */
+void GLWidget::finishFrame( const FrameState &state )
+{
+        // Read the frame back before the overlay goes on top of it. If
+        // that ended the recording the panel's button has to come back
+        // up (which turns recordingWanted off in turn).
+        if (!capture.Capture( state.width, state.height ))
+                emit recordingChanged( false );
+
+        if (!state.hudOn) {
+                frameMs = 0.0;          // start averaging afresh next time
+                return;
+        }
+
+        // Wait for the GPU so we time the whole frame, not just
+        // how long it took us to queue up the commands
+        glFinish();
+        double ms = frameClock.nsecsElapsed() / 1000000.0;
+        frameMs = (frameMs == 0.0) ? ms : 0.9 * frameMs + 0.1 * ms;
+        frameTotalMs += ms;
+        frameCount++;
+
+        // Every so often, tell the panel what the shadow presets cost
+        if (!state.softwareMode && lightManager.Shaded()) {
+                shadowMs[state.shadowQuality] += ms;
+                shadowFrames[state.shadowQuality]++;
+                if (shadowFrames[state.shadowQuality] % 30 == 0)
+                        emit shadowCostsChanged( shadowCosts() );
+        }
+        drawHud( state );
+}
+
+/*
+ * (Render side) Bring the shadow maps of the lights that are on up to
+ * date. Only maps whose light has moved relative to the model are drawn
+ * again (see shadows.hpp); the fixed function path has no shadows.
+ */
+void GLWidget::updateShadows( const FrameState &state )
+{
+        if (!lightManager.Shaded())
+                return;
+
+        static const GLfloat *positions[SHADOW_LIGHTS] = {
+                roomLightPos, rightLightPos, leftLightPos
+        };
+        const float *on[SHADOW_LIGHTS];
+        for (unsigned int l = 0; l < SHADOW_LIGHTS; l++)
+                on[l] = state.lights[l] ? positions[l] : NULL;
+
+        shadows.SetQuality( state.shadowQuality );
+        shadows.Update( *asset, state.view, on, viewportRect );
+}
+
+/*
+ * (Render side) The same draw the frame's culling picked, without culling
+ * again: the ranges, the GPU's commands or the stream's chunks are all
+ * still there from the first time.
+ */
+void GLWidget::redrawModel( const FrameState &state, bool gpuCull,
+                            const std::vector<char> *meshVisible )
+{
+        if (gpuCull)
+                asset->DrawCommands( gpuCuller.CommandBuffer(), gpuCuller.CountBuffer(),
+                                     gpuCuller.MaxCommands() );
+        else if (!asset->OutOfCore() && (state.clusterCulling || meshVisible))
+                asset->Draw( drawRanges );
+        else
+                asset->Draw();
+}
+
+/*
+ * Average timed frame per shadow preset, e.g. "Off 1.20 ms, Low -, ..."
+ */
+QString GLWidget::shadowCosts( void ) const
+{
+        static const char *names[SHADOW_QUALITIES] = { "Off", "Low", "Medium", "High" };
+
+        QStringList costs;
+        for (int q = 0; q < SHADOW_QUALITIES; q++) {
+                if (shadowFrames[q] == 0)
+                        costs << QString( "%1 -" ).arg( names[q] );
+                else
+                        costs << QString( "%1 %2 ms" ).arg( names[q] )
+                                        .arg( shadowMs[q] / shadowFrames[q], 0, 'f', 2 );
+        }
+        return costs.join( ", " );
+}
+
+/*
+ * What the overlay says, one line each
+ */
+QStringList GLWidget::hudLines( const FrameState &state )
+{
+        QString format = (asset->GetVertexFormat() == Asset3ds::CompactVertices)
+                         ? "compact" : "float";
+        if (state.softwareMode)
+                format = "CPU renderer";
+
+        QStringList lines;
+        lines << QString( "Frame: %1 ms" ).arg( frameMs, 0, 'f', 2 );
+        lines << QString( "Vertices: %1 KiB (%2)" )
+                        .arg( asset->GetVertexBytes() / 1024 ).arg( format );
+
+        unsigned int objects = asset->GetObjectCount();
+        bool gpuCull = state.clusterCulling && state.gpuCulling && gpuCuller.Ready()
+                       && !asset->OutOfCore() && objects > 0;
+        if (gpuCull && !state.softwareMode) {
+                lines << QString( "Clusters: %1 / %2 drawn (%3% culled), culled on the GPU" )
+                                .arg( gpuVisible )
+                                .arg( objects )
+                                .arg( 100.0 * (objects - gpuVisible) / objects, 0, 'f', 1 );
+        } else if (state.clusterCulling && !state.softwareMode && drawRanges.clustersTested > 0) {
+                unsigned int culled = drawRanges.clustersTested - drawRanges.clustersVisible;
+                Asset3ds::SubmitMode submit = asset->GetSubmitMode();
+                if (!asset->SubmitSupported( submit ))
+                        submit = Asset3ds::MultiDrawSubmit;
+                lines << QString( "Clusters: %1 / %2 drawn (%3% culled), %4 draws (%5)" )
+                                .arg( drawRanges.clustersVisible )
+                                .arg( drawRanges.clustersTested )
+                                .arg( 100.0 * culled / drawRanges.clustersTested, 0, 'f', 1 )
+                                .arg( drawRanges.firstIndex.size() )
+                                .arg( Asset3ds::SubmitName( submit ) );
+        }
+
+        const ChunkStream *stream = asset->GetStream();
+        if (stream != NULL && !state.softwareMode) {
+                lines << QString( "Chunks: %1 / %2 in view, drawn %3 / %4 / %5 by LOD, %6 waiting" )
+                                .arg( stream->Visible() )
+                                .arg( stream->Count() )
+                                .arg( stream->Drawn( 0 ) )
+                                .arg( stream->Drawn( 1 ) )
+                                .arg( stream->Drawn( 2 ) )
+                                .arg( stream->Waiting() );
+                lines << QString( "Streamed: RAM %1 / %2 MiB, VRAM %3 / %4 MiB" )
+                                .arg( stream->RamBytes() / 1048576.0, 0, 'f', 1 )
+                                .arg( stream->RamBudget() / 1048576 )
+                                .arg( stream->VramBytes() / 1048576.0, 0, 'f', 1 )
+                                .arg( stream->VramBudget() / 1048576 );
+        }
+
+        if (state.occlusionCulling && !state.softwareMode && stream == NULL) {
+                lines << QString( "Occlusion: %1 / %2 meshes hidden" )
+                                .arg( occlusion.HiddenCount() )
+                                .arg( asset->GetMeshCount() );
+        }
+
+        if (capture.Recording()) {
+                lines << QString( "Recording: %1 frames, %2 failed, %3 late, %4 dropped" )
+                                .arg( capture.FramesWritten() )
+                                .arg( capture.FramesFailed() )
+                                .arg( capture.FramesLate() )
+                                .arg( capture.FramesDropped() );
+        }
+
+        if (!state.softwareMode) {
+                lines << QString( "Lights: %1 / %2 on, %3 updates, %4 KiB sent (%5)" )
+                                .arg( lightManager.EnabledCount() )
+                                .arg( lightManager.Count() )
+                                .arg( lightManager.Uploads() )
+                                .arg( lightManager.BytesUploaded() / 1024.0, 0, 'f', 1 )
+                                .arg( lightManager.Shaded() ? "uniform buffer" : "fixed function" );
+        }
+
+        if (!state.softwareMode && lightManager.Tiled()) {
+                lines << QString( "Tiles: %1 x %2, %3 lights max, %4 average" )
+                                .arg( lightManager.TilesX() )
+                                .arg( lightManager.TilesY() )
+                                .arg( lightManager.TileMaxLights() )
+                                .arg( lightManager.TileAverageLights(), 0, 'f', 1 );
+        }
+
+        if (!state.softwareMode && lightManager.Shaded() && state.shadowQuality != ShadowsOff) {
+                lines << QString( "Shadows: %1^2, %2 taps, %3 maps drawn (%4 this frame)" )
+                                .arg( ShadowMaps::MapSize( state.shadowQuality ) )
+                                .arg( ShadowMaps::FilterTaps( state.shadowQuality ) )
+                                .arg( shadows.Renders() )
+                                .arg( shadows.LastRenders() );
+        }
+
+        QString gpu = QString( "GPU: %1 MiB (vertex %2, index %3, texture %4, other %5)" )
+                        .arg( GpuMemory::TotalBytes() / 1048576.0, 0, 'f', 1 )
+                        .arg( GpuMemory::Bytes( GpuVertex ) / 1048576.0, 0, 'f', 1 )
+                        .arg( GpuMemory::Bytes( GpuIndex ) / 1048576.0, 0, 'f', 1 )
+                        .arg( GpuMemory::Bytes( GpuTexture ) / 1048576.0, 0, 'f', 1 )
+                        .arg( GpuMemory::Bytes( GpuOther ) / 1048576.0, 0, 'f', 1 );
+        if (GpuMemory::Budget() > 0) {
+                gpu += QString( ", budget %1 MiB, %2 evicted" )
+                                .arg( GpuMemory::Budget() / 1048576 )
+                                .arg( GpuMemory::Evictions() );
+        }
+        lines << gpu;
+
+        lines << QString( "Input: %1 events -> %2 updates, %3 frames" )
+                        .arg( state.inputEvents )
+                        .arg( state.inputUpdates )
+                        .arg( framesDrawn );
+
+        if (latencyCount > 0) {
+                lines << QString( "Latency: %1 ms, %2 ms worst%3" )
+                                .arg( latencyMs, 0, 'f', 1 )
+                                .arg( latencyMaxMs, 0, 'f', 1 )
+                                .arg( threaded ? " (render thread)" : "" );
+        }
+        return lines;
+}
+
+/*
+ * Frame timing overlay. renderText() draws with the current color, so
+ * lighting has to be off for the text to show up white.
+ *
+ * renderText() is only safe on the GUI thread, so the render thread
+ * paints the text into an image instead and draws that as pixels.
+ */
+void GLWidget::drawHud( const FrameState &state )
+{
+        QStringList lines = hudLines( state );
+
+        if (!threaded) {
+                glDisable( GL_LIGHTING );
+                qglColor( Qt::white );
+                for (int i = 0; i < lines.size(); i++)
+                        renderText( 10, 20 + 16 * i, lines.at( i ) );
+                glEnable( GL_LIGHTING );
+                return;
+        }
+
+        QImage text( qMax( state.width, 1 ), 16 * lines.size() + 8,
+                     QImage::Format_ARGB32_Premultiplied );
+        text.fill( 0 );
+        QPainter painter( &text );
+        painter.setPen( Qt::white );
+        for (int i = 0; i < lines.size(); i++)
+                painter.drawText( 10, 20 + 16 * i, lines.at( i ) );
+        painter.end();
+        text = text.mirrored();         // GL wants the bottom row first
+
+        glPushAttrib( GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT );
+        glDisable( GL_LIGHTING );
+        glDisable( GL_DEPTH_TEST );
+        glDisable( GL_TEXTURE_2D );
+        glEnable( GL_BLEND );
+        glBlendFunc( GL_ONE, GL_ONE_MINUS_SRC_ALPHA );
+        glWindowPos2i( 0, state.height - text.height() );
+        glDrawPixels( text.width(), text.height(), GL_BGRA, GL_UNSIGNED_BYTE,
+                      text.constBits() );
+        glPopAttrib();
 }
 
 /*
@@ -504,49 +1688,52 @@ void GLWidget::resizeGL( int width, int height )
 {
         int side = qMin( width, height );
 
-        // Setting up the viewport
-        glViewport( (width - side) / 2, (height - side) / 2, side, side );
+        // Setting up the viewport (the projection is the camera's job
+        // and doesn't depend on the size, the view is always square)
+        viewportRect[0] = (width - side) / 2;
+        viewportRect[1] = (height - side) / 2;
+        viewportRect[2] = viewportRect[3] = side;
+        glViewport( viewportRect[0], viewportRect[1], side, side );
+}
 
-        glMatrixMode( GL_PROJECTION );
-        glLoadIdentity();
+/*
+ * Back the camera off (and size the orthographic view) so the whole model
+ * fits, and scale the movement keys and wheel to the size of the model.
+ * Uses the bounds from modelBoundsReady(), which comes once the asset's
+ * VBOs are built (that's when its bounds are worked out).
+ */
+void GLWidget::fitCamera( void )
+{
+        if (modelRadius < 0.0f) {
+                camera.SetPosition( 0.0, 0.0, -20.0 );
+                camera.SetOrthoSize( 5.0 );
+                return;
+        }
 
-        /*
-         * For perspective projection, since we aren't using GLUT, we need
-         * to do a conversion.  
-         * 
-         * This site helped:
-         
-        http://jleland.blogspot.com/2008/12/gluperspective-to-glfrustrumf.html
+        // Something a few hundred times smaller than a pixel is as good
+        // as a point, don't let it turn into a divide by zero
+        float radius = qMax( modelRadius, 1e-6f );
+        camera.SetTarget( modelCenter, radius );
 
-         */
-        GLfloat top, bottom, left, right;
-        GLfloat fov = 40, near = 0.1, far = 10000.0;
-        
-        if (perspectiveMode) {
-//                GLfloat aspect = (GLfloat) height / (GLfloat) width;
-                // Always make aspect ratio 0 to avoid nasty looking resizes
-                GLfloat aspect = 1.0;
-                top = tan( toRadians( fov ) ) * near;
-                bottom = -top;
-                left = aspect * bottom;
-                right = aspect * top;
-                
-                // See if we're running OpenGL ES and use the proper function
-#ifdef QT_OPENGL_ES_1
-                glFrustumf( left, right, bottom, top, near, far );
-#else
-                glFrustum( left, right, bottom, top, near, far );
-#endif
-                
-        } else {
-                // See if we're running OpenGL ES and use the proper function
-#ifdef QT_OPENGL_ES_1
-                glOrthof( ortho_left, ortho_right, ortho_top, ortho_bottom, near, far );
-#else
-                glOrtho( ortho_left, ortho_right, ortho_top, ortho_bottom, near, far );
-#endif
-        }
-        glMatrixMode( GL_MODELVIEW );
+        camera.SetPosition( 0.0, 0.0, -radius * FIT_MARGIN / sin( toRadians( FIELD_OF_VIEW ) ) );
+        camera.SetOrthoSize( radius * FIT_MARGIN );
+
+        // The steps were made for models about 10 units across
+        moveStep = radius / 10.0;
+}
+
+void GLWidget::setModelBounds( float x, float y, float z, float radius )
+{
+        modelCenter[0] = x;
+        modelCenter[1] = y;
+        modelCenter[2] = z;
+        modelRadius = radius;
+        fitCamera();
+
+        // Without the render thread this is called from initializeGL(),
+        // and the frame that's about to be drawn picks the fit up anyway
+        if (threaded)
+                requestFrame();
 }
 
 // Function is adapted from:
@@ -564,66 +1751,189 @@ void GLWidget::loadGLTextures()
         }
 
         t = QGLWidget::convertToGLFormat( b );
-        glGenTextures( 1, asset->GetTexCoordVBO() );
-        glBindTexture( GL_TEXTURE_2D, *(asset->GetTexCoordVBO()) );
+        GLTexture texture;
+        texture.Create();
 
         glTexImage2D( GL_TEXTURE_2D, 0, 3, t.width(), t.height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, t.bits() );
 //        glTexImage2D( GL_TEXTURE_2D, 0, 3, t.height(), t.width(), 0, GL_RGBA, GL_UNSIGNED_BYTE, t.bits() );
+        texture.SetBytes( t.width() * t.height() * 4 );
         glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
         glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
         glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+
+        // The asset owns it from here on
+        asset->SetTexture( texture );
 }
 
 /*
  * The time event will keep looking for updates to the motion key statuses
+ * and mouse drags. Everything that happened since the last tick is
+ * applied at once, scaled by how long it has actually been (so motion
+ * doesn't speed up or slow down with the timer or the frame rate), and
+ * then ONE frame is drawn for all of it.
  */
 void GLWidget::timerEvent( QTimerEvent *timer )
 {
+        float dt = motionClock.nsecsElapsed() / 1e9;
+        motionClock.start();
+        dt = qMin( dt, MAX_INPUT_STEP );
+
+        bool moved = false;
+
         /*
          * This area will control all possible directions of camera movement
          */
-        if (moveUp_) {
-                panVertical(-5.0);
-        } else if (moveDn_) {
-                panVertical(5.0);
-        } else if (moveLeft_) {
-                panHorizontal(5.0);
-        } else if (moveRight_){
-                panHorizontal(-5.0);
+        float vx = 0.0, vy = 0.0;
+        if (moveUp_)    vy -= PAN_SPEED;
+        if (moveDn_)    vy += PAN_SPEED;
+        if (moveLeft_)  vx += PAN_SPEED;
+        if (moveRight_) vx -= PAN_SPEED;
+
+        if (vx != 0.0 || vy != 0.0) {
+                camera.Move( vx * dt * moveStep, vy * dt * moveStep, 0.0 );
+                moved = true;
+        }
+
+        // Everything the mouse, wheel and sliders did since the last tick
+        InputFrame frame;
+        if (input.Take( frame )) {
+                bool rotated = false;
+                for (int k = 0; k < 3; k++) {
+                        if (frame.rotationSet[k] && frame.rotation[k] != camera.Rotation( k )) {
+                                camera.SetRotation( k, frame.rotation[k] );
+                                rotated = true;
+                        }
+                }
+
+                // All the drags as one rotation
+                if (frame.dragged) {
+                        float q[4];
+                        if (frame.buttons & Qt::LeftButton)
+                                arcball( frame.dragFrom, frame.dragTo, q );
+                        else
+                                twist( frame.dragFrom, frame.dragTo, q );
+                        camera.Rotate( q );
+                        rotated = true;
+                }
+
+                if (frame.zoom != 0.0) {
+                        if (!camera.Perspective())
+                                camera.SetOrthoSize( camera.OrthoSize() - frame.zoom * moveStep );
+                        else
+                                camera.Move( 0.0, 0.0, frame.zoom * moveStep );
+                }
+
+                if (rotated)
+                        emitRotations();
+                moved = true;
+
+                // Latency is timed from the first event that made it
+                // into a frame (skipped frames fold into the next one)
+                if (pendingInput < 0)
+                        pendingInput = frame.firstEvent;
         }
+
+        // Keep frames coming at the timer rate while recording
+        if (moved || recordingWanted)
+                requestFrame();
+}
+
+/*
+ * Let the sliders know where the camera's rotation ended up (the Window
+ * updates them without them signalling back)
+ */
+void GLWidget::emitRotations( void )
+{
+        emit xRotationChanged( camera.Rotation( 0 ) );
+        emit yRotationChanged( camera.Rotation( 1 ) );
+        emit zRotationChanged( camera.Rotation( 2 ) );
+}
+
+/*
+ * Where a point on the widget lands on a unit ball filling the view
+ * (Shoemake's arcball), or on its rim if it's outside
+ */
+void GLWidget::ballPoint( QPoint pos, float p[3] )
+{
+        float side = qMax( qMin( width(), height() ), 1 );
+        p[0] = (2.0 * pos.x() - width()) / side;
+        p[1] = (height() - 2.0 * pos.y()) / side;
+
+        float r2 = p[0] * p[0] + p[1] * p[1];
+        if (r2 <= 1.0) {
+                p[2] = sqrt( 1.0 - r2 );
+        } else {
+                float r = sqrt( r2 );
+                p[0] /= r;
+                p[1] /= r;
+                p[2] = 0.0;
+        }
+}
+
+/*
+ * The rotation that carries the ball from under one point to under the
+ * other (left button): the quaternion between the two ball points
+ */
+void GLWidget::arcball( QPoint from, QPoint to, float q[4] )
+{
+        float a[3], b[3];
+        ballPoint( from, a );
+        ballPoint( to, b );
+
+        // q = (a x b, 1 + a.b), normalized, is the rotation from a to b
+        q[0] = a[1] * b[2] - a[2] * b[1];
+        q[1] = a[2] * b[0] - a[0] * b[2];
+        q[2] = a[0] * b[1] - a[1] * b[0];
+        q[3] = 1.0 + a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+
+        float length = sqrt( q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3] );
+        if (length < 1e-6) {
+                q[0] = q[1] = q[2] = 0.0;
+                q[3] = 1.0;
+                return;
+        }
+        for (int k = 0; k < 4; k++)
+                q[k] /= length;
+}
+
+/*
+ * Right button: vertical motion tips the model about the screen's x axis
+ * and horizontal motion spins it about the axis pointing at the viewer
+ */
+void GLWidget::twist( QPoint from, QPoint to, float q[4] )
+{
+        float tip = toRadians( (to.y() - from.y()) * DEGREES_PER_PIXEL );
+        float spin = toRadians( (to.x() - from.x()) * DEGREES_PER_PIXEL );
+
+        float qx[4] = { sin( 0.5 * tip ), 0.0, 0.0, cos( 0.5 * tip ) };
+        float qz[4] = { 0.0, 0.0, sin( 0.5 * spin ), cos( 0.5 * spin ) };
+
+        // qz * qx
+        q[0] = qz[3] * qx[0];
+        q[1] = qz[2] * qx[0];
+        q[2] = qz[2] * qx[3];
+        q[3] = qz[3] * qx[3];
 }
 
 
 /*
  * Mouse clicked handler:
- *  This will update the lastPos object with the place JUST clicked.
+ *  This starts a new drag at the place JUST clicked.
  */
 void GLWidget::mousePressEvent( QMouseEvent *event )
 {
-        lastPos = event->pos();
+        input.MousePressed( event->pos(), event->buttons() );
 }
 
 /*
  * Mouse displacement handler (within the framebuffer)
  *
- * Mouse rotation is modified X/Y on left-click, X/Z on right-click
- * (user must hold down the button to acheive this behavior)
+ * Left-drag rolls the model like a trackball, right-drag tips it and
+ * spins it about the view direction (user must hold down the button to
+ * acheive this behavior). Only the latest position is kept here; the
+ * timer turns everything since the last frame into one rotation.
  */
 void GLWidget::mouseMoveEvent( QMouseEvent *event )
 {
-        int dx = event->x() - lastPos.x();
-        int dy = event->y() - lastPos.y();
-
-        if (event->buttons() & Qt::LeftButton) {
-                setXRotation( xRot + 8 * dy );
-                setYRotation( yRot + 8 * dx );
-        }
-        else {
-                setXRotation( xRot + 8 * dy );
-                setZRotation( zRot + 8 * dx );
-        }
-
-        // Update lastPos with the new position so subsequent moves
-        // will be handled based off of the present location.
-        lastPos = event->pos();
+        input.MouseMoved( event->pos(), event->buttons() );
 }
@@ -18,12 +18,55 @@
 #define _GLWIDGET_H
 
 #include "asset.hpp"   // Our new magical asset loading tool
+#include "occlusion.hpp"
+#include "gpucull.hpp"
+#include "debugviews.hpp"
+#include "softrender.hpp"
+#include "framecapture.hpp"
+#include "camera.hpp"
+#include "input.hpp"
+#include "lights.hpp"
+#include "shadows.hpp"
+#include "triplebuffer.hpp"
 #include <QGLWidget>   // The OpenGL "canvas" of sorts
+#include <QElapsedTimer>
+#include <QStringList>
 #include <string>
 
 class QtLogo;
 // We'll use this for dummy test data for now
 
+class RenderThread;
+
+/*
+ * Everything a frame is drawn from that the GUI side can change. Frames
+ * are always drawn from one of these, so with --render-thread the GUI
+ * thread can keep changing its own copy while the last one is drawn.
+ */
+struct FrameState
+{
+        float view[16], projection[16];     // camera matrices
+        unsigned int cameraVersion, projectionVersion;
+        bool perspective;
+
+        bool lights[3];                     // room, aux and opposite light
+        GLfloat auxColor[4], axxColor[4];
+
+        bool clusterCulling, gpuCulling, occlusionCulling, softwareMode;
+        bool hudOn;
+        int debugViews;                     // DebugViews::View bits
+        int lightGrid;                      // spawned lights per side, 0 = none
+        bool tiledLighting, tileHeatmap;
+        ShadowQuality shadowQuality;
+        bool recording;                     // should capture be running?
+        FrameCapture::Format captureFormat;
+
+        int width, height;                  // widget size
+        unsigned int inputEvents, inputUpdates;
+        qint64 inputTime;                   // InputState::Now() of the oldest
+                                            // input in this frame, or -1
+};
+
 /*
  * The window we create publically-inherits from the far-reaching
  * QWidget class as per the API requirements.
@@ -45,6 +88,13 @@ public:
         QSize minimumSizeHint() const;
         QSize sizeHint() const;
 
+        // Is the CPU renderer drawing the frames?
+        bool softwareRendering( void ) const;
+
+        // Called on the render thread (--render-thread only): take over
+        // the context, draw the newest snapshot, give the context back
+        friend class RenderThread;
+
         /*
          * These receiver slots will accept a new angle as an integer.
          * The slider widgets actually "emit" (send a SIGNAL) that is
@@ -109,6 +159,45 @@ public slots:
          * redraw of the scene.
          */
         void setScaling( double usrFactor );
+
+        // Show/hide the frame timing overlay
+        void toggleHud( void );
+
+        // Skip meshlets that are off screen or facing away
+        void setClusterCulling( bool on );
+
+        // Do the meshlet culling in a compute shader when GL can
+        void setGpuCulling( bool on );
+
+        // Debug overlays over the model (see debugviews.hpp)
+        void setWireframe( bool on );
+        void setNormals( bool on );
+        void setBoundingBoxes( bool on );
+
+        // Skip meshes that were hidden behind others last frame
+        void setOcclusionCulling( bool on );
+
+        // Draw with the CPU renderer instead of GL
+        void setSoftwareRendering( bool on );
+
+        // Time GL against the CPU renderer (prints the results)
+        void runBenchmark( void );
+
+        // Spawn a perSide^3 grid of point lights around the model (or
+        // remove it), and the Forward+ tiling controls
+        void setLightGrid( int perSide );
+        void clearLights( void );
+        void setTiledLighting( bool on );
+        void setTileHeatmap( bool on );
+
+        // Shadow map preset (a ShadowQuality)
+        void setShadowQuality( int quality );
+
+        // Record every frame to ./capture (see framecapture.hpp).
+        // The format is a FrameCapture::Format and only takes effect
+        // when the next recording starts.
+        void setRecording( bool on );
+        void setCaptureFormat( int format );
         
 signals:
         /*
@@ -120,6 +209,21 @@ signals:
         void yRotationChanged( int angle );
         void zRotationChanged( int angle );
 
+        // Recording started or stopped (it can fail to start, and a raw
+        // capture stops itself when the window is resized)
+        void recordingChanged( bool on );
+
+        // Average frame time of each shadow preset so far, for the panel
+        void shadowCostsChanged( const QString &costs );
+
+        // The model's bounding sphere (radius below zero if it's empty),
+        // sent once its VBOs are built on whichever thread has GL
+        void modelBoundsReady( float x, float y, float z, float radius );
+
+private slots:
+        // Back on the GUI thread: fit the camera to the model and redraw
+        void setModelBounds( float x, float y, float z, float radius );
+
 protected:
         /*
          * IMPORTANT:
@@ -135,9 +239,69 @@ protected:
         void paintGL();
         void resizeGL( int width, int height );  // Called on every resize
 
+        // With --render-thread Qt mustn't touch the context from the GUI
+        // thread, so painting and resizing only ask for a new frame
+        void paintEvent( QPaintEvent *event );
+        void resizeEvent( QResizeEvent *event );
+        void showEvent( QShowEvent *event );
+
+        // Redraw with updateGL(), or hand a snapshot to the render thread
+        void requestFrame( void );
+        void makeState( FrameState &state );
+
+        // Draw one frame from a snapshot (whichever thread GL is on)
+        void renderFrame( const FrameState &state );
+
+        // The render thread's side of things
+        void startRendering( void );
+        void renderNextFrame( void );
+        void stopRendering( void );
+
+        // Input to screen time for a frame that has just been shown
+        void measureLatency( const FrameState &state );
+
+        // Spawned light grid: build it, and put it in eye space
+        void buildLightGrid( int perSide );
+        void placeGridLights( const float view[16] );
+
+        // Camera distance and ortho size that show the whole model
+        void fitCamera( void );
+
+        // Mouse drags as rotations (quaternions x, y, z, w)
+        void ballPoint( QPoint pos, float p[3] );
+        void arcball( QPoint from, QPoint to, float q[4] );
+        void twist( QPoint from, QPoint to, float q[4] );
+        void emitRotations( void );
+
         // Function to load the textures (they will be "placed" by the asset handler)
         void loadGLTextures( void );
 
+        // Draws the frame timing overlay on top of the scene
+        QStringList hudLines( const FrameState &state );
+        void drawHud( const FrameState &state );
+
+        // Frame timing and overlay, at the end of renderFrame()
+        void finishFrame( const FrameState &state );
+
+        // Shadow maps for the lights that are on (render side)
+        void updateShadows( const FrameState &state );
+
+        // Draw the model again just as renderFrame() drew it (for the
+        // debug overlays), and turn one of the overlays on or off
+        void redrawModel( const FrameState &state, bool gpuCull,
+                          const std::vector<char> *meshVisible );
+        void setDebugView( int view, bool on );
+        QString shadowCosts( void ) const;
+
+        // Time the ways of submitting draws against each other
+        void benchmarkSubmission( void );
+
+        // Time the CPU and GPU meshlet culling over more and more objects
+        void benchmarkCulling( void );
+
+        // Camera, lights and sizes for the CPU renderer
+        SoftFrame softwareFrame( const FrameState &state );
+
         // Mouse-button-was-pressed within the framebuffer (EVENT HANDLER)
         void mousePressEvent( QMouseEvent *event );
 
@@ -151,23 +315,27 @@ private:
          */
         QtLogo *logo;      // The logo object that will show on the screen
         Asset3ds *asset;   // Our new magic asset (must be a 3ds file)
+        QString assetName; // Path it was loaded from
 
-        int xRot;          // X-Axis orientation value (DEGREES)
-        int yRot;          // Y-Axis orientation value (DEGREES)
-        int zRot;          // Z-Axis orientation value (DEGREES)
+        // Position, rotation (1/16ths of a degree), scaling and projection
+        // of the scene, and the matrices made from them
+        Camera camera;
+        unsigned int loadedProjection;  // camera version GL has
+        unsigned int cullVersion;       // camera version cullView is for
+        CullView cullView;
 
-        // For camera positions. May be deprecated in favor of a
-        // QVector in the near/immediate future.
-        GLfloat xPos, yPos, zPos;
+        // How far the movement keys / wheel go for a model this size
+        GLfloat moveStep;
 
-        // Scaling factor that will determine the size of the model loaded.
-        // (Need this to control the glScalef on the repaints!)
-        GLfloat scaleFactor;
+        // The model's bounding sphere as last sent by modelBoundsReady()
+        // (the GUI thread's copy, the asset belongs to the GL side)
+        float modelCenter[3], modelRadius;
 
         // State flags to determine if the scene needs moving
         bool moveUp_, moveDn_, moveRight_, moveLeft_;
 
-        QPoint lastPos;    // The last position the mouse was in (QPoint)
+        InputState input;  // mouse / wheel / slider input since the last tick
+        QElapsedTimer motionClock;  // time since the last motion update
         QColor qtGreen;    // A shortcut to getting a real green
         QColor qtPurple;   // A shortcut to getting a purple
         QColor qtGray;     // A dark grey that will hopefully make a good b-g.
@@ -185,10 +353,73 @@ private:
         int auxR, auxG, auxB, auxA;
         GLfloat auxColor[4], axxColor[4];
         
-        bool perspectiveMode;  // Are we in perspective mode? TRUE
-                               // or orthographic mode? FALSE
+        bool clusterCulling;   // cull meshlets before drawing?
+        DrawRanges drawRanges; // what survived last frame's culling
+
+        bool gpuCulling;            // cull in a compute shader if we can?
+        GpuCuller gpuCuller;
+        unsigned int gpuVisible;    // meshlets it drew last frame (overlay only)
+
+        int debugViews;             // DebugViews::View bits the panel has on
+        DebugViews debugOverlay;
+
+        bool occlusionCulling;      // use the occlusion queries?
+        OcclusionCuller occlusion;
+
+        bool shadedLights;          // lighting shader if GL has it?
+        LightManager lightManager;
+        int lightGrid;              // panel's light grid size
+        bool tiledLighting, tileHeatmap;
+
+        // Shadows for the three fixed lights (shader path only), and
+        // the timed frames per preset behind the panel's costs
+        ShadowQuality shadowQuality;
+        ShadowMaps shadows;
+        double shadowMs[SHADOW_QUALITIES];
+        unsigned int shadowFrames[SHADOW_QUALITIES];
+
+        // Render side: the grid that's in the light manager, in model
+        // space (xyz per light), how far each light reaches, and the
+        // viewport the tiles are laid over
+        int renderLightGrid;
+        std::vector<float> gridLights;
+        float gridRange;
+        int viewportRect[4];
 
-        GLfloat ortho_left, ortho_right, ortho_top, ortho_bottom;
+        bool softwareMode;          // CPU renderer instead of GL?
+        bool softwareReady;         // has it been given the geometry?
+        SoftwareRenderer software;
+        bool benchmarkQuit;         // quit once the benchmark is done
+
+        FrameCapture capture;
+        FrameCapture::Format captureFormat;
+        bool recordingWanted;       // what the panel asked for
+        bool recordingStarted;      // what the renderer last did about it
+        bool occlusionWasOn;        // render side copy, to reset on turn off
+
+        // --render-thread: GL lives on its own thread and frames are
+        // drawn from snapshots passed over in states
+        bool threaded;
+        RenderThread *renderThread;
+        TripleBuffer<FrameState> states;
+        int renderWidth, renderHeight;  // size GL was last set up for
+
+        // Input to screen latency: oldest input not yet in a snapshot,
+        // running average / worst case, and the total/count summary
+        qint64 pendingInput;
+        double latencyMs, latencyMaxMs, latencyTotalMs;
+        unsigned int latencyCount;
+
+        /*
+         * Frame timing (only measured while the overlay is up).
+         * frameMs is a running average for display, the total/count
+         * pair gives the per-model summary printed on exit.
+         */
+        bool hudOn;
+        QElapsedTimer frameClock;
+        double frameMs, frameTotalMs;
+        unsigned int frameCount;
+        unsigned int framesDrawn;   // every paintGL(), timed or not
 };
 
 #endif    //_GLWIDGET_H
@@ -0,0 +1,479 @@
+/*
+ * Filename: gpucull.cpp
+ *
+ * The compute culling stage and its depth pyramid (see gpucull.hpp).
+ */
+
+#include "gpucull.hpp"
+#include "gl.hpp"
+
+#include <iostream>
+#include <cstdio>
+#include <cmath>
+
+// Invocations per work group (objects for culling, 8x8 texels for the
+// pyramid)
+static const unsigned int CULL_GROUP = 64;
+static const unsigned int REDUCE_GROUP = 8;
+
+// Texture unit the pyramid is read from while culling
+static const int PYRAMID_UNIT = 6;
+
+/*
+ * The same tests as MeshletBounds::Cull(), then the occlusion test: the
+ * corners of the sphere's box go through last frame's matrix, and the
+ * nearest of them is compared with the farthest depth under the box at
+ * the pyramid level where the box is at most two texels across. Anything
+ * crossing the near plane is kept.
+ */
+static const char *cullSource =
+        "layout(local_size_x = CULL_GROUP) in;\n"
+        "struct Object { vec4 sphere; vec4 cone; uint firstIndex; uint indexCount; uint pad0; uint pad1; };\n"
+        "struct Command { uint count; uint instanceCount; uint firstIndex; uint baseVertex; uint baseInstance; };\n"
+        "layout(std430, binding = 0) readonly buffer Objects { Object objects[]; };\n"
+        "layout(std430, binding = 1) writeonly buffer Commands { Command commands[]; };\n"
+        "layout(binding = 0, offset = 0) uniform atomic_uint drawCount;\n"
+        "uniform uint objectCount;\n"
+        "uniform vec4 planes[6];\n"
+        "uniform vec3 eye;\n"
+        "uniform vec3 viewDir;\n"
+        "uniform bool orthographic;\n"
+        "uniform bool coneTest;\n"
+        "uniform bool occlusion;\n"
+        "uniform mat4 pyramidMatrix;\n"
+        "uniform ivec2 pyramidSize;\n"
+        "uniform int pyramidLevels;\n"
+        "uniform sampler2D pyramid;\n"
+        "bool occluded( vec3 center, float radius )\n"
+        "{\n"
+        "        vec3 lo = vec3( 1.0 ), hi = vec3( -1.0 );\n"
+        "        for (int i = 0; i < 8; i++) {\n"
+        "                vec3 corner = center + radius * vec3( (i & 1) != 0 ? 1.0 : -1.0,\n"
+        "                                                      (i & 2) != 0 ? 1.0 : -1.0,\n"
+        "                                                      (i & 4) != 0 ? 1.0 : -1.0 );\n"
+        "                vec4 clip = pyramidMatrix * vec4( corner, 1.0 );\n"
+        "                if (clip.w <= 0.0)\n"
+        "                        return false;\n"
+        "                vec3 ndc = clip.xyz / clip.w;\n"
+        "                lo = (i == 0) ? ndc : min( lo, ndc );\n"
+        "                hi = (i == 0) ? ndc : max( hi, ndc );\n"
+        "        }\n"
+        "        vec2 uvLo = clamp( lo.xy * 0.5 + 0.5, 0.0, 1.0 );\n"
+        "        vec2 uvHi = clamp( hi.xy * 0.5 + 0.5, 0.0, 1.0 );\n"
+        "        vec2 pixels = (uvHi - uvLo) * vec2( pyramidSize );\n"
+        "        int level = int( ceil( log2( max( max( pixels.x, pixels.y ), 1.0 ) ) ) );\n"
+        "        level = min( level, pyramidLevels - 1 );\n"
+        "        ivec2 last = textureSize( pyramid, level ) - 1;\n"
+        "        ivec2 a = min( ivec2( uvLo * vec2( pyramidSize ) ) >> level, last );\n"
+        "        ivec2 b = min( ivec2( uvHi * vec2( pyramidSize ) ) >> level, last );\n"
+        "        float farthest = max( max( texelFetch( pyramid, a, level ).r,\n"
+        "                                   texelFetch( pyramid, ivec2( b.x, a.y ), level ).r ),\n"
+        "                              max( texelFetch( pyramid, ivec2( a.x, b.y ), level ).r,\n"
+        "                                   texelFetch( pyramid, b, level ).r ) );\n"
+        "        return lo.z * 0.5 + 0.5 > farthest;\n"
+        "}\n"
+        "void main()\n"
+        "{\n"
+        "        uint i = gl_GlobalInvocationID.x;\n"
+        "        if (i >= objectCount || objects[i].indexCount == 0u)\n"
+        "                return;\n"
+        "        vec3 center = objects[i].sphere.xyz;\n"
+        "        float radius = objects[i].sphere.w;\n"
+        "        for (int p = 0; p < 6; p++) {\n"
+        "                if (dot( planes[p].xyz, center ) + planes[p].w < -radius)\n"
+        "                        return;\n"
+        "        }\n"
+        "        vec4 cone = objects[i].cone;\n"
+        "        if (coneTest) {\n"
+        "                if (orthographic) {\n"
+        "                        if (dot( viewDir, cone.xyz ) >= cone.w)\n"
+        "                                return;\n"
+        "                } else {\n"
+        "                        vec3 d = center - eye;\n"
+        "                        if (dot( d, cone.xyz ) >= cone.w * length( d ) + radius)\n"
+        "                                return;\n"
+        "                }\n"
+        "        }\n"
+        "        if (occlusion && occluded( center, radius ))\n"
+        "                return;\n"
+        "        uint slot = atomicCounterIncrement( drawCount );\n"
+        "        commands[slot] = Command( objects[i].indexCount, 1u, objects[i].firstIndex, 0u, 0u );\n"
+        "}\n";
+
+/*
+ * One pyramid level from the one above it (or from the depth texture for
+ * level 0): the farthest of the 2x2 texels it covers, plus the extra row
+ * or column when the level above has an odd size, so nothing is missed.
+ */
+static const char *reduceSource =
+        "layout(local_size_x = REDUCE_GROUP, local_size_y = REDUCE_GROUP) in;\n"
+        "uniform bool fromDepth;\n"
+        "uniform sampler2D depth;\n"
+        "layout(r32f, binding = 0) writeonly uniform image2D target;\n"
+        "layout(r32f, binding = 1) readonly uniform image2D source;\n"
+        "void main()\n"
+        "{\n"
+        "        ivec2 at = ivec2( gl_GlobalInvocationID.xy );\n"
+        "        ivec2 size = imageSize( target );\n"
+        "        if (at.x >= size.x || at.y >= size.y)\n"
+        "                return;\n"
+        "        if (fromDepth) {\n"
+        "                imageStore( target, at, vec4( texelFetch( depth, at, 0 ).r ) );\n"
+        "                return;\n"
+        "        }\n"
+        "        ivec2 above = imageSize( source );\n"
+        "        ivec2 extent = ivec2( 2 );\n"
+        "        if ((above.x & 1) != 0 && at.x == size.x - 1) extent.x = 3;\n"
+        "        if ((above.y & 1) != 0 && at.y == size.y - 1) extent.y = 3;\n"
+        "        float farthest = 0.0;\n"
+        "        for (int y = 0; y < extent.y; y++)\n"
+        "                for (int x = 0; x < extent.x; x++)\n"
+        "                        farthest = max( farthest, imageLoad( source, min( at * 2 + ivec2( x, y ), above - 1 ) ).r );\n"
+        "        imageStore( target, at, vec4( farthest ) );\n"
+        "}\n";
+
+/*
+ * Compile and link one compute program, printing the log if it doesn't.
+ * Returns 0 on failure.
+ */
+static GLuint buildProgram( const char *body )
+{
+        char header[256];
+        snprintf( header, sizeof(header),
+                  "#version 430\n"
+                  "#define CULL_GROUP %u\n"
+                  "#define REDUCE_GROUP %u\n",
+                  CULL_GROUP, REDUCE_GROUP );
+        const char *sources[2] = { header, body };
+
+        GLuint shader = glCreateShader( GL_COMPUTE_SHADER );
+        glShaderSource( shader, 2, sources, NULL );
+        glCompileShader( shader );
+
+        char log[1024];
+        GLint ok = GL_FALSE;
+        glGetShaderiv( shader, GL_COMPILE_STATUS, &ok );
+        if (!ok) {
+                glGetShaderInfoLog( shader, sizeof(log), NULL, log );
+                std::cerr << "WARNING: culling shader didn't compile:\n" << log << std::endl;
+                glDeleteShader( shader );
+                return 0;
+        }
+
+        GLuint program = glCreateProgram();
+        glAttachShader( program, shader );
+        glLinkProgram( program );
+        glDeleteShader( shader );       // the program keeps it alive
+
+        glGetProgramiv( program, GL_LINK_STATUS, &ok );
+        if (!ok) {
+                glGetProgramInfoLog( program, sizeof(log), NULL, log );
+                std::cerr << "WARNING: culling shader didn't link:\n" << log << std::endl;
+                glDeleteProgram( program );
+                return 0;
+        }
+        return program;
+}
+
+GpuCuller::GpuCuller()
+{
+        m_CullProgram = m_ReduceProgram = 0;
+        m_CountDraw = false;
+        m_Capacity = m_Count = 0;
+        m_Framebuffer = 0;
+        m_Width = m_Height = m_Levels = 0;
+        m_PyramidValid = m_BlitFailed = false;
+}
+
+GpuCuller::~GpuCuller()
+{
+        Reset();
+}
+
+void GpuCuller::Reset()
+{
+        if (m_CullProgram != 0)
+                glDeleteProgram( m_CullProgram );
+        if (m_ReduceProgram != 0)
+                glDeleteProgram( m_ReduceProgram );
+        m_CullProgram = m_ReduceProgram = 0;
+
+        m_Commands.Reset();
+        m_Counter.Reset();
+        m_Capacity = m_Count = 0;
+        DropPyramid();
+}
+
+void GpuCuller::DropPyramid()
+{
+        if (m_Framebuffer != 0)
+                glDeleteFramebuffers( 1, &m_Framebuffer );
+        m_Framebuffer = 0;
+        m_Depth.Reset();
+        m_Pyramid.Reset();
+        m_Width = m_Height = m_Levels = 0;
+        m_PyramidValid = false;
+}
+
+bool GpuCuller::Init()
+{
+        Reset();
+
+        // Compute shaders, storage buffers, atomic counters, image
+        // load/store and indirect drawing are all core in GL 4.3
+        if (!GLVersionAtLeast( 4, 3 )) {
+                std::cerr << "WARNING: no compute shaders (GL 4.3), culling on the CPU" << std::endl;
+                return false;
+        }
+
+        m_CullProgram = buildProgram( cullSource );
+        m_ReduceProgram = buildProgram( reduceSource );
+        if (m_CullProgram == 0 || m_ReduceProgram == 0) {
+                std::cerr << "WARNING: culling on the CPU" << std::endl;
+                Reset();
+                return false;
+        }
+
+        glUseProgram( m_CullProgram );
+        glUniform1i( glGetUniformLocation( m_CullProgram, "pyramid" ), PYRAMID_UNIT );
+        glUseProgram( m_ReduceProgram );
+        glUniform1i( glGetUniformLocation( m_ReduceProgram, "depth" ), PYRAMID_UNIT );
+        glUseProgram( 0 );
+
+        m_CountDraw = GLVersionAtLeast( 4, 6 ) || HaveGLExtension( "GL_ARB_indirect_parameters" );
+        m_Counter.Create( GL_ATOMIC_COUNTER_BUFFER, GpuOther, sizeof(GLuint), NULL, GL_DYNAMIC_DRAW );
+        glBindBuffer( GL_ATOMIC_COUNTER_BUFFER, 0 );
+        return true;
+}
+
+bool GpuCuller::Ready() const
+{
+        return m_CullProgram != 0;
+}
+
+void GpuCuller::Cull( GLuint objectBuffer, unsigned int count, const CullView &view,
+                      bool occlusion )
+{
+        if (!Ready())
+                return;
+
+        // Room for every object to pass (grown as needed, doubling)
+        GLsizeiptr commandBytes = sizeof(GLuint) * 5;
+        if (count > m_Capacity || !m_Commands.Valid()) {
+                m_Capacity = qMax( m_Capacity, 1024u );
+                while (m_Capacity < count)
+                        m_Capacity *= 2;
+                m_Commands.Create( GL_SHADER_STORAGE_BUFFER, GpuOther, commandBytes * m_Capacity,
+                                   NULL, GL_DYNAMIC_DRAW );
+        } else {
+                glBindBuffer( GL_SHADER_STORAGE_BUFFER, m_Commands.Name() );
+        }
+
+        // Without a count to draw with, the commands nobody writes have
+        // to draw nothing
+        if (!m_CountDraw) {
+                glClearBufferSubData( GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, commandBytes * count,
+                                      GL_RED_INTEGER, GL_UNSIGNED_INT, NULL );
+        }
+        glBindBuffer( GL_SHADER_STORAGE_BUFFER, 0 );
+        m_Count = count;
+
+        GLuint zero = 0;
+        glBindBuffer( GL_ATOMIC_COUNTER_BUFFER, m_Counter.Name() );
+        glBufferSubData( GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(zero), &zero );
+        glBindBuffer( GL_ATOMIC_COUNTER_BUFFER, 0 );
+
+        glUseProgram( m_CullProgram );
+        glUniform1ui( glGetUniformLocation( m_CullProgram, "objectCount" ), count );
+        glUniform4fv( glGetUniformLocation( m_CullProgram, "planes" ), 6, &view.planes[0][0] );
+        glUniform3fv( glGetUniformLocation( m_CullProgram, "eye" ), 1, view.eye );
+        glUniform3fv( glGetUniformLocation( m_CullProgram, "viewDir" ), 1, view.viewDir );
+        glUniform1i( glGetUniformLocation( m_CullProgram, "orthographic" ), view.orthographic );
+        glUniform1i( glGetUniformLocation( m_CullProgram, "coneTest" ), view.coneTest );
+
+        bool testDepth = occlusion && m_PyramidValid;
+        glUniform1i( glGetUniformLocation( m_CullProgram, "occlusion" ), testDepth );
+        if (testDepth) {
+                glUniformMatrix4fv( glGetUniformLocation( m_CullProgram, "pyramidMatrix" ), 1,
+                                    GL_FALSE, m_PyramidMatrix );
+                glUniform2i( glGetUniformLocation( m_CullProgram, "pyramidSize" ), m_Width, m_Height );
+                glUniform1i( glGetUniformLocation( m_CullProgram, "pyramidLevels" ), m_Levels );
+                glActiveTexture( GL_TEXTURE0 + PYRAMID_UNIT );
+                glBindTexture( GL_TEXTURE_2D, m_Pyramid.Name() );
+                glActiveTexture( GL_TEXTURE0 );
+        }
+
+        glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 0, objectBuffer );
+        glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 1, m_Commands.Name() );
+        glBindBufferBase( GL_ATOMIC_COUNTER_BUFFER, 0, m_Counter.Name() );
+
+        glDispatchCompute( (count + CULL_GROUP - 1) / CULL_GROUP, 1, 1 );
+
+        glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 0, 0 );
+        glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 1, 0 );
+        glBindBufferBase( GL_ATOMIC_COUNTER_BUFFER, 0, 0 );
+        glUseProgram( 0 );
+        if (testDepth) {
+                glActiveTexture( GL_TEXTURE0 + PYRAMID_UNIT );
+                glBindTexture( GL_TEXTURE_2D, 0 );
+                glActiveTexture( GL_TEXTURE0 );
+        }
+
+        // The draw reads the commands and the count as indirect arguments
+        glMemoryBarrier( GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT
+                         | GL_ATOMIC_COUNTER_BARRIER_BIT );
+}
+
+GLuint GpuCuller::CommandBuffer() const
+{
+        return m_Commands.Name();
+}
+
+GLuint GpuCuller::CountBuffer() const
+{
+        return m_CountDraw ? m_Counter.Name() : 0;
+}
+
+unsigned int GpuCuller::MaxCommands() const
+{
+        return m_Count;
+}
+
+unsigned int GpuCuller::LastVisible() const
+{
+        if (!m_Counter.Valid())
+                return 0;
+
+        GLuint count = 0;
+        glBindBuffer( GL_ATOMIC_COUNTER_BUFFER, m_Counter.Name() );
+        glGetBufferSubData( GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(count), &count );
+        glBindBuffer( GL_ATOMIC_COUNTER_BUFFER, 0 );
+        return count;
+}
+
+/*
+ * The window's depth buffer is resolved into a depth texture of the same
+ * format by a blit (which is also the only way to read a multisampled
+ * one), then turned into the pyramid a level at a time.
+ */
+void GpuCuller::BuildPyramid( const int viewport[4], const float modelview[16],
+                              const float projection[16] )
+{
+        int width = viewport[2], height = viewport[3];
+        if (!Ready() || m_BlitFailed || width <= 0 || height <= 0)
+                return;
+
+        if (width != m_Width || height != m_Height || m_Framebuffer == 0) {
+                DropPyramid();
+
+                // Blits only copy depth between matching formats
+                GLint depthBits = 0, stencilBits = 0;
+                glGetIntegerv( GL_DEPTH_BITS, &depthBits );
+                glGetIntegerv( GL_STENCIL_BITS, &stencilBits );
+                GLenum format = GL_DEPTH_COMPONENT24, attachment = GL_DEPTH_ATTACHMENT;
+                GLenum type = GL_UNSIGNED_INT;
+                if (stencilBits > 0) {
+                        format = GL_DEPTH24_STENCIL8;
+                        attachment = GL_DEPTH_STENCIL_ATTACHMENT;
+                        type = GL_UNSIGNED_INT_24_8;
+                } else if (depthBits == 16) {
+                        format = GL_DEPTH_COMPONENT16;
+                } else if (depthBits == 32) {
+                        format = GL_DEPTH_COMPONENT32;
+                }
+
+                m_Depth.Create();
+                glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+                glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+                glTexImage2D( GL_TEXTURE_2D, 0, format, width, height, 0,
+                              stencilBits > 0 ? GL_DEPTH_STENCIL : GL_DEPTH_COMPONENT, type, NULL );
+                m_Depth.SetBytes( (GLsizeiptr) width * height * 4 );
+
+                m_Levels = 0;
+                GLsizeiptr bytes = 0;
+                m_Pyramid.Create();
+                for (int w = width, h = height; ; w = qMax( w / 2, 1 ), h = qMax( h / 2, 1 )) {
+                        glTexImage2D( GL_TEXTURE_2D, m_Levels, GL_R32F, w, h, 0, GL_RED, GL_FLOAT, NULL );
+                        bytes += (GLsizeiptr) w * h * 4;
+                        m_Levels++;
+                        if (w == 1 && h == 1)
+                                break;
+                }
+                glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, m_Levels - 1 );
+                glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST );
+                glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+                m_Pyramid.SetBytes( bytes );
+                glBindTexture( GL_TEXTURE_2D, 0 );
+
+                glGenFramebuffers( 1, &m_Framebuffer );
+                glBindFramebuffer( GL_FRAMEBUFFER, m_Framebuffer );
+                glFramebufferTexture2D( GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, m_Depth.Name(), 0 );
+                glDrawBuffer( GL_NONE );
+                glReadBuffer( GL_NONE );
+                GLenum status = glCheckFramebufferStatus( GL_FRAMEBUFFER );
+                glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+                if (status != GL_FRAMEBUFFER_COMPLETE) {
+                        std::cerr << "WARNING: can't copy the depth buffer (framebuffer status 0x"
+                                  << std::hex << status << std::dec << "), no occlusion culling on the GPU"
+                                  << std::endl;
+                        DropPyramid();
+                        m_BlitFailed = true;
+                        return;
+                }
+                m_Width = width;
+                m_Height = height;
+        }
+
+        while (glGetError() != GL_NO_ERROR)
+                ;
+        glBindFramebuffer( GL_READ_FRAMEBUFFER, 0 );
+        glBindFramebuffer( GL_DRAW_FRAMEBUFFER, m_Framebuffer );
+        glBlitFramebuffer( viewport[0], viewport[1], viewport[0] + width, viewport[1] + height,
+                           0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST );
+        glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+        if (glGetError() != GL_NO_ERROR) {
+                std::cerr << "WARNING: can't copy the depth buffer, no occlusion culling on the GPU"
+                          << std::endl;
+                DropPyramid();
+                m_BlitFailed = true;
+                return;
+        }
+
+        glUseProgram( m_ReduceProgram );
+        GLint fromDepth = glGetUniformLocation( m_ReduceProgram, "fromDepth" );
+        glActiveTexture( GL_TEXTURE0 + PYRAMID_UNIT );
+        glBindTexture( GL_TEXTURE_2D, m_Depth.Name() );
+        glActiveTexture( GL_TEXTURE0 );
+
+        int w = width, h = height;
+        for (int level = 0; level < m_Levels; level++) {
+                glUniform1i( fromDepth, level == 0 );
+                glBindImageTexture( 0, m_Pyramid.Name(), level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F );
+                if (level > 0)
+                        glBindImageTexture( 1, m_Pyramid.Name(), level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F );
+                glDispatchCompute( (w + REDUCE_GROUP - 1) / REDUCE_GROUP,
+                                   (h + REDUCE_GROUP - 1) / REDUCE_GROUP, 1 );
+                glMemoryBarrier( GL_SHADER_IMAGE_ACCESS_BARRIER_BIT );
+                w = qMax( w / 2, 1 );
+                h = qMax( h / 2, 1 );
+        }
+
+        glBindImageTexture( 0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F );
+        glBindImageTexture( 1, 0, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F );
+        glActiveTexture( GL_TEXTURE0 + PYRAMID_UNIT );
+        glBindTexture( GL_TEXTURE_2D, 0 );
+        glActiveTexture( GL_TEXTURE0 );
+        glUseProgram( 0 );
+        glMemoryBarrier( GL_TEXTURE_FETCH_BARRIER_BIT );
+
+        // What the pyramid's depths were drawn with: projection * modelview
+        for (int c = 0; c < 4; c++) {
+                for (int r = 0; r < 4; r++) {
+                        float sum = 0.0f;
+                        for (int k = 0; k < 4; k++)
+                                sum += projection[k * 4 + r] * modelview[c * 4 + k];
+                        m_PyramidMatrix[c * 4 + r] = sum;
+                }
+        }
+        m_PyramidValid = true;
+}
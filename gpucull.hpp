@@ -0,0 +1,92 @@
+/*
+ * Filename: gpucull.hpp
+ *
+ * Meshlet culling on the GPU (GL 4.3 compute shaders). With many
+ * thousands of meshlets the CPU tests in culling.cpp start to cost more
+ * than the drawing, so this does the same tests in a compute shader, one
+ * meshlet per invocation, reading the bounds buffer the asset builds
+ * (GpuCullObject each, see culling.hpp):
+ *   - the sphere against the six frustum planes
+ *   - the normal cone (all back facing?)
+ *   - with occlusion on, the sphere's screen box against a depth pyramid
+ *     (max depth mip chain) of the last frame's depth buffer
+ * Survivors are appended to a buffer of indirect draw commands through an
+ * atomic counter, and the asset draws them with one
+ * glMultiDrawElementsIndirect(). The count is left on the GPU: with
+ * ARB_indirect_parameters it's read from there, otherwise the command
+ * buffer is cleared first and the unused commands draw nothing.
+ *
+ * Without compute shaders Init() fails and the CPU culling is used.
+ *
+ * The depth pyramid is a frame behind, like the occlusion queries: a
+ * meshlet coming out from behind something shows up one frame late.
+ */
+
+#ifndef _GPUCULL_H
+#define _GPUCULL_H
+
+#include "culling.hpp"
+#include "gl.hpp"
+#include "gpuresource.hpp"
+
+class GpuCuller
+{
+public:
+        GpuCuller();
+
+        // Needs the GL context current (it deletes the programs)
+        ~GpuCuller();
+
+        // Build the compute programs if GL can. False (with a WARNING)
+        // means culling stays on the CPU.
+        bool Init();
+        bool Ready() const;
+        void Reset();
+
+        // Test count objects in objectBuffer against view, and against
+        // the depth pyramid (if there is one yet) when occlusion is set.
+        // The commands are ready for drawing when this returns.
+        void Cull( GLuint objectBuffer, unsigned int count, const CullView &view,
+                   bool occlusion );
+
+        // Where Cull() left its commands, the buffer holding how many
+        // there are (0 if GL can't read the count from a buffer; the
+        // rest of the commands are empty then) and how many there can be
+        // (the objects last culled)
+        GLuint CommandBuffer() const;
+        GLuint CountBuffer() const;
+        unsigned int MaxCommands() const;
+
+        // Make the depth pyramid from the part of the depth buffer under
+        // viewport (x, y, width, height) that was just drawn with
+        // projection * modelview. The next occlusion Cull() tests
+        // against it.
+        void BuildPyramid( const int viewport[4], const float modelview[16],
+                           const float projection[16] );
+        void DropPyramid();
+
+        // Commands written by the last Cull(). Reads the counter back,
+        // so it waits on the GPU (the overlay does anyway).
+        unsigned int LastVisible() const;
+
+private:
+        GpuCuller( const GpuCuller & );
+        GpuCuller &operator=( const GpuCuller & );
+
+        GLuint m_CullProgram, m_ReduceProgram;
+        bool m_CountDraw;              // ARB_indirect_parameters?
+
+        GLBuffer m_Commands, m_Counter;
+        unsigned int m_Capacity, m_Count;
+
+        // Depth pyramid: the resolved depth buffer (through an FBO,
+        // since the window's may be multisampled) and the max-depth
+        // mip chain made from it
+        GLuint m_Framebuffer;
+        GLTexture m_Depth, m_Pyramid;
+        int m_Width, m_Height, m_Levels;
+        bool m_PyramidValid, m_BlitFailed;
+        float m_PyramidMatrix[16];
+};
+
+#endif    // _GPUCULL_H
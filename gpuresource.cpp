@@ -0,0 +1,347 @@
+/*
+ * Filename: gpuresource.cpp
+ *
+ * GL object handles and the GPU memory bookkeeping (see gpuresource.hpp).
+ */
+
+#include "gpuresource.hpp"
+
+#include <QMutex>
+
+#include <iostream>
+#include <list>
+
+/*
+ * Everything GpuMemory knows. The handles are used from the GUI, render
+ * and loader threads, so it's all behind the one lock.
+ */
+struct CacheSlot
+{
+        GpuCacheEntry *entry;
+        unsigned int used;              // frame it was last touched in
+};
+
+static QMutex gpuLock;
+static long gpuBytes[GPU_CATEGORIES];
+static long gpuPeak = 0;
+static unsigned int gpuBuffers = 0, gpuTextures = 0;
+static long gpuBudget = 0;
+static std::list<CacheSlot> gpuCache;   // least recently used first
+static unsigned int gpuFrame = 0;
+static unsigned int gpuEvictions = 0;
+
+static long totalLocked()
+{
+        long total = 0;
+        for (int c = 0; c < GPU_CATEGORIES; c++)
+                total += gpuBytes[c];
+        return total;
+}
+
+long GpuMemory::Bytes( GpuCategory category )
+{
+        QMutexLocker locker( &gpuLock );
+        return gpuBytes[category];
+}
+
+long GpuMemory::TotalBytes()
+{
+        QMutexLocker locker( &gpuLock );
+        return totalLocked();
+}
+
+long GpuMemory::PeakBytes()
+{
+        QMutexLocker locker( &gpuLock );
+        return gpuPeak;
+}
+
+const char *GpuMemory::CategoryName( GpuCategory category )
+{
+        static const char *names[GPU_CATEGORIES] = { "vertex", "index", "texture", "other" };
+        return names[category];
+}
+
+unsigned int GpuMemory::Buffers()
+{
+        QMutexLocker locker( &gpuLock );
+        return gpuBuffers;
+}
+
+unsigned int GpuMemory::Textures()
+{
+        QMutexLocker locker( &gpuLock );
+        return gpuTextures;
+}
+
+bool GpuMemory::ReportLeaks()
+{
+        QMutexLocker locker( &gpuLock );
+        if (gpuBuffers == 0 && gpuTextures == 0 && totalLocked() == 0)
+                return true;
+
+        std::cerr << "WARNING: GPU objects never deleted: " << gpuBuffers << " buffers, "
+                  << gpuTextures << " textures";
+        for (int c = 0; c < GPU_CATEGORIES; c++) {
+                if (gpuBytes[c] != 0) {
+                        std::cerr << ", " << gpuBytes[c] / 1024 << " KiB "
+                                  << CategoryName( (GpuCategory) c );
+                }
+        }
+        std::cerr << std::endl;
+        return false;
+}
+
+void GpuMemory::SetBudget( long bytes )
+{
+        QMutexLocker locker( &gpuLock );
+        gpuBudget = bytes;
+}
+
+long GpuMemory::Budget()
+{
+        QMutexLocker locker( &gpuLock );
+        return gpuBudget;
+}
+
+void GpuMemory::Register( GpuCacheEntry *entry )
+{
+        QMutexLocker locker( &gpuLock );
+        CacheSlot slot = { entry, gpuFrame };
+        gpuCache.push_back( slot );
+}
+
+void GpuMemory::Unregister( GpuCacheEntry *entry )
+{
+        QMutexLocker locker( &gpuLock );
+        for (std::list<CacheSlot>::iterator i = gpuCache.begin(); i != gpuCache.end(); ++i) {
+                if (i->entry == entry) {
+                        gpuCache.erase( i );
+                        return;
+                }
+        }
+}
+
+// Move it to the back (most recently used)
+void GpuMemory::Touch( const GpuCacheEntry *entry )
+{
+        QMutexLocker locker( &gpuLock );
+        for (std::list<CacheSlot>::iterator i = gpuCache.begin(); i != gpuCache.end(); ++i) {
+                if (i->entry == entry) {
+                        CacheSlot slot = { i->entry, gpuFrame };
+                        gpuCache.erase( i );
+                        gpuCache.push_back( slot );
+                        return;
+                }
+        }
+}
+
+/*
+ * Entries touched since the last Enforce() were drawn with last frame and
+ * are left alone (evicting them would just mean making them again right
+ * away). The victim is evicted with the lock released, since evicting
+ * deletes handles and they come back in here.
+ */
+unsigned int GpuMemory::Enforce()
+{
+        unsigned int evicted = 0;
+        bool warned = false;
+
+        for (;;) {
+                GpuCacheEntry *victim = NULL;
+                {
+                        QMutexLocker locker( &gpuLock );
+                        if (gpuBudget <= 0 || totalLocked() <= gpuBudget)
+                                break;
+
+                        std::list<CacheSlot>::iterator i;
+                        for (i = gpuCache.begin(); i != gpuCache.end(); ++i) {
+                                if (i->used < gpuFrame && i->entry->GpuBytes() > 0) {
+                                        victim = i->entry;
+                                        break;
+                                }
+                        }
+
+                        // Everything left is in use: over budget it is
+                        if (victim == NULL) {
+                                static bool toldOnce = false;
+                                warned = !toldOnce;
+                                toldOnce = true;
+                                break;
+                        }
+                        gpuEvictions++;
+                }
+
+                victim->EvictGpu();
+                evicted++;
+        }
+
+        QMutexLocker locker( &gpuLock );
+        if (warned) {
+                std::cerr << "WARNING: " << totalLocked() / (1024 * 1024) << " MiB in use is over the "
+                          << gpuBudget / (1024 * 1024) << " MiB GPU memory budget" << std::endl;
+        }
+        gpuFrame++;
+        return evicted;
+}
+
+unsigned int GpuMemory::Evictions()
+{
+        QMutexLocker locker( &gpuLock );
+        return gpuEvictions;
+}
+
+void GpuMemory::Allocated( GpuCategory category, long bytes )
+{
+        QMutexLocker locker( &gpuLock );
+        gpuBytes[category] += bytes;
+        long total = totalLocked();
+        if (total > gpuPeak)
+                gpuPeak = total;
+}
+
+void GpuMemory::Created( bool texture )
+{
+        QMutexLocker locker( &gpuLock );
+        if (texture)
+                gpuTextures++;
+        else
+                gpuBuffers++;
+}
+
+void GpuMemory::Deleted( bool texture )
+{
+        QMutexLocker locker( &gpuLock );
+        if (texture)
+                gpuTextures--;
+        else
+                gpuBuffers--;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  GLBuffer
+//////////////////////////////////////////////////////////////////////////////
+
+GLBuffer::GLBuffer()
+{
+        m_Name = 0;
+        m_Category = GpuOther;
+        m_Bytes = 0;
+}
+
+GLBuffer::~GLBuffer()
+{
+        Reset();
+}
+
+void GLBuffer::Create( GLenum target, GpuCategory category, GLsizeiptr bytes,
+                       const GLvoid *data, GLenum usage )
+{
+        Reset();
+
+        glGenBuffers( 1, &m_Name );
+        glBindBuffer( target, m_Name );
+        glBufferData( target, bytes, data, usage );
+        m_Category = category;
+        m_Bytes = bytes;
+
+        GpuMemory::Created( false );
+        GpuMemory::Allocated( m_Category, m_Bytes );
+}
+
+void GLBuffer::Reset()
+{
+        if (m_Name == 0)
+                return;
+
+        glDeleteBuffers( 1, &m_Name );
+        GpuMemory::Allocated( m_Category, -m_Bytes );
+        GpuMemory::Deleted( false );
+        m_Name = 0;
+        m_Bytes = 0;
+}
+
+void GLBuffer::Swap( GLBuffer &other )
+{
+        qSwap( m_Name, other.m_Name );
+        qSwap( m_Category, other.m_Category );
+        qSwap( m_Bytes, other.m_Bytes );
+}
+
+GLuint GLBuffer::Name() const
+{
+        return m_Name;
+}
+
+bool GLBuffer::Valid() const
+{
+        return m_Name != 0;
+}
+
+GLsizeiptr GLBuffer::Bytes() const
+{
+        return m_Bytes;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  GLTexture
+//////////////////////////////////////////////////////////////////////////////
+
+GLTexture::GLTexture()
+{
+        m_Name = 0;
+        m_Bytes = 0;
+}
+
+GLTexture::~GLTexture()
+{
+        Reset();
+}
+
+void GLTexture::Create()
+{
+        Reset();
+
+        glGenTextures( 1, &m_Name );
+        glBindTexture( GL_TEXTURE_2D, m_Name );
+        GpuMemory::Created( true );
+}
+
+void GLTexture::SetBytes( GLsizeiptr bytes )
+{
+        GpuMemory::Allocated( GpuTexture, bytes - m_Bytes );
+        m_Bytes = bytes;
+}
+
+void GLTexture::Reset()
+{
+        if (m_Name == 0)
+                return;
+
+        glDeleteTextures( 1, &m_Name );
+        GpuMemory::Allocated( GpuTexture, -m_Bytes );
+        GpuMemory::Deleted( true );
+        m_Name = 0;
+        m_Bytes = 0;
+}
+
+void GLTexture::Swap( GLTexture &other )
+{
+        qSwap( m_Name, other.m_Name );
+        qSwap( m_Bytes, other.m_Bytes );
+}
+
+GLuint GLTexture::Name() const
+{
+        return m_Name;
+}
+
+bool GLTexture::Valid() const
+{
+        return m_Name != 0;
+}
+
+GLsizeiptr GLTexture::Bytes() const
+{
+        return m_Bytes;
+}
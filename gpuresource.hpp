@@ -0,0 +1,140 @@
+/*
+ * Filename: gpuresource.hpp
+ *
+ * Owning handles for GL buffers and textures, and the bookkeeping of
+ * what they hold.
+ *
+ * A GLBuffer or GLTexture deletes its GL object when it goes away (or is
+ * Reset()), so it can't be forgotten or deleted twice, and it can't be
+ * copied: ownership only moves with Swap(). Everything they allocate is
+ * counted in GpuMemory by category, which the HUD shows; anything still
+ * alive when GpuMemory::ReportLeaks() runs at shutdown is reported.
+ *
+ * GpuMemory also keeps a VRAM budget. Things that can give their GL data
+ * back and make it again later (an asset's buffers, the shadow maps)
+ * register as a GpuCacheEntry; when the total is over the budget, the
+ * least recently used entries that weren't used last frame are evicted
+ * until it fits.
+ *
+ * Deleting needs the GL context current, like the glDelete*() calls it
+ * replaces. There are no vertex array objects to look after: the arrays
+ * are set up with fixed function client state every draw.
+ */
+
+#ifndef _GPURESOURCE_H
+#define _GPURESOURCE_H
+
+#include "gl.hpp"
+
+// What the memory is for (the HUD and leak report break it down by this)
+enum GpuCategory { GpuVertex, GpuIndex, GpuTexture, GpuOther };
+const int GPU_CATEGORIES = 4;
+
+/*
+ * Anything holding GL data it can rebuild on its own (from a CPU copy,
+ * or by drawing it again). EvictGpu() is only called on the GL thread,
+ * from GpuMemory::Enforce().
+ */
+class GpuCacheEntry
+{
+public:
+        virtual ~GpuCacheEntry() {}
+
+        virtual long GpuBytes() const = 0;
+        virtual void EvictGpu() = 0;
+};
+
+class GpuMemory
+{
+public:
+        // Bytes by category right now, all of them, and the most ever
+        static long Bytes( GpuCategory category );
+        static long TotalBytes();
+        static long PeakBytes();
+        static const char *CategoryName( GpuCategory category );
+
+        // Live buffers and textures
+        static unsigned int Buffers();
+        static unsigned int Textures();
+
+        // Print a WARNING for anything that was never deleted. Returns
+        // true if everything was cleaned up.
+        static bool ReportLeaks();
+
+        // Budget in bytes (0 = no budget)
+        static void SetBudget( long bytes );
+        static long Budget();
+
+        // Cache entries: register once made, unregister before they go
+        // away, touch whenever they're drawn with
+        static void Register( GpuCacheEntry *entry );
+        static void Unregister( GpuCacheEntry *entry );
+        static void Touch( const GpuCacheEntry *entry );
+
+        // Once a frame, before drawing: evict until under budget. Returns
+        // how many entries went.
+        static unsigned int Enforce();
+        static unsigned int Evictions();
+
+        // For the handles
+        static void Allocated( GpuCategory category, long bytes );
+        static void Created( bool texture );
+        static void Deleted( bool texture );
+};
+
+class GLBuffer
+{
+public:
+        GLBuffer();
+        ~GLBuffer();
+
+        // Make a new buffer (dropping the old one) of bytes, filled from
+        // data if it isn't NULL. It's left bound to target.
+        void Create( GLenum target, GpuCategory category, GLsizeiptr bytes,
+                     const GLvoid *data, GLenum usage );
+
+        // Delete it (if there is one)
+        void Reset();
+        void Swap( GLBuffer &other );
+
+        GLuint Name() const;
+        bool Valid() const;
+        GLsizeiptr Bytes() const;
+
+private:
+        GLBuffer( const GLBuffer & );
+        GLBuffer &operator=( const GLBuffer & );
+
+        GLuint m_Name;
+        GpuCategory m_Category;
+        GLsizeiptr m_Bytes;
+};
+
+class GLTexture
+{
+public:
+        GLTexture();
+        ~GLTexture();
+
+        // Make a new texture name (dropping the old one). It's left bound
+        // to GL_TEXTURE_2D. Images are sized by the caller: tell it with
+        // SetBytes() after each glTexImage*().
+        void Create();
+        void SetBytes( GLsizeiptr bytes );
+
+        void Reset();
+        void Swap( GLTexture &other );
+
+        GLuint Name() const;
+        bool Valid() const;
+        GLsizeiptr Bytes() const;
+
+private:
+        GLTexture( const GLTexture & );
+        GLTexture &operator=( const GLTexture & );
+
+        GLuint m_Name;
+        GLsizeiptr m_Bytes;
+};
+
+#endif    // _GPURESOURCE_H
@@ -0,0 +1,117 @@
+/*
+ * Filename: input.cpp
+ *
+ * Per-frame input coalescing (see input.hpp).
+ */
+
+#include "input.hpp"
+
+/*
+ * Back to "nothing happened", with the drag starting where the mouse is
+ */
+static void clearFrame( InputFrame &frame, QPoint mousePos )
+{
+        frame.dragged = false;
+        frame.dragFrom = frame.dragTo = mousePos;
+        frame.buttons = Qt::NoButton;
+        frame.zoom = 0.0;
+        for (int k = 0; k < 3; k++) {
+                frame.rotationSet[k] = false;
+                frame.rotation[k] = 0;
+        }
+        frame.firstEvent = -1;
+}
+
+InputState::InputState()
+{
+        m_Dirty = false;
+        m_Events = m_Updates = 0;
+        m_Clock.start();
+        clearFrame( m_Pending, m_MousePos );
+}
+
+/*
+ * Count an event that needs a frame, remembering when the first one
+ * since the last frame arrived
+ */
+void InputState::stamp()
+{
+        m_Events++;
+        if (m_Pending.firstEvent < 0)
+                m_Pending.firstEvent = Now();
+        m_Dirty = true;
+}
+
+/*
+ * A new drag starts here, so anything left over from the last one
+ * (which had its own frame already) mustn't be joined onto it
+ */
+void InputState::MousePressed( QPoint pos, Qt::MouseButtons buttons )
+{
+        m_Events++;
+        m_MousePos = pos;
+        m_Pending.dragFrom = m_Pending.dragTo = pos;
+        m_Pending.dragged = false;
+        m_Pending.buttons = buttons;
+}
+
+/*
+ * Only the latest position matters: the drag for this frame goes from
+ * where the mouse was at the last frame to here
+ */
+void InputState::MouseMoved( QPoint pos, Qt::MouseButtons buttons )
+{
+        m_MousePos = pos;
+        m_Pending.dragTo = pos;
+        m_Pending.buttons = buttons;
+        m_Pending.dragged = (m_Pending.dragTo != m_Pending.dragFrom);
+        stamp();
+}
+
+void InputState::Zoom( float amount )
+{
+        m_Pending.zoom += amount;
+        stamp();
+}
+
+void InputState::SetRotation( int axis, int angle )
+{
+        m_Pending.rotationSet[axis] = true;
+        m_Pending.rotation[axis] = angle;
+        stamp();
+}
+
+void InputState::Touch()
+{
+        stamp();
+}
+
+bool InputState::Take( InputFrame &frame )
+{
+        if (!m_Dirty)
+                return false;
+
+        frame = m_Pending;
+        Qt::MouseButtons buttons = m_Pending.buttons;
+        clearFrame( m_Pending, m_MousePos );
+        m_Pending.buttons = buttons;
+
+        m_Dirty = false;
+        m_Updates++;
+        return true;
+}
+
+unsigned int InputState::EventsReceived() const
+{
+        return m_Events;
+}
+
+unsigned int InputState::UpdatesApplied() const
+{
+        return m_Updates;
+}
+
+qint64 InputState::Now() const
+{
+        return m_Clock.nsecsElapsed() / 1000;
+}
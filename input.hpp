@@ -0,0 +1,74 @@
+/*
+ * Filename: input.hpp
+ *
+ * Collects the raw input that moves the camera (mouse drags, the wheel,
+ * the rotation sliders) between frames so it can all be applied in one
+ * go. A mouse polling at 1000 Hz or a slider being dragged used to mean
+ * a synchronous repaint per event; now events only update this state and
+ * the GLWidget's frame tick turns whatever piled up into one camera
+ * update and one frame.
+ *
+ * It also counts events against the frames they ended up in, so it's
+ * easy to see how much coalescing is going on.
+ */
+
+#ifndef _INPUT_H
+#define _INPUT_H
+
+#include <QPoint>
+#include <QElapsedTimer>
+
+// Everything that happened since the last frame
+struct InputFrame
+{
+        bool dragged;                // did the mouse move with a button down?
+        QPoint dragFrom, dragTo;     // where it was at the last frame / now
+        Qt::MouseButtons buttons;
+
+        float zoom;                  // forward() / backward() amounts, summed
+
+        bool rotationSet[3];         // slider x, y, z moved?
+        int rotation[3];             // and its latest value
+
+        qint64 firstEvent;           // Now() when the first of it came in
+};
+
+class InputState
+{
+public:
+        InputState();
+
+        // Raw events
+        void MousePressed( QPoint pos, Qt::MouseButtons buttons );
+        void MouseMoved( QPoint pos, Qt::MouseButtons buttons );
+        void Zoom( float amount );
+        void SetRotation( int axis, int angle );
+
+        // Anything else that needs a redraw (colors, scaling ...)
+        void Touch();
+
+        // Hand over (and clear) what has built up. Returns false if
+        // nothing happened since the last call.
+        bool Take( InputFrame &frame );
+
+        // Events seen, and how many frames they were folded into
+        unsigned int EventsReceived() const;
+        unsigned int UpdatesApplied() const;
+
+        // Microseconds on the clock events are stamped with, for
+        // measuring how long input takes to reach the screen
+        qint64 Now() const;
+
+private:
+        void stamp();
+
+        QElapsedTimer m_Clock;
+        InputFrame m_Pending;
+        bool m_Dirty;
+        QPoint m_MousePos;
+
+        unsigned int m_Events;
+        unsigned int m_Updates;
+};
+
+#endif    // _INPUT_H
@@ -0,0 +1,712 @@
+/*
+ * Filename: lights.cpp
+ *
+ * Dirty-tracked lights and the uniform block lighting shader
+ * (see lights.hpp).
+ */
+
+#include "lights.hpp"
+#include "gl.hpp"
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+
+/*
+ * Per-pixel version of what fixed function does with our lights (diffuse
+ * only, the default material has no specular): the scene ambient plus
+ * each light's diffuse term. p.xyz - p.w * eye is the direction to a
+ * point light and just p.xyz for a directional one. Lights with a range
+ * fade out (squared) to nothing there.
+ *
+ * With tileSize set, only the lights binned into this pixel's tile are
+ * looked at (see LightManager::Bin()).
+ *
+ * With shadowKernel set, the lights named in shadowLight are shadowed by
+ * their map (see shadows.hpp), averaged over shadowKernel^2 compares.
+ * The shadow coordinates come from the eye space position, since in the
+ * compact vertex format gl_Vertex isn't in model units. GLSL 1.30 can't
+ * index an array of samplers with a variable, hence the three of them.
+ */
+static const char *vertexSource =
+        "uniform mat4 shadowMatrix[3];\n"
+        "out vec3 eyePosition;\n"
+        "out vec3 eyeNormal;\n"
+        "out vec4 shadowCoord[3];\n"
+        "void main()\n"
+        "{\n"
+        "        eyePosition = vec3( gl_ModelViewMatrix * gl_Vertex );\n"
+        "        for (int k = 0; k < 3; k++)\n"
+        "                shadowCoord[k] = shadowMatrix[k] * vec4( eyePosition, 1.0 );\n"
+        "        eyeNormal = gl_NormalMatrix * gl_Normal;\n"
+        "        gl_Position = ftransform();\n"
+        "}\n";
+
+static const char *fragmentSource =
+        "struct Light { vec4 position; vec4 diffuseRange; };\n"
+        "layout(std140) uniform Lights { Light lights[MAX_LIGHTS]; };\n"
+        "uniform int lightCount;\n"
+        "uniform int tileSize;\n"
+        "uniform ivec2 tileOrigin;\n"
+        "uniform bool heatmap;\n"
+        "uniform usampler2D tileRanges;\n"
+        "uniform usampler2D tileLights;\n"
+        "uniform int shadowKernel;\n"
+        "uniform float shadowTexel;\n"
+        "uniform int shadowLight[3];\n"
+        "uniform sampler2DShadow shadowMap0;\n"
+        "uniform sampler2DShadow shadowMap1;\n"
+        "uniform sampler2DShadow shadowMap2;\n"
+        "in vec3 eyePosition;\n"
+        "in vec3 eyeNormal;\n"
+        "in vec4 shadowCoord[3];\n"
+        "float shadowed( sampler2DShadow map, vec4 coord )\n"
+        "{\n"
+        "        vec3 c = coord.xyz / coord.w;\n"
+        "        if (coord.w <= 0.0 || c.z >= 1.0)\n"
+        "                return 1.0;\n"
+        "        int r = shadowKernel / 2;\n"
+        "        float lit = 0.0;\n"
+        "        for (int y = -r; y <= r; y++) {\n"
+        "                for (int x = -r; x <= r; x++)\n"
+        "                        lit += shadow2D( map, c + vec3( x, y, 0.0 ) * shadowTexel ).r;\n"
+        "        }\n"
+        "        return lit / float( shadowKernel * shadowKernel );\n"
+        "}\n"
+        "float shadowFor( int i )\n"
+        "{\n"
+        "        if (shadowKernel == 0)\n"
+        "                return 1.0;\n"
+        "        if (i == shadowLight[0])\n"
+        "                return shadowed( shadowMap0, shadowCoord[0] );\n"
+        "        if (i == shadowLight[1])\n"
+        "                return shadowed( shadowMap1, shadowCoord[1] );\n"
+        "        if (i == shadowLight[2])\n"
+        "                return shadowed( shadowMap2, shadowCoord[2] );\n"
+        "        return 1.0;\n"
+        "}\n"
+        "vec3 shade( int i, vec3 n )\n"
+        "{\n"
+        "        vec4 p = lights[i].position;\n"
+        "        vec3 d = p.xyz - p.w * eyePosition;\n"
+        "        float range = lights[i].diffuseRange.w;\n"
+        "        float fade = 1.0;\n"
+        "        if (range > 0.0) {\n"
+        "                fade = max( 1.0 - length( d ) / range, 0.0 );\n"
+        "                fade *= fade;\n"
+        "        }\n"
+        "        return lights[i].diffuseRange.rgb * fade * shadowFor( i )\n"
+        "               * max( dot( n, normalize( d ) ), 0.0 );\n"
+        "}\n"
+        "void main()\n"
+        "{\n"
+        "        vec3 n = normalize( eyeNormal );\n"
+        "        vec3 light = vec3( 0.0 );\n"
+        "        uint count = uint( lightCount );\n"
+        "        if (tileSize == 0) {\n"
+        "                for (int i = 0; i < lightCount; i++)\n"
+        "                        light += shade( i, n );\n"
+        "        } else {\n"
+        "                ivec2 tile = (ivec2( gl_FragCoord.xy ) - tileOrigin) / tileSize;\n"
+        "                uvec2 range = texelFetch( tileRanges, tile, 0 ).rg;\n"
+        "                for (uint k = 0u; k < range.y; k++) {\n"
+        "                        uint at = range.x + k;\n"
+        "                        ivec2 texel = ivec2( int( at % TILE_LIGHTS_WIDTH ),\n"
+        "                                             int( at / TILE_LIGHTS_WIDTH ) );\n"
+        "                        light += shade( int( texelFetch( tileLights, texel, 0 ).r ), n );\n"
+        "                }\n"
+        "                count = range.y;\n"
+        "        }\n"
+        "        vec3 color = gl_FrontLightModelProduct.sceneColor.rgb\n"
+        "                     + light * gl_FrontMaterial.diffuse.rgb;\n"
+        "        if (heatmap) {\n"
+        "                float t = min( float( count ) / HEATMAP_LIGHTS, 1.0 );\n"
+        "                vec3 heat = vec3( clamp( 2.0 * t - 1.0, 0.0, 1.0 ),\n"
+        "                                  1.0 - abs( 2.0 * t - 1.0 ),\n"
+        "                                  clamp( 1.0 - 2.0 * t, 0.0, 1.0 ) );\n"
+        "                color = mix( color, heat, 0.6 );\n"
+        "        }\n"
+        "        gl_FragColor = vec4( color, gl_FrontMaterial.diffuse.a );\n"
+        "}\n";
+
+// Light indices per row of the tile light texture
+static const unsigned int TILE_LIGHTS_WIDTH = 1024;
+
+// Lights in a tile that show up as full red on the heatmap
+static const int HEATMAP_LIGHTS = 32;
+
+// Texture units the tile lists are bound to (0 is the model's texture)
+static const int TILE_RANGE_UNIT = 1;
+static const int TILE_INDEX_UNIT = 2;
+
+/*
+ * Compile one stage, printing the log if it doesn't. Returns 0 on failure.
+ */
+static GLuint compileShader( GLenum type, const char *body )
+{
+        char header[256];
+        snprintf( header, sizeof(header),
+                  "#version 130\n"
+                  "#extension GL_ARB_uniform_buffer_object : enable\n"
+                  "#define MAX_LIGHTS %u\n"
+                  "#define TILE_LIGHTS_WIDTH %uu\n"
+                  "#define HEATMAP_LIGHTS %d.0\n",
+                  MAX_LIGHTS, TILE_LIGHTS_WIDTH, HEATMAP_LIGHTS );
+        const char *sources[2] = { header, body };
+
+        GLuint shader = glCreateShader( type );
+        glShaderSource( shader, 2, sources, NULL );
+        glCompileShader( shader );
+
+        GLint ok = GL_FALSE;
+        glGetShaderiv( shader, GL_COMPILE_STATUS, &ok );
+        if (!ok) {
+                char log[1024];
+                glGetShaderInfoLog( shader, sizeof(log), NULL, log );
+                std::cerr << "WARNING: lighting shader didn't compile:\n" << log << std::endl;
+                glDeleteShader( shader );
+                return 0;
+        }
+        return shader;
+}
+
+LightManager::LightManager()
+{
+        m_Changed = false;
+        m_Program = 0;
+        m_CountLocation = -1;
+        m_Uploads = 0;
+        m_BytesUploaded = 0;
+
+        m_Tiled = m_Heatmap = false;
+        m_BinDirty = true;
+        memset( m_BinProjection, 0, sizeof(m_BinProjection) );
+        memset( m_BinViewport, 0, sizeof(m_BinViewport) );
+        m_TilesX = m_TilesY = 0;
+        for (int k = 0; k < 3; k++)
+                m_TileLocations[k] = -1;
+        m_TileMax = 0;
+        m_TileAverage = 0.0;
+}
+
+LightManager::~LightManager()
+{
+        Reset();
+}
+
+void LightManager::Reset()
+{
+        if (m_Program != 0)
+                glDeleteProgram( m_Program );
+        m_Buffer.Reset();
+        m_RangeTexture.Reset();
+        m_IndexTexture.Reset();
+
+        m_Program = 0;
+        m_CountLocation = -1;
+        m_Uploaded.clear();
+        m_BinDirty = true;
+}
+
+unsigned int LightManager::Add( const float position[4], const float diffuse[4],
+                                float range )
+{
+        LightData light;
+        memcpy( light.position, position, sizeof(light.position) );
+        memcpy( light.diffuse, diffuse, sizeof(light.diffuse) );
+        light.range = range;
+
+        m_Lights.push_back( light );
+        m_Enabled.push_back( 1 );
+        m_Dirty.push_back( 1 );
+        m_Changed = true;
+        return m_Lights.size() - 1;
+}
+
+void LightManager::SetPosition( unsigned int light, const float position[4] )
+{
+        if (memcmp( m_Lights[light].position, position, sizeof(float) * 4 ) == 0)
+                return;
+
+        memcpy( m_Lights[light].position, position, sizeof(float) * 4 );
+        m_Dirty[light] = 1;
+        m_Changed = true;
+}
+
+// Only red, green and blue: the alpha never did anything to the lighting
+void LightManager::SetDiffuse( unsigned int light, const float diffuse[4] )
+{
+        if (memcmp( m_Lights[light].diffuse, diffuse, sizeof(float) * 3 ) == 0)
+                return;
+
+        memcpy( m_Lights[light].diffuse, diffuse, sizeof(float) * 3 );
+        m_Dirty[light] = 1;
+        m_Changed = true;
+}
+
+void LightManager::SetRange( unsigned int light, float range )
+{
+        if (m_Lights[light].range == range)
+                return;
+
+        m_Lights[light].range = range;
+        m_Dirty[light] = 1;
+        m_Changed = true;
+}
+
+void LightManager::Truncate( unsigned int count )
+{
+        if (count >= m_Lights.size())
+                return;
+
+        // Fixed function lights that are going away have to be switched off
+        for (unsigned int i = count; i < m_Lights.size(); i++)
+                m_Removed.push_back( i );
+
+        m_Lights.resize( count );
+        m_Enabled.resize( count );
+        m_Dirty.resize( count );
+        m_Changed = true;
+}
+
+void LightManager::SetEnabled( unsigned int light, bool on )
+{
+        if ((m_Enabled[light] != 0) == on)
+                return;
+
+        m_Enabled[light] = on;
+        m_Dirty[light] = 1;
+        m_Changed = true;
+}
+
+unsigned int LightManager::Count() const
+{
+        return m_Lights.size();
+}
+
+unsigned int LightManager::EnabledCount() const
+{
+        unsigned int count = 0;
+        for (unsigned int i = 0; i < m_Enabled.size(); i++) {
+                if (m_Enabled[i])
+                        count++;
+        }
+        return count;
+}
+
+bool LightManager::Shaded() const
+{
+        return m_Program != 0;
+}
+
+GLuint LightManager::Program() const
+{
+        return m_Program;
+}
+
+int LightManager::PackedIndex( unsigned int light ) const
+{
+        if (light >= m_Lights.size() || !m_Enabled[light])
+                return -1;
+
+        unsigned int index = 0;
+        for (unsigned int i = 0; i < light; i++) {
+                if (m_Enabled[i])
+                        index++;
+        }
+        return (index < MAX_LIGHTS) ? (int) index : -1;
+}
+
+unsigned int LightManager::Uploads() const
+{
+        return m_Uploads;
+}
+
+unsigned long LightManager::BytesUploaded() const
+{
+        return m_BytesUploaded;
+}
+
+void LightManager::Init( bool shaders )
+{
+        Reset();
+
+        // Whatever GL had is gone or stale
+        for (unsigned int i = 0; i < m_Dirty.size(); i++)
+                m_Dirty[i] = 1;
+        m_Changed = true;
+
+        // #version 130 needs GL 3.0, uniform blocks are core in 3.1
+        if (!shaders)
+                return;
+        if (!GLVersionAtLeast( 3, 0 ) ||
+            !(GLVersionAtLeast( 3, 1 ) || HaveGLExtension( "GL_ARB_uniform_buffer_object" ))) {
+                std::cerr << "WARNING: no uniform buffer objects, using fixed function lighting" << std::endl;
+                return;
+        }
+
+        GLuint vertex = compileShader( GL_VERTEX_SHADER, vertexSource );
+        GLuint fragment = compileShader( GL_FRAGMENT_SHADER, fragmentSource );
+        if (vertex == 0 || fragment == 0) {
+                if (vertex != 0)
+                        glDeleteShader( vertex );
+                if (fragment != 0)
+                        glDeleteShader( fragment );
+                std::cerr << "WARNING: using fixed function lighting" << std::endl;
+                return;
+        }
+
+        m_Program = glCreateProgram();
+        glAttachShader( m_Program, vertex );
+        glAttachShader( m_Program, fragment );
+        glLinkProgram( m_Program );
+        glDeleteShader( vertex );       // the program keeps them alive
+        glDeleteShader( fragment );
+
+        GLint ok = GL_FALSE;
+        glGetProgramiv( m_Program, GL_LINK_STATUS, &ok );
+        GLuint block = glGetUniformBlockIndex( m_Program, "Lights" );
+        if (!ok || block == GL_INVALID_INDEX) {
+                char log[1024];
+                glGetProgramInfoLog( m_Program, sizeof(log), NULL, log );
+                std::cerr << "WARNING: lighting shader didn't link, using fixed function lighting:\n"
+                          << log << std::endl;
+                Reset();
+                return;
+        }
+
+        glUniformBlockBinding( m_Program, block, 0 );
+        m_CountLocation = glGetUniformLocation( m_Program, "lightCount" );
+        m_TileLocations[0] = glGetUniformLocation( m_Program, "tileSize" );
+        m_TileLocations[1] = glGetUniformLocation( m_Program, "tileOrigin" );
+        m_TileLocations[2] = glGetUniformLocation( m_Program, "heatmap" );
+
+        glUseProgram( m_Program );
+        glUniform1i( glGetUniformLocation( m_Program, "tileRanges" ), TILE_RANGE_UNIT );
+        glUniform1i( glGetUniformLocation( m_Program, "tileLights" ), TILE_INDEX_UNIT );
+        glUseProgram( 0 );
+
+        // Integer textures can't be filtered (or they're incomplete)
+        GLTexture *textures[2] = { &m_RangeTexture, &m_IndexTexture };
+        for (int t = 0; t < 2; t++) {
+                textures[t]->Create();
+                glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+                glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+        }
+        glBindTexture( GL_TEXTURE_2D, 0 );
+
+        m_Buffer.Create( GL_UNIFORM_BUFFER, GpuOther, MAX_LIGHTS * sizeof(LightData), NULL,
+                         GL_DYNAMIC_DRAW );
+        glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+}
+
+void LightManager::Apply()
+{
+        if (!m_Changed)
+                return;
+
+        if (Shaded())
+                applyShaded();
+        else
+                applyFixed();
+
+        for (unsigned int i = 0; i < m_Dirty.size(); i++)
+                m_Dirty[i] = 0;
+        m_Changed = false;
+}
+
+/*
+ * Only the lights that changed. Positions are in eye space, so they go in
+ * with an identity modelview (GL transforms them by whatever is loaded).
+ */
+void LightManager::applyFixed()
+{
+        GLint maxLights = 8;
+        glGetIntegerv( GL_MAX_LIGHTS, &maxLights );
+        unsigned int count = qMin( (unsigned int) maxLights, Count() );
+
+        for (unsigned int r = 0; r < m_Removed.size(); r++) {
+                if (m_Removed[r] < (unsigned int) maxLights)
+                        glDisable( GL_LIGHT0 + m_Removed[r] );
+        }
+        m_Removed.clear();
+
+        glMatrixMode( GL_MODELVIEW );
+        glPushMatrix();
+        glLoadIdentity();
+        for (unsigned int i = 0; i < count; i++) {
+                if (!m_Dirty[i])
+                        continue;
+
+                GLenum light = GL_LIGHT0 + i;
+                if (m_Enabled[i])
+                        glEnable( light );
+                else
+                        glDisable( light );
+
+                // The range is only used for tiling, fixed function
+                // lights don't fade out
+                const LightData &data = m_Lights[i];
+                GLfloat diffuse[4] = { data.diffuse[0], data.diffuse[1], data.diffuse[2], 1.0 };
+                glLightfv( light, GL_POSITION, data.position );
+                glLightfv( light, GL_DIFFUSE, diffuse );
+
+                m_Uploads++;
+                m_BytesUploaded += sizeof(LightData);
+        }
+        glPopMatrix();
+}
+
+/*
+ * Pack the enabled lights and send the range that differs from what the
+ * buffer already holds (usually just the one light that changed; turning
+ * a light on or off shifts everything after it)
+ */
+void LightManager::applyShaded()
+{
+        m_Packed.clear();
+        for (unsigned int i = 0; i < m_Lights.size() && m_Packed.size() < MAX_LIGHTS; i++) {
+                if (m_Enabled[i])
+                        m_Packed.push_back( m_Lights[i] );
+        }
+
+        unsigned int first = 0;
+        while (first < m_Packed.size() && first < m_Uploaded.size() &&
+               memcmp( &m_Packed[first], &m_Uploaded[first], sizeof(LightData) ) == 0)
+                first++;
+
+        unsigned int last = m_Packed.size();
+        if (m_Packed.size() == m_Uploaded.size()) {
+                while (last > first &&
+                       memcmp( &m_Packed[last - 1], &m_Uploaded[last - 1], sizeof(LightData) ) == 0)
+                        last--;
+        }
+
+        if (last > first) {
+                glBindBuffer( GL_UNIFORM_BUFFER, m_Buffer.Name() );
+                glBufferSubData( GL_UNIFORM_BUFFER, first * sizeof(LightData),
+                                 (last - first) * sizeof(LightData), &m_Packed[first] );
+                glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+                m_BytesUploaded += (last - first) * sizeof(LightData);
+        }
+
+        if (m_Packed.size() != m_Uploaded.size()) {
+                glUseProgram( m_Program );
+                glUniform1i( m_CountLocation, m_Packed.size() );
+                glUseProgram( 0 );
+        }
+
+        if (last > first || m_Packed.size() != m_Uploaded.size()) {
+                m_Uploads++;
+                m_BinDirty = true;
+        }
+        m_Uploaded = m_Packed;
+        m_Removed.clear();
+}
+
+void LightManager::SetTiled( bool on )
+{
+        if (on && !m_Tiled)
+                m_BinDirty = true;
+        m_Tiled = on;
+}
+
+void LightManager::SetHeatmap( bool on )
+{
+        m_Heatmap = on;
+}
+
+bool LightManager::Tiled() const
+{
+        return m_Tiled && Shaded();
+}
+
+int LightManager::TilesX() const
+{
+        return m_TilesX;
+}
+
+int LightManager::TilesY() const
+{
+        return m_TilesY;
+}
+
+unsigned int LightManager::TileMaxLights() const
+{
+        return m_TileMax;
+}
+
+float LightManager::TileAverageLights() const
+{
+        return m_TileAverage;
+}
+
+/*
+ * The tiles (x0, y0) - (x1, y1) inclusive that a light can reach. Lights
+ * without a range reach everything. Otherwise the eight corners of the box
+ * around its sphere are projected: the rectangle around them holds the
+ * whole sphere on screen. A sphere poking through the eye plane can't be
+ * projected that way and also gets every tile. False if it's off screen.
+ */
+static bool lightTiles( const LightData &light, const float *m, const int viewport[4],
+                        int tilesX, int tilesY, int rect[4] )
+{
+        rect[0] = rect[1] = 0;
+        rect[2] = tilesX - 1;
+        rect[3] = tilesY - 1;
+        if (light.range <= 0.0 || light.position[3] == 0.0)
+                return true;
+
+        const float *c = light.position;
+        float r = light.range;
+        if (c[2] - r > 0.0)
+                return false;           // all of it is behind the eye
+
+        float minX = 1e30, minY = 1e30, maxX = -1e30, maxY = -1e30;
+        for (int k = 0; k < 8; k++) {
+                float x = c[0] + ((k & 1) ? r : -r);
+                float y = c[1] + ((k & 2) ? r : -r);
+                float z = c[2] + ((k & 4) ? r : -r);
+
+                float w = m[3] * x + m[7] * y + m[11] * z + m[15];
+                if (w <= 1e-6)
+                        return true;
+
+                float px = (m[0] * x + m[4] * y + m[8] * z + m[12]) / w;
+                float py = (m[1] * x + m[5] * y + m[9] * z + m[13]) / w;
+                minX = qMin( minX, px );
+                maxX = qMax( maxX, px );
+                minY = qMin( minY, py );
+                maxY = qMax( maxY, py );
+        }
+
+        if (maxX < -1.0 || minX > 1.0 || maxY < -1.0 || minY > 1.0)
+                return false;
+
+        // Normalized device coordinates to tiles within the viewport
+        float toTileX = 0.5 * viewport[2] / LightManager::TILE_SIZE;
+        float toTileY = 0.5 * viewport[3] / LightManager::TILE_SIZE;
+        rect[0] = qMax( (int) floor( (minX + 1.0) * toTileX ), 0 );
+        rect[1] = qMax( (int) floor( (minY + 1.0) * toTileY ), 0 );
+        rect[2] = qMin( (int) floor( (maxX + 1.0) * toTileX ), tilesX - 1 );
+        rect[3] = qMin( (int) floor( (maxY + 1.0) * toTileY ), tilesY - 1 );
+        return rect[0] <= rect[2] && rect[1] <= rect[3];
+}
+
+/*
+ * The CPU culling pass: count the lights per tile, turn the counts into
+ * where each tile's list starts, then fill the lists in. Two passes over
+ * the lights' tile rectangles, no per-tile allocations.
+ */
+void LightManager::Bin( const float projection[16], const int viewport[4] )
+{
+        if (!Tiled())
+                return;
+        if (!m_BinDirty &&
+            memcmp( projection, m_BinProjection, sizeof(m_BinProjection) ) == 0 &&
+            memcmp( viewport, m_BinViewport, sizeof(m_BinViewport) ) == 0)
+                return;
+
+        memcpy( m_BinProjection, projection, sizeof(m_BinProjection) );
+        memcpy( m_BinViewport, viewport, sizeof(m_BinViewport) );
+        m_BinDirty = false;
+
+        m_TilesX = qMax( (viewport[2] + TILE_SIZE - 1) / TILE_SIZE, 1 );
+        m_TilesY = qMax( (viewport[3] + TILE_SIZE - 1) / TILE_SIZE, 1 );
+        unsigned int tiles = m_TilesX * m_TilesY;
+
+        // Tile rectangle of every light (x0 > x1 if it's off screen)
+        unsigned int lights = m_Uploaded.size();
+        m_LightTiles.resize( lights * 4 );
+        m_TileRanges.assign( tiles * 2, 0 );
+        for (unsigned int i = 0; i < lights; i++) {
+                int *rect = &m_LightTiles[i * 4];
+                if (!lightTiles( m_Uploaded[i], projection, viewport, m_TilesX, m_TilesY, rect )) {
+                        rect[0] = 1;
+                        rect[2] = 0;
+                        continue;
+                }
+                for (int y = rect[1]; y <= rect[3]; y++) {
+                        for (int x = rect[0]; x <= rect[2]; x++)
+                                m_TileRanges[(y * m_TilesX + x) * 2 + 1]++;
+                }
+        }
+
+        // Counts to starting points (the counts get rebuilt as they fill)
+        unsigned int total = 0;
+        m_TileMax = 0;
+        for (unsigned int t = 0; t < tiles; t++) {
+                GLuint count = m_TileRanges[t * 2 + 1];
+                m_TileRanges[t * 2] = total;
+                m_TileRanges[t * 2 + 1] = 0;
+                m_TileMax = qMax( m_TileMax, (unsigned int) count );
+                total += count;
+        }
+
+        m_TileAverage = (float) total / tiles;
+        m_TileLights.resize( total );
+        for (unsigned int i = 0; i < lights; i++) {
+                const int *rect = &m_LightTiles[i * 4];
+                for (int y = rect[1]; y <= rect[3]; y++) {
+                        for (int x = rect[0]; x <= rect[2]; x++) {
+                                GLuint *range = &m_TileRanges[(y * m_TilesX + x) * 2];
+                                m_TileLights[range[0] + range[1]] = i;
+                                range[1]++;
+                        }
+                }
+        }
+
+        uploadTiles();
+}
+
+/*
+ * Ranges as a tilesX x tilesY RG texture, indices TILE_LIGHTS_WIDTH to a
+ * row (padded out to a whole row)
+ */
+void LightManager::uploadTiles()
+{
+        unsigned int rows = qMax( (unsigned int) (m_TileLights.size() + TILE_LIGHTS_WIDTH - 1)
+                                  / TILE_LIGHTS_WIDTH, 1u );
+        m_TileLights.resize( rows * TILE_LIGHTS_WIDTH, 0 );
+
+        glBindTexture( GL_TEXTURE_2D, m_RangeTexture.Name() );
+        glTexImage2D( GL_TEXTURE_2D, 0, GL_RG32UI, m_TilesX, m_TilesY, 0,
+                      GL_RG_INTEGER, GL_UNSIGNED_INT, &m_TileRanges[0] );
+        m_RangeTexture.SetBytes( m_TileRanges.size() * sizeof(GLuint) );
+        glBindTexture( GL_TEXTURE_2D, m_IndexTexture.Name() );
+        glTexImage2D( GL_TEXTURE_2D, 0, GL_R32UI, TILE_LIGHTS_WIDTH, rows, 0,
+                      GL_RED_INTEGER, GL_UNSIGNED_INT, &m_TileLights[0] );
+        m_IndexTexture.SetBytes( m_TileLights.size() * sizeof(GLuint) );
+        glBindTexture( GL_TEXTURE_2D, 0 );
+
+        m_BytesUploaded += (m_TileRanges.size() + m_TileLights.size()) * sizeof(GLuint);
+}
+
+void LightManager::Begin() const
+{
+        if (!Shaded())
+                return;
+
+        glBindBufferBase( GL_UNIFORM_BUFFER, 0, m_Buffer.Name() );
+        glUseProgram( m_Program );
+
+        bool tiled = Tiled() && m_TilesX > 0;
+        glUniform1i( m_TileLocations[0], tiled ? TILE_SIZE : 0 );
+        glUniform2i( m_TileLocations[1], m_BinViewport[0], m_BinViewport[1] );
+        glUniform1i( m_TileLocations[2], m_Heatmap );
+
+        if (tiled) {
+                glActiveTexture( GL_TEXTURE0 + TILE_RANGE_UNIT );
+                glBindTexture( GL_TEXTURE_2D, m_RangeTexture.Name() );
+                glActiveTexture( GL_TEXTURE0 + TILE_INDEX_UNIT );
+                glBindTexture( GL_TEXTURE_2D, m_IndexTexture.Name() );
+                glActiveTexture( GL_TEXTURE0 );
+        }
+}
+
+void LightManager::End() const
+{
+        if (Shaded())
+                glUseProgram( 0 );
+}
@@ -0,0 +1,151 @@
+/*
+ * Filename: lights.hpp
+ *
+ * Keeps every light in the scene in one compact array and only sends GL
+ * what has changed since the last frame (the old code re-sent the aux
+ * light colors every frame and switched lights on and off from the
+ * slots, wherever the context happened to be).
+ *
+ * On GL 3.0+ with uniform buffer objects the lights are drawn by a small
+ * per-pixel lighting shader: the enabled lights are packed back to back
+ * into a uniform block (std140) and only the part of it that differs
+ * from what was last uploaded is sent, so any number of lights up to
+ * MAX_LIGHTS costs one glBufferSubData() when something changes and
+ * nothing when it doesn't.
+ *
+ * Without that (or with --fixed-function) the first GL_MAX_LIGHTS go to
+ * the fixed function lights, again only the ones that changed.
+ *
+ * Tiled (Forward+) mode, for when there are dozens of point lights: the
+ * screen is cut into TILE_SIZE pixel tiles and each light with a range is
+ * binned on the CPU into the tiles its sphere can touch. The tile lists
+ * go to GL as two integer textures (first / count per tile, and the light
+ * indices) and each pixel only loops over the lights in its tile.
+ * Binning is redone only when the lights, projection or viewport change.
+ */
+
+#ifndef _LIGHTS_H
+#define _LIGHTS_H
+
+#include "gl.hpp"
+#include "gpuresource.hpp"
+
+#include <vector>
+
+// One light, laid out like the shader's std140 struct
+struct LightData
+{
+        float position[4];              // eye space, w == 0 for directional
+        float diffuse[3];
+        float range;                    // fades out to 0 here; 0 = no falloff
+};
+
+// Size of the shader's light array (16 KiB of uniform block, the least
+// GL promises)
+const unsigned int MAX_LIGHTS = 512;
+
+class LightManager
+{
+public:
+        LightManager();
+
+        // Needs the GL context current (it deletes the buffer and shader)
+        ~LightManager();
+
+        // Setting up the lights. No GL calls; setting something to the
+        // value it already has doesn't count as a change.
+        unsigned int Add( const float position[4], const float diffuse[4],
+                          float range = 0.0 );
+        void SetPosition( unsigned int light, const float position[4] );
+        void SetDiffuse( unsigned int light, const float diffuse[4] );
+        void SetRange( unsigned int light, float range );
+        void SetEnabled( unsigned int light, bool on );
+
+        // Drop every light from count on
+        void Truncate( unsigned int count );
+
+        unsigned int Count() const;
+        unsigned int EnabledCount() const;
+
+        // Build the shader and uniform buffer if GL can do it (and
+        // shaders is set), otherwise use fixed function. Needs the
+        // context; everything is sent again at the next Apply().
+        void Init( bool shaders );
+        bool Shaded() const;
+
+        // The lighting shader (0 with fixed function), and where light
+        // sits in its packed array (-1 when it's off or didn't fit)
+        GLuint Program() const;
+        int PackedIndex( unsigned int light ) const;
+
+        // Send whatever changed since the last call. Call once per frame
+        // before drawing (the modelview doesn't matter).
+        void Apply();
+
+        // Forward+ tiling (shaded path only), and coloring each pixel by
+        // how many lights its tile has
+        void SetTiled( bool on );
+        void SetHeatmap( bool on );
+        bool Tiled() const;
+
+        // Bin the lights into tiles for this projection and viewport
+        // (x, y, w, h). Call after Apply(), before Begin().
+        void Bin( const float projection[16], const int viewport[4] );
+
+        // Tile grid and lights per tile from the last Bin()
+        int TilesX() const;
+        int TilesY() const;
+        unsigned int TileMaxLights() const;
+        float TileAverageLights() const;
+
+        // Around the lit geometry: binds the lighting shader
+        void Begin() const;
+        void End() const;
+
+        // Drop the GL objects (e.g. before the context goes away)
+        void Reset();
+
+        // How many times Apply() had something to send, and how much
+        unsigned int Uploads() const;
+        unsigned long BytesUploaded() const;
+
+        static const int TILE_SIZE = 16;
+
+private:
+        void applyFixed();
+        void applyShaded();
+        void uploadTiles();
+
+        std::vector<LightData> m_Lights;
+        std::vector<char> m_Enabled;
+        std::vector<char> m_Dirty;      // per light, since the last Apply()
+        std::vector<unsigned int> m_Removed;  // truncated since then
+        bool m_Changed;
+
+        // Shaded path: the enabled lights back to back, and what the
+        // uniform buffer holds right now
+        std::vector<LightData> m_Packed;
+        std::vector<LightData> m_Uploaded;
+        GLuint m_Program;
+        GLBuffer m_Buffer;
+        GLint m_CountLocation;
+
+        // Forward+ tiles: first / count per tile, then the light indices
+        bool m_Tiled, m_Heatmap;
+        bool m_BinDirty;                // lights changed since the last Bin()
+        float m_BinProjection[16];
+        int m_BinViewport[4];
+        int m_TilesX, m_TilesY;
+        std::vector<GLuint> m_TileRanges;
+        std::vector<GLuint> m_TileLights;
+        std::vector<int> m_LightTiles;  // x0, y0, x1, y1 per packed light
+        GLTexture m_RangeTexture, m_IndexTexture;
+        GLint m_TileLocations[3];       // tileSize, tileOrigin, heatmap
+        unsigned int m_TileMax;
+        float m_TileAverage;
+
+        unsigned int m_Uploads;
+        unsigned long m_BytesUploaded;
+};
+
+#endif    // _LIGHTS_H
@@ -23,11 +23,41 @@
  */
 
 #include <QApplication>     // Needed to pull in Qt app. framework
+#include <QCoreApplication>
 #include <QDesktopWidget>   // Pulls in the Qt - Window Manager i-face
 #include <string>
+#include <cstring>
 #include <iostream>
 
 #include "window.hpp"       // Actual interface to the GUI window
+#include "batch.hpp"        // Offscreen rendering of lots of models
+#include "gpuresource.hpp"  // GPU memory / leak accounting
+#include "meshstats.hpp"    // --stats report
+
+/*
+ * --stats: check the model over and print the report as JSON. Only needs
+ * a QCoreApplication (for the thread pool), so no window or display.
+ */
+static int printStats( int argc, char *argv[] )
+{
+        QCoreApplication app( argc, argv );
+
+        const char *path = NULL;
+        for (int i = 1; i < argc; i++) {
+                if (strncmp( argv[i], "--", 2 ) != 0)
+                        path = argv[i];
+        }
+        if (path == NULL) {
+                std::cerr << "ERROR: --stats needs a model file path" << std::endl;
+                return 1;
+        }
+
+        ModelStats stats;
+        if (!AnalyzeModel( path, stats ))
+                return 1;
+        WriteStatsJson( stats, std::cout );
+        return 0;
+}
 
 /***********************************************************************
  * Main begins program execution
@@ -35,28 +65,77 @@
 
 int main( int argc, char *argv[] )
 {
+        // The report is done before there's any GUI to open
+        for (int i = 1; i < argc; i++) {
+                if (strcmp( argv[i], "--stats" ) == 0)
+                        return printStats( argc, argv );
+        }
+
         // Make a QApplication that can take any command line arguments
         QApplication app( argc, argv );
 
-        if (argc != 2) {
+        // Batch mode renders the models in a list and never opens a window
+        if (TurntableBatch::Requested( app.arguments() )) {
+                TurntableBatch batch( app.arguments() );
+                int result = batch.Run();
+                GpuMemory::ReportLeaks();
+                return result;
+        }
+
+        // Anything that isn't a "--option" is taken to be the model path
+        int models = 0;
+        for (int i = 1; i < argc; i++) {
+                if (strncmp( argv[i], "--", 2 ) != 0)
+                        models++;
+        }
+
+        if (models != 1) {
                 std::cerr << "You must provide a model file path (relative to working directory)" << std::endl;
+                std::cerr << "Options:" << std::endl;
+                std::cerr << "  --compact   store vertices in the compact (20 byte) format" << std::endl;
+                std::cerr << "  --no-cache  don't read or write <model>.meshcache" << std::endl;
+                std::cerr << "  --merge-coplanar  also collapse tiny flat edges while cleaning up faces" << std::endl;
+                std::cerr << "  --smooth-angle=<degrees>  sharpest edge to smooth normals across (default 80)" << std::endl;
+                std::cerr << "  --software  draw with the CPU renderer instead of GL" << std::endl;
+                std::cerr << "  --bench     time GL against the CPU renderer, then quit" << std::endl;
+                std::cerr << "  --render-thread  do all the drawing on a separate thread" << std::endl;
+                std::cerr << "  --fixed-function  light with fixed function GL, not the shader" << std::endl;
+                std::cerr << "  --submit=<mode>  per-range, multi-draw or indirect (default) draw submission" << std::endl;
+                std::cerr << "  --vram-budget=<MiB>  evict cached GPU data past this much" << std::endl;
+                std::cerr << "  --out-of-core  stream the model from <model>.chunks as needed" << std::endl;
+                std::cerr << "  --ooc-ram=<MiB>, --ooc-vram=<MiB>  what streaming may keep in RAM / on the GPU" << std::endl;
+                std::cerr << "  --stats     print a JSON report on the model and quit (no window)" << std::endl;
+                std::cerr << std::endl;
+                std::cerr << "Batch mode (no model path, no window):" << std::endl;
+                std::cerr << "  --batch=<list>  render every model listed in <list> (one per line)" << std::endl;
+                std::cerr << "  --angles=<n>    views per model (default 8)" << std::endl;
+                std::cerr << "  --size=<n>      image width and height (default 256)" << std::endl;
+                std::cerr << "  --out=<dir>     where the PNGs go (default .)" << std::endl;
                 exit( 0 );
         }
 
-        Window window;   // Creates a window (widgets will go in there)
-        window.resize( window.sizeHint() );
+        // The window (and with it the GL context) has to be gone before
+        // we can tell whether anything on the GPU was left behind
+        int result;
+        {
+                Window window;   // Creates a window (widgets will go in there)
+                window.resize( window.sizeHint() );
 
-        // Is window big enough to warrant starting maximized?
-        int desktopArea = QApplication::desktop()->width()
-                        * QApplication::desktop()->height();
-        int widgetArea = window.width() * window.height();
+                // Is window big enough to warrant starting maximized?
+                int desktopArea = QApplication::desktop()->width()
+                                * QApplication::desktop()->height();
+                int widgetArea = window.width() * window.height();
 
-        // Actually prepare to display the window now
-        if (((float) widgetArea / (float) desktopArea) < 0.75f)
-                window.show();
-        else
-                window.showMaximized();
+                // Actually prepare to display the window now
+                if (((float) widgetArea / (float) desktopArea) < 0.75f)
+                        window.show();
+                else
+                        window.showMaximized();
+
+                // Start running the application code for the GUI.
+                result = app.exec();
+        }
 
-        // Start running the application code for the GUI.
-        return app.exec();
+        GpuMemory::ReportLeaks();
+        return result;
 }
@@ -0,0 +1,44 @@
+/*
+ * Filename: memusage.cpp
+ *
+ * Memory usage numbers pulled out of /proc/self/status.
+ */
+
+#include "memusage.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+/*
+ * Find a "Name:   1234 kB" line and return the number
+ */
+static long statusField( const char *name )
+{
+        FILE *status = fopen( "/proc/self/status", "r" );
+        if (!status)
+                return -1;
+
+        size_t length = strlen( name );
+        char line[256];
+        long value = -1;
+
+        while (fgets( line, sizeof(line), status )) {
+                if (strncmp( line, name, length ) == 0 && line[length] == ':') {
+                        sscanf( line + length + 1, "%ld", &value );
+                        break;
+                }
+        }
+
+        fclose( status );
+        return value;
+}
+
+long ResidentKiB()
+{
+        return statusField( "VmRSS" );
+}
+
+long PeakResidentKiB()
+{
+        return statusField( "VmHWM" );
+}
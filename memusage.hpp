@@ -0,0 +1,18 @@
+/*
+ * Filename: memusage.hpp
+ *
+ * How much memory this process is using, as the kernel sees it (read
+ * from /proc/self/status). Only works on Linux; elsewhere everything
+ * comes back as -1.
+ */
+
+#ifndef _MEMUSAGE_H
+#define _MEMUSAGE_H
+
+// Resident set size right now, in KiB
+long ResidentKiB();
+
+// Highest resident set size since the process started, in KiB
+long PeakResidentKiB();
+
+#endif    // _MEMUSAGE_H
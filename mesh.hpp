@@ -0,0 +1,84 @@
+/*
+ * Filename: mesh.hpp
+ *
+ * CPU-side copy of a model's meshes after they've been pulled out of
+ * lib3ds and processed (welded, reordered, ...). This is what gets
+ * uploaded to the GPU by Asset3ds and what the mesh cache stores on disk.
+ *
+ * Nothing in here depends on OpenGL or Qt so the processing code can run
+ * on worker threads without a GL context.
+ */
+
+#ifndef _MESH_H
+#define _MESH_H
+
+#include <string>
+#include <vector>
+
+// One welded vertex. Also the layout of the float vertex VBO.
+struct MeshVertex
+{
+        float pos[3];
+        float normal[3];
+        float texCoord[2];
+        unsigned int tangent;               // packed, see meshtangents.hpp
+};
+
+/*
+ * The other layout the vertex VBO can have (Asset3ds::CompactVertices).
+ * Both are interleaved so a single buffer bind sets up all of the
+ * attribute pointers.
+ */
+struct CompactVertex
+{
+        short pos[4];                       // xyz in [-32767, 32767], w is padding
+        unsigned int normal;                // GL_INT_2_10_10_10_REV
+        unsigned short texCoord[2];         // half floats
+        unsigned int tangent;               // as in MeshVertex
+};
+
+/*
+ * Post-transform vertex cache numbers, before and after the index buffer
+ * was reordered:
+ *   ACMR - average cache miss ratio (vertex shader runs per triangle)
+ *   ATVR - average transform to vertex ratio (runs per unique vertex)
+ */
+struct MeshCacheStats
+{
+        float acmrBefore, acmrAfter;
+        float atvrBefore, atvrAfter;
+};
+
+/*
+ * A small cluster of a mesh's triangles (see meshlet.hpp). The triangles
+ * are a contiguous run of Mesh::indices. The sphere and normal cone are
+ * what the renderer culls against:
+ *   - off screen if the sphere is outside the view frustum
+ *   - all back facing if dot(center - eye, coneAxis)
+ *                              >= coneCutoff * |center - eye| + radius
+ *     (a coneCutoff of 1 means the triangles face every which way)
+ */
+struct Meshlet
+{
+        unsigned int firstIndex, indexCount;
+        unsigned int vertexCount;
+        float center[3];
+        float radius;
+        float coneAxis[3];
+        float coneCutoff;
+};
+
+struct Mesh
+{
+        std::string name;
+        bool hasTexels;                     // did the file have texcoords?
+
+        std::vector<MeshVertex> vertices;   // unique vertices
+        std::vector<unsigned int> indices;  // triangle list into vertices
+
+        std::vector<Meshlet> meshlets;      // covers all of indices
+
+        MeshCacheStats cacheStats;
+};
+
+#endif    // _MESH_H
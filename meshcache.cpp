@@ -0,0 +1,196 @@
+/*
+ * Filename: meshcache.cpp
+ *
+ * Reading and writing of the processed mesh cache files. The format is
+ * just the Mesh structs dumped in the machine's own byte order, which is
+ * fine since the cache never leaves the machine that made it.
+ */
+
+#include "meshcache.hpp"
+
+#include <fstream>
+#include <cstring>
+#include <sys/stat.h>
+
+// Bump this whenever Mesh or the processing changes what ends up in it
+static const unsigned int MESHCACHE_VERSION = 5;
+static const char MESHCACHE_MAGIC[8] = { 'U', 'M', 'L', 'M', 'E', 'S', 'H', '\0' };
+
+struct MeshCacheHeader
+{
+        char magic[8];
+        unsigned int version;
+        unsigned int meshCount;
+        unsigned int mergeCoplanar;
+        float smoothAngle;
+        long long sourceSize;
+        long long sourceTime;
+};
+
+// Size and mtime of the model, so a changed model invalidates the cache
+static bool sourceStamp( const std::string &modelPath, MeshCacheHeader &header )
+{
+        struct stat info;
+        if (stat( modelPath.c_str(), &info ) != 0)
+                return false;
+
+        header.sourceSize = (long long) info.st_size;
+        header.sourceTime = (long long) info.st_mtime;
+        return true;
+}
+
+// Helpers to move a std::vector of plain structs in and out of a stream
+template <typename T>
+static void writeVector( std::ofstream &out, const std::vector<T> &v )
+{
+        unsigned int count = v.size();
+        out.write( (const char *) &count, sizeof(count) );
+        if (count > 0)
+                out.write( (const char *) &v[0], sizeof(T) * count );
+}
+
+// What's left of the file after the read position
+static long long bytesLeft( std::ifstream &in )
+{
+        std::streampos here = in.tellg();
+        in.seekg( 0, std::ios::end );
+        std::streampos end = in.tellg();
+        in.seekg( here );
+        return (here < 0 || end < here) ? 0 : (long long) (end - here);
+}
+
+template <typename T>
+static bool readVector( std::ifstream &in, std::vector<T> &v )
+{
+        unsigned int count = 0;
+        if (!in.read( (char *) &count, sizeof(count) ))
+                return false;
+
+        // A corrupt or cut off count mustn't turn into a huge allocation
+        if ((long long) sizeof(T) * count > bytesLeft( in ))
+                return false;
+        v.resize( count );
+        if (count > 0)
+                in.read( (char *) &v[0], sizeof(T) * count );
+        return (bool) in;
+}
+
+/*
+ * Everything the mesh points at is inside it: whole triangles, indices
+ * below the vertex count and meshlets within the index list. Anything
+ * else is a damaged cache that would have the draws read past the
+ * buffers.
+ */
+static bool validMesh( const Mesh &mesh )
+{
+        unsigned int vertexCount = mesh.vertices.size();
+        unsigned int indexCount = mesh.indices.size();
+        if (indexCount % 3 != 0)
+                return false;
+        for (unsigned int i = 0; i < indexCount; i++) {
+                if (mesh.indices[i] >= vertexCount)
+                        return false;
+        }
+        for (unsigned int m = 0; m < mesh.meshlets.size(); m++) {
+                const Meshlet &meshlet = mesh.meshlets[m];
+                if (meshlet.firstIndex > indexCount
+                    || meshlet.indexCount > indexCount - meshlet.firstIndex)
+                        return false;
+        }
+        return true;
+}
+
+std::string MeshCachePath( const std::string &modelPath )
+{
+        return modelPath + ".meshcache";
+}
+
+bool LoadMeshCache( const std::string &modelPath, std::vector<Mesh> &meshes,
+                    bool mergeCoplanar, float smoothAngle )
+{
+        MeshCacheHeader expected;
+        if (!sourceStamp( modelPath, expected ))
+                return false;
+
+        std::ifstream in( MeshCachePath( modelPath ).c_str(), std::ios::binary );
+        if (!in)
+                return false;
+
+        MeshCacheHeader header;
+        if (!in.read( (char *) &header, sizeof(header) ))
+                return false;
+        if (memcmp( header.magic, MESHCACHE_MAGIC, sizeof(MESHCACHE_MAGIC) ) != 0
+            || header.version != MESHCACHE_VERSION
+            || header.mergeCoplanar != (mergeCoplanar ? 1u : 0u)
+            || header.smoothAngle != smoothAngle
+            || header.sourceSize != expected.sourceSize
+            || header.sourceTime != expected.sourceTime) {
+                return false;
+        }
+
+        // Each mesh takes at least its four counts, the texcoords flag
+        // and the stats, so a bad count fails here instead of allocating
+        long long minMeshBytes = 4 * sizeof(unsigned int) + sizeof(unsigned char)
+                                 + sizeof(MeshCacheStats);
+        if (header.meshCount * minMeshBytes > bytesLeft( in ))
+                return false;
+
+        std::vector<Mesh> loaded( header.meshCount );
+        for (unsigned int m = 0; m < header.meshCount; m++) {
+                Mesh &mesh = loaded[m];
+                std::vector<char> name;
+                unsigned char hasTexels = 0;
+
+                if (!readVector( in, name ))
+                        return false;
+                mesh.name.assign( name.begin(), name.end() );
+
+                if (!in.read( (char *) &hasTexels, sizeof(hasTexels) )
+                    || !in.read( (char *) &mesh.cacheStats, sizeof(mesh.cacheStats) ))
+                        return false;
+                mesh.hasTexels = (hasTexels != 0);
+
+                if (!readVector( in, mesh.vertices ) || !readVector( in, mesh.indices )
+                    || !readVector( in, mesh.meshlets ) || !validMesh( mesh )) {
+                        return false;
+                }
+        }
+
+        meshes.swap( loaded );
+        return true;
+}
+
+bool SaveMeshCache( const std::string &modelPath, const std::vector<Mesh> &meshes,
+                    bool mergeCoplanar, float smoothAngle )
+{
+        MeshCacheHeader header;
+        memset( &header, 0, sizeof(header) );
+        if (!sourceStamp( modelPath, header ))
+                return false;
+
+        memcpy( header.magic, MESHCACHE_MAGIC, sizeof(MESHCACHE_MAGIC) );
+        header.version = MESHCACHE_VERSION;
+        header.meshCount = meshes.size();
+        header.mergeCoplanar = mergeCoplanar ? 1 : 0;
+        header.smoothAngle = smoothAngle;
+
+        std::ofstream out( MeshCachePath( modelPath ).c_str(),
+                           std::ios::binary | std::ios::trunc );
+        if (!out)
+                return false;
+
+        out.write( (const char *) &header, sizeof(header) );
+        for (unsigned int m = 0; m < meshes.size(); m++) {
+                const Mesh &mesh = meshes[m];
+                unsigned char hasTexels = mesh.hasTexels ? 1 : 0;
+
+                writeVector( out, std::vector<char>( mesh.name.begin(), mesh.name.end() ) );
+                out.write( (const char *) &hasTexels, sizeof(hasTexels) );
+                out.write( (const char *) &mesh.cacheStats, sizeof(mesh.cacheStats) );
+                writeVector( out, mesh.vertices );
+                writeVector( out, mesh.indices );
+                writeVector( out, mesh.meshlets );
+        }
+
+        return (bool) out;
+}
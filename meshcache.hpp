@@ -0,0 +1,35 @@
+/*
+ * Filename: meshcache.hpp
+ *
+ * Processed meshes (welded and reordered, see meshopt.hpp, and split into
+ * meshlets, see meshlet.hpp) are saved next
+ * to the model as "<model>.meshcache" so the next load of the same file can
+ * skip lib3ds and all of the load-time processing.
+ *
+ * A cache is only used if its version matches, the model file has the
+ * same size and modification time as when the cache was written, and it
+ * was processed the same way (mergeCoplanar, see meshclean.hpp, and
+ * smoothAngle, see meshnormals.hpp).
+ */
+
+#ifndef _MESHCACHE_H
+#define _MESHCACHE_H
+
+#include "mesh.hpp"
+#include "meshnormals.hpp"
+
+#include <string>
+#include <vector>
+
+// Where the cache for a given model lives
+std::string MeshCachePath( const std::string &modelPath );
+
+// Returns false (and leaves meshes alone) if there's no usable cache
+bool LoadMeshCache( const std::string &modelPath, std::vector<Mesh> &meshes,
+                    bool mergeCoplanar = false, float smoothAngle = SMOOTH_ANGLE );
+
+// Returns false if the cache couldn't be written (read-only dir, ...)
+bool SaveMeshCache( const std::string &modelPath, const std::vector<Mesh> &meshes,
+                    bool mergeCoplanar = false, float smoothAngle = SMOOTH_ANGLE );
+
+#endif    // _MESHCACHE_H
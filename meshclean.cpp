@@ -0,0 +1,356 @@
+/*
+ * Filename: meshclean.cpp
+ *
+ * Dropping the faces that draw nothing (see meshclean.hpp). The area test
+ * runs four faces at a time with SSE; duplicates are found by hashing
+ * each face's sorted corners.
+ */
+
+#include "meshclean.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <xmmintrin.h>
+#endif
+
+// A face's corners packed 21 bits each, and the empty hash slot (no face
+// packs to it)
+static const unsigned int KEY_BITS = 21;
+static const unsigned long long EMPTY_KEY = ~0ULL;
+
+/*
+ * The corners are rotated to put the smallest first but stay in their
+ * winding order, so a face and its back side (two-sided geometry, which
+ * draws with GL_CULL_FACE on) don't count as duplicates
+ */
+static unsigned long long faceKey( const unsigned int *face )
+{
+        unsigned int first = 0;
+        if (face[1] < face[first]) first = 1;
+        if (face[2] < face[first]) first = 2;
+        unsigned int a = face[first], b = face[(first + 1) % 3], c = face[(first + 2) % 3];
+        return ((unsigned long long) a << (2 * KEY_BITS))
+               | ((unsigned long long) b << KEY_BITS) | c;
+}
+
+// Unnormalized normal (a x b for the edges out of the first corner)
+static void faceNormal( const float *p0, const float *p1, const float *p2, float n[3] )
+{
+        float a[3], b[3];
+        for (int i = 0; i < 3; i++) {
+                a[i] = p1[i] - p0[i];
+                b[i] = p2[i] - p0[i];
+        }
+        n[0] = a[1] * b[2] - a[2] * b[1];
+        n[1] = a[2] * b[0] - a[0] * b[2];
+        n[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+static float dot3( const float a[3], const float b[3] )
+{
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static bool flat( const float *p0, const float *p1, const float *p2 )
+{
+        float a[3], b[3], n[3];
+        for (int i = 0; i < 3; i++) {
+                a[i] = p1[i] - p0[i];
+                b[i] = p2[i] - p0[i];
+        }
+        faceNormal( p0, p1, p2, n );
+        return dot3( n, n ) <= DEGENERATE_SINE_SQ * dot3( a, a ) * dot3( b, b );
+}
+
+/*
+ * Drop every face not dropped yet that has no area, four at a time. The
+ * corners are gathered into x/y/z lanes and the whole test is done on
+ * the lanes; faces already dropped read point 0 so nothing is read out
+ * of range.
+ */
+static unsigned int dropFlat( const float *points, const unsigned int *faces,
+                              unsigned int faceCount, char *drop )
+{
+        unsigned int dropped = 0;
+        unsigned int f = 0;
+
+#ifdef __SSE2__
+        const __m128 limit = _mm_set1_ps( DEGENERATE_SINE_SQ );
+        for (; f + 4 <= faceCount; f += 4) {
+                float lanes[3][3][4];           // [corner][axis][face]
+                for (unsigned int k = 0; k < 4; k++) {
+                        for (unsigned int c = 0; c < 3; c++) {
+                                unsigned int p = drop[f + k] ? 0 : faces[(f + k) * 3 + c];
+                                for (unsigned int axis = 0; axis < 3; axis++)
+                                        lanes[c][axis][k] = points[p * 3 + axis];
+                        }
+                }
+
+                __m128 a[3], b[3];
+                for (unsigned int axis = 0; axis < 3; axis++) {
+                        __m128 p0 = _mm_loadu_ps( lanes[0][axis] );
+                        a[axis] = _mm_sub_ps( _mm_loadu_ps( lanes[1][axis] ), p0 );
+                        b[axis] = _mm_sub_ps( _mm_loadu_ps( lanes[2][axis] ), p0 );
+                }
+                __m128 nx = _mm_sub_ps( _mm_mul_ps( a[1], b[2] ), _mm_mul_ps( a[2], b[1] ) );
+                __m128 ny = _mm_sub_ps( _mm_mul_ps( a[2], b[0] ), _mm_mul_ps( a[0], b[2] ) );
+                __m128 nz = _mm_sub_ps( _mm_mul_ps( a[0], b[1] ), _mm_mul_ps( a[1], b[0] ) );
+                __m128 nSq = _mm_add_ps( _mm_add_ps( _mm_mul_ps( nx, nx ), _mm_mul_ps( ny, ny ) ),
+                                         _mm_mul_ps( nz, nz ) );
+                __m128 aSq = _mm_add_ps( _mm_add_ps( _mm_mul_ps( a[0], a[0] ), _mm_mul_ps( a[1], a[1] ) ),
+                                         _mm_mul_ps( a[2], a[2] ) );
+                __m128 bSq = _mm_add_ps( _mm_add_ps( _mm_mul_ps( b[0], b[0] ), _mm_mul_ps( b[1], b[1] ) ),
+                                         _mm_mul_ps( b[2], b[2] ) );
+                int isFlat = _mm_movemask_ps(
+                        _mm_cmple_ps( nSq, _mm_mul_ps( limit, _mm_mul_ps( aSq, bSq ) ) ) );
+
+                for (unsigned int k = 0; k < 4; k++) {
+                        if ((isFlat & (1 << k)) && !drop[f + k]) {
+                                drop[f + k] = 1;
+                                dropped++;
+                        }
+                }
+        }
+#endif
+
+        for (; f < faceCount; f++) {
+                const unsigned int *face = &faces[f * 3];
+                if (!drop[f] && flat( &points[face[0] * 3], &points[face[1] * 3],
+                                      &points[face[2] * 3] )) {
+                        drop[f] = 1;
+                        dropped++;
+                }
+        }
+        return dropped;
+}
+
+/*
+ * Can point from be moved onto point to? Every face around from (as the
+ * points are now, after remap) has to be in one plane, and the ones that
+ * don't vanish with the move have to keep facing the same way and keep
+ * some area.
+ */
+static bool canCollapse( const float *points, const unsigned int *faces,
+                         const unsigned int *around, unsigned int aroundCount,
+                         const unsigned int *remap, unsigned int from, unsigned int to )
+{
+        float reference[3];
+        bool haveReference = false;
+
+        for (unsigned int i = 0; i < aroundCount; i++) {
+                unsigned int c[3];
+                for (int k = 0; k < 3; k++)
+                        c[k] = remap[faces[around[i] * 3 + k]];
+
+                float n[3];
+                faceNormal( &points[c[0] * 3], &points[c[1] * 3], &points[c[2] * 3], n );
+                float length = sqrtf( dot3( n, n ) );
+                if (length == 0.0f)
+                        continue;               // goes anyway
+                for (int k = 0; k < 3; k++)
+                        n[k] /= length;
+
+                if (!haveReference) {
+                        memcpy( reference, n, sizeof(reference) );
+                        haveReference = true;
+                } else if (dot3( n, reference ) < MERGE_COPLANAR_COS) {
+                        return false;
+                }
+
+                if (c[0] == to || c[1] == to || c[2] == to)
+                        continue;               // collapses with the edge
+
+                for (int k = 0; k < 3; k++) {
+                        if (c[k] == from)
+                                c[k] = to;
+                }
+                const float *p0 = &points[c[0] * 3], *p1 = &points[c[1] * 3], *p2 = &points[c[2] * 3];
+                float moved[3];
+                faceNormal( p0, p1, p2, moved );
+                if (dot3( moved, n ) <= 0.0f || flat( p0, p1, p2 ))
+                        return false;
+        }
+        return haveReference;
+}
+
+/*
+ * Collapse the short flat edges (see meshclean.hpp) by pointing remap
+ * at the point each one is merged onto. Both ends of a collapsed edge are
+ * left alone after that, so remap never chains.
+ */
+static void mergeCoplanar( const float *points, unsigned int pointCount,
+                           const float *texels, const unsigned int *faces,
+                           unsigned int faceCount, const char *drop,
+                           unsigned int *remap, Arena &arena )
+{
+        float min[3], max[3];
+        for (int i = 0; i < 3; i++)
+                min[i] = max[i] = points[i];
+        for (unsigned int p = 1; p < pointCount; p++) {
+                for (int i = 0; i < 3; i++) {
+                        min[i] = std::min( min[i], points[p * 3 + i] );
+                        max[i] = std::max( max[i], points[p * 3 + i] );
+                }
+        }
+        float diagonal[3] = { max[0] - min[0], max[1] - min[1], max[2] - min[2] };
+        float limitSq = MERGE_EDGE_FRACTION * MERGE_EDGE_FRACTION * dot3( diagonal, diagonal );
+
+        // The faces around each point, packed one point after another
+        unsigned int *first = arena.Array<unsigned int>( pointCount + 1 );
+        memset( first, 0, sizeof(unsigned int) * (pointCount + 1) );
+        for (unsigned int f = 0; f < faceCount; f++) {
+                if (!drop[f]) {
+                        for (int k = 0; k < 3; k++)
+                                first[faces[f * 3 + k] + 1]++;
+                }
+        }
+        for (unsigned int p = 0; p < pointCount; p++)
+                first[p + 1] += first[p];
+
+        unsigned int *around = arena.Array<unsigned int>( first[pointCount] );
+        unsigned int *fill = arena.Array<unsigned int>( pointCount );
+        memcpy( fill, first, sizeof(unsigned int) * pointCount );
+        for (unsigned int f = 0; f < faceCount; f++) {
+                if (!drop[f]) {
+                        for (int k = 0; k < 3; k++)
+                                around[fill[faces[f * 3 + k]]++] = f;
+                }
+        }
+
+        char *locked = arena.Array<char>( pointCount );
+        memset( locked, 0, pointCount );
+
+        for (unsigned int f = 0; f < faceCount; f++) {
+                if (drop[f])
+                        continue;
+                for (int e = 0; e < 3; e++) {
+                        unsigned int a = faces[f * 3 + e], b = faces[f * 3 + (e + 1) % 3];
+                        if (a == b || locked[a] || locked[b])
+                                continue;
+
+                        float d[3];
+                        for (int i = 0; i < 3; i++)
+                                d[i] = points[b * 3 + i] - points[a * 3 + i];
+                        if (dot3( d, d ) >= limitSq)
+                                continue;
+                        if (texels != NULL && (texels[a * 2] != texels[b * 2]
+                                               || texels[a * 2 + 1] != texels[b * 2 + 1]))
+                                continue;
+
+                        unsigned int from = b, to = a;
+                        if (!canCollapse( points, faces, &around[first[b]], first[b + 1] - first[b],
+                                          remap, b, a )) {
+                                from = a;
+                                to = b;
+                                if (!canCollapse( points, faces, &around[first[a]],
+                                                  first[a + 1] - first[a], remap, a, b ))
+                                        continue;
+                        }
+                        remap[from] = to;
+                        locked[a] = locked[b] = 1;
+                }
+        }
+}
+
+unsigned int CleanFaces( const float *points, unsigned int pointCount,
+                         const float *texels, unsigned int *faces,
+                         unsigned int faceCount, bool merge,
+                         unsigned int *kept, Arena &arena, CleanStats &stats )
+{
+        memset( &stats, 0, sizeof(stats) );
+
+        // Faces pointing past the points can't be drawn at all
+        char *drop = arena.Array<char>( faceCount );
+        for (unsigned int f = 0; f < faceCount; f++) {
+                const unsigned int *face = &faces[f * 3];
+                drop[f] = (face[0] >= pointCount || face[1] >= pointCount
+                           || face[2] >= pointCount);
+                stats.degenerate += drop[f];
+        }
+        if (stats.degenerate == faceCount)
+                return 0;
+
+        // Which points any face uses, to tell what went with the faces
+        char *usedBefore = arena.Array<char>( pointCount );
+        memset( usedBefore, 0, pointCount );
+        for (unsigned int f = 0; f < faceCount; f++) {
+                if (!drop[f]) {
+                        for (int k = 0; k < 3; k++)
+                                usedBefore[faces[f * 3 + k]] = 1;
+                }
+        }
+
+        unsigned int *remap = arena.Array<unsigned int>( pointCount );
+        for (unsigned int p = 0; p < pointCount; p++)
+                remap[p] = p;
+        if (merge)
+                mergeCoplanar( points, pointCount, texels, faces, faceCount, drop, remap, arena );
+
+        // Repeated corners, counted as merged if the merge made them so
+        for (unsigned int f = 0; f < faceCount; f++) {
+                if (drop[f])
+                        continue;
+                unsigned int *face = &faces[f * 3];
+                bool repeated = (face[0] == face[1] || face[1] == face[2] || face[0] == face[2]);
+                for (int k = 0; k < 3; k++)
+                        face[k] = remap[face[k]];
+                if (repeated) {
+                        stats.degenerate++;
+                        drop[f] = 1;
+                } else if (face[0] == face[1] || face[1] == face[2] || face[0] == face[2]) {
+                        stats.merged++;
+                        drop[f] = 1;
+                }
+        }
+
+        stats.degenerate += dropFlat( points, faces, faceCount, drop );
+
+        /*
+         * Exact duplicates: open addressing on the corners, with
+         * the table at least twice the faces so the probes stay short.
+         * The first of each set of duplicates is the one kept.
+         */
+        if (pointCount <= (1u << KEY_BITS)) {
+                unsigned int bits = 4;
+                while ((1u << bits) < faceCount * 2)
+                        bits++;
+                unsigned int mask = (1u << bits) - 1;
+                unsigned long long *table = arena.Array<unsigned long long>( mask + 1 );
+                for (unsigned int i = 0; i <= mask; i++)
+                        table[i] = EMPTY_KEY;
+
+                for (unsigned int f = 0; f < faceCount; f++) {
+                        if (drop[f])
+                                continue;
+                        unsigned long long key = faceKey( &faces[f * 3] );
+                        unsigned int slot = (unsigned int)
+                                ((key * 0x9E3779B97F4A7C15ULL) >> (64 - bits));
+                        while (table[slot] != EMPTY_KEY && table[slot] != key)
+                                slot = (slot + 1) & mask;
+                        if (table[slot] == key) {
+                                stats.duplicate++;
+                                drop[f] = 1;
+                        } else {
+                                table[slot] = key;
+                        }
+                }
+        }
+
+        unsigned int keptCount = 0;
+        char *usedAfter = arena.Array<char>( pointCount );
+        memset( usedAfter, 0, pointCount );
+        for (unsigned int f = 0; f < faceCount; f++) {
+                if (drop[f])
+                        continue;
+                kept[keptCount++] = f;
+                for (int k = 0; k < 3; k++)
+                        usedAfter[faces[f * 3 + k]] = 1;
+        }
+        for (unsigned int p = 0; p < pointCount; p++)
+                stats.pointsDropped += (usedBefore[p] && !usedAfter[p]);
+
+        return keptCount;
+}
@@ -0,0 +1,54 @@
+/*
+ * Filename: meshclean.hpp
+ *
+ * Import-time cleanup of a mesh's faces, before anything is built from
+ * them. 3ds exports are often full of faces that draw nothing: faces
+ * with a repeated corner or no area at all, and the same face given
+ * twice. Those are dropped here so they never reach the GPU.
+ *
+ * Optionally (--merge-coplanar) tiny edges lying flat in the surface are
+ * collapsed too: a point is moved onto its neighbor at the other end of
+ * an edge shorter than MERGE_EDGE_FRACTION of the mesh's size, if every
+ * face around it is in the same plane (and stays facing the same way),
+ * so the slivers along the edge fall away as degenerates. This moves the
+ * outline by at most that much where the point is on the mesh's edge.
+ */
+
+#ifndef _MESHCLEAN_H
+#define _MESHCLEAN_H
+
+#include "arena.hpp"
+
+// A face has no area when |a x b|^2 <= DEGENERATE_SINE_SQ |a|^2 |b|^2 for
+// the two edges a, b out of its first corner
+const float DEGENERATE_SINE_SQ = 1e-12f;
+
+// Coplanar merging: edges shorter than this times the mesh's bounding
+// box diagonal, between faces whose normals are this close (cosine)
+const float MERGE_EDGE_FRACTION = 0.002f;
+const float MERGE_COPLANAR_COS = 0.9998f;
+
+// What the cleanup took out of a mesh
+struct CleanStats
+{
+        unsigned int degenerate;        // repeated corners, no area or bad indices
+        unsigned int duplicate;         // same corners and winding as a face kept earlier
+        unsigned int merged;            // gone with a collapsed edge
+        unsigned int pointsDropped;     // points only those faces used
+};
+
+/*
+ * Clean up faceCount faces (point index triples in faces) over pointCount
+ * points (xyz each). texels (uv per point) may be NULL; points are only
+ * merged onto neighbors with the same texture coordinates.
+ *
+ * faces is rewritten with any merged points, and kept[] gets the indices
+ * of the faces to keep, in their original order. Returns how many there
+ * are. Temporaries come from arena.
+ */
+unsigned int CleanFaces( const float *points, unsigned int pointCount,
+                         const float *texels, unsigned int *faces,
+                         unsigned int faceCount, bool mergeCoplanar,
+                         unsigned int *kept, Arena &arena, CleanStats &stats );
+
+#endif    // _MESHCLEAN_H
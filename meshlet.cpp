@@ -0,0 +1,144 @@
+/*
+ * Filename: meshlet.cpp
+ *
+ * Greedy meshlet builder plus the bounds/cone math. The cone construction
+ * is the one used by meshoptimizer (Arseny Kapoulkine):
+ *   https://github.com/zeux/meshoptimizer
+ */
+
+#include "meshlet.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+static void finishMeshlet( const Mesh &mesh, Meshlet &meshlet )
+{
+        const unsigned int *indices = &mesh.indices[meshlet.firstIndex];
+        unsigned int triCount = meshlet.indexCount / 3;
+
+        // Bounding sphere: middle of the box, radius out to the far corner
+        float lo[3] = {  HUGE_VALF,  HUGE_VALF,  HUGE_VALF };
+        float hi[3] = { -HUGE_VALF, -HUGE_VALF, -HUGE_VALF };
+        for (unsigned int i = 0; i < meshlet.indexCount; i++) {
+                const float *p = mesh.vertices[indices[i]].pos;
+                for (unsigned int k = 0; k < 3; k++) {
+                        lo[k] = std::min( lo[k], p[k] );
+                        hi[k] = std::max( hi[k], p[k] );
+                }
+        }
+
+        float radiusSq = 0.0f;
+        for (unsigned int k = 0; k < 3; k++)
+                meshlet.center[k] = 0.5f * (lo[k] + hi[k]);
+        for (unsigned int i = 0; i < meshlet.indexCount; i++) {
+                const float *p = mesh.vertices[indices[i]].pos;
+                float dx = p[0] - meshlet.center[0];
+                float dy = p[1] - meshlet.center[1];
+                float dz = p[2] - meshlet.center[2];
+                radiusSq = std::max( radiusSq, dx * dx + dy * dy + dz * dz );
+        }
+        meshlet.radius = sqrtf( radiusSq );
+
+        /*
+         * Normal cone: the axis is the average face normal, and the
+         * cutoff comes from the face normal that strays furthest from it.
+         */
+        std::vector<float> normals( triCount * 3, 0.0f );
+        float axis[3] = { 0.0f, 0.0f, 0.0f };
+        for (unsigned int t = 0; t < triCount; t++) {
+                const float *a = mesh.vertices[indices[t * 3]].pos;
+                const float *b = mesh.vertices[indices[t * 3 + 1]].pos;
+                const float *c = mesh.vertices[indices[t * 3 + 2]].pos;
+
+                float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+                float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+                float n[3] = { e1[1] * e2[2] - e1[2] * e2[1],
+                               e1[2] * e2[0] - e1[0] * e2[2],
+                               e1[0] * e2[1] - e1[1] * e2[0] };
+
+                float length = sqrtf( n[0] * n[0] + n[1] * n[1] + n[2] * n[2] );
+                if (length <= 0.0f)
+                        continue;           // degenerate, faces nowhere
+
+                for (unsigned int k = 0; k < 3; k++) {
+                        normals[t * 3 + k] = n[k] / length;
+                        axis[k] += n[k] / length;
+                }
+        }
+
+        float axisLength = sqrtf( axis[0] * axis[0] + axis[1] * axis[1]
+                                + axis[2] * axis[2] );
+        float minDot = -1.0f;
+        if (axisLength > 0.0f) {
+                for (unsigned int k = 0; k < 3; k++)
+                        axis[k] /= axisLength;
+
+                minDot = 1.0f;
+                for (unsigned int t = 0; t < triCount; t++) {
+                        const float *n = &normals[t * 3];
+                        if (n[0] == 0.0f && n[1] == 0.0f && n[2] == 0.0f)
+                                continue;
+                        minDot = std::min( minDot, n[0] * axis[0] + n[1] * axis[1]
+                                                 + n[2] * axis[2] );
+                }
+        }
+
+        for (unsigned int k = 0; k < 3; k++)
+                meshlet.coneAxis[k] = axis[k];
+
+        // Cones wider than ~84 degrees can't ever be entirely back facing
+        // in a useful way, so mark them as "never cull"
+        if (minDot <= 0.1f)
+                meshlet.coneCutoff = 1.0f;
+        else
+                meshlet.coneCutoff = sqrtf( 1.0f - minDot * minDot );
+}
+
+void BuildMeshlets( Mesh &mesh )
+{
+        mesh.meshlets.clear();
+
+        // Which meshlet last used each vertex (so we count each one once)
+        std::vector<int> usedBy( mesh.vertices.size(), -1 );
+
+        Meshlet current;
+        current.firstIndex = 0;
+        current.indexCount = 0;
+        current.vertexCount = 0;
+
+        for (unsigned int t = 0; t < mesh.indices.size() / 3; t++) {
+                const unsigned int *tri = &mesh.indices[t * 3];
+                int id = mesh.meshlets.size();
+
+                unsigned int newVertices = 0;
+                for (unsigned int k = 0; k < 3; k++) {
+                        if (usedBy[tri[k]] != id)
+                                newVertices++;
+                }
+
+                // Start a new meshlet if this triangle won't fit
+                if (current.vertexCount + newVertices > MESHLET_MAX_VERTICES
+                    || current.indexCount / 3 + 1 > MESHLET_MAX_TRIANGLES) {
+                        finishMeshlet( mesh, current );
+                        mesh.meshlets.push_back( current );
+
+                        current.firstIndex = t * 3;
+                        current.indexCount = 0;
+                        current.vertexCount = 0;
+                        id++;
+                }
+
+                for (unsigned int k = 0; k < 3; k++) {
+                        if (usedBy[tri[k]] != id) {
+                                usedBy[tri[k]] = id;
+                                current.vertexCount++;
+                        }
+                }
+                current.indexCount += 3;
+        }
+
+        if (current.indexCount > 0) {
+                finishMeshlet( mesh, current );
+                mesh.meshlets.push_back( current );
+        }
+}
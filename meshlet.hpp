@@ -0,0 +1,28 @@
+/*
+ * Filename: meshlet.hpp
+ *
+ * Splits a mesh into meshlets: small runs of triangles that share few
+ * enough vertices to be culled (and someday shaded) as a unit. Each one
+ * gets a bounding sphere and a cone that holds all of its face normals,
+ * which is enough to throw away whole clusters that are off screen or
+ * facing away from the camera before they're ever submitted.
+ */
+
+#ifndef _MESHLET_H
+#define _MESHLET_H
+
+#include "mesh.hpp"
+
+// Limits per meshlet (the usual sizes for mesh shading hardware)
+const unsigned int MESHLET_MAX_VERTICES  = 64;
+const unsigned int MESHLET_MAX_TRIANGLES = 124;
+
+/*
+ * Fill mesh.meshlets. The triangles are taken in index buffer order, so
+ * run this AFTER the cache optimization in meshopt.hpp: it keeps triangles
+ * that share vertices next to each other, which is exactly what makes a
+ * good meshlet.
+ */
+void BuildMeshlets( Mesh &mesh );
+
+#endif    // _MESHLET_H
@@ -0,0 +1,238 @@
+/*
+ * Filename: meshnormals.cpp
+ *
+ * Smoothing group normals (see meshnormals.hpp).
+ */
+
+#include "meshnormals.hpp"
+
+#include <QtConcurrentMap>
+#include <QStringList>
+
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <cstring>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <xmmintrin.h>
+#endif
+
+/*
+ * Everything the jobs share: the input, the face normals (area weighted
+ * and unit length) and the faces around each point
+ */
+struct NormalData
+{
+        const float *points;
+        const unsigned int *faces, *smoothing;
+        float cosLimit;
+        float *weighted, *unit;         // xyz per face
+        const unsigned int *first, *around;
+        float *normals;
+};
+
+// One run of faces for the thread pool
+struct NormalJob
+{
+        const NormalData *data;
+        unsigned int begin, end;
+};
+
+static void normalizeFace( float *weighted, float *unit )
+{
+        float length = sqrtf( weighted[0] * weighted[0] + weighted[1] * weighted[1]
+                              + weighted[2] * weighted[2] );
+        float scale = length > 0.0f ? 1.0f / length : 0.0f;
+        for (int i = 0; i < 3; i++)
+                unit[i] = weighted[i] * scale;
+}
+
+/*
+ * (p1 - p0) x (p2 - p0) for each face, which is twice its area long.
+ * Four faces at a time: the corners are gathered into x/y/z lanes and
+ * the cross products come out the same way.
+ */
+static void faceNormals( NormalJob &job )
+{
+        const NormalData &d = *job.data;
+        unsigned int f = job.begin;
+
+#ifdef __SSE2__
+        for (; f + 4 <= job.end; f += 4) {
+                float lanes[3][3][4];           // [corner][axis][face]
+                for (unsigned int k = 0; k < 4; k++) {
+                        for (unsigned int c = 0; c < 3; c++) {
+                                const float *p = &d.points[d.faces[(f + k) * 3 + c] * 3];
+                                for (unsigned int axis = 0; axis < 3; axis++)
+                                        lanes[c][axis][k] = p[axis];
+                        }
+                }
+
+                __m128 a[3], b[3];
+                for (unsigned int axis = 0; axis < 3; axis++) {
+                        __m128 p0 = _mm_loadu_ps( lanes[0][axis] );
+                        a[axis] = _mm_sub_ps( _mm_loadu_ps( lanes[1][axis] ), p0 );
+                        b[axis] = _mm_sub_ps( _mm_loadu_ps( lanes[2][axis] ), p0 );
+                }
+                float n[3][4];
+                _mm_storeu_ps( n[0], _mm_sub_ps( _mm_mul_ps( a[1], b[2] ), _mm_mul_ps( a[2], b[1] ) ) );
+                _mm_storeu_ps( n[1], _mm_sub_ps( _mm_mul_ps( a[2], b[0] ), _mm_mul_ps( a[0], b[2] ) ) );
+                _mm_storeu_ps( n[2], _mm_sub_ps( _mm_mul_ps( a[0], b[1] ), _mm_mul_ps( a[1], b[0] ) ) );
+
+                for (unsigned int k = 0; k < 4; k++) {
+                        float *weighted = &d.weighted[(f + k) * 3];
+                        for (unsigned int axis = 0; axis < 3; axis++)
+                                weighted[axis] = n[axis][k];
+                        normalizeFace( weighted, &d.unit[(f + k) * 3] );
+                }
+        }
+#endif
+
+        for (; f < job.end; f++) {
+                const float *p0 = &d.points[d.faces[f * 3] * 3];
+                const float *p1 = &d.points[d.faces[f * 3 + 1] * 3];
+                const float *p2 = &d.points[d.faces[f * 3 + 2] * 3];
+                float a[3], b[3];
+                for (int i = 0; i < 3; i++) {
+                        a[i] = p1[i] - p0[i];
+                        b[i] = p2[i] - p0[i];
+                }
+                float *weighted = &d.weighted[f * 3];
+                weighted[0] = a[1] * b[2] - a[2] * b[1];
+                weighted[1] = a[2] * b[0] - a[0] * b[2];
+                weighted[2] = a[0] * b[1] - a[1] * b[0];
+                normalizeFace( weighted, &d.unit[f * 3] );
+        }
+}
+
+/*
+ * Each corner: the faces around its point that smooth with this one
+ */
+static void cornerNormals( NormalJob &job )
+{
+        const NormalData &d = *job.data;
+
+        for (unsigned int f = job.begin; f < job.end; f++) {
+                const float *unit = &d.unit[f * 3];
+                unsigned int groups = d.smoothing[f];
+
+                for (unsigned int c = 0; c < 3; c++) {
+                        float *normal = &d.normals[(f * 3 + c) * 3];
+                        if (groups == 0) {
+                                memcpy( normal, unit, sizeof(float) * 3 );
+                                continue;
+                        }
+
+                        float sum[3] = { 0.0f, 0.0f, 0.0f };
+                        unsigned int p = d.faces[f * 3 + c];
+                        for (unsigned int i = d.first[p]; i < d.first[p + 1]; i++) {
+                                unsigned int g = d.around[i];
+                                const float *other = &d.unit[g * 3];
+                                if (g != f && ((d.smoothing[g] & groups) == 0
+                                               || unit[0] * other[0] + unit[1] * other[1]
+                                                  + unit[2] * other[2] < d.cosLimit))
+                                        continue;
+                                for (int k = 0; k < 3; k++)
+                                        sum[k] += d.weighted[g * 3 + k];
+                        }
+
+                        // Faces that cancel out (or have no area) keep
+                        // their own normal
+                        float length = sqrtf( sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2] );
+                        if (length > 0.0f) {
+                                for (int k = 0; k < 3; k++)
+                                        normal[k] = sum[k] / length;
+                        } else {
+                                memcpy( normal, unit, sizeof(float) * 3 );
+                        }
+                }
+        }
+}
+
+/*
+ * Run fn over every face, in NORMAL_JOB_FACES pieces on the thread pool
+ * when there's more than one piece (this is usually called from a pool
+ * thread already, which then works through pieces too)
+ */
+static void runJobs( const NormalData &data, unsigned int faceCount,
+                     void (*fn)( NormalJob & ) )
+{
+        std::vector<NormalJob> jobs;
+        for (unsigned int begin = 0; begin < faceCount; begin += NORMAL_JOB_FACES) {
+                NormalJob job;
+                job.data = &data;
+                job.begin = begin;
+                job.end = std::min( faceCount, begin + NORMAL_JOB_FACES );
+                jobs.push_back( job );
+        }
+
+        if (jobs.size() == 1)
+                fn( jobs[0] );
+        else if (jobs.size() > 1)
+                QtConcurrent::blockingMap( jobs, fn );
+}
+
+void SmoothNormals( const float *points, unsigned int pointCount,
+                    const unsigned int *faces, const unsigned int *smoothing,
+                    unsigned int faceCount, float smoothAngle,
+                    float *normals, Arena &arena )
+{
+        if (faceCount == 0)
+                return;
+
+        NormalData data;
+        data.points = points;
+        data.faces = faces;
+        data.smoothing = smoothing;
+        data.cosLimit = (float) cos( smoothAngle * M_PI / 180.0 );
+        data.weighted = arena.Array<float>( faceCount * 3 );
+        data.unit = arena.Array<float>( faceCount * 3 );
+        data.normals = normals;
+
+        runJobs( data, faceCount, faceNormals );
+
+        // Faces around each point: count, offsets, then fill
+        unsigned int *first = arena.Array<unsigned int>( pointCount + 1 );
+        unsigned int *around = arena.Array<unsigned int>( faceCount * 3 );
+        memset( first, 0, sizeof(unsigned int) * (pointCount + 1) );
+        for (unsigned int i = 0; i < faceCount * 3; i++)
+                first[faces[i] + 1]++;
+        for (unsigned int p = 0; p < pointCount; p++)
+                first[p + 1] += first[p];
+
+        unsigned int *fill = arena.Array<unsigned int>( pointCount );
+        memcpy( fill, first, sizeof(unsigned int) * pointCount );
+        for (unsigned int i = 0; i < faceCount * 3; i++)
+                around[fill[faces[i]]++] = i / 3;
+
+        data.first = first;
+        data.around = around;
+        runJobs( data, faceCount, cornerNormals );
+}
+
+float SmoothAngleArg( const QStringList &args )
+{
+        float angle = SMOOTH_ANGLE;
+        for (int i = 1; i < args.size(); i++) {
+                if (!args.at(i).startsWith( "--smooth-angle=" ))
+                        continue;
+
+                QString value = args.at(i).mid( 15 );
+                bool ok = false;
+                float degrees = value.toFloat( &ok );
+                if (!ok) {
+                        std::cerr << "WARNING: --smooth-angle needs degrees, not "
+                                  << value.toLocal8Bit().constData() << "\n";
+                        continue;
+                }
+                if (degrees < 0.0f || degrees > 180.0f) {
+                        degrees = qBound( 0.0f, degrees, 180.0f );
+                        std::cerr << "WARNING: --smooth-angle must be 0 to 180, using "
+                                  << degrees << "\n";
+                }
+                angle = degrees;
+        }
+        return angle;
+}
@@ -0,0 +1,46 @@
+/*
+ * Filename: meshnormals.hpp
+ *
+ * Vertex normals from 3ds smoothing groups, done here instead of by
+ * lib3ds_mesh_calculate_normals() (one thread, a malloc per face corner
+ * and a linked list walk per point).
+ *
+ * Each corner gets the area weighted sum of the normals of the faces
+ * around its point that share a smoothing group bit with its own face
+ * and are within smoothAngle of it; a face with no smoothing groups is
+ * flat. The face normals are worked out four at a time with SSE, the
+ * faces around each point come from one packed (CSR) table built once,
+ * and big meshes are split over the thread pool.
+ */
+
+#ifndef _MESHNORMALS_H
+#define _MESHNORMALS_H
+
+#include "arena.hpp"
+
+class QStringList;
+
+// Faces further apart than this (degrees) never share a normal, even in
+// the same smoothing group (--smooth-angle=<degrees>)
+const float SMOOTH_ANGLE = 80.0f;
+
+// --smooth-angle=<degrees> from the command line, or SMOOTH_ANGLE if it
+// isn't there. A value that isn't a number gets a WARNING and the default,
+// one outside [0, 180] a WARNING and the nearest end.
+float SmoothAngleArg( const QStringList &args );
+
+// Meshes with more faces than this are split into jobs of this many
+const unsigned int NORMAL_JOB_FACES = 16384;
+
+/*
+ * Normals for the faceCount faces (point index triples in faces) over
+ * pointCount points (xyz each), with smoothing[f] the face's smoothing
+ * group bits. normals gets xyz for every face corner, in face order.
+ * Temporaries come from arena.
+ */
+void SmoothNormals( const float *points, unsigned int pointCount,
+                    const unsigned int *faces, const unsigned int *smoothing,
+                    unsigned int faceCount, float smoothAngle,
+                    float *normals, Arena &arena );
+
+#endif    // _MESHNORMALS_H
@@ -0,0 +1,439 @@
+/*
+ * Filename: meshopt.cpp
+ *
+ * Implementation of the load-time index buffer optimizations.
+ *
+ * The vertex cache optimizer follows Tom Forsyth's article:
+ *   http://tomforsyth1000.github.io/papers/fast_vert_cache_opt.html
+ * and the overdraw pass is the cluster sort described in:
+ *   Sander, Nehab, Barczak - "Fast Triangle Reordering for Vertex
+ *   Locality and Reduced Overdraw" (SIGGRAPH 2007)
+ */
+
+#include "meshopt.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+/*
+ * Scoring constants straight out of Forsyth's article. The cache size here
+ * is the LRU cache the scoring models, not the hardware FIFO.
+ */
+static const unsigned int FORSYTH_CACHE_SIZE = 32;
+static const float CACHE_DECAY_POWER   = 1.5f;
+static const float LAST_TRI_SCORE      = 0.75f;
+static const float VALENCE_BOOST_SCALE = 2.0f;
+static const float VALENCE_BOOST_POWER = 0.5f;
+
+static const unsigned int NO_INDEX = ~0u;
+
+//////////////////////////////////////////////////////////////////////////////
+//  Welding
+//////////////////////////////////////////////////////////////////////////////
+
+// FNV-1a over the raw bytes of a vertex (we weld exact matches only)
+static unsigned int hashVertex( const MeshVertex &v )
+{
+        const unsigned char *bytes = (const unsigned char *) &v;
+        unsigned int hash = 2166136261u;
+        for (unsigned int i = 0; i < sizeof(MeshVertex); i++) {
+                hash ^= bytes[i];
+                hash *= 16777619u;
+        }
+        return hash;
+}
+
+void WeldVertices( const MeshVertex *corners, unsigned int count, Mesh &mesh )
+{
+        mesh.vertices.clear();
+        mesh.indices.resize( count );
+
+        // Open addressing table, at least twice as big as the input
+        unsigned int tableSize = 1;
+        while (tableSize < count * 2)
+                tableSize <<= 1;
+        std::vector<unsigned int> table( tableSize, NO_INDEX );
+
+        for (unsigned int c = 0; c < count; c++) {
+                unsigned int slot = hashVertex( corners[c] ) & (tableSize - 1);
+
+                while (table[slot] != NO_INDEX
+                       && memcmp( &mesh.vertices[table[slot]], &corners[c],
+                                  sizeof(MeshVertex) ) != 0) {
+                        slot = (slot + 1) & (tableSize - 1);
+                }
+
+                if (table[slot] == NO_INDEX) {
+                        table[slot] = mesh.vertices.size();
+                        mesh.vertices.push_back( corners[c] );
+                }
+                mesh.indices[c] = table[slot];
+        }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  Cache statistics
+//////////////////////////////////////////////////////////////////////////////
+
+/*
+ * FIFO cache simulation. A vertex is still cached if fewer than cacheSize
+ * misses have happened since it was last loaded.
+ */
+static unsigned int countMisses( const std::vector<unsigned int> &indices,
+                                 unsigned int cacheSize )
+{
+        unsigned int vertexCount = 0;
+        for (unsigned int i = 0; i < indices.size(); i++)
+                vertexCount = std::max( vertexCount, indices[i] + 1 );
+
+        std::vector<unsigned int> loadedAt( vertexCount, 0 );
+        std::vector<bool> seen( vertexCount, false );
+        unsigned int misses = 0;
+
+        for (unsigned int i = 0; i < indices.size(); i++) {
+                unsigned int v = indices[i];
+                if (!seen[v] || misses - loadedAt[v] >= cacheSize) {
+                        loadedAt[v] = misses;
+                        seen[v] = true;
+                        misses++;
+                }
+        }
+        return misses;
+}
+
+float ComputeACMR( const std::vector<unsigned int> &indices,
+                   unsigned int cacheSize )
+{
+        if (indices.empty())
+                return 0.0f;
+        return (float) countMisses( indices, cacheSize )
+             / (float) (indices.size() / 3);
+}
+
+float ComputeATVR( const std::vector<unsigned int> &indices,
+                   unsigned int vertexCount, unsigned int cacheSize )
+{
+        if (vertexCount == 0)
+                return 0.0f;
+        return (float) countMisses( indices, cacheSize ) / (float) vertexCount;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  Forsyth vertex cache optimization
+//////////////////////////////////////////////////////////////////////////////
+
+static float vertexScore( int cachePosition, unsigned int remainingTris )
+{
+        // Vertices with no triangles left don't matter any more
+        if (remainingTris == 0)
+                return -1.0f;
+
+        float score = 0.0f;
+        if (cachePosition >= 0) {
+                if (cachePosition < 3) {
+                        // Used by the last triangle: fixed score so we don't
+                        // favor strips too much
+                        score = LAST_TRI_SCORE;
+                } else {
+                        float scale = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+                        score = powf( 1.0f - (cachePosition - 3) * scale,
+                                      CACHE_DECAY_POWER );
+                }
+        }
+
+        // Boost vertices with few triangles left so we finish them off
+        score += VALENCE_BOOST_SCALE
+               * powf( (float) remainingTris, -VALENCE_BOOST_POWER );
+        return score;
+}
+
+void OptimizeVertexCache( std::vector<unsigned int> &indices,
+                          unsigned int vertexCount )
+{
+        unsigned int triCount = indices.size() / 3;
+        if (triCount == 0)
+                return;
+
+        /*
+         * Vertex -> triangle adjacency as offsets into one flat list.
+         * remaining[v] is how many of v's triangles are still unemitted,
+         * and those always sit at the front of v's slice of the list.
+         */
+        std::vector<unsigned int> remaining( vertexCount, 0 );
+        for (unsigned int i = 0; i < indices.size(); i++)
+                remaining[indices[i]]++;
+
+        std::vector<unsigned int> offsets( vertexCount + 1, 0 );
+        for (unsigned int v = 0; v < vertexCount; v++)
+                offsets[v + 1] = offsets[v] + remaining[v];
+
+        std::vector<unsigned int> adjacency( indices.size() );
+        std::vector<unsigned int> fill( offsets.begin(), offsets.end() - 1 );
+        for (unsigned int t = 0; t < triCount; t++) {
+                for (unsigned int k = 0; k < 3; k++) {
+                        unsigned int v = indices[t * 3 + k];
+                        adjacency[fill[v]++] = t;
+                }
+        }
+
+        std::vector<int> cachePosition( vertexCount, -1 );
+        std::vector<float> score( vertexCount );
+        for (unsigned int v = 0; v < vertexCount; v++)
+                score[v] = vertexScore( -1, remaining[v] );
+
+        std::vector<float> triScore( triCount );
+        std::vector<bool> emitted( triCount, false );
+        for (unsigned int t = 0; t < triCount; t++) {
+                triScore[t] = score[indices[t * 3]]
+                            + score[indices[t * 3 + 1]]
+                            + score[indices[t * 3 + 2]];
+        }
+
+        std::vector<unsigned int> output;
+        output.reserve( indices.size() );
+
+        std::vector<unsigned int> cache, nextCache;
+        cache.reserve( FORSYTH_CACHE_SIZE + 3 );
+        nextCache.reserve( FORSYTH_CACHE_SIZE + 3 );
+
+        unsigned int bestTri = 0;
+        unsigned int scanCursor = 0;
+
+        for (unsigned int n = 0; n < triCount; n++) {
+                if (bestTri == NO_INDEX) {
+                        // Nothing in the cache is useful: take the next
+                        // unemitted triangle in file order
+                        while (emitted[scanCursor])
+                                scanCursor++;
+                        bestTri = scanCursor;
+                }
+
+                emitted[bestTri] = true;
+                const unsigned int *tri = &indices[bestTri * 3];
+
+                // Emit it and take it out of its vertices' adjacency lists
+                for (unsigned int k = 0; k < 3; k++) {
+                        unsigned int v = tri[k];
+                        output.push_back( v );
+
+                        unsigned int *list = &adjacency[offsets[v]];
+                        for (unsigned int j = 0; j < remaining[v]; j++) {
+                                if (list[j] == bestTri) {
+                                        list[j] = list[remaining[v] - 1];
+                                        break;
+                                }
+                        }
+                        remaining[v]--;
+                }
+
+                // New cache: this triangle's vertices, then the old order
+                nextCache.clear();
+                nextCache.push_back( tri[0] );
+                nextCache.push_back( tri[1] );
+                nextCache.push_back( tri[2] );
+                for (unsigned int i = 0; i < cache.size(); i++) {
+                        unsigned int v = cache[i];
+                        if (v != tri[0] && v != tri[1] && v != tri[2])
+                                nextCache.push_back( v );
+                }
+
+                // Rescore everything that was or is in the cache
+                for (unsigned int i = 0; i < nextCache.size(); i++) {
+                        unsigned int v = nextCache[i];
+                        cachePosition[v] = (i < FORSYTH_CACHE_SIZE) ? (int) i : -1;
+                        score[v] = vertexScore( cachePosition[v], remaining[v] );
+                }
+
+                // ... and pick the best triangle touching the cache
+                bestTri = NO_INDEX;
+                float bestScore = -1.0f;
+                for (unsigned int i = 0; i < nextCache.size(); i++) {
+                        unsigned int v = nextCache[i];
+                        for (unsigned int j = 0; j < remaining[v]; j++) {
+                                unsigned int t = adjacency[offsets[v] + j];
+                                triScore[t] = score[indices[t * 3]]
+                                            + score[indices[t * 3 + 1]]
+                                            + score[indices[t * 3 + 2]];
+                                if (triScore[t] > bestScore) {
+                                        bestScore = triScore[t];
+                                        bestTri = t;
+                                }
+                        }
+                }
+
+                if (nextCache.size() > FORSYTH_CACHE_SIZE)
+                        nextCache.resize( FORSYTH_CACHE_SIZE );
+                cache.swap( nextCache );
+        }
+
+        indices.swap( output );
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  Overdraw (cluster) ordering
+//////////////////////////////////////////////////////////////////////////////
+
+struct Cluster
+{
+        unsigned int firstTri, triCount;
+        float sortKey;
+};
+
+static bool drawsBefore( const Cluster &a, const Cluster &b )
+{
+        return a.sortKey > b.sortKey;
+}
+
+void OptimizeOverdraw( std::vector<unsigned int> &indices,
+                       const std::vector<MeshVertex> &vertices )
+{
+        unsigned int triCount = indices.size() / 3;
+        if (triCount == 0)
+                return;
+
+        /*
+         * Split the cache-ordered list at its "hard boundaries": the
+         * triangles that miss on all three vertices. Moving whole clusters
+         * around won't change the cache behavior inside them.
+         */
+        std::vector<Cluster> clusters;
+        std::vector<unsigned int> loadedAt( vertices.size(), 0 );
+        std::vector<bool> seen( vertices.size(), false );
+        unsigned int misses = 0;
+
+        for (unsigned int t = 0; t < triCount; t++) {
+                unsigned int triMisses = 0;
+                for (unsigned int k = 0; k < 3; k++) {
+                        unsigned int v = indices[t * 3 + k];
+                        if (!seen[v] || misses - loadedAt[v] >= MESHOPT_CACHE_SIZE) {
+                                loadedAt[v] = misses;
+                                seen[v] = true;
+                                misses++;
+                                triMisses++;
+                        }
+                }
+                if (t == 0 || triMisses == 3) {
+                        Cluster c = { t, 0, 0.0f };
+                        clusters.push_back( c );
+                }
+                clusters.back().triCount++;
+        }
+
+        if (clusters.size() < 2)
+                return;
+
+        // Area-weighted centroid of the whole mesh
+        std::vector<float> triArea( triCount );
+        std::vector<float> triCenter( triCount * 3 );
+        std::vector<float> triNormal( triCount * 3 );
+        float meshCenter[3] = { 0.0f, 0.0f, 0.0f };
+        float meshArea = 0.0f;
+
+        for (unsigned int t = 0; t < triCount; t++) {
+                const float *a = vertices[indices[t * 3]].pos;
+                const float *b = vertices[indices[t * 3 + 1]].pos;
+                const float *c = vertices[indices[t * 3 + 2]].pos;
+
+                float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+                float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+                float *n = &triNormal[t * 3];
+                n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+                n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+                n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+
+                // |cross| is twice the area; the factor cancels out
+                triArea[t] = sqrtf( n[0] * n[0] + n[1] * n[1] + n[2] * n[2] );
+                for (unsigned int k = 0; k < 3; k++) {
+                        triCenter[t * 3 + k] = (a[k] + b[k] + c[k]) / 3.0f;
+                        meshCenter[k] += triCenter[t * 3 + k] * triArea[t];
+                }
+                meshArea += triArea[t];
+        }
+
+        if (meshArea <= 0.0f)
+                return;
+        for (unsigned int k = 0; k < 3; k++)
+                meshCenter[k] /= meshArea;
+
+        /*
+         * A cluster facing away from the middle of the mesh is likely to be
+         * in front of the rest from whichever side it's seen, so those go
+         * first and the depth test rejects more of what comes after.
+         */
+        for (unsigned int i = 0; i < clusters.size(); i++) {
+                float center[3] = { 0.0f, 0.0f, 0.0f };
+                float normal[3] = { 0.0f, 0.0f, 0.0f };
+                float area = 0.0f;
+
+                for (unsigned int t = clusters[i].firstTri;
+                     t < clusters[i].firstTri + clusters[i].triCount; t++) {
+                        for (unsigned int k = 0; k < 3; k++) {
+                                center[k] += triCenter[t * 3 + k] * triArea[t];
+                                normal[k] += triNormal[t * 3 + k];
+                        }
+                        area += triArea[t];
+                }
+
+                float length = sqrtf( normal[0] * normal[0] + normal[1] * normal[1]
+                                    + normal[2] * normal[2] );
+                if (area <= 0.0f || length <= 0.0f)
+                        continue;
+
+                float key = 0.0f;
+                for (unsigned int k = 0; k < 3; k++)
+                        key += (center[k] / area - meshCenter[k]) * normal[k] / length;
+                clusters[i].sortKey = key;
+        }
+
+        std::stable_sort( clusters.begin(), clusters.end(), drawsBefore );
+
+        std::vector<unsigned int> output;
+        output.reserve( indices.size() );
+        for (unsigned int i = 0; i < clusters.size(); i++) {
+                output.insert( output.end(),
+                               indices.begin() + clusters[i].firstTri * 3,
+                               indices.begin() + (clusters[i].firstTri
+                                                  + clusters[i].triCount) * 3 );
+        }
+        indices.swap( output );
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  Vertex fetch ordering
+//////////////////////////////////////////////////////////////////////////////
+
+void OptimizeVertexFetch( Mesh &mesh )
+{
+        std::vector<unsigned int> remap( mesh.vertices.size(), NO_INDEX );
+        std::vector<MeshVertex> ordered;
+        ordered.reserve( mesh.vertices.size() );
+
+        for (unsigned int i = 0; i < mesh.indices.size(); i++) {
+                unsigned int v = mesh.indices[i];
+                if (remap[v] == NO_INDEX) {
+                        remap[v] = ordered.size();
+                        ordered.push_back( mesh.vertices[v] );
+                }
+                mesh.indices[i] = remap[v];
+        }
+
+        mesh.vertices.swap( ordered );
+}
+
+void OptimizeMesh( Mesh &mesh )
+{
+        unsigned int vertexCount = mesh.vertices.size();
+
+        mesh.cacheStats.acmrBefore = ComputeACMR( mesh.indices, MESHOPT_CACHE_SIZE );
+        mesh.cacheStats.atvrBefore = ComputeATVR( mesh.indices, vertexCount,
+                                                  MESHOPT_CACHE_SIZE );
+
+        OptimizeVertexCache( mesh.indices, vertexCount );
+        OptimizeOverdraw( mesh.indices, mesh.vertices );
+        OptimizeVertexFetch( mesh );
+
+        mesh.cacheStats.acmrAfter = ComputeACMR( mesh.indices, MESHOPT_CACHE_SIZE );
+        mesh.cacheStats.atvrAfter = ComputeATVR( mesh.indices, mesh.vertices.size(),
+                                                 MESHOPT_CACHE_SIZE );
+}
@@ -0,0 +1,50 @@
+/*
+ * Filename: meshopt.hpp
+ *
+ * Index buffer processing done on each mesh at load time:
+ *
+ *   1. Weld the face-expanded corners into unique vertices
+ *   2. Reorder triangles for the post-transform vertex cache
+ *      (Tom Forsyth's "Linear-Speed Vertex Cache Optimisation")
+ *   3. Reorder clusters of those triangles to cut down on overdraw
+ *      (the cluster sort from Sander et al.'s "Tipsify" paper)
+ *   4. Renumber the vertices in the order they are fetched
+ *
+ * Each function only touches the mesh it is given, so different meshes
+ * can be processed on different threads at the same time.
+ */
+
+#ifndef _MESHOPT_H
+#define _MESHOPT_H
+
+#include "mesh.hpp"
+
+// Cache size used for the ACMR/ATVR numbers (a typical FIFO size)
+const unsigned int MESHOPT_CACHE_SIZE = 16;
+
+// Merge the count identical corners (3 per face) into mesh.vertices /
+// mesh.indices
+void WeldVertices( const MeshVertex *corners, unsigned int count, Mesh &mesh );
+
+// Reorder triangles so vertices get reused while they're still cached
+void OptimizeVertexCache( std::vector<unsigned int> &indices,
+                          unsigned int vertexCount );
+
+// Reorder triangle clusters so the outward-facing ones are drawn first.
+// Run this AFTER OptimizeVertexCache(), it keeps clusters intact.
+void OptimizeOverdraw( std::vector<unsigned int> &indices,
+                       const std::vector<MeshVertex> &vertices );
+
+// Renumber (and drop unused) vertices in the order they're first used
+void OptimizeVertexFetch( Mesh &mesh );
+
+// Cache statistics for a triangle list with a FIFO of the given size
+float ComputeACMR( const std::vector<unsigned int> &indices,
+                   unsigned int cacheSize );
+float ComputeATVR( const std::vector<unsigned int> &indices,
+                   unsigned int vertexCount, unsigned int cacheSize );
+
+// Steps 2-4 in order, filling in mesh.cacheStats along the way
+void OptimizeMesh( Mesh &mesh );
+
+#endif    // _MESHOPT_H
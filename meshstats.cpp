@@ -0,0 +1,314 @@
+/*
+ * Filename: meshstats.cpp
+ *
+ * The --stats model check-up (see meshstats.hpp).
+ */
+
+#include "meshstats.hpp"
+#include "mesh.hpp"
+#include "meshlet.hpp"
+#include "culling.hpp"
+#include "meshclean.hpp"
+
+#include <lib3ds/file.h>
+#include <lib3ds/mesh.h>
+
+#include <QElapsedTimer>
+#include <QtConcurrentMap>
+
+#include <iostream>
+#include <algorithm>
+#include <cstdio>
+
+// Bytes per vertex in the compact format and per position in the compact
+// position buffer (the xyz and padding of CompactVertex::pos)
+static const long COMPACT_VERTEX_BYTES = sizeof(CompactVertex);
+static const long COMPACT_POSITION_BYTES = sizeof(short) * 4;
+
+// A face with corners a, b, c (a the smallest, the winding kept), or an
+// edge lo <= hi, as one sortable key (21 bits a point is more than lib3ds
+// can index)
+static unsigned long long faceKey( unsigned int a, unsigned int b, unsigned int c )
+{
+        return ((unsigned long long) a << 42) | ((unsigned long long) b << 21) | c;
+}
+
+static unsigned long long edgeKey( unsigned int a, unsigned int b )
+{
+        return a < b ? ((unsigned long long) a << 32) | b
+                     : ((unsigned long long) b << 32) | a;
+}
+
+/*
+ * No area: the two edges from the first corner are (close enough to)
+ * parallel, i.e. |a x b| is tiny next to |a| |b|
+ */
+static bool flat( const float *p0, const float *p1, const float *p2 )
+{
+        float a[3], b[3];
+        for (int i = 0; i < 3; i++) {
+                a[i] = p1[i] - p0[i];
+                b[i] = p2[i] - p0[i];
+        }
+        float cross[3] = {
+                a[1] * b[2] - a[2] * b[1],
+                a[2] * b[0] - a[0] * b[2],
+                a[0] * b[1] - a[1] * b[0]
+        };
+        float crossSq = cross[0] * cross[0] + cross[1] * cross[1] + cross[2] * cross[2];
+        float aSq = a[0] * a[0] + a[1] * a[1] + a[2] * a[2];
+        float bSq = b[0] * b[0] + b[1] * b[1] + b[2] * b[2];
+        return crossSq <= DEGENERATE_SINE_SQ * aSq * bSq;
+}
+
+/*
+ * One mesh for the thread pool
+ */
+struct StatsJob
+{
+        const Lib3dsMesh *source;
+        MeshStats *stats;
+};
+
+static void analyzeMesh( StatsJob &job )
+{
+        const Lib3dsMesh *source = job.source;
+        MeshStats &stats = *job.stats;
+        unsigned int points = source->points;
+
+        stats.name = source->name;
+        stats.triangles = source->faces;
+        stats.points = points;
+        stats.degenerateFaces = stats.badFaces = stats.duplicateFaces = 0;
+        stats.boundaryEdges = stats.nonManifoldEdges = 0;
+        stats.hasTexels = (source->texels != 0);
+
+        for (int i = 0; i < 3; i++)
+                stats.boundsMin[i] = stats.boundsMax[i] = points > 0 ? source->pointL[0].pos[i] : 0.0f;
+        for (unsigned int p = 1; p < points; p++) {
+                for (int i = 0; i < 3; i++) {
+                        stats.boundsMin[i] = std::min( stats.boundsMin[i], source->pointL[p].pos[i] );
+                        stats.boundsMax[i] = std::max( stats.boundsMax[i], source->pointL[p].pos[i] );
+                }
+        }
+
+        /*
+         * Every face that's really a triangle goes in as its corners,
+         * smallest first in winding order (as the import's cleanup
+         * compares them, see meshclean.cpp, so a face's back side isn't a
+         * duplicate); after sorting, duplicates are next to each other.
+         */
+        std::vector<char> used( points, 0 );
+        std::vector<unsigned long long> faces;
+        faces.reserve( source->faces );
+        for (unsigned int f = 0; f < source->faces; f++) {
+                unsigned int c[3];
+                for (int i = 0; i < 3; i++)
+                        c[i] = source->faceL[f].points[i];
+                if (c[0] >= points || c[1] >= points || c[2] >= points) {
+                        stats.badFaces++;
+                        continue;
+                }
+                used[c[0]] = used[c[1]] = used[c[2]] = 1;
+
+                if (c[0] == c[1] || c[1] == c[2] || c[0] == c[2]
+                    || flat( source->pointL[c[0]].pos, source->pointL[c[1]].pos,
+                             source->pointL[c[2]].pos )) {
+                        stats.degenerateFaces++;
+                        continue;
+                }
+
+                int first = 0;
+                if (c[1] < c[first]) first = 1;
+                if (c[2] < c[first]) first = 2;
+                faces.push_back( faceKey( c[first], c[(first + 1) % 3], c[(first + 2) % 3] ) );
+        }
+        std::sort( faces.begin(), faces.end() );
+
+        // Edges of the faces left once duplicates are dropped, counted the
+        // same way: one face is a boundary, more than two is non-manifold
+        std::vector<unsigned long long> edges;
+        edges.reserve( faces.size() * 3 );
+        for (unsigned int f = 0; f < faces.size(); f++) {
+                if (f > 0 && faces[f] == faces[f - 1]) {
+                        stats.duplicateFaces++;
+                        continue;
+                }
+                unsigned int a = (unsigned int) (faces[f] >> 42);
+                unsigned int b = (unsigned int) (faces[f] >> 21) & 0x1fffff;
+                unsigned int c = (unsigned int) faces[f] & 0x1fffff;
+                edges.push_back( edgeKey( a, b ) );
+                edges.push_back( edgeKey( b, c ) );
+                edges.push_back( edgeKey( a, c ) );
+        }
+        std::sort( edges.begin(), edges.end() );
+
+        for (unsigned int e = 0; e < edges.size(); ) {
+                unsigned int run = 1;
+                while (e + run < edges.size() && edges[e + run] == edges[e])
+                        run++;
+                if (run == 1)
+                        stats.boundaryEdges++;
+                else if (run > 2)
+                        stats.nonManifoldEdges++;
+                e += run;
+        }
+
+        unsigned int usedPoints = 0;
+        for (unsigned int p = 0; p < points; p++)
+                usedPoints += used[p];
+        stats.unusedPoints = points - usedPoints;
+
+        // What CreateVBO() would upload: the import drops the faces that
+        // don't index properly, degenerates and duplicates (see
+        // meshclean.hpp)
+        long drawn = stats.triangles - stats.badFaces - stats.degenerateFaces
+                     - stats.duplicateFaces;
+        long common = drawn * 3 * sizeof(unsigned int)
+                      + (drawn + MESHLET_MAX_TRIANGLES - 1) / MESHLET_MAX_TRIANGLES
+                        * sizeof(GpuCullObject);
+        stats.floatBytes = usedPoints * (long) (sizeof(MeshVertex) + 3 * sizeof(float)) + common;
+        stats.compactBytes = usedPoints * (COMPACT_VERTEX_BYTES + COMPACT_POSITION_BYTES) + common;
+}
+
+bool AnalyzeModel( const std::string &path, ModelStats &stats )
+{
+        QElapsedTimer timer;
+        timer.start();
+
+        stats.path = path;
+        stats.meshes.clear();
+
+        Lib3dsFile *model = lib3ds_file_load( path.c_str() );
+        if (model == NULL) {
+                std::cerr << "ERROR: could not read " << path << "\n";
+                return false;
+        }
+        stats.loadMs = timer.nsecsElapsed() / 1000000.0;
+        timer.start();
+
+        unsigned int meshCount = 0;
+        Lib3dsMesh *mesh;
+        for (mesh = model->meshes; mesh != NULL; mesh = mesh->next)
+                meshCount++;
+
+        stats.meshes.resize( meshCount );
+        std::vector<StatsJob> jobs( meshCount );
+        unsigned int m = 0;
+        for (mesh = model->meshes; mesh != NULL; mesh = mesh->next, m++) {
+                jobs[m].source = mesh;
+                jobs[m].stats = &stats.meshes[m];
+        }
+
+        QtConcurrent::blockingMap( jobs, analyzeMesh );
+
+        // The totals, and the box around every mesh that has points
+        MeshStats &total = stats.total;
+        total.name = path;
+        total.triangles = total.points = 0;
+        total.degenerateFaces = total.badFaces = total.duplicateFaces = 0;
+        total.boundaryEdges = total.nonManifoldEdges = total.unusedPoints = 0;
+        total.hasTexels = meshCount > 0;
+        total.floatBytes = total.compactBytes = 0;
+        bool boxed = false;
+        for (m = 0; m < meshCount; m++) {
+                const MeshStats &s = stats.meshes[m];
+                total.triangles += s.triangles;
+                total.points += s.points;
+                total.degenerateFaces += s.degenerateFaces;
+                total.badFaces += s.badFaces;
+                total.duplicateFaces += s.duplicateFaces;
+                total.boundaryEdges += s.boundaryEdges;
+                total.nonManifoldEdges += s.nonManifoldEdges;
+                total.unusedPoints += s.unusedPoints;
+                total.hasTexels = total.hasTexels && s.hasTexels;
+                total.floatBytes += s.floatBytes;
+                total.compactBytes += s.compactBytes;
+
+                if (s.points == 0)
+                        continue;
+                for (int i = 0; i < 3; i++) {
+                        total.boundsMin[i] = boxed ? std::min( total.boundsMin[i], s.boundsMin[i] )
+                                                   : s.boundsMin[i];
+                        total.boundsMax[i] = boxed ? std::max( total.boundsMax[i], s.boundsMax[i] )
+                                                   : s.boundsMax[i];
+                }
+                boxed = true;
+        }
+        if (!boxed) {
+                for (int i = 0; i < 3; i++)
+                        total.boundsMin[i] = total.boundsMax[i] = 0.0f;
+        }
+
+        lib3ds_file_free( model );
+        stats.analyzeMs = timer.nsecsElapsed() / 1000000.0;
+        return true;
+}
+
+/*
+ * A JSON string (3ds names are short and usually plain ASCII, but the
+ * path could be anything)
+ */
+static void writeString( std::ostream &out, const std::string &text )
+{
+        out << '"';
+        for (unsigned int i = 0; i < text.size(); i++) {
+                unsigned char c = text[i];
+                if (c == '"' || c == '\\') {
+                        out << '\\' << c;
+                } else if (c < 0x20) {
+                        char escaped[8];
+                        snprintf( escaped, sizeof(escaped), "\\u%04x", c );
+                        out << escaped;
+                } else {
+                        out << c;
+                }
+        }
+        out << '"';
+}
+
+static void writeVector( std::ostream &out, const float v[3] )
+{
+        out << "[" << v[0] << ", " << v[1] << ", " << v[2] << "]";
+}
+
+static void writeMesh( std::ostream &out, const MeshStats &s, const char *indent )
+{
+        out << indent << "\"triangles\": " << s.triangles << ",\n"
+            << indent << "\"points\": " << s.points << ",\n"
+            << indent << "\"degenerateFaces\": " << s.degenerateFaces << ",\n"
+            << indent << "\"badFaces\": " << s.badFaces << ",\n"
+            << indent << "\"duplicateFaces\": " << s.duplicateFaces << ",\n"
+            << indent << "\"boundaryEdges\": " << s.boundaryEdges << ",\n"
+            << indent << "\"nonManifoldEdges\": " << s.nonManifoldEdges << ",\n"
+            << indent << "\"unusedPoints\": " << s.unusedPoints << ",\n"
+            << indent << "\"texcoords\": " << (s.hasTexels ? "true" : "false") << ",\n"
+            << indent << "\"boundsMin\": ";
+        writeVector( out, s.boundsMin );
+        out << ",\n" << indent << "\"boundsMax\": ";
+        writeVector( out, s.boundsMax );
+        out << ",\n"
+            << indent << "\"gpuBytesFloat\": " << s.floatBytes << ",\n"
+            << indent << "\"gpuBytesCompact\": " << s.compactBytes << "\n";
+}
+
+void WriteStatsJson( const ModelStats &stats, std::ostream &out )
+{
+        out << "{\n  \"file\": ";
+        writeString( out, stats.path );
+        out << ",\n  \"loadMs\": " << stats.loadMs
+            << ",\n  \"analyzeMs\": " << stats.analyzeMs
+            << ",\n  \"meshCount\": " << stats.meshes.size()
+            << ",\n  \"total\": {\n";
+        writeMesh( out, stats.total, "    " );
+        out << "  },\n  \"meshes\": [";
+
+        for (unsigned int m = 0; m < stats.meshes.size(); m++) {
+                out << (m == 0 ? "\n" : ",\n") << "    {\n      \"name\": ";
+                writeString( out, stats.meshes[m].name );
+                out << ",\n";
+                writeMesh( out, stats.meshes[m], "      " );
+                out << "    }";
+        }
+        out << "\n  ]\n}" << std::endl;
+}
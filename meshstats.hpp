@@ -0,0 +1,54 @@
+/*
+ * Filename: meshstats.hpp
+ *
+ * A check-up of a model straight from the 3ds file (--stats): for every
+ * mesh its size, what's wrong with it (degenerate and duplicate faces,
+ * edges shared by more than two faces, points no face uses), whether it
+ * has texture coordinates, its box and roughly what it will take on the
+ * GPU. Meshes are looked at in parallel, one per thread, and nothing
+ * needs a GL context, so this runs without a window.
+ */
+
+#ifndef _MESHSTATS_H
+#define _MESHSTATS_H
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+struct MeshStats
+{
+        std::string name;
+        unsigned int triangles, points;
+        unsigned int degenerateFaces;   // repeated corners or no area
+        unsigned int badFaces;          // corners past the point list
+        unsigned int duplicateFaces;    // same corners and winding as an earlier face
+        unsigned int boundaryEdges;     // used by one face
+        unsigned int nonManifoldEdges;  // used by more than two faces
+        unsigned int unusedPoints;
+        bool hasTexels;
+        float boundsMin[3], boundsMax[3];   // of every point; 0 if none
+
+        // GPU bytes for the float and compact vertex formats (vertex,
+        // position and index buffers and the culling bounds), counting
+        // each used point once: welding adds more where smoothing
+        // groups meet, so it's a lower bound
+        long floatBytes, compactBytes;
+};
+
+struct ModelStats
+{
+        std::string path;
+        std::vector<MeshStats> meshes;
+        MeshStats total;                // sums, and the box around everything
+        double loadMs, analyzeMs;
+};
+
+// Load path with lib3ds and look at every mesh. False (with an ERROR) if
+// the file can't be read.
+bool AnalyzeModel( const std::string &path, ModelStats &stats );
+
+// The report as JSON
+void WriteStatsJson( const ModelStats &stats, std::ostream &out );
+
+#endif    // _MESHSTATS_H
@@ -0,0 +1,217 @@
+/*
+ * Filename: meshtangents.cpp
+ *
+ * MikkTSpace style tangents (see meshtangents.hpp). The corners that
+ * share a tangent are found by hashing the bytes that end up welded
+ * together, plus which way round the face maps the texture.
+ */
+
+#include "meshtangents.hpp"
+
+#include <cstddef>
+#include <cstring>
+#include <cmath>
+
+static const unsigned int NO_GROUP = ~0u;
+
+// What the tangent is keyed on: everything in MeshVertex before it
+static const unsigned int KEY_BYTES = offsetof(MeshVertex, tangent);
+
+// Texture mapping this close to no area can't give a direction
+static const float MIN_UV_AREA = 1e-20f;
+
+// FNV-1a over a corner's key bytes and its face's mirroring
+static unsigned int hashCorner( const MeshVertex &v, bool flip )
+{
+        const unsigned char *bytes = (const unsigned char *) &v;
+        unsigned int hash = 2166136261u;
+        for (unsigned int i = 0; i < KEY_BYTES; i++) {
+                hash ^= bytes[i];
+                hash *= 16777619u;
+        }
+        hash ^= flip ? 1u : 0u;
+        hash *= 16777619u;
+        return hash;
+}
+
+static float dot3( const float *a, const float *b )
+{
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+// v minus its part along the unit vector n, scaled to unit length;
+// false if nothing is left
+static bool flattenOnto( const float *n, float *v )
+{
+        float along = dot3( n, v );
+        for (int k = 0; k < 3; k++)
+                v[k] -= n[k] * along;
+        float length = sqrt( dot3( v, v ) );
+        if (!(length > 1e-12f))
+                return false;
+        for (int k = 0; k < 3; k++)
+                v[k] /= length;
+        return true;
+}
+
+// Map [-1, 1] onto a signed 10 bit field
+static unsigned int packSnorm10( float value )
+{
+        if (value > 1.0f)  value = 1.0f;
+        if (value < -1.0f) value = -1.0f;
+        int q = (int) floorf( value * 511.0f + 0.5f );
+        return (unsigned int) q & 0x3ff;
+}
+
+// w is 1 (01) or -1 (11) in the top two bits
+static unsigned int packTangent( const float *t, bool flip )
+{
+        return packSnorm10( t[0] )
+             | (packSnorm10( t[1] ) << 10)
+             | (packSnorm10( t[2] ) << 20)
+             | ((flip ? 3u : 1u) << 30);
+}
+
+void ComputeTangents( MeshVertex *corners, unsigned int count, Arena &arena )
+{
+        unsigned int faceCount = count / 3;
+        if (faceCount == 0)
+                return;
+
+        /*
+         * Each face's direction of increasing u, solved from its edges and
+         * their texture coordinate deltas, and whether the mapping is
+         * mirrored (negative area in texture space)
+         */
+        float *faceTangents = arena.Array<float>( faceCount * 3 );
+        unsigned char *faceFlags = arena.Array<unsigned char>( faceCount );
+        enum { Flip = 1, Usable = 2 };
+
+        for (unsigned int f = 0; f < faceCount; f++) {
+                const MeshVertex *c = &corners[f * 3];
+                float d1[3], d2[3];
+                for (int k = 0; k < 3; k++) {
+                        d1[k] = c[1].pos[k] - c[0].pos[k];
+                        d2[k] = c[2].pos[k] - c[0].pos[k];
+                }
+                float s1 = c[1].texCoord[0] - c[0].texCoord[0];
+                float t1 = c[1].texCoord[1] - c[0].texCoord[1];
+                float s2 = c[2].texCoord[0] - c[0].texCoord[0];
+                float t2 = c[2].texCoord[1] - c[0].texCoord[1];
+                float area = s1 * t2 - s2 * t1;
+
+                float *tangent = &faceTangents[f * 3];
+                float scale = area < 0.0f ? -1.0f : 1.0f;
+                for (int k = 0; k < 3; k++)
+                        tangent[k] = (t2 * d1[k] - t1 * d2[k]) * scale;
+
+                faceFlags[f] = 0;
+                if (area < 0.0f)
+                        faceFlags[f] |= Flip;
+                if (fabsf( area ) > MIN_UV_AREA && dot3( tangent, tangent ) > 0.0f)
+                        faceFlags[f] |= Usable;
+        }
+
+        /*
+         * Group the corners: open addressing table, at least twice as big
+         * as the input, holding the first corner seen of each group
+         */
+        unsigned int tableSize = 1;
+        while (tableSize < count * 2)
+                tableSize <<= 1;
+        unsigned int *table = arena.Array<unsigned int>( tableSize );
+        for (unsigned int i = 0; i < tableSize; i++)
+                table[i] = NO_GROUP;
+
+        unsigned int *groupOf = arena.Array<unsigned int>( count );
+        unsigned int *firstCorner = arena.Array<unsigned int>( count );
+        unsigned int groupCount = 0;
+
+        for (unsigned int c = 0; c < count; c++) {
+                bool flip = (faceFlags[c / 3] & Flip) != 0;
+                unsigned int slot = hashCorner( corners[c], flip ) & (tableSize - 1);
+
+                while (table[slot] != NO_GROUP) {
+                        unsigned int other = firstCorner[table[slot]];
+                        if (memcmp( &corners[other], &corners[c], KEY_BYTES ) == 0
+                            && ((faceFlags[other / 3] & Flip) != 0) == flip)
+                                break;
+                        slot = (slot + 1) & (tableSize - 1);
+                }
+
+                if (table[slot] == NO_GROUP) {
+                        table[slot] = groupCount;
+                        firstCorner[groupCount++] = c;
+                }
+                groupOf[c] = table[slot];
+        }
+
+        /*
+         * Sum each face's tangent into its corners' groups, flattened onto
+         * the corner's normal and weighted by the face's angle there (the
+         * angle between the two edges, also flattened)
+         */
+        float *sums = arena.Array<float>( groupCount * 3 );
+        memset( sums, 0, sizeof(float) * groupCount * 3 );
+
+        for (unsigned int c = 0; c < count; c++) {
+                unsigned int f = c / 3;
+                if (!(faceFlags[f] & Usable))
+                        continue;
+
+                const MeshVertex &corner = corners[c];
+                const MeshVertex &next = corners[f * 3 + (c + 1) % 3];
+                const MeshVertex &prev = corners[f * 3 + (c + 2) % 3];
+
+                float tangent[3], toNext[3], toPrev[3];
+                for (int k = 0; k < 3; k++) {
+                        tangent[k] = faceTangents[f * 3 + k];
+                        toNext[k] = next.pos[k] - corner.pos[k];
+                        toPrev[k] = prev.pos[k] - corner.pos[k];
+                }
+                if (!flattenOnto( corner.normal, tangent ))
+                        continue;
+
+                float angle = 0.0f;
+                if (flattenOnto( corner.normal, toNext ) && flattenOnto( corner.normal, toPrev )) {
+                        float cosine = dot3( toNext, toPrev );
+                        if (cosine > 1.0f)  cosine = 1.0f;
+                        if (cosine < -1.0f) cosine = -1.0f;
+                        angle = acosf( cosine );
+                }
+
+                float *sum = &sums[groupOf[c] * 3];
+                for (int k = 0; k < 3; k++)
+                        sum[k] += tangent[k] * angle;
+        }
+
+        // Every corner gets its group's tangent, at right angles to its
+        // normal (any such direction if the group had nothing to go on)
+        for (unsigned int c = 0; c < count; c++) {
+                MeshVertex &corner = corners[c];
+                const float *n = corner.normal;
+                float tangent[3];
+                memcpy( tangent, &sums[groupOf[c] * 3], sizeof(tangent) );
+
+                if (!flattenOnto( n, tangent )) {
+                        // Cross the normal with whichever axis it's least
+                        // along
+                        float axis[3] = { 0.0f, 0.0f, 0.0f };
+                        int least = 0;
+                        for (int k = 1; k < 3; k++) {
+                                if (fabsf( n[k] ) < fabsf( n[least] ))
+                                        least = k;
+                        }
+                        axis[least] = 1.0f;
+                        tangent[0] = n[1] * axis[2] - n[2] * axis[1];
+                        tangent[1] = n[2] * axis[0] - n[0] * axis[2];
+                        tangent[2] = n[0] * axis[1] - n[1] * axis[0];
+                        if (!flattenOnto( n, tangent )) {
+                                tangent[0] = 1.0f;
+                                tangent[1] = tangent[2] = 0.0f;
+                        }
+                }
+
+                corner.tangent = packTangent( tangent, (faceFlags[c / 3] & Flip) != 0 );
+        }
+}
@@ -0,0 +1,40 @@
+/*
+ * Filename: meshtangents.hpp
+ *
+ * Tangent space for normal maps, following MikkTSpace's rules so maps
+ * baked by other tools line up:
+ *   - a face's tangent is the direction u grows in across it, flattened
+ *     onto each corner's normal
+ *   - the corners that end up as one vertex (same position, normal and
+ *     texture coordinates) and whose faces map the texture the same way
+ *     round (not mirrored) share the sum of those tangents, weighted by
+ *     the angle of each face at the corner
+ *   - the bitangent isn't stored, just which way it points:
+ *     bitangent = w * cross(normal, tangent)
+ *
+ * This runs on the face corners before they're welded, so vertices that
+ * only differ in tangent (mirrored texture seams) are split by the weld.
+ * The tangent goes in MeshVertex::tangent packed as 10_10_10_2: xyz in
+ * the three 10 bit fields and w (+1 or -1) in the 2 bit one, in both
+ * vertex layouts (4 bytes a vertex).
+ */
+
+#ifndef _MESHTANGENTS_H
+#define _MESHTANGENTS_H
+
+#include "mesh.hpp"
+#include "arena.hpp"
+
+// Generic vertex attribute the tangents are bound to while drawing, for
+// shaders to pick up with glBindAttribLocation()
+const unsigned int TANGENT_ATTRIB = 6;
+
+/*
+ * Fill in the tangent of each of count corners (three per face, in
+ * order). Faces without usable texture coordinates pick up their
+ * neighbors' tangents, or any tangent at right angles to the normal when
+ * there are none. Temporaries come from arena.
+ */
+void ComputeTangents( MeshVertex *corners, unsigned int count, Arena &arena );
+
+#endif    // _MESHTANGENTS_H
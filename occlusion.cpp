@@ -0,0 +1,154 @@
+/*
+ * Filename: occlusion.cpp
+ *
+ * Implementation of the lagged occlusion queries (see occlusion.hpp).
+ */
+
+#include "occlusion.hpp"
+
+OcclusionCuller::OcclusionCuller()
+{
+}
+
+OcclusionCuller::~OcclusionCuller()
+{
+        Reset();
+}
+
+void OcclusionCuller::Reset()
+{
+        if (!m_Queries.empty())
+                glDeleteQueries( m_Queries.size(), &m_Queries[0] );
+
+        m_Queries.clear();
+        m_Pending.clear();
+        m_Visible.clear();
+}
+
+const std::vector<char> &OcclusionCuller::Visible() const
+{
+        return m_Visible;
+}
+
+unsigned int OcclusionCuller::HiddenCount() const
+{
+        unsigned int hidden = 0;
+        for (unsigned int i = 0; i < m_Visible.size(); i++) {
+                if (!m_Visible[i])
+                        hidden++;
+        }
+        return hidden;
+}
+
+void OcclusionCuller::CollectResults( const Asset3ds &asset )
+{
+        unsigned int meshCount = asset.GetMeshCount();
+
+        // First frame (or new model): everything is visible until the
+        // queries say otherwise
+        if (m_Queries.size() != meshCount) {
+                Reset();
+                m_Queries.resize( meshCount );
+                if (meshCount > 0)
+                        glGenQueries( meshCount, &m_Queries[0] );
+                m_Pending.assign( meshCount, 0 );
+                m_Visible.assign( meshCount, 1 );
+                return;
+        }
+
+        for (unsigned int i = 0; i < meshCount; i++) {
+                if (!m_Pending[i])
+                        continue;
+
+                // Not back yet? Keep last answer, check again next frame
+                GLuint available = 0;
+                glGetQueryObjectuiv( m_Queries[i], GL_QUERY_RESULT_AVAILABLE, &available );
+                if (!available)
+                        continue;
+
+                GLuint samples = 0;
+                glGetQueryObjectuiv( m_Queries[i], GL_QUERY_RESULT, &samples );
+                m_Visible[i] = (samples > 0);
+                m_Pending[i] = 0;
+        }
+}
+
+// The six faces of a box as quads (winding doesn't matter, culling is off)
+static void drawBox( const float lo[3], const float hi[3] )
+{
+        glBegin( GL_QUADS );
+        glVertex3f( lo[0], lo[1], lo[2] ); glVertex3f( hi[0], lo[1], lo[2] );
+        glVertex3f( hi[0], hi[1], lo[2] ); glVertex3f( lo[0], hi[1], lo[2] );
+
+        glVertex3f( lo[0], lo[1], hi[2] ); glVertex3f( hi[0], lo[1], hi[2] );
+        glVertex3f( hi[0], hi[1], hi[2] ); glVertex3f( lo[0], hi[1], hi[2] );
+
+        glVertex3f( lo[0], lo[1], lo[2] ); glVertex3f( lo[0], hi[1], lo[2] );
+        glVertex3f( lo[0], hi[1], hi[2] ); glVertex3f( lo[0], lo[1], hi[2] );
+
+        glVertex3f( hi[0], lo[1], lo[2] ); glVertex3f( hi[0], hi[1], lo[2] );
+        glVertex3f( hi[0], hi[1], hi[2] ); glVertex3f( hi[0], lo[1], hi[2] );
+
+        glVertex3f( lo[0], lo[1], lo[2] ); glVertex3f( hi[0], lo[1], lo[2] );
+        glVertex3f( hi[0], lo[1], hi[2] ); glVertex3f( lo[0], lo[1], hi[2] );
+
+        glVertex3f( lo[0], hi[1], lo[2] ); glVertex3f( hi[0], hi[1], lo[2] );
+        glVertex3f( hi[0], hi[1], hi[2] ); glVertex3f( lo[0], hi[1], hi[2] );
+        glEnd();
+}
+
+/*
+ * Does the box reach through the near plane (view.planes[4])? Then the
+ * part of it in front of the camera can be clipped away, leaving no
+ * samples even though the mesh is right there.
+ */
+static bool crossesNear( const CullView &view, const float lo[3], const float hi[3] )
+{
+        const float *plane = view.planes[4];
+        float nearest = plane[3], furthest = plane[3];
+        for (int k = 0; k < 3; k++) {
+                nearest += plane[k] * (plane[k] >= 0.0f ? lo[k] : hi[k]);
+                furthest += plane[k] * (plane[k] >= 0.0f ? hi[k] : lo[k]);
+        }
+        return nearest < 0.0f && furthest >= 0.0f;
+}
+
+void OcclusionCuller::IssueQueries( const Asset3ds &asset, const CullView &view )
+{
+        if (m_Queries.size() != asset.GetMeshCount())
+                return;
+
+        // Boxes only touch the query counters, never the framebuffer
+        glPushAttrib( GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+        glDisable( GL_LIGHTING );
+        glDisable( GL_CULL_FACE );
+        glDisable( GL_TEXTURE_2D );
+        glColorMask( GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE );
+        glDepthMask( GL_FALSE );
+        glDepthFunc( GL_LEQUAL );
+
+        for (unsigned int i = 0; i < m_Queries.size(); i++) {
+                if (m_Pending[i])
+                        continue;
+
+                float lo[3], hi[3];
+                asset.GetMeshBounds( i, lo, hi );
+                if (lo[0] > hi[0])
+                        continue;           // empty mesh, nothing to draw
+
+                // If we're standing inside the box, or just outside it
+                // but closer than the near plane, its faces can all get
+                // clipped away, so just call it visible
+                if (crossesNear( view, lo, hi )) {
+                        m_Visible[i] = 1;
+                        continue;
+                }
+
+                glBeginQuery( GL_SAMPLES_PASSED, m_Queries[i] );
+                drawBox( lo, hi );
+                glEndQuery( GL_SAMPLES_PASSED );
+                m_Pending[i] = 1;
+        }
+
+        glPopAttrib();
+}
@@ -0,0 +1,54 @@
+/*
+ * Filename: occlusion.hpp
+ *
+ * Hardware occlusion queries against each mesh's bounding box. Results are
+ * read one frame late so we never sit and wait on the GPU:
+ *
+ *   frame N   - draw the meshes that were visible, then draw every mesh's
+ *               box (no color or depth writes) inside a query
+ *   frame N+1 - any box that didn't touch a single pixel is hidden behind
+ *               what was drawn, so that mesh is skipped
+ *
+ * A mesh that comes back into view pops in a frame late, which is the
+ * price of never stalling.
+ */
+
+#ifndef _OCCLUSION_H
+#define _OCCLUSION_H
+
+#include "gl.hpp"
+#include "asset.hpp"
+
+#include <vector>
+
+class OcclusionCuller
+{
+public:
+        OcclusionCuller();
+
+        // Needs the GL context current (it deletes query objects)
+        ~OcclusionCuller();
+
+        // Pick up whatever query results have come back. Call at the start
+        // of the frame, before using Visible().
+        void CollectResults( const Asset3ds &asset );
+
+        // One entry per mesh: non-zero if the mesh should be drawn
+        const std::vector<char> &Visible() const;
+
+        // Query every mesh's box against the depth buffer as it stands.
+        // Call AFTER the frame's geometry is drawn.
+        void IssueQueries( const Asset3ds &asset, const CullView &view );
+
+        // Drop all queries (e.g. when turning occlusion culling off)
+        void Reset();
+
+        unsigned int HiddenCount() const;
+
+private:
+        std::vector<GLuint> m_Queries;
+        std::vector<char> m_Pending;     // query issued, result not read yet
+        std::vector<char> m_Visible;
+};
+
+#endif    // _OCCLUSION_H
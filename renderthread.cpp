@@ -0,0 +1,46 @@
+/*
+ * Filename: renderthread.cpp
+ *
+ * The render thread's loop (see renderthread.hpp).
+ */
+
+#include "renderthread.hpp"
+#include "glwidget.hpp"
+
+RenderThread::RenderThread( GLWidget *widget ) :
+                m_Widget( widget ), m_Quit( 0 )
+{
+}
+
+void RenderThread::RequestFrame()
+{
+        // One wake-up is enough however many snapshots pile up, the
+        // frame always draws the newest
+        if (m_Requests.available() == 0)
+                m_Requests.release();
+}
+
+void RenderThread::Stop()
+{
+        if (!isRunning())
+                return;
+
+        m_Quit.fetchAndStoreOrdered( 1 );
+        m_Requests.release();
+        wait();
+}
+
+bool RenderThread::waitForFrame()
+{
+        m_Requests.acquire();
+        m_Requests.tryAcquire( m_Requests.available() );
+        return m_Quit == 0;
+}
+
+void RenderThread::run()
+{
+        m_Widget->startRendering();
+        while (waitForFrame())
+                m_Widget->renderNextFrame();
+        m_Widget->stopRendering();
+}
@@ -0,0 +1,48 @@
+/*
+ * Filename: renderthread.hpp
+ *
+ * Runs all of a GLWidget's GL work on its own thread (--render-thread) so
+ * a slow frame on a heavy model doesn't hold up the control panel or the
+ * mouse. This is the usual Qt 4 recipe for threaded GL: the widget stops
+ * painting and resizing itself, gives its context to this thread, and
+ * this thread makes it current, draws and swaps buffers.
+ *
+ * The GUI thread never waits on it: each frame it publishes a snapshot
+ * of the camera and lighting (see TripleBuffer) and pokes the thread.
+ * The thread draws the newest snapshot whenever it's ready for another
+ * frame.
+ */
+
+#ifndef _RENDERTHREAD_H
+#define _RENDERTHREAD_H
+
+#include <QThread>
+#include <QSemaphore>
+#include <QAtomicInt>
+
+class GLWidget;
+
+class RenderThread : public QThread
+{
+public:
+        RenderThread( GLWidget *widget );
+
+        // A new snapshot is waiting (cheap, never blocks)
+        void RequestFrame();
+
+        // Finish the current frame, clean up and wait for the thread
+        void Stop();
+
+protected:
+        void run();
+
+private:
+        // Sleep until there's a frame to draw; false means quit
+        bool waitForFrame();
+
+        GLWidget *m_Widget;
+        QSemaphore m_Requests;
+        QAtomicInt m_Quit;
+};
+
+#endif    // _RENDERTHREAD_H
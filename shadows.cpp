@@ -0,0 +1,455 @@
+/*
+ * Filename: shadows.cpp
+ *
+ * Cached shadow maps (see shadows.hpp).
+ */
+
+#include "shadows.hpp"
+#include "gl.hpp"
+
+#include <iostream>
+#include <cstring>
+#include <cmath>
+
+// First texture unit the maps go on (after the model texture and the
+// light tiles, see lights.cpp)
+static const int SHADOW_UNIT = 3;
+
+// Depth offset for the shadow casters, against shadow acne
+static const float SHADOW_OFFSET_FACTOR = 2.0;
+static const float SHADOW_OFFSET_UNITS = 4.0;
+
+/*
+ * out = a * b (column major, out may be a or b)
+ */
+static void multiply( const float a[16], const float b[16], float out[16] )
+{
+        float result[16];
+        for (int j = 0; j < 4; j++) {
+                for (int i = 0; i < 4; i++) {
+                        result[j * 4 + i] = a[i] * b[j * 4]
+                                          + a[4 + i] * b[j * 4 + 1]
+                                          + a[8 + i] * b[j * 4 + 2]
+                                          + a[12 + i] * b[j * 4 + 3];
+                }
+        }
+        memcpy( out, result, sizeof(result) );
+}
+
+/*
+ * Inverse of a view matrix (rotation, scale and translation, no
+ * projection): invert the 3x3 part and move the translation through it
+ */
+static void invertAffine( const float m[16], float out[16] )
+{
+        // Cofactors of the upper 3x3, column major a(row, col) = m[col * 4 + row]
+        float c00 = m[5] * m[10] - m[9] * m[6];
+        float c01 = m[9] * m[2] - m[1] * m[10];
+        float c02 = m[1] * m[6] - m[5] * m[2];
+        float det = m[0] * c00 + m[4] * c01 + m[8] * c02;
+        float inv = (fabs( det ) > 1e-20) ? 1.0 / det : 0.0;
+
+        out[0] = c00 * inv;
+        out[1] = c01 * inv;
+        out[2] = c02 * inv;
+        out[4] = (m[8] * m[6] - m[4] * m[10]) * inv;
+        out[5] = (m[0] * m[10] - m[8] * m[2]) * inv;
+        out[6] = (m[4] * m[2] - m[0] * m[6]) * inv;
+        out[8] = (m[4] * m[9] - m[8] * m[5]) * inv;
+        out[9] = (m[8] * m[1] - m[0] * m[9]) * inv;
+        out[10] = (m[0] * m[5] - m[4] * m[1]) * inv;
+
+        for (int r = 0; r < 3; r++)
+                out[12 + r] = -(out[r] * m[12] + out[4 + r] * m[13] + out[8 + r] * m[14]);
+        out[3] = out[7] = out[11] = 0.0;
+        out[15] = 1.0;
+}
+
+/*
+ * gluLookAt() into a matrix
+ */
+static void lookAt( const float eye[3], const float center[3], const float up[3], float m[16] )
+{
+        float f[3], s[3], u[3];
+        for (int k = 0; k < 3; k++)
+                f[k] = center[k] - eye[k];
+        float length = sqrt( f[0] * f[0] + f[1] * f[1] + f[2] * f[2] );
+        for (int k = 0; k < 3; k++)
+                f[k] /= length;
+
+        s[0] = f[1] * up[2] - f[2] * up[1];
+        s[1] = f[2] * up[0] - f[0] * up[2];
+        s[2] = f[0] * up[1] - f[1] * up[0];
+        length = sqrt( s[0] * s[0] + s[1] * s[1] + s[2] * s[2] );
+        for (int k = 0; k < 3; k++)
+                s[k] /= length;
+
+        u[0] = s[1] * f[2] - s[2] * f[1];
+        u[1] = s[2] * f[0] - s[0] * f[2];
+        u[2] = s[0] * f[1] - s[1] * f[0];
+
+        for (int k = 0; k < 3; k++) {
+                m[k * 4 + 0] = s[k];
+                m[k * 4 + 1] = u[k];
+                m[k * 4 + 2] = -f[k];
+                m[k * 4 + 3] = 0.0;
+        }
+        for (int r = 0; r < 3; r++) {
+                const float *row = (r == 0) ? s : (r == 1) ? u : f;
+                float d = row[0] * eye[0] + row[1] * eye[1] + row[2] * eye[2];
+                m[12 + r] = (r == 2) ? d : -d;
+        }
+        m[15] = 1.0;
+}
+
+/*
+ * glFrustum() / glOrtho() into a matrix, symmetric about the axis
+ */
+static void projection( bool perspective, float half, float zNear, float zFar, float m[16] )
+{
+        memset( m, 0, sizeof(float) * 16 );
+        if (perspective) {
+                m[0] = m[5] = zNear / half;
+                m[10] = -(zFar + zNear) / (zFar - zNear);
+                m[11] = -1.0;
+                m[14] = -2.0 * zFar * zNear / (zFar - zNear);
+        } else {
+                m[0] = m[5] = 1.0 / half;
+                m[10] = -2.0 / (zFar - zNear);
+                m[14] = -(zFar + zNear) / (zFar - zNear);
+                m[15] = 1.0;
+        }
+}
+
+ShadowMaps::ShadowMaps()
+{
+        m_Quality = ShadowsMedium;
+        m_Size = 0;
+        m_Framebuffer = 0;
+        m_Failed = false;
+        m_Radius = -1.0;
+        m_Chunks = 0;
+        m_Renders = m_LastRenders = 0;
+        for (unsigned int k = 0; k < SHADOW_LIGHTS; k++)
+                m_Valid[k] = false;
+
+        GpuMemory::Register( this );
+}
+
+ShadowMaps::~ShadowMaps()
+{
+        GpuMemory::Unregister( this );
+        Reset();
+}
+
+void ShadowMaps::Reset()
+{
+        if (m_Framebuffer != 0)
+                glDeleteFramebuffers( 1, &m_Framebuffer );
+
+        m_Framebuffer = 0;
+        m_Size = 0;
+        for (unsigned int k = 0; k < SHADOW_LIGHTS; k++) {
+                m_Textures[k].Reset();
+                m_Valid[k] = false;
+        }
+}
+
+long ShadowMaps::GpuBytes() const
+{
+        long bytes = 0;
+        for (unsigned int k = 0; k < SHADOW_LIGHTS; k++)
+                bytes += m_Textures[k].Bytes();
+        return bytes;
+}
+
+// They're only a cache of what the model looks like from the lights
+void ShadowMaps::EvictGpu()
+{
+        Reset();
+}
+
+int ShadowMaps::MapSize( ShadowQuality quality )
+{
+        static const int sizes[SHADOW_QUALITIES] = { 0, 1024, 2048, 4096 };
+        return sizes[quality];
+}
+
+int ShadowMaps::FilterTaps( ShadowQuality quality )
+{
+        static const int taps[SHADOW_QUALITIES] = { 0, 1, 3, 5 };
+        return taps[quality];
+}
+
+void ShadowMaps::SetQuality( ShadowQuality quality )
+{
+        m_Quality = quality;
+}
+
+ShadowQuality ShadowMaps::Quality() const
+{
+        return m_Quality;
+}
+
+unsigned int ShadowMaps::Renders() const
+{
+        return m_Renders;
+}
+
+unsigned int ShadowMaps::LastRenders() const
+{
+        return m_LastRenders;
+}
+
+/*
+ * Depth textures of the current quality's size (made again, and so
+ * invalidated, when the size changes) and the framebuffer to draw them
+ */
+bool ShadowMaps::init()
+{
+        if (m_Failed)
+                return false;
+
+        GLint maxSize = 2048;
+        glGetIntegerv( GL_MAX_TEXTURE_SIZE, &maxSize );
+        int size = qMin( MapSize( m_Quality ), (int) maxSize );
+        if (m_Framebuffer != 0 && size == m_Size)
+                return true;
+
+        if (m_Framebuffer == 0) {
+                if (!HaveGL( 3, 0, "GL_ARB_framebuffer_object" )) {
+                        std::cerr << "WARNING: no framebuffer objects, shadows are off" << std::endl;
+                        m_Failed = true;
+                        return false;
+                }
+                glGenFramebuffers( 1, &m_Framebuffer );
+                for (unsigned int k = 0; k < SHADOW_LIGHTS; k++)
+                        m_Textures[k].Create();
+        }
+
+        // Lookups do the depth compare (filtered over 2x2 by the hardware),
+        // and anything off the map is lit
+        static const GLfloat lit[4] = { 1.0, 1.0, 1.0, 1.0 };
+        for (unsigned int k = 0; k < SHADOW_LIGHTS; k++) {
+                glBindTexture( GL_TEXTURE_2D, m_Textures[k].Name() );
+                glTexImage2D( GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, size, size, 0,
+                              GL_DEPTH_COMPONENT, GL_FLOAT, NULL );
+                m_Textures[k].SetBytes( (GLsizeiptr) size * size * 4 );
+                glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+                glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+                glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER );
+                glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER );
+                glTexParameterfv( GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, lit );
+                glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE );
+                glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL );
+                m_Valid[k] = false;
+        }
+        glBindTexture( GL_TEXTURE_2D, 0 );
+
+        // Depth only: no color buffer to draw to or read from
+        glBindFramebuffer( GL_FRAMEBUFFER, m_Framebuffer );
+        glDrawBuffer( GL_NONE );
+        glReadBuffer( GL_NONE );
+        glFramebufferTexture2D( GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
+                                m_Textures[0].Name(), 0 );
+        GLenum status = glCheckFramebufferStatus( GL_FRAMEBUFFER );
+        glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+
+        if (status != GL_FRAMEBUFFER_COMPLETE) {
+                std::cerr << "WARNING: can't render shadow maps (framebuffer status 0x"
+                          << std::hex << status << std::dec << "), shadows are off" << std::endl;
+                Reset();
+                m_Failed = true;
+                return false;
+        }
+
+        m_Size = size;
+        return true;
+}
+
+void ShadowMaps::Update( const Asset3ds &asset, const float view[16],
+                         const float *positions[SHADOW_LIGHTS], const int viewport[4] )
+{
+        m_LastRenders = 0;
+        if (m_Quality == ShadowsOff)
+                return;
+        GpuMemory::Touch( this );
+        if (!init())
+                return;
+
+        // A different model (or none) means nothing cached is any good
+        float center[3], radius;
+        if (!asset.GetBoundingSphere( center, radius ))
+                return;
+        const ChunkStream *stream = asset.GetStream();
+        unsigned int chunks = stream != NULL ? stream->GpuVersion() : 0;
+        if (radius != m_Radius || memcmp( center, m_Center, sizeof(center) ) != 0
+            || chunks != m_Chunks) {
+                m_Radius = radius;
+                memcpy( m_Center, center, sizeof(center) );
+                m_Chunks = chunks;
+                for (unsigned int k = 0; k < SHADOW_LIGHTS; k++)
+                        m_Valid[k] = false;
+        }
+
+        float toModel[16];
+        invertAffine( view, toModel );
+
+        // Map [-1, 1] clip space onto [0, 1] texture / depth coordinates
+        static const float bias[16] = { 0.5, 0.0, 0.0, 0.0,  0.0, 0.5, 0.0, 0.0,
+                                        0.0, 0.0, 0.5, 0.0,  0.5, 0.5, 0.5, 1.0 };
+
+        for (unsigned int k = 0; k < SHADOW_LIGHTS; k++) {
+                if (positions[k] == NULL)
+                        continue;
+
+                // Where the light is as seen from the model: a direction
+                // (normalized, the view can scale) or a point
+                const float *p = positions[k];
+                float key[4];
+                for (int r = 0; r < 3; r++) {
+                        key[r] = toModel[r] * p[0] + toModel[4 + r] * p[1] + toModel[8 + r] * p[2]
+                               + toModel[12 + r] * p[3];
+                }
+                key[3] = p[3];
+
+                float tolerance = 1e-5;
+                if (key[3] == 0.0) {
+                        float length = sqrt( key[0] * key[0] + key[1] * key[1] + key[2] * key[2] );
+                        for (int r = 0; r < 3 && length > 0.0; r++)
+                                key[r] /= length;
+                } else {
+                        tolerance *= qMax( radius, 1.0f );
+                }
+
+                bool moved = !m_Valid[k];
+                for (int r = 0; r < 4 && !moved; r++)
+                        moved = fabs( key[r] - m_Key[k][r] ) > tolerance;
+
+                if (moved) {
+                        memcpy( m_Key[k], key, sizeof(key) );
+                        render( k, asset );
+                        m_Valid[k] = true;
+                        m_Renders++;
+                        m_LastRenders++;
+                }
+
+                // This frame's eye space to the map
+                multiply( bias, m_LightMatrix[k], m_EyeMatrix[k] );
+                multiply( m_EyeMatrix[k], toModel, m_EyeMatrix[k] );
+        }
+
+        if (m_LastRenders > 0)
+                glViewport( viewport[0], viewport[1], viewport[2], viewport[3] );
+}
+
+/*
+ * Draw the model's depth from light k (m_Key[k]). A directional light (or
+ * a point light too close for a frustum around the model) gets an
+ * orthographic box around the bounding sphere, a point light a frustum
+ * just wide enough for the sphere.
+ */
+void ShadowMaps::render( unsigned int map, const Asset3ds &asset )
+{
+        const float *key = m_Key[map];
+        float r = qMax( m_Radius, 1e-6f );
+
+        float toLight[3];
+        float distance = 0.0;
+        if (key[3] != 0.0) {
+                for (int k = 0; k < 3; k++)
+                        toLight[k] = key[k] - m_Center[k];
+                distance = sqrt( toLight[0] * toLight[0] + toLight[1] * toLight[1]
+                                 + toLight[2] * toLight[2] );
+        } else {
+                memcpy( toLight, key, sizeof(toLight) );
+        }
+
+        float length = sqrt( toLight[0] * toLight[0] + toLight[1] * toLight[1]
+                             + toLight[2] * toLight[2] );
+        if (length < 1e-12) {
+                toLight[0] = toLight[1] = 0.0;
+                toLight[2] = length = 1.0;
+        }
+        for (int k = 0; k < 3; k++)
+                toLight[k] /= length;
+
+        bool perspective = (key[3] != 0.0 && distance > 1.5 * r);
+        float eye[3], lightView[16], lightProjection[16];
+        if (perspective) {
+                memcpy( eye, key, sizeof(eye) );
+                float zNear = distance - r;
+                projection( true, zNear * r / sqrt( distance * distance - r * r ),
+                            zNear, distance + r, lightProjection );
+        } else {
+                for (int k = 0; k < 3; k++)
+                        eye[k] = m_Center[k] + 2.0 * r * toLight[k];
+                projection( false, r, r, 3.0 * r, lightProjection );
+        }
+
+        float up[3] = { 0.0, 1.0, 0.0 };
+        if (fabs( toLight[1] ) > 0.99) {
+                up[0] = 1.0;
+                up[1] = 0.0;
+        }
+        lookAt( eye, m_Center, up, lightView );
+        multiply( lightProjection, lightView, m_LightMatrix[map] );
+
+        glBindFramebuffer( GL_FRAMEBUFFER, m_Framebuffer );
+        glFramebufferTexture2D( GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
+                                m_Textures[map].Name(), 0 );
+        glViewport( 0, 0, m_Size, m_Size );
+        glClear( GL_DEPTH_BUFFER_BIT );
+
+        glPushAttrib( GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_POLYGON_BIT );
+        glDisable( GL_LIGHTING );
+        glDisable( GL_TEXTURE_2D );
+        glEnable( GL_DEPTH_TEST );
+        glColorMask( GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE );
+        glEnable( GL_POLYGON_OFFSET_FILL );
+        glPolygonOffset( SHADOW_OFFSET_FACTOR, SHADOW_OFFSET_UNITS );
+
+        glMatrixMode( GL_PROJECTION );
+        glPushMatrix();
+        glLoadMatrixf( lightProjection );
+        glMatrixMode( GL_MODELVIEW );
+        glPushMatrix();
+        glLoadMatrixf( lightView );
+
+        asset.DrawPositions();
+
+        glPopMatrix();
+        glMatrixMode( GL_PROJECTION );
+        glPopMatrix();
+        glMatrixMode( GL_MODELVIEW );
+        glPopAttrib();
+
+        glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+}
+
+void ShadowMaps::Bind( GLuint program, const int slots[SHADOW_LIGHTS] ) const
+{
+        bool on = (m_Quality != ShadowsOff && m_Framebuffer != 0);
+        glUniform1i( glGetUniformLocation( program, "shadowKernel" ),
+                     on ? FilterTaps( m_Quality ) : 0 );
+        if (!on)
+                return;
+
+        // A light whose map was never drawn (it's been off) isn't shadowed
+        int valid[SHADOW_LIGHTS];
+        for (unsigned int k = 0; k < SHADOW_LIGHTS; k++)
+                valid[k] = m_Valid[k] ? slots[k] : -1;
+
+        glUniform1iv( glGetUniformLocation( program, "shadowLight" ), SHADOW_LIGHTS, valid );
+        glUniform1f( glGetUniformLocation( program, "shadowTexel" ), 1.0 / m_Size );
+        glUniformMatrix4fv( glGetUniformLocation( program, "shadowMatrix" ), SHADOW_LIGHTS,
+                            GL_FALSE, &m_EyeMatrix[0][0] );
+
+        static const char *samplers[SHADOW_LIGHTS] = { "shadowMap0", "shadowMap1", "shadowMap2" };
+        for (unsigned int k = 0; k < SHADOW_LIGHTS; k++) {
+                glUniform1i( glGetUniformLocation( program, samplers[k] ), SHADOW_UNIT + k );
+                glActiveTexture( GL_TEXTURE0 + SHADOW_UNIT + k );
+                glBindTexture( GL_TEXTURE_2D, m_Textures[k].Name() );
+        }
+        glActiveTexture( GL_TEXTURE0 );
+}
@@ -0,0 +1,97 @@
+/*
+ * Filename: shadows.hpp
+ *
+ * Shadow maps for the room light and the two side lights, used by the
+ * lighting shader (see lights.hpp).
+ *
+ * The model never changes shape, so a shadow map only goes stale when
+ * its light moves relative to the model. Each map remembers the light's
+ * position (or direction) in MODEL space that it was rendered for and is
+ * only rendered again when that changes, or when the quality changes.
+ * Our lights are fixed to the camera, so turning the model re-renders
+ * them but just sitting there (or zooming in on a directional light)
+ * costs nothing past the lookups. A streamed model (--out-of-core) does
+ * change as chunks come and go on the GPU, so its maps are also drawn
+ * again whenever that happens.
+ *
+ * The depth passes draw from the asset's position-only buffer with
+ * fixed function, color writes off.
+ *
+ * The maps are a GPU memory cache entry (see gpuresource.hpp): with
+ * shadows off they can be evicted, and are drawn again when needed.
+ */
+
+#ifndef _SHADOWS_H
+#define _SHADOWS_H
+
+#include "gl.hpp"
+#include "asset.hpp"
+
+// Presets: map size and how many taps (per side) the lookup filters over
+enum ShadowQuality { ShadowsOff, ShadowsLow, ShadowsMedium, ShadowsHigh };
+const int SHADOW_QUALITIES = 4;
+
+const unsigned int SHADOW_LIGHTS = 3;
+
+class ShadowMaps : public GpuCacheEntry
+{
+public:
+        ShadowMaps();
+
+        // Needs the GL context current (it deletes the textures)
+        ~ShadowMaps();
+
+        void SetQuality( ShadowQuality quality );
+        ShadowQuality Quality() const;
+
+        // Bring the maps up to date. positions are the lights in eye
+        // space like glLightfv( GL_POSITION ) takes them (w == 0 for
+        // directional), view takes the model to eye space. Renders any
+        // map whose light has moved relative to the model, then restores
+        // the given viewport. Call before drawing, with no shader bound.
+        void Update( const Asset3ds &asset, const float view[16],
+                     const float *positions[SHADOW_LIGHTS], const int viewport[4] );
+
+        // With the lighting shader bound: hand it the maps. slots[k] is
+        // which of the shader's (packed) lights map k belongs to, or -1.
+        void Bind( GLuint program, const int slots[SHADOW_LIGHTS] ) const;
+
+        // Drop the GL objects (e.g. before the context goes away)
+        void Reset();
+
+        // Maps rendered so far (cache misses) and last Update()'s count
+        unsigned int Renders() const;
+        unsigned int LastRenders() const;
+
+        static int MapSize( ShadowQuality quality );
+        static int FilterTaps( ShadowQuality quality );
+
+        long GpuBytes() const;
+        void EvictGpu();
+
+private:
+        bool init();
+        void render( unsigned int map, const Asset3ds &asset );
+
+        ShadowQuality m_Quality;
+        int m_Size;                         // of the maps GL has now
+
+        GLuint m_Framebuffer;
+        GLTexture m_Textures[SHADOW_LIGHTS];
+        bool m_Valid[SHADOW_LIGHTS];
+        bool m_Failed;                      // no FBOs / depth textures
+
+        float m_Key[SHADOW_LIGHTS][4];      // model space light it's for
+        float m_Radius;                     // model's sphere it's fitted to
+        float m_Center[3];
+        unsigned int m_Chunks;              // stream's GpuVersion() it's for
+
+        // Model space to light clip space (what was rendered), and eye
+        // space to shadow map coordinates (this frame)
+        float m_LightMatrix[SHADOW_LIGHTS][16];
+        float m_EyeMatrix[SHADOW_LIGHTS][16];
+
+        unsigned int m_Renders, m_LastRenders;
+};
+
+#endif    // _SHADOWS_H
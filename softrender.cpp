@@ -0,0 +1,523 @@
+/*
+ * Filename: softrender.cpp
+ *
+ * Implementation of the tile-binned CPU renderer (see softrender.hpp).
+ * The rasterizer is the usual half-space / edge function approach:
+ *   Juan Pineda, "A Parallel Algorithm for Polygon Rasterization" (1988)
+ */
+
+#include "softrender.hpp"
+
+#include <QtConcurrentMap>
+#include <QThread>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Fixed function defaults for everything we don't set ourselves
+static const float GLOBAL_AMBIENT    = 0.2f;   // GL_LIGHT_MODEL_AMBIENT
+static const float MATERIAL_AMBIENT  = 0.2f;   // GL_AMBIENT of the material
+static const float MATERIAL_DIFFUSE  = 0.8f;   // GL_DIFFUSE of the material
+
+// Vertices per transform job
+static const unsigned int VERTEX_CHUNK = 16384;
+
+SoftwareRenderer::SoftwareRenderer()
+{
+        m_Width = m_Height = m_Stride = 0;
+        m_TilesX = m_TilesY = 0;
+}
+
+void SoftwareRenderer::SetGeometry( const std::vector<Mesh> &meshes )
+{
+        m_Positions.clear();
+        m_Normals.clear();
+        m_Indices.clear();
+
+        for (unsigned int m = 0; m < meshes.size(); m++) {
+                const Mesh &mesh = meshes[m];
+                unsigned int base = m_Positions.size() / 3;
+
+                for (unsigned int v = 0; v < mesh.vertices.size(); v++) {
+                        const MeshVertex &vertex = mesh.vertices[v];
+                        m_Positions.insert( m_Positions.end(), vertex.pos, vertex.pos + 3 );
+                        m_Normals.insert( m_Normals.end(), vertex.normal, vertex.normal + 3 );
+                }
+                for (unsigned int i = 0; i < mesh.indices.size(); i++)
+                        m_Indices.push_back( base + mesh.indices[i] );
+        }
+}
+
+unsigned int SoftwareRenderer::TriangleCount() const
+{
+        return m_Indices.size() / 3;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  Stage 1: vertices
+//////////////////////////////////////////////////////////////////////////////
+
+static void transformVertices( SoftwareRenderer::VertexJob &job )
+{
+        job.r->TransformVertices( job );
+}
+
+void SoftwareRenderer::TransformVertices( const VertexJob &job )
+{
+        const float *mv = m_Frame.modelview;
+        const float *pr = m_Frame.projection;
+
+        // Normals go through the inverse transpose of the modelview's 3x3.
+        // We renormalize afterwards, so the cofactor matrix (no divide by
+        // the determinant) is all we need.
+        float nm[9] = {
+                mv[5] * mv[10] - mv[6] * mv[9], mv[6] * mv[8] - mv[4] * mv[10], mv[4] * mv[9] - mv[5] * mv[8],
+                mv[2] * mv[9] - mv[1] * mv[10], mv[0] * mv[10] - mv[2] * mv[8], mv[1] * mv[8] - mv[0] * mv[9],
+                mv[1] * mv[6] - mv[2] * mv[5], mv[2] * mv[4] - mv[0] * mv[6], mv[0] * mv[5] - mv[1] * mv[4]
+        };
+
+#ifdef __SSE2__
+        // Columns of the matrices, so a transform is 4 multiply-adds
+        __m128 mvCol[4], prCol[4];
+        for (unsigned int c = 0; c < 4; c++) {
+                mvCol[c] = _mm_loadu_ps( mv + c * 4 );
+                prCol[c] = _mm_loadu_ps( pr + c * 4 );
+        }
+#endif
+
+        for (unsigned int v = job.begin; v < job.end; v++) {
+                const float *p = &m_Positions[v * 3];
+                const float *n = &m_Normals[v * 3];
+                float eye[4];
+
+#ifdef __SSE2__
+                __m128 e = _mm_add_ps(
+                        _mm_add_ps( _mm_mul_ps( mvCol[0], _mm_set1_ps( p[0] ) ),
+                                    _mm_mul_ps( mvCol[1], _mm_set1_ps( p[1] ) ) ),
+                        _mm_add_ps( _mm_mul_ps( mvCol[2], _mm_set1_ps( p[2] ) ),
+                                    mvCol[3] ) );
+                _mm_storeu_ps( eye, e );
+
+                __m128 clip = _mm_add_ps(
+                        _mm_add_ps( _mm_mul_ps( prCol[0], _mm_set1_ps( eye[0] ) ),
+                                    _mm_mul_ps( prCol[1], _mm_set1_ps( eye[1] ) ) ),
+                        _mm_add_ps( _mm_mul_ps( prCol[2], _mm_set1_ps( eye[2] ) ),
+                                    _mm_mul_ps( prCol[3], _mm_set1_ps( eye[3] ) ) ) );
+                _mm_storeu_ps( &m_Clip[v * 4], clip );
+#else
+                for (unsigned int r = 0; r < 4; r++)
+                        eye[r] = mv[r] * p[0] + mv[4 + r] * p[1] + mv[8 + r] * p[2] + mv[12 + r];
+                for (unsigned int r = 0; r < 4; r++) {
+                        m_Clip[v * 4 + r] = pr[r] * eye[0] + pr[4 + r] * eye[1]
+                                          + pr[8 + r] * eye[2] + pr[12 + r] * eye[3];
+                }
+#endif
+
+                float en[3];
+                for (unsigned int r = 0; r < 3; r++)
+                        en[r] = nm[r * 3] * n[0] + nm[r * 3 + 1] * n[1] + nm[r * 3 + 2] * n[2];
+                float length = sqrtf( en[0] * en[0] + en[1] * en[1] + en[2] * en[2] );
+                if (length > 0.0f) {
+                        en[0] /= length; en[1] /= length; en[2] /= length;
+                }
+
+                // Fixed function lighting with the default material
+                float color[3];
+                for (unsigned int k = 0; k < 3; k++)
+                        color[k] = GLOBAL_AMBIENT * MATERIAL_AMBIENT;
+
+                for (unsigned int l = 0; l < SOFT_MAX_LIGHTS; l++) {
+                        const SoftLight &light = m_Frame.lights[l];
+                        if (!light.enabled)
+                                continue;
+
+                        float dir[3];
+                        for (unsigned int k = 0; k < 3; k++) {
+                                dir[k] = (light.position[3] == 0.0f)
+                                       ? light.position[k]
+                                       : light.position[k] - eye[k];
+                        }
+                        float d = sqrtf( dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2] );
+                        if (d <= 0.0f)
+                                continue;
+
+                        float ndotl = (en[0] * dir[0] + en[1] * dir[1] + en[2] * dir[2]) / d;
+                        if (ndotl <= 0.0f)
+                                continue;
+                        for (unsigned int k = 0; k < 3; k++)
+                                color[k] += ndotl * light.diffuse[k] * MATERIAL_DIFFUSE;
+                }
+
+                for (unsigned int k = 0; k < 3; k++)
+                        m_Color[v * 3 + k] = std::min( color[k], 1.0f );
+        }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  Stage 2: triangle setup and binning
+//////////////////////////////////////////////////////////////////////////////
+
+// A vertex on its way through clipping
+struct ClipVertex
+{
+        float pos[4];
+        float color[3];
+};
+
+static void lerpVertex( const ClipVertex &a, const ClipVertex &b, float t,
+                        ClipVertex &out )
+{
+        for (unsigned int k = 0; k < 4; k++)
+                out.pos[k] = a.pos[k] + (b.pos[k] - a.pos[k]) * t;
+        for (unsigned int k = 0; k < 3; k++)
+                out.color[k] = a.color[k] + (b.color[k] - a.color[k]) * t;
+}
+
+/*
+ * Clip against the near plane (z >= -w). That's the only plane that MUST
+ * be clipped: everything else is handled by the screen bounds and the
+ * depth test. Gives back 0, 3 or 4 vertices.
+ */
+static unsigned int clipNear( const ClipVertex in[3], ClipVertex out[4] )
+{
+        unsigned int count = 0;
+        for (unsigned int i = 0; i < 3; i++) {
+                const ClipVertex &a = in[i];
+                const ClipVertex &b = in[(i + 1) % 3];
+                float da = a.pos[2] + a.pos[3];
+                float db = b.pos[2] + b.pos[3];
+
+                if (da >= 0.0f)
+                        out[count++] = a;
+                if ((da >= 0.0f) != (db >= 0.0f))
+                        lerpVertex( a, b, da / (da - db), out[count++] );
+        }
+        return count;
+}
+
+static void setupTriangles( SoftwareRenderer::TriangleJob &job )
+{
+        job.r->SetupTriangles( job );
+}
+
+// value as an int in [lo, hi] (NaN goes to lo)
+static int clampPixel( float value, int lo, int hi )
+{
+        if (!(value > (float) lo))
+                return lo;
+        if (value >= (float) hi)
+                return hi;
+        return (int) value;
+}
+
+void SoftwareRenderer::SetupTriangles( const TriangleJob &job )
+{
+        const int *vp = m_Frame.viewport;
+        std::vector<SoftTriangle> &tris = *job.tris;
+        std::vector< std::vector<unsigned int> > &bins = *job.bins;
+
+        tris.clear();
+        for (unsigned int b = 0; b < bins.size(); b++)
+                bins[b].clear();
+
+        for (unsigned int t = job.begin; t < job.end; t++) {
+                ClipVertex in[3], poly[4];
+                for (unsigned int k = 0; k < 3; k++) {
+                        unsigned int v = m_Indices[t * 3 + k];
+                        memcpy( in[k].pos, &m_Clip[v * 4], sizeof(float) * 4 );
+                        memcpy( in[k].color, &m_Color[v * 3], sizeof(float) * 3 );
+                }
+
+                unsigned int count = clipNear( in, poly );
+                if (count < 3)
+                        continue;
+
+                // Perspective divide + viewport transform
+                float x[4], y[4], z[4], invW[4];
+                for (unsigned int k = 0; k < count; k++) {
+                        invW[k] = 1.0f / poly[k].pos[3];
+                        x[k] = vp[0] + (poly[k].pos[0] * invW[k] + 1.0f) * 0.5f * vp[2];
+                        y[k] = vp[1] + (poly[k].pos[1] * invW[k] + 1.0f) * 0.5f * vp[3];
+                        z[k] = (poly[k].pos[2] * invW[k] + 1.0f) * 0.5f;
+                }
+
+                // Fan the (at most) quad into triangles
+                for (unsigned int f = 1; f + 1 < count; f++) {
+                        unsigned int idx[3] = { 0, f, f + 1 };
+
+                        // Twice the signed area; counter-clockwise is the
+                        // front (GL_CULL_FACE drops the rest)
+                        float area = (x[idx[1]] - x[idx[0]]) * (y[idx[2]] - y[idx[0]])
+                                   - (x[idx[2]] - x[idx[0]]) * (y[idx[1]] - y[idx[0]]);
+                        if (area <= 0.0f)
+                                continue;
+
+                        SoftTriangle tri;
+                        float lo[2] = {  HUGE_VALF,  HUGE_VALF };
+                        float hi[2] = { -HUGE_VALF, -HUGE_VALF };
+                        for (unsigned int k = 0; k < 3; k++) {
+                                unsigned int i = idx[k];
+                                unsigned int j = idx[(k + 1) % 3];
+                                unsigned int opposite = (k + 2) % 3;
+
+                                // Edge i->j belongs to the vertex across from it
+                                tri.a[opposite] = -(y[j] - y[i]) / area;
+                                tri.b[opposite] =  (x[j] - x[i]) / area;
+                                tri.c[opposite] = ((y[j] - y[i]) * x[i] - (x[j] - x[i]) * y[i]) / area;
+
+                                tri.z[k] = z[i];
+                                tri.invW[k] = invW[i];
+                                memcpy( tri.color[k], poly[i].color, sizeof(float) * 3 );
+
+                                lo[0] = std::min( lo[0], x[i] ); hi[0] = std::max( hi[0], x[i] );
+                                lo[1] = std::min( lo[1], y[i] ); hi[1] = std::max( hi[1], y[i] );
+                        }
+
+                        // Pixel bounds, clamped to the viewport (in float,
+                        // a vertex far off screen doesn't fit in an int)
+                        int lastX = std::min( vp[0] + vp[2], m_Width ) - 1;
+                        int lastY = std::min( vp[1] + vp[3], m_Height ) - 1;
+                        tri.minX = clampPixel( floorf( lo[0] ), vp[0], lastX + 1 );
+                        tri.minY = clampPixel( floorf( lo[1] ), vp[1], lastY + 1 );
+                        tri.maxX = clampPixel( ceilf( hi[0] ), vp[0] - 1, lastX );
+                        tri.maxY = clampPixel( ceilf( hi[1] ), vp[1] - 1, lastY );
+                        if (tri.minX > tri.maxX || tri.minY > tri.maxY)
+                                continue;
+
+                        // Hand it to every tile its box touches
+                        unsigned int id = tris.size();
+                        tris.push_back( tri );
+                        for (int ty = tri.minY / TILE_SIZE; ty <= tri.maxY / TILE_SIZE; ty++) {
+                                for (int tx = tri.minX / TILE_SIZE; tx <= tri.maxX / TILE_SIZE; tx++)
+                                        bins[ty * m_TilesX + tx].push_back( id );
+                        }
+                }
+        }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  Stage 3: rasterization
+//////////////////////////////////////////////////////////////////////////////
+
+static void rasterizeTile( SoftwareRenderer::TileJob &job )
+{
+        job.r->RasterizeTile( job );
+}
+
+static inline unsigned int packColor( float r, float g, float b )
+{
+        return 0xff000000u
+             | ((unsigned int) (r * 255.0f + 0.5f) << 16)
+             | ((unsigned int) (g * 255.0f + 0.5f) << 8)
+             |  (unsigned int) (b * 255.0f + 0.5f);
+}
+
+void SoftwareRenderer::RasterizeTile( const TileJob &job )
+{
+        int tileX = (job.tile % m_TilesX) * TILE_SIZE;
+        int tileY = (job.tile / m_TilesX) * TILE_SIZE;
+        int tileMaxX = std::min( tileX + TILE_SIZE, m_Width ) - 1;
+        int tileMaxY = std::min( tileY + TILE_SIZE, m_Height ) - 1;
+
+        for (unsigned int j = 0; j < m_JobBins.size(); j++) {
+                const std::vector<unsigned int> &bin = m_JobBins[j][job.tile];
+                const std::vector<SoftTriangle> &tris = m_JobTriangles[j];
+
+                for (unsigned int n = 0; n < bin.size(); n++) {
+                        const SoftTriangle &tri = tris[bin[n]];
+                        int x0 = std::max( tri.minX, tileX ) & ~3;   // SSE groups of 4
+                        int x1 = std::min( tri.maxX, tileMaxX );
+                        int y0 = std::max( tri.minY, tileY );
+                        int y1 = std::min( tri.maxY, tileMaxY );
+
+                        // Perspective correct colors: interpolate c/w and 1/w
+                        float cw[3][3];
+                        for (unsigned int k = 0; k < 3; k++) {
+                                for (unsigned int c = 0; c < 3; c++)
+                                        cw[k][c] = tri.color[k][c] * tri.invW[k];
+                        }
+
+                        for (int y = y0; y <= y1; y++) {
+                                float py = y + 0.5f;
+                                unsigned int *pixels = &m_Pixels[y * m_Stride];
+                                float *depth = &m_Depth[y * m_Stride];
+
+#ifdef __SSE2__
+                                const __m128 zero = _mm_setzero_ps();
+                                const __m128 lane = _mm_set_ps( 3.5f, 2.5f, 1.5f, 0.5f );
+                                __m128 rowB[3];
+                                for (unsigned int k = 0; k < 3; k++)
+                                        rowB[k] = _mm_set1_ps( tri.b[k] * py + tri.c[k] );
+
+                                for (int x = x0; x <= x1; x += 4) {
+                                        __m128 px = _mm_add_ps( _mm_set1_ps( (float) x ), lane );
+                                        __m128 w0 = _mm_add_ps( _mm_mul_ps( _mm_set1_ps( tri.a[0] ), px ), rowB[0] );
+                                        __m128 w1 = _mm_add_ps( _mm_mul_ps( _mm_set1_ps( tri.a[1] ), px ), rowB[1] );
+                                        __m128 w2 = _mm_add_ps( _mm_mul_ps( _mm_set1_ps( tri.a[2] ), px ), rowB[2] );
+
+                                        __m128 inside = _mm_and_ps( _mm_and_ps( _mm_cmpge_ps( w0, zero ),
+                                                                                _mm_cmpge_ps( w1, zero ) ),
+                                                                    _mm_cmpge_ps( w2, zero ) );
+
+                                        // Don't run past the triangle's box or the tile
+                                        __m128 limit = _mm_set1_ps( (float) x1 + 1.0f );
+                                        __m128 start = _mm_set1_ps( (float) std::max( tri.minX, tileX ) );
+                                        inside = _mm_and_ps( inside, _mm_cmplt_ps( px, limit ) );
+                                        inside = _mm_and_ps( inside, _mm_cmpge_ps( px, start ) );
+                                        if (_mm_movemask_ps( inside ) == 0)
+                                                continue;
+
+                                        __m128 z = _mm_add_ps( _mm_add_ps( _mm_mul_ps( w0, _mm_set1_ps( tri.z[0] ) ),
+                                                                           _mm_mul_ps( w1, _mm_set1_ps( tri.z[1] ) ) ),
+                                                               _mm_mul_ps( w2, _mm_set1_ps( tri.z[2] ) ) );
+                                        __m128 oldZ = _mm_loadu_ps( depth + x );
+                                        __m128 pass = _mm_and_ps( inside, _mm_cmplt_ps( z, oldZ ) );
+                                        int mask = _mm_movemask_ps( pass );
+                                        if (mask == 0)
+                                                continue;
+
+                                        _mm_storeu_ps( depth + x, _mm_or_ps( _mm_and_ps( pass, z ),
+                                                                             _mm_andnot_ps( pass, oldZ ) ) );
+
+                                        __m128 iw = _mm_add_ps( _mm_add_ps( _mm_mul_ps( w0, _mm_set1_ps( tri.invW[0] ) ),
+                                                                            _mm_mul_ps( w1, _mm_set1_ps( tri.invW[1] ) ) ),
+                                                                _mm_mul_ps( w2, _mm_set1_ps( tri.invW[2] ) ) );
+                                        __m128 wOut = _mm_div_ps( _mm_set1_ps( 1.0f ), iw );
+
+                                        // Shade: rgb in [0, 255], packed into 0xffRRGGBB
+                                        __m128i packed = _mm_set1_epi32( (int) 0xff000000 );
+                                        for (unsigned int c = 0; c < 3; c++) {
+                                                __m128 v = _mm_add_ps( _mm_add_ps( _mm_mul_ps( w0, _mm_set1_ps( cw[0][c] ) ),
+                                                                                   _mm_mul_ps( w1, _mm_set1_ps( cw[1][c] ) ) ),
+                                                                       _mm_mul_ps( w2, _mm_set1_ps( cw[2][c] ) ) );
+                                                v = _mm_mul_ps( _mm_mul_ps( v, wOut ), _mm_set1_ps( 255.0f ) );
+                                                v = _mm_min_ps( _mm_max_ps( v, zero ), _mm_set1_ps( 255.0f ) );
+                                                __m128i channel = _mm_cvtps_epi32( v );
+                                                packed = _mm_or_si128( packed,
+                                                                       _mm_slli_epi32( channel, 16 - 8 * c ) );
+                                        }
+
+                                        __m128i passI = _mm_castps_si128( pass );
+                                        __m128i old = _mm_loadu_si128( (const __m128i *) (pixels + x) );
+                                        _mm_storeu_si128( (__m128i *) (pixels + x),
+                                                          _mm_or_si128( _mm_and_si128( passI, packed ),
+                                                                        _mm_andnot_si128( passI, old ) ) );
+                                }
+#else
+                                for (int x = std::max( tri.minX, tileX ); x <= x1; x++) {
+                                        float px = x + 0.5f;
+                                        float w[3];
+                                        for (unsigned int k = 0; k < 3; k++)
+                                                w[k] = tri.a[k] * px + tri.b[k] * py + tri.c[k];
+                                        if (w[0] < 0.0f || w[1] < 0.0f || w[2] < 0.0f)
+                                                continue;
+
+                                        float z = w[0] * tri.z[0] + w[1] * tri.z[1] + w[2] * tri.z[2];
+                                        if (z >= depth[x])
+                                                continue;
+                                        depth[x] = z;
+
+                                        float iw = w[0] * tri.invW[0] + w[1] * tri.invW[1] + w[2] * tri.invW[2];
+                                        float rgb[3];
+                                        for (unsigned int c = 0; c < 3; c++) {
+                                                rgb[c] = (w[0] * cw[0][c] + w[1] * cw[1][c] + w[2] * cw[2][c]) / iw;
+                                                rgb[c] = std::max( 0.0f, std::min( rgb[c], 1.0f ) );
+                                        }
+                                        pixels[x] = packColor( rgb[0], rgb[1], rgb[2] );
+                                }
+#endif
+                        }
+                }
+        }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  The frame
+//////////////////////////////////////////////////////////////////////////////
+
+const QImage &SoftwareRenderer::Render( const SoftFrame &frame )
+{
+        m_Frame = frame;
+
+        // (Re)size the framebuffer. The stride is padded so the SSE row
+        // loop can always touch 4 pixels without running off the end.
+        if (frame.width != m_Width || frame.height != m_Height) {
+                m_Width = frame.width;
+                m_Height = frame.height;
+                m_Stride = (m_Width + 3) & ~3;
+                m_Pixels.resize( m_Stride * m_Height );
+                m_Depth.resize( m_Stride * m_Height );
+                m_TilesX = (m_Width + TILE_SIZE - 1) / TILE_SIZE;
+                m_TilesY = (m_Height + TILE_SIZE - 1) / TILE_SIZE;
+        }
+
+        std::fill( m_Pixels.begin(), m_Pixels.end(),
+                   packColor( frame.clearColor[0], frame.clearColor[1], frame.clearColor[2] ) );
+        std::fill( m_Depth.begin(), m_Depth.end(), 1.0f );
+
+        // 1. Vertices
+        unsigned int vertexCount = m_Positions.size() / 3;
+        m_Clip.resize( vertexCount * 4 );
+        m_Color.resize( vertexCount * 3 );
+
+        std::vector<VertexJob> vertexJobs;
+        for (unsigned int v = 0; v < vertexCount; v += VERTEX_CHUNK) {
+                VertexJob job = { this, v, std::min( v + VERTEX_CHUNK, vertexCount ) };
+                vertexJobs.push_back( job );
+        }
+        QtConcurrent::blockingMap( vertexJobs, transformVertices );
+
+        // 2. Setup and binning, a few jobs per core so they balance out
+        unsigned int triCount = TriangleCount();
+        unsigned int jobCount = std::max( 1, QThread::idealThreadCount() * 4 );
+        unsigned int perJob = (triCount + jobCount - 1) / jobCount;
+
+        m_JobTriangles.resize( jobCount );
+        m_JobBins.resize( jobCount );
+
+        std::vector<TriangleJob> triangleJobs;
+        for (unsigned int j = 0; j < jobCount; j++) {
+                m_JobBins[j].resize( m_TilesX * m_TilesY );
+
+                TriangleJob job;
+                job.r = this;
+                job.begin = std::min( j * perJob, triCount );
+                job.end = std::min( job.begin + perJob, triCount );
+                job.tris = &m_JobTriangles[j];
+                job.bins = &m_JobBins[j];
+                triangleJobs.push_back( job );
+        }
+        QtConcurrent::blockingMap( triangleJobs, setupTriangles );
+
+        // 3. Tiles
+        std::vector<TileJob> tileJobs;
+        for (int t = 0; t < m_TilesX * m_TilesY; t++) {
+                TileJob job = { this, (unsigned int) t };
+                tileJobs.push_back( job );
+        }
+        QtConcurrent::blockingMap( tileJobs, rasterizeTile );
+
+        // The image wants the top row first
+        if (m_Image.width() != m_Width || m_Image.height() != m_Height)
+                m_Image = QImage( m_Width, m_Height, QImage::Format_RGB32 );
+        for (int y = 0; y < m_Height; y++) {
+                memcpy( m_Image.scanLine( m_Height - 1 - y ), &m_Pixels[y * m_Stride],
+                        sizeof(unsigned int) * m_Width );
+        }
+
+        return m_Image;
+}
+
+const unsigned int *SoftwareRenderer::GLOrderPixels() const
+{
+        return m_Pixels.empty() ? 0 : &m_Pixels[0];
+}
+
+int SoftwareRenderer::Stride() const
+{
+        return m_Stride;
+}
@@ -0,0 +1,123 @@
+/*
+ * Filename: softrender.hpp
+ *
+ * A CPU renderer for machines where the only OpenGL around is a slow
+ * software driver (headless render boxes and the like). It draws the same
+ * meshes Asset3ds uploads, lit the way our fixed function setup lights them
+ * (per-vertex diffuse + ambient, Gouraud shaded), into a QImage that can
+ * be blitted into the GLWidget or saved to a file.
+ *
+ * The work is split three ways over the QtConcurrent thread pool:
+ *   1. vertex transform and lighting, in chunks of vertices
+ *   2. triangle setup (near clipping, back face culling) and binning into
+ *      screen tiles, in chunks of triangles
+ *   3. rasterization, one tile at a time, 4 pixels at once with SSE
+ *
+ * No GL calls are made anywhere in here.
+ */
+
+#ifndef _SOFTRENDER_H
+#define _SOFTRENDER_H
+
+#include "mesh.hpp"
+
+#include <QImage>
+#include <vector>
+
+/*
+ * One light as fixed function sees it. The position is in EYE space (our
+ * lights are set up with an identity modelview) and w == 0 means it's a
+ * directional light, just like glLightfv( ..., GL_POSITION, ... ).
+ */
+struct SoftLight
+{
+        bool enabled;
+        float position[4];
+        float diffuse[4];
+};
+
+const unsigned int SOFT_MAX_LIGHTS = 3;
+
+// Everything about a frame that isn't geometry
+struct SoftFrame
+{
+        int width, height;                  // size of the image
+        int viewport[4];                    // x, y, w, h like glViewport
+        float modelview[16];                // column major, like GL
+        float projection[16];
+        float clearColor[3];
+        SoftLight lights[SOFT_MAX_LIGHTS];
+};
+
+/*
+ * Per-triangle data produced by setup and consumed by the rasterizer. The
+ * edge equations are already divided by the triangle's area, so at a pixel
+ * (x, y) the barycentric weight of vertex i is a[i] * x + b[i] * y + c[i].
+ */
+struct SoftTriangle
+{
+        float a[3], b[3], c[3];
+        float z[3];                         // window depth, 0..1
+        float invW[3];                      // for perspective correction
+        float color[3][3];
+        int minX, minY, maxX, maxY;         // pixel bounds, inclusive
+};
+
+class SoftwareRenderer
+{
+public:
+        SoftwareRenderer();
+
+        // Take a copy of the meshes (flattened into one vertex/index list)
+        void SetGeometry( const std::vector<Mesh> &meshes );
+
+        // Draw a frame. The image is top row first, ready to save.
+        const QImage &Render( const SoftFrame &frame );
+
+        // Same frame, but rows bottom first (what glDrawPixels expects)
+        // with Stride() pixels per row. Only valid right after Render().
+        const unsigned int *GLOrderPixels() const;
+        int Stride() const;
+
+        unsigned int TriangleCount() const;
+
+        // Tile size in pixels (multiple of 4 for the SSE row loop)
+        static const int TILE_SIZE = 64;
+
+        // Work items handed to the thread pool (public so the static
+        // worker functions in softrender.cpp can see them)
+        struct VertexJob   { SoftwareRenderer *r; unsigned int begin, end; };
+        struct TriangleJob { SoftwareRenderer *r; unsigned int begin, end;
+                             std::vector<SoftTriangle> *tris;
+                             std::vector< std::vector<unsigned int> > *bins; };
+        struct TileJob     { SoftwareRenderer *r; unsigned int tile; };
+
+        void TransformVertices( const VertexJob &job );
+        void SetupTriangles( const TriangleJob &job );
+        void RasterizeTile( const TileJob &job );
+
+private:
+        // Geometry (model space)
+        std::vector<float> m_Positions;     // xyz per vertex
+        std::vector<float> m_Normals;       // xyz per vertex
+        std::vector<unsigned int> m_Indices;
+
+        // Per frame: clip space positions and lit colors
+        std::vector<float> m_Clip;          // xyzw per vertex
+        std::vector<float> m_Color;         // rgb per vertex
+
+        // Framebuffer, bottom row first, stride padded to a multiple of 4
+        int m_Width, m_Height, m_Stride;
+        std::vector<unsigned int> m_Pixels;
+        std::vector<float> m_Depth;
+        QImage m_Image;
+
+        // Binning results: one set of triangles and tile bins per job
+        int m_TilesX, m_TilesY;
+        std::vector< std::vector<SoftTriangle> > m_JobTriangles;
+        std::vector< std::vector< std::vector<unsigned int> > > m_JobBins;
+
+        SoftFrame m_Frame;
+};
+
+#endif    // _SOFTRENDER_H
@@ -0,0 +1,67 @@
+/*
+ * Filename: triplebuffer.hpp
+ *
+ * Hands the latest copy of something from one thread to another without
+ * locks and without either side ever waiting on the other.
+ *
+ * There are three slots. The writer always fills its own "back" slot and
+ * then swaps it with the shared "middle" slot; the reader swaps its
+ * "front" slot with the middle one when there's something new there. The
+ * middle slot's index and a "fresh" bit live together in one atomic int,
+ * so each hand-over is a single atomic exchange. If the writer publishes
+ * several times before the reader looks, the reader simply gets the
+ * newest one.
+ *
+ * One writer thread and one reader thread only.
+ */
+
+#ifndef _TRIPLEBUFFER_H
+#define _TRIPLEBUFFER_H
+
+#include <QAtomicInt>
+
+template <class T>
+class TripleBuffer
+{
+public:
+        TripleBuffer() : m_Middle( 1 ), m_Back( 0 ), m_Front( 2 ) {}
+
+        // Writer: the slot to fill in, then Publish() it
+        T &Back()
+        {
+                return m_Slots[m_Back];
+        }
+
+        void Publish()
+        {
+                int old = m_Middle.fetchAndStoreOrdered( m_Back | FRESH );
+                m_Back = old & INDEX;
+        }
+
+        // Reader: pick up the newest published copy, if there is one
+        // since the last call. Front() is what was picked up.
+        bool Update()
+        {
+                if (!(m_Middle & FRESH))
+                        return false;
+
+                int old = m_Middle.fetchAndStoreOrdered( m_Front );
+                m_Front = old & INDEX;
+                return true;
+        }
+
+        const T &Front() const
+        {
+                return m_Slots[m_Front];
+        }
+
+private:
+        enum { INDEX = 3, FRESH = 4 };
+
+        T m_Slots[3];
+        QAtomicInt m_Middle;                // index | FRESH
+        int m_Back;                         // writer only
+        int m_Front;                        // reader only
+};
+
+#endif    // _TRIPLEBUFFER_H
@@ -77,25 +77,27 @@ Window::Window()
          * able to change the orientation of the object by dragging sliders.
          *
          * Because we bind them both ways, however ... any changed made in
-         * the frame buffer is reflected on the sliders, too.
+         * the frame buffer is reflected on the sliders, too. That direction
+         * goes through showXRotation() & co. so the slider doesn't bounce
+         * the value straight back at the GLWidget.
          */
         connect( xSlider, SIGNAL(valueChanged(int)),
                         glWidget, SLOT(setXRotation(int)) );
 
         connect( glWidget, SIGNAL(xRotationChanged(int)),
-                        xSlider, SLOT(setValue(int)) );
+                        this, SLOT(showXRotation(int)) );
 
         connect( ySlider, SIGNAL(valueChanged(int)),
                         glWidget, SLOT(setYRotation(int)) );
 
         connect( glWidget, SIGNAL(yRotationChanged(int)),
-                        ySlider, SLOT(setValue(int)) );
+                        this, SLOT(showYRotation(int)) );
 
         connect( zSlider, SIGNAL(valueChanged(int)),
                         glWidget, SLOT(setZRotation(int)) );
 
         connect( glWidget, SIGNAL(zRotationChanged(int)),
-                        zSlider, SLOT(setValue(int)) );
+                        this, SLOT(showZRotation(int)) );
 
         /*
          * NEW FEATURE!
@@ -193,6 +195,143 @@ Window::Window()
         connect( bluSlider,  SIGNAL(valueChanged(int)),
                  glWidget,   SLOT(auxBlue(int)) );
 
+        // Grids of point lights for checking materials (size^3 lights)
+        QHBoxLayout *gridLayout = new QHBoxLayout;
+        lightingLayout->addLayout( gridLayout );
+        lightGridSize = new QSpinBox;
+        lightGridSize->setRange( 1, 8 );
+        lightGridSize->setValue( 4 );
+        lightGridSize->setSuffix( "^3" );
+        gridLayout->addWidget( lightGridSize );
+
+        QPushButton *spawnGrid = new QPushButton( "Spawn Grid" );
+        gridLayout->addWidget( spawnGrid );
+        connect( spawnGrid, SIGNAL(clicked()), this, SLOT(spawnLightGrid()) );
+
+        QPushButton *clearGrid = new QPushButton( "Clear" );
+        gridLayout->addWidget( clearGrid );
+        connect( clearGrid, SIGNAL(clicked()), glWidget, SLOT(clearLights()) );
+
+        // Forward+ (only the lights in each screen tile are shaded), and
+        // a heatmap of how many lights each tile ended up with
+        tiledLighting = new QCheckBox( "Forward+ Tiles" );
+        tiledLighting->setChecked( true );
+        lightingLayout->addWidget( tiledLighting );
+        connect( tiledLighting, SIGNAL(toggled(bool)),
+                 glWidget, SLOT(setTiledLighting(bool)) );
+
+        tileHeatmap = new QCheckBox( "Tile Light Counts" );
+        lightingLayout->addWidget( tileHeatmap );
+        connect( tileHeatmap, SIGNAL(toggled(bool)),
+                 glWidget, SLOT(setTileHeatmap(bool)) );
+
+        // Shadow map presets (same order as ShadowQuality), and what
+        // each has cost per frame so far (timed with the overlay up)
+        QHBoxLayout *shadowLayout = new QHBoxLayout;
+        lightingLayout->addLayout( shadowLayout );
+        shadowLayout->addWidget( new QLabel( "Shadows" ) );
+        shadowQuality = new QComboBox;
+        shadowQuality->addItem( "Off" );
+        shadowQuality->addItem( "Low (1024, 1 tap)" );
+        shadowQuality->addItem( "Medium (2048, 3x3)" );
+        shadowQuality->addItem( "High (4096, 5x5)" );
+        shadowQuality->setCurrentIndex( ShadowsMedium );
+        shadowLayout->addWidget( shadowQuality );
+        connect( shadowQuality, SIGNAL(currentIndexChanged(int)),
+                 glWidget, SLOT(setShadowQuality(int)) );
+
+        shadowCosts = new QLabel( "Frame costs: press H to time" );
+        shadowCosts->setWordWrap( true );
+        lightingLayout->addWidget( shadowCosts );
+        connect( glWidget, SIGNAL(shadowCostsChanged(const QString &)),
+                 shadowCosts, SLOT(setText(const QString &)) );
+
+        /*
+         * Rendering options (mostly for checking how fast things go)
+         */
+        QGroupBox *rendering = new QGroupBox( "Rendering" );
+        rendering->setAlignment( Qt::AlignHCenter );
+        mainControls->addWidget( rendering );
+        QVBoxLayout *renderLayout = new QVBoxLayout;
+        rendering->setLayout( renderLayout );
+
+        // Skip the meshlets that are off screen or facing away
+        clusterCulling = new QCheckBox( "Cluster Culling" );
+        clusterCulling->setChecked( true );
+        renderLayout->addWidget( clusterCulling );
+        connect( clusterCulling, SIGNAL(toggled(bool)),
+                 glWidget, SLOT(setClusterCulling(bool)) );
+
+        // Do that culling in a compute shader (when GL has them)
+        gpuCulling = new QCheckBox( "GPU Culling" );
+        gpuCulling->setChecked( true );
+        renderLayout->addWidget( gpuCulling );
+        connect( gpuCulling, SIGNAL(toggled(bool)),
+                 glWidget, SLOT(setGpuCulling(bool)) );
+
+        // Skip whole meshes hidden behind others (e.g. rooms behind walls)
+        occlusionCulling = new QCheckBox( "Occlusion Culling" );
+        renderLayout->addWidget( occlusionCulling );
+        connect( occlusionCulling, SIGNAL(toggled(bool)),
+                 glWidget, SLOT(setOcclusionCulling(bool)) );
+
+        // Draw on the CPU (starts checked if we were run with --software)
+        softwareRenderer = new QCheckBox( "Software Renderer" );
+        softwareRenderer->setChecked( glWidget->softwareRendering() );
+        renderLayout->addWidget( softwareRenderer );
+        connect( softwareRenderer, SIGNAL(toggled(bool)),
+                 glWidget, SLOT(setSoftwareRendering(bool)) );
+
+        /*
+         * Overlays for checking the model (one extra pass, see
+         * debugviews.hpp)
+         */
+        QGroupBox *debugging = new QGroupBox( "Debug Views" );
+        debugging->setAlignment( Qt::AlignHCenter );
+        mainControls->addWidget( debugging );
+        QHBoxLayout *debugLayout = new QHBoxLayout;
+        debugging->setLayout( debugLayout );
+
+        wireframe = new QCheckBox( "Wireframe" );
+        debugLayout->addWidget( wireframe );
+        connect( wireframe, SIGNAL(toggled(bool)),
+                 glWidget, SLOT(setWireframe(bool)) );
+
+        normals = new QCheckBox( "Normals" );
+        debugLayout->addWidget( normals );
+        connect( normals, SIGNAL(toggled(bool)),
+                 glWidget, SLOT(setNormals(bool)) );
+
+        boundingBoxes = new QCheckBox( "Boxes" );
+        debugLayout->addWidget( boundingBoxes );
+        connect( boundingBoxes, SIGNAL(toggled(bool)),
+                 glWidget, SLOT(setBoundingBoxes(bool)) );
+
+        /*
+         * Frame capture (written to ./capture)
+         */
+        QGroupBox *capturing = new QGroupBox( "Capture" );
+        capturing->setAlignment( Qt::AlignHCenter );
+        mainControls->addWidget( capturing );
+        QHBoxLayout *captureLayout = new QHBoxLayout;
+        capturing->setLayout( captureLayout );
+
+        // Same order as FrameCapture::Format
+        captureFormat = new QComboBox;
+        captureFormat->addItem( "PNG Sequence" );
+        captureFormat->addItem( "Raw Video" );
+        captureLayout->addWidget( captureFormat );
+        connect( captureFormat, SIGNAL(currentIndexChanged(int)),
+                 glWidget, SLOT(setCaptureFormat(int)) );
+
+        recordButton = new QPushButton( "Record" );
+        recordButton->setCheckable( true );
+        captureLayout->addWidget( recordButton );
+        connect( recordButton, SIGNAL(toggled(bool)),
+                 glWidget, SLOT(setRecording(bool)) );
+        connect( glWidget, SIGNAL(recordingChanged(bool)),
+                 recordButton, SLOT(setChecked(bool)) );
+
         /*
          * VERY IMPORTANT: 
          * Make it so only the GL frame buffer expands (the layout will NOT
@@ -222,6 +361,38 @@ Window::Window()
         setWindowTitle( tr( "Qt/OpenGL Final Project" ) );
 }
 
+/*
+ * Move a slider to where the scene already is, WITHOUT it emitting
+ * valueChanged() (which would send the same angle back to the GLWidget as
+ * a new request and cost another update)
+ */
+static void setQuietly( QSlider *slider, int value )
+{
+        bool wasBlocked = slider->blockSignals( true );
+        slider->setValue( value );
+        slider->blockSignals( wasBlocked );
+}
+
+void Window::spawnLightGrid( void )
+{
+        glWidget->setLightGrid( lightGridSize->value() );
+}
+
+void Window::showXRotation( int angle )
+{
+        setQuietly( xSlider, angle );
+}
+
+void Window::showYRotation( int angle )
+{
+        setQuietly( ySlider, angle );
+}
+
+void Window::showZRotation( int angle )
+{
+        setQuietly( zSlider, angle );
+}
+
 /* 
  * A helper function to streamline the creation of the sliders.
  * (ensures suitable ranges, stepping-values, tick intervals, and page steps)
@@ -289,6 +460,10 @@ void Window::keyPressEvent( QKeyEvent *e )
                 glWidget->forward( 5.0 );
         else if (e->key() == Qt::Key_Minus)
                 glWidget->backward( 5.0 );
+        else if (e->key() == Qt::Key_H)
+                glWidget->toggleHud();
+        else if (e->key() == Qt::Key_B)
+                glWidget->runBenchmark();
 
         if (e->key() == Qt::Key_Escape)
                 close();
@@ -27,6 +27,10 @@ class GLWidget;
 class QPushButton;
 class QRadioButton;
 class QDoubleSpinBox;
+class QCheckBox;
+class QComboBox;
+class QSpinBox;
+class QLabel;
 
 /*
  * The window we create publicly-inherits from the far-reaching
@@ -39,6 +43,15 @@ Q_OBJECT
 public:
         Window();
 
+private slots:
+        // Follow rotations made in the GLWidget (mouse drags, reset)
+        void showXRotation( int angle );
+        void showYRotation( int angle );
+        void showZRotation( int angle );
+
+        // Spawn a light grid of the size in the spin box
+        void spawnLightGrid( void );
+
 protected:
         // Handles the pressing of keys and wheel motion in the scene
         void keyPressEvent( QKeyEvent *event );
@@ -68,6 +81,18 @@ private:
         QSlider *redSlider, *grnSlider, *bluSlider, *alpSlider;
         QRadioButton *p_orth, *p_pers;
         QDoubleSpinBox *modifyScale;
+        QCheckBox *clusterCulling;
+        QCheckBox *gpuCulling;
+        QCheckBox *occlusionCulling;
+        QCheckBox *softwareRenderer;
+        QCheckBox *wireframe, *normals, *boundingBoxes;
+        QSpinBox *lightGridSize;
+        QCheckBox *tiledLighting;
+        QCheckBox *tileHeatmap;
+        QComboBox *shadowQuality;
+        QLabel *shadowCosts;
+        QComboBox *captureFormat;
+        QPushButton *recordButton;
 };
 
 #endif    //_WINDOW_H